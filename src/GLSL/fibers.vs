@@ -1,10 +1,21 @@
 varying vec4 myColor;
 varying vec4 VaryingTexCoord0;
 
+// Compact buffers store the positions as 16 bit values relative to the
+// fibers bounding box, the colors and normals as normalized bytes.
+uniform bool isQuantized;
+uniform vec3 quantizedScale;
+uniform vec3 quantizedOffset;
+
 void main() {
-    VaryingTexCoord0 = gl_Vertex;
+	vec4 vertex = gl_Vertex;
+
+	if (isQuantized)
+		vertex = vec4(gl_Vertex.xyz * quantizedScale + quantizedOffset, 1.0);
+
+    VaryingTexCoord0 = vertex;
 
 	myColor = abs(gl_Color);
 
-	gl_Position = ftransform();
+	gl_Position = gl_ModelViewProjectionMatrix * vertex;
 }
@@ -63,6 +63,8 @@ void Logger::print( const wxString &str, const LogLevel level )
 
     wxDateTime time = wxDateTime::Now();
 
+    wxMutexLocker lock( m_mutex );
+
     // Get std::string from wxString.
     // This avoids problems between different compiler versions.
     std::string message_string = std::string(str.mb_str());
@@ -72,7 +74,7 @@ void Logger::print( const wxString &str, const LogLevel level )
     
     if( LOGLEVEL_ERROR == level || LOGLEVEL_GLERROR == level )
     {
-        m_lastError = str;
+        m_lastError = str.c_str();
     }
 
     printf( "%s", m_oss.str().c_str() );
@@ -107,6 +109,14 @@ bool Logger::printIfGLError( wxString str )
 
 //////////////////////////////////////////////////////////////////////////
 
+wxString Logger::getLastError() const
+{
+    wxMutexLocker lock( m_mutex );
+    return wxString( m_lastError.c_str() );
+}
+
+//////////////////////////////////////////////////////////////////////////
+
 void Logger::setMessageLevel( int level )
 {
     m_level = level;
@@ -8,6 +8,7 @@
 
 #include <GL/glew.h>
 #include <wx/string.h>
+#include <wx/thread.h>
 #include <sstream>
 
 // print levels
@@ -23,7 +24,7 @@ public:
     void print( const wxString &str, const LogLevel level );
     bool printIfGLError( wxString str );
 
-    wxString getLastError() const { return m_lastError; }
+    wxString getLastError() const;
     void setMessageLevel( int level );
 
 protected:
@@ -34,6 +35,9 @@ private:
     int m_level;
     std::ostringstream m_oss;
     wxString m_lastError;
+
+    // print may be called from worker threads.
+    mutable wxMutex m_mutex;
 };
 
 #endif // LOGGER_H_
\ No newline at end of file
@@ -0,0 +1,333 @@
+#include "AsyncLoader.h"
+
+#include "Anatomy.h"
+#include "DatasetManager.h"
+#include "Fibers.h"
+#include "../Logger.h"
+
+#include <wx/filename.h>
+
+#include <string>
+
+extern const wxEventType wxEVT_ASYNC_LOAD_EVENT = wxNewEventType();
+
+namespace
+{
+    wxString getExtension( const wxString &filename )
+    {
+        wxString extension = filename.AfterLast( '.' );
+
+        if( wxT( "gz" ) == extension )
+        {
+            extension = filename.BeforeLast( '.' ).AfterLast( '.' );
+        }
+        return extension;
+    }
+
+    bool isFibersExtension( const wxString &extension )
+    {
+        return wxT( "fib" ) == extension || wxT( "trk" ) == extension || wxT( "bundlesdata" ) == extension
+            || wxT( "Bfloat" ) == extension || wxT( "tck" ) == extension;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+AsyncLoadResult::AsyncLoadResult( const wxString &filename, const bool loadAsPeaks, const unsigned int generation )
+:   filename( filename.c_str() ),
+    extension( getExtension( filename ) ),
+    loadAsPeaks( loadAsPeaks ),
+    generation( generation ),
+    error( false ),
+    pCancel( NULL ),
+    pFibers( NULL ),
+    pAnatomy( NULL ),
+    pHeader( NULL ),
+    pBody( NULL )
+{
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+AsyncLoader::AsyncLoader( wxEvtHandler *pHandler, int id )
+:   m_pHandler( pHandler ),
+    m_id( id ),
+    m_pWorker( NULL ),
+    m_jobAvailable( m_mutex ),
+    m_generation( 0 ),
+    m_cancelParse( false ),
+    m_isBusy( false ),
+    m_stop( false )
+{
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+AsyncLoader::~AsyncLoader()
+{
+    {
+        wxMutexLocker lock( m_mutex );
+        m_stop = true;
+        m_cancelParse = true;
+        m_jobs.clear();
+        m_jobAvailable.Signal();
+    }
+
+    if( NULL != m_pWorker )
+    {
+        // The worker may be waiting for a result that will never be handled.
+        m_resultHandled.Post();
+        m_pWorker->Wait();
+        delete m_pWorker;
+        m_pWorker = NULL;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+bool AsyncLoader::push( const wxString &filename, const bool loadAsPeaks )
+{
+    if( NULL == m_pWorker )
+    {
+        m_pWorker = new Worker( *this );
+
+        if( wxTHREAD_NO_ERROR != m_pWorker->Create() || wxTHREAD_NO_ERROR != m_pWorker->Run() )
+        {
+            Logger::getInstance()->print( wxT( "Cannot start the loading thread" ), LOGLEVEL_ERROR );
+            delete m_pWorker;
+            m_pWorker = NULL;
+            return false;
+        }
+    }
+
+    wxMutexLocker lock( m_mutex );
+
+    // wxString is reference counted without locking, give the worker its own copy.
+    Job job;
+    job.filename    = wxString( filename.c_str() );
+    job.loadAsPeaks = loadAsPeaks;
+    job.generation  = m_generation;
+    m_jobs.push_back( job );
+
+    m_jobAvailable.Signal();
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void AsyncLoader::cancel()
+{
+    wxMutexLocker lock( m_mutex );
+    ++m_generation;
+    m_jobs.clear();
+
+    // Only the file already picked by the worker can be parsed.
+    m_cancelParse = m_isBusy;
+
+    Logger::getInstance()->print( wxT( "Loading cancelled" ), LOGLEVEL_MESSAGE );
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void AsyncLoader::acknowledge()
+{
+    {
+        wxMutexLocker lock( m_mutex );
+        m_isBusy = false;
+    }
+    m_resultHandled.Post();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+bool AsyncLoader::isLoading()
+{
+    wxMutexLocker lock( m_mutex );
+    return m_isBusy || !m_jobs.empty();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+size_t AsyncLoader::getPendingCount()
+{
+    wxMutexLocker lock( m_mutex );
+    return m_jobs.size();
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Objects owning GL resources are never deleted here, a failed dataset is kept in the result with the error
+// flag set and destroyed by AsyncLoader::discard on the main thread.
+//////////////////////////////////////////////////////////////////////////
+void AsyncLoader::parse( AsyncLoadResult &result )
+{
+    DatasetManager *pDatasetManager = DatasetManager::getInstance();
+
+    if( !wxFileName::FileExists( result.filename ) )
+    {
+        Logger::getInstance()->print( wxString::Format( wxT( "File \"%s\" doesn't exist!" ), result.filename.c_str() ), LOGLEVEL_ERROR );
+        result.error = true;
+    }
+    else if( isFibersExtension( result.extension ) )
+    {
+        if( !pDatasetManager->isAnatomyLoaded() )
+        {
+            Logger::getInstance()->print( wxT( "No anatomy file loaded" ), LOGLEVEL_ERROR );
+            result.error = true;
+            return;
+        }
+
+        result.pFibers = new Fibers();
+        result.error   = !result.pFibers->load( result.filename, result.pCancel );
+    }
+    else if( wxT( "nii" ) == result.extension )
+    {
+        // Get std::string from wxString.
+        // This avoids problems between different compiler versions.
+        std::string filename_str = std::string( result.filename.mb_str() );
+
+        result.pHeader = nifti_image_read( filename_str.c_str(), 0 );
+        result.pBody   = nifti_image_read( filename_str.c_str(), 1 );
+
+        if( NULL == result.pHeader || NULL == result.pBody )
+        {
+            Logger::getInstance()->print( wxT( "nifti file corrupt, cannot create nifti image from header" ), LOGLEVEL_ERROR );
+            result.error = true;
+        }
+        else if( DatasetManager::isAnatomyNifti( result.pHeader ) )
+        {
+            // Glyph datasets build their GL buffers while loading and are
+            // converted on the main thread, anatomies are converted here.
+            Logger::getInstance()->print( wxT( "Loading anatomy" ), LOGLEVEL_MESSAGE );
+            result.pAnatomy = new Anatomy( result.filename );
+            result.error    = !result.pAnatomy->load( result.pHeader, result.pBody );
+
+            nifti_image_free( result.pHeader );
+            nifti_image_free( result.pBody );
+            result.pHeader = NULL;
+            result.pBody   = NULL;
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+bool AsyncLoader::isCancelled( const AsyncLoadResult *pResult )
+{
+    wxMutexLocker lock( m_mutex );
+    return pResult->generation != m_generation;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+DatasetIndex AsyncLoader::insert( AsyncLoadResult *pResult )
+{
+    if( pResult->error )
+    {
+        discard( pResult );
+        return BAD_INDEX;
+    }
+
+    DatasetManager *pDatasetManager = DatasetManager::getInstance();
+    DatasetIndex index( BAD_INDEX );
+
+    if( NULL != pResult->pFibers )
+    {
+        index = pDatasetManager->addFibers( pResult->pFibers );
+    }
+    else if( NULL != pResult->pAnatomy )
+    {
+        index = pDatasetManager->addAnatomy( pResult->pAnatomy );
+    }
+    else if( NULL != pResult->pHeader )
+    {
+        pDatasetManager->forceLoadingAsMaximas( pResult->loadAsPeaks );
+        index = pDatasetManager->load( pResult->filename, pResult->pHeader, pResult->pBody );
+        pDatasetManager->forceLoadingAsMaximas( false );
+
+        nifti_image_free( pResult->pHeader );
+        nifti_image_free( pResult->pBody );
+    }
+    else
+    {
+        pDatasetManager->forceLoadingAsMaximas( pResult->loadAsPeaks );
+        index = pDatasetManager->load( pResult->filename, pResult->extension );
+        pDatasetManager->forceLoadingAsMaximas( false );
+    }
+
+    delete pResult;
+    return index;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void AsyncLoader::discard( AsyncLoadResult *pResult )
+{
+    delete pResult->pFibers;
+    delete pResult->pAnatomy;
+
+    if( NULL != pResult->pHeader )
+    {
+        nifti_image_free( pResult->pHeader );
+    }
+    if( NULL != pResult->pBody )
+    {
+        nifti_image_free( pResult->pBody );
+    }
+
+    delete pResult;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void AsyncLoader::post( AsyncLoadStage stage, const wxString &filename, AsyncLoadResult *pResult )
+{
+    wxCommandEvent event( wxEVT_ASYNC_LOAD_EVENT, m_id );
+    event.SetInt( stage );
+    event.SetString( filename.c_str() );
+    event.SetClientData( pResult );
+    m_pHandler->AddPendingEvent( event );
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+wxThread::ExitCode AsyncLoader::Worker::Entry()
+{
+    while( true )
+    {
+        Job job;
+        {
+            wxMutexLocker lock( m_loader.m_mutex );
+            while( m_loader.m_jobs.empty() && !m_loader.m_stop )
+            {
+                m_loader.m_jobAvailable.Wait();
+            }
+
+            if( m_loader.m_stop )
+            {
+                break;
+            }
+
+            job = m_loader.m_jobs.front();
+            m_loader.m_jobs.pop_front();
+            m_loader.m_isBusy = true;
+            m_loader.m_cancelParse = false;
+        }
+
+        m_loader.post( ASYNC_LOAD_STARTED, job.filename, NULL );
+
+        AsyncLoadResult *pResult = new AsyncLoadResult( job.filename, job.loadAsPeaks, job.generation );
+        pResult->pCancel = &m_loader.m_cancelParse;
+
+        // Scenes and meshes are left to the main thread, they
+        // create their GL objects and list items while loading.
+        if( wxT( "scn" ) != pResult->extension )
+        {
+            parse( *pResult );
+        }
+
+        m_loader.post( ASYNC_LOAD_DONE, job.filename, pResult );
+        m_loader.m_resultHandled.Wait();
+    }
+
+    return 0;
+}
@@ -0,0 +1,132 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:            AsyncLoader.h
+//
+// Description: Queue of files parsed one after the other by a worker thread.
+//
+// The worker does the file reading, the type conversion and the octree
+// build, then hands the result to the main thread with a wxCommandEvent.
+// The main thread inserts it in the DatasetManager and calls acknowledge(),
+// only then does the worker start the next file: the anatomy setting the
+// global dimensions is always in place before the files depending on it
+// are parsed. GL buffers and textures are still created lazily on the
+// main thread when the datasets are first drawn.
+/////////////////////////////////////////////////////////////////////////////
+#ifndef ASYNCLOADER_H_
+#define ASYNCLOADER_H_
+
+#include "DatasetIndex.h"
+#include "../misc/nifti/nifti1_io.h"
+
+#include <wx/event.h>
+#include <wx/string.h>
+#include <wx/thread.h>
+
+#include <deque>
+
+class Anatomy;
+class Fibers;
+
+extern const wxEventType wxEVT_ASYNC_LOAD_EVENT;
+
+// Value of GetInt() for the events posted by the worker.
+enum AsyncLoadStage { ASYNC_LOAD_STARTED, ASYNC_LOAD_DONE };
+
+// Posted with the ASYNC_LOAD_DONE event as client data, owned by the
+// receiver which must give it back to AsyncLoader::insert or discard.
+struct AsyncLoadResult
+{
+    AsyncLoadResult( const wxString &filename, const bool loadAsPeaks = false, const unsigned int generation = 0 );
+
+    wxString        filename;
+    wxString        extension;
+    bool            loadAsPeaks;
+    unsigned int    generation;
+    bool            error;
+
+    // Set by AsyncLoader::cancel while the file is parsed, NULL when
+    // the parse cannot be cancelled.
+    const volatile bool *pCancel;
+
+    // At most one of these is set. When none is, the file was left
+    // to the main thread (scenes, meshes).
+    Fibers          *pFibers;
+    Anatomy         *pAnatomy;
+    nifti_image     *pHeader;
+    nifti_image     *pBody;
+};
+
+class AsyncLoader
+{
+public:
+    AsyncLoader( wxEvtHandler *pHandler, int id );
+    ~AsyncLoader();
+
+    // Queues a file, returns false if the worker thread cannot be started.
+    bool push( const wxString &filename, const bool loadAsPeaks = false );
+
+    // Drops the queued files and aborts the fibers being parsed. The file
+    // being parsed is still posted, isCancelled() tells the receiver to
+    // discard it.
+    void cancel();
+
+    // Lets the worker go on with the next file, call it once
+    // the ASYNC_LOAD_DONE event has been handled.
+    void acknowledge();
+
+    bool   isLoading();
+    size_t getPendingCount();
+
+    // True if cancel() was called after the file was queued.
+    bool isCancelled( const AsyncLoadResult *pResult );
+
+    // Reads and converts what can be off the main thread, may be
+    // called from any thread as long as no dataset is inserted meanwhile.
+    static void         parse( AsyncLoadResult &result );
+
+    // Main thread only. Inserts the parsed dataset in the DatasetManager,
+    // loading the meshes left by the worker synchronously. Scenes
+    // must go through SceneManager::load instead.
+    static DatasetIndex insert( AsyncLoadResult *pResult );
+    static void         discard( AsyncLoadResult *pResult );
+
+private:
+    AsyncLoader( const AsyncLoader & );
+    AsyncLoader &operator=( const AsyncLoader & );
+
+    struct Job
+    {
+        wxString        filename;
+        bool            loadAsPeaks;
+        unsigned int    generation;
+    };
+
+    class Worker : public wxThread
+    {
+    public:
+        Worker( AsyncLoader &loader ) : wxThread( wxTHREAD_JOINABLE ), m_loader( loader ) {}
+
+    protected:
+        virtual ExitCode Entry();
+
+    private:
+        AsyncLoader &m_loader;
+    };
+
+    void post( AsyncLoadStage stage, const wxString &filename, AsyncLoadResult *pResult );
+
+private:
+    wxEvtHandler        *m_pHandler;
+    int                 m_id;
+    Worker              *m_pWorker;
+
+    wxMutex             m_mutex;
+    wxCondition         m_jobAvailable;
+    wxSemaphore         m_resultHandled;
+    std::deque<Job>     m_jobs;
+    unsigned int        m_generation;
+    volatile bool       m_cancelParse;      // Read by the parse without the mutex
+    bool                m_isBusy;
+    bool                m_stop;
+};
+
+#endif // ASYNCLOADER_H_
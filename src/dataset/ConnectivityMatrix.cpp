@@ -0,0 +1,330 @@
+#include "ConnectivityMatrix.h"
+
+#include "Anatomy.h"
+#include "DatasetManager.h"
+#include "Fibers.h"
+#include "../Logger.h"
+#include "../misc/BitSet.h"
+
+#include <algorithm>
+#include <fstream>
+#include <vector>
+using std::vector;
+
+namespace
+{
+    // Memory the per chunk matrices may use together, the fibers are split
+    // in fewer chunks when the atlas has many regions.
+    const size_t CONNECTIVITY_CHUNKS_MEMORY( 256 * 1024 * 1024 );
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Counts the fibers of each chunk in the matrix of this chunk.
+//////////////////////////////////////////////////////////////////////////
+class ConnectivityMatrix::ChunkTask : public Fibers::ChunkVisitor
+{
+public:
+    ChunkTask( const ConnectivityMatrix &matrix, const Fibers &fibers, size_t nbChunks )
+    :   m_matrix( matrix ),
+        m_fibers( fibers ),
+        m_counts( nbChunks, vector< int >( matrix.getCellsCount(), 0 ) ),
+        m_lengths( nbChunks, vector< double >( matrix.getCellsCount(), 0.0 ) ),
+        m_regions( nbChunks )
+    {
+    }
+
+    virtual void visit( size_t chunk, int fiberId, const float *pPoints, int nbPoints )
+    {
+        if( nbPoints > 0 )
+        {
+            addFiber( pPoints, nbPoints, m_fibers.getFiberLength( fiberId ), m_counts[chunk], m_lengths[chunk], m_regions[chunk] );
+        }
+    }
+
+    // The totals are moved out of the matrices of the first chunk.
+    void merge( vector< int > &o_counts, vector< double > &o_lengths )
+    {
+        for( size_t chunk = 1; chunk < m_counts.size(); ++chunk )
+        {
+            for( size_t cell = 0; cell < m_counts[0].size(); ++cell )
+            {
+                m_counts[0][cell]  += m_counts[chunk][cell];
+                m_lengths[0][cell] += m_lengths[chunk][cell];
+            }
+        }
+
+        o_counts.swap( m_counts[0] );
+        o_lengths.swap( m_lengths[0] );
+    }
+
+private:
+    void addFiber( const float *pPoints, int nbPoints, float length,
+                   vector< int > &io_counts, vector< double > &io_lengths, vector< int > &io_regions ) const
+    {
+        if( m_matrix.m_membership == MEMBERSHIP_ENDPOINTS )
+        {
+            const int regionA = m_matrix.getRegion( pPoints );
+            const int regionB = m_matrix.getRegion( pPoints + ( nbPoints - 1 ) * 3 );
+
+            if( regionA >= 0 && regionB >= 0 )
+            {
+                const size_t cell = m_matrix.getIndex( regionA, regionB );
+                ++io_counts[cell];
+                io_lengths[cell] += length;
+            }
+            return;
+        }
+
+        // Regions crossed by the fiber, the consecutive points mostly stay in the same one.
+        io_regions.clear();
+
+        for( int p = 0; p < nbPoints; ++p )
+        {
+            const int region = m_matrix.getRegion( pPoints + p * 3 );
+
+            if( region >= 0 && ( io_regions.empty() || io_regions.back() != region ) &&
+                std::find( io_regions.begin(), io_regions.end(), region ) == io_regions.end() )
+            {
+                io_regions.push_back( region );
+            }
+        }
+
+        if( io_regions.size() == 1 )
+        {
+            const size_t cell = m_matrix.getIndex( io_regions[0], io_regions[0] );
+            ++io_counts[cell];
+            io_lengths[cell] += length;
+            return;
+        }
+
+        for( size_t i = 0; i < io_regions.size(); ++i )
+        {
+            for( size_t j = i + 1; j < io_regions.size(); ++j )
+            {
+                const size_t cell = m_matrix.getIndex( io_regions[i], io_regions[j] );
+                ++io_counts[cell];
+                io_lengths[cell] += length;
+            }
+        }
+    }
+
+private:
+    const ConnectivityMatrix        &m_matrix;
+    const Fibers                    &m_fibers;
+
+    vector< vector< int > >         m_counts;
+    vector< vector< double > >      m_lengths;
+    vector< vector< int > >         m_regions;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+ConnectivityMatrix::ConnectivityMatrix( Fibers *pFibers, Anatomy *pLabels, Membership membership )
+:   m_membership( membership )
+{
+    DatasetManager *pDM = DatasetManager::getInstance();
+    m_columns      = pDM->getColumns();
+    m_rows         = pDM->getRows();
+    m_frames       = pDM->getFrames();
+    m_voxelSize[0] = pDM->getVoxelX();
+    m_voxelSize[1] = pDM->getVoxelY();
+    m_voxelSize[2] = pDM->getVoxelZ();
+
+    if( !readLabels( pLabels ) )
+    {
+        Logger::getInstance()->print( wxT( "The labels of a connectivity matrix must be a scalar volume on the anatomy grid." ), LOGLEVEL_ERROR );
+        m_labels.clear();
+        return;
+    }
+
+    BitSet shown( pFibers->m_selected );
+    shown.andNot( pFibers->m_filtered );
+
+    const size_t matrixSize = getCellsCount() * ( sizeof( int ) + sizeof( double ) );
+    const size_t nbChunks = std::min( pFibers->getVisitChunksCount(),
+                                      std::max( static_cast< size_t >( 1 ), CONNECTIVITY_CHUNKS_MEMORY / matrixSize ) );
+
+    Logger::getInstance()->print( wxString::Format( wxT( "Computing connectivity matrix of %d regions..." ), getRegionsCount() ), LOGLEVEL_MESSAGE );
+
+    ChunkTask task( *this, *pFibers, nbChunks );
+    pFibers->visitFibersInChunks( shown, nbChunks, task );
+    task.merge( m_counts, m_lengths );
+
+    // The voxels are not needed anymore.
+    vector< unsigned short >().swap( m_voxelRegions );
+
+    Logger::getInstance()->print( wxT( "Connectivity matrix done" ), LOGLEVEL_MESSAGE );
+}
+
+//////////////////////////////////////////////////////////////////////////
+// The anatomies keep normalized values, the labels are scaled back with
+// the maximum used when the volume was read. The 16 bit volumes are
+// clipped to their 99.9th percentile when read, the labels above it are
+// lost and would be merged, such volumes are refused.
+//////////////////////////////////////////////////////////////////////////
+bool ConnectivityMatrix::readLabels( Anatomy *pLabels )
+{
+    float scale( 0.0f );
+
+    switch( pLabels->getType() )
+    {
+        case HEAD_BYTE:
+            scale = 255.0f;
+            break;
+        case HEAD_SHORT:
+            if( pLabels->getOldMax() > pLabels->getNewMax() )
+            {
+                Logger::getInstance()->print( wxString::Format( wxT( "The labels above %d were clipped when the volume was read, they cannot be told apart." ),
+                                                                static_cast< int >( pLabels->getNewMax() ) ), LOGLEVEL_ERROR );
+                return false;
+            }
+            scale = pLabels->getNewMax();
+            break;
+        case OVERLAY:
+            scale = pLabels->getOldMax();
+            break;
+        default:
+            return false;
+    }
+
+    const vector< float > &values = *pLabels->getFloatDataset();
+    const size_t nbVoxels = static_cast< size_t >( m_columns ) * m_rows * m_frames;
+
+    if( values.size() != nbVoxels )
+    {
+        return false;
+    }
+
+    vector< int > voxelLabels( nbVoxels );
+
+    for( size_t v = 0; v < nbVoxels; ++v )
+    {
+        voxelLabels[v] = static_cast< int >( values[v] * scale + 0.5f );
+
+        if( voxelLabels[v] > 0 )
+        {
+            m_labels.push_back( voxelLabels[v] );
+        }
+    }
+
+    std::sort( m_labels.begin(), m_labels.end() );
+    m_labels.erase( std::unique( m_labels.begin(), m_labels.end() ), m_labels.end() );
+
+    if( m_labels.empty() || m_labels.size() > 65535 )
+    {
+        return false;
+    }
+
+    m_voxelRegions.assign( nbVoxels, 0 );
+
+    for( size_t v = 0; v < nbVoxels; ++v )
+    {
+        if( voxelLabels[v] > 0 )
+        {
+            m_voxelRegions[v] = std::lower_bound( m_labels.begin(), m_labels.end(), voxelLabels[v] ) - m_labels.begin() + 1;
+        }
+    }
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+int ConnectivityMatrix::getRegion( const float *pPoint ) const
+{
+    const float x = pPoint[0] / m_voxelSize[0];
+    const float y = pPoint[1] / m_voxelSize[1];
+    const float z = pPoint[2] / m_voxelSize[2];
+
+    if( x < 0.0f || y < 0.0f || z < 0.0f )
+    {
+        return -1;
+    }
+
+    const int col   = static_cast< int >( x );
+    const int row   = static_cast< int >( y );
+    const int frame = static_cast< int >( z );
+
+    if( col >= m_columns || row >= m_rows || frame >= m_frames )
+    {
+        return -1;
+    }
+
+    return static_cast< int >( m_voxelRegions[( static_cast< size_t >( frame ) * m_rows + row ) * m_columns + col] ) - 1;
+}
+
+size_t ConnectivityMatrix::getCellsCount() const
+{
+    return m_labels.size() * ( m_labels.size() + 1 ) / 2;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Row regionA of the triangle starts after the N + ( N - 1 ) + ... cells
+// of the rows before it.
+//////////////////////////////////////////////////////////////////////////
+size_t ConnectivityMatrix::getIndex( int regionA, int regionB ) const
+{
+    if( regionA > regionB )
+    {
+        std::swap( regionA, regionB );
+    }
+
+    const size_t row = regionA;
+    return row * m_labels.size() - row * ( row - 1 ) / 2 + ( regionB - regionA );
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+int ConnectivityMatrix::getCount( int regionA, int regionB ) const
+{
+    return m_counts[getIndex( regionA, regionB )];
+}
+
+float ConnectivityMatrix::getMeanLength( int regionA, int regionB ) const
+{
+    const size_t cell = getIndex( regionA, regionB );
+
+    return m_counts[cell] > 0 ? static_cast< float >( m_lengths[cell] / m_counts[cell] ) : 0.0f;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+bool ConnectivityMatrix::saveCSV( const wxString &filename, Value value ) const
+{
+    std::ofstream file( filename.mb_str( wxConvUTF8 ) );
+
+    if( !file )
+    {
+        Logger::getInstance()->print( wxT( "Cannot write the connectivity matrix to " ) + filename, LOGLEVEL_ERROR );
+        return false;
+    }
+
+    file << "label";
+    for( int region = 0; region < getRegionsCount(); ++region )
+    {
+        file << ',' << m_labels[region];
+    }
+    file << '\n';
+
+    for( int regionA = 0; regionA < getRegionsCount(); ++regionA )
+    {
+        file << m_labels[regionA];
+
+        for( int regionB = 0; regionB < getRegionsCount(); ++regionB )
+        {
+            file << ',';
+
+            if( value == VALUE_COUNT )
+            {
+                file << getCount( regionA, regionB );
+            }
+            else
+            {
+                file << getMeanLength( regionA, regionB );
+            }
+        }
+        file << '\n';
+    }
+
+    return !file.fail();
+}
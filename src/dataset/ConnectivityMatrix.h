@@ -0,0 +1,71 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:            ConnectivityMatrix.h
+//
+// Description: Counts the fibers joining each pair of regions of a label
+// volume, with their mean length, in one pass over the fibers.
+//
+// The labels are read from an anatomy on the grid of the DatasetManager,
+// every non zero label is a region. A fiber belongs to the regions of its
+// two end points, or to every region one of its points goes through. The
+// fibers are split in chunks counted on separate threads, each chunk in
+// its own matrix, and the matrices are summed at the end.
+/////////////////////////////////////////////////////////////////////////////
+#ifndef CONNECTIVITYMATRIX_H_
+#define CONNECTIVITYMATRIX_H_
+
+#include <wx/string.h>
+
+#include <cstddef>
+#include <vector>
+
+class Anatomy;
+class Fibers;
+
+class ConnectivityMatrix
+{
+public:
+    enum Membership { MEMBERSHIP_ENDPOINTS, MEMBERSHIP_ANY_POINT };
+    enum Value      { VALUE_COUNT, VALUE_MEAN_LENGTH };
+
+    // Counts the fibers shown by pFibers. The matrix is empty if pLabels
+    // is not a scalar volume on the grid of the DatasetManager.
+    ConnectivityMatrix( Fibers *pFibers, Anatomy *pLabels, Membership membership );
+
+    bool  isEmpty() const           { return m_labels.empty(); }
+    int   getRegionsCount() const   { return m_labels.size(); }
+    int   getLabel( int region ) const { return m_labels[region]; }
+
+    // The matrix is symmetric. The diagonal counts the fibers joining a
+    // region to itself only: both ends in it, or no other region crossed.
+    int   getCount( int regionA, int regionB ) const;
+    float getMeanLength( int regionA, int regionB ) const;
+
+    // Writes one value of the matrix, with the labels as the first row and column.
+    bool  saveCSV( const wxString &filename, Value value ) const;
+
+private:
+    class ChunkTask;
+
+    bool  readLabels( Anatomy *pLabels );
+    int   getRegion( const float *pPoint ) const;
+    size_t getCellsCount() const;
+    size_t getIndex( int regionA, int regionB ) const;
+
+private:
+    Membership                      m_membership;
+
+    int                             m_columns;
+    int                             m_rows;
+    int                             m_frames;
+    float                           m_voxelSize[3];
+
+    std::vector< int >              m_labels;       // Label of each region, increasing
+    std::vector< unsigned short >   m_voxelRegions; // Region + 1 of each voxel, 0 outside
+
+    // Upper triangle of the N x N matrices, regionA <= regionB, packed
+    // row by row.
+    std::vector< int >              m_counts;
+    std::vector< double >           m_lengths;
+};
+
+#endif // CONNECTIVITYMATRIX_H_
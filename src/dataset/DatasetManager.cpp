@@ -293,57 +293,9 @@ DatasetIndex DatasetManager::load( const wxString &filename, const wxString &ext
         {
             Logger::getInstance()->print( wxT( "nifti file corrupt, cannot create nifti image from header" ), LOGLEVEL_ERROR );
         }
-        else if( 16 == pHeader->datatype && 4 == pHeader->ndim && 6 == pHeader->dim[4] )
-        {
-            if ( m_anatomies.empty() )
-            {
-                Logger::getInstance()->print( wxT( "No anatomy file loaded" ), LOGLEVEL_ERROR );
-            }
-            else if ( !m_tensors.empty() )
-            {
-                Logger::getInstance()->print( wxT( "Tensors already loaded" ), LOGLEVEL_ERROR );
-            }
-            else
-            {
-                result = loadTensors( filename, pHeader, pBody );
-            }
-        }
-        else if( 16 == pHeader->datatype && 4 == pHeader->ndim && 
-                 (0 == pHeader->dim[4] 
-                  || ( 15 == pHeader->dim[4] && !m_forceLoadingAsMaximas )
-                  || 28 == pHeader->dim[4] 
-                  || 45 == pHeader->dim[4] 
-                  || 66 == pHeader->dim[4] 
-                  || 91 == pHeader->dim[4] 
-                  || 120 == pHeader->dim[4] 
-                  || 153 == pHeader->dim[4] ) )
-        {
-            if ( m_anatomies.empty() )
-            {
-                Logger::getInstance()->print( wxT( "No anatomy file loaded" ), LOGLEVEL_ERROR );
-            }
-            else
-            {
-                result = loadODF( filename, pHeader, pBody );
-            }
-        }
-        else if( 16 == pHeader->datatype && 4 == pHeader->ndim 
-                && ( 9 == pHeader->dim[4] 
-                    || ( 15 == pHeader->dim[4] && m_forceLoadingAsMaximas )
-                    || 12 == pHeader->dim[4] ) )
-        {
-            if ( m_anatomies.empty() )
-            {
-                Logger::getInstance()->print( wxT( "No anatomy file loaded" ), LOGLEVEL_ERROR );
-            }
-            else
-            {
-                result = loadMaximas( filename, pHeader, pBody );
-            }
-        }
         else
         {
-            result = loadAnatomy( filename, pHeader, pBody );
+            result = load( filename, pHeader, pBody );
         }
 
         nifti_image_free( pHeader );
@@ -381,6 +333,74 @@ DatasetIndex DatasetManager::load( const wxString &filename, const wxString &ext
 
 //////////////////////////////////////////////////////////////////////////
 
+DatasetIndex DatasetManager::load( const wxString &filename, nifti_image *pHeader, nifti_image *pBody )
+{
+    DatasetIndex result( BAD_INDEX );
+
+    if( isAnatomyNifti( pHeader ) )
+    {
+        result = loadAnatomy( filename, pHeader, pBody );
+    }
+    else if( 6 == pHeader->dim[4] )
+    {
+        if ( m_anatomies.empty() )
+        {
+            Logger::getInstance()->print( wxT( "No anatomy file loaded" ), LOGLEVEL_ERROR );
+        }
+        else if ( !m_tensors.empty() )
+        {
+            Logger::getInstance()->print( wxT( "Tensors already loaded" ), LOGLEVEL_ERROR );
+        }
+        else
+        {
+            result = loadTensors( filename, pHeader, pBody );
+        }
+    }
+    else if( 9 == pHeader->dim[4] 
+            || ( 15 == pHeader->dim[4] && m_forceLoadingAsMaximas )
+            || 12 == pHeader->dim[4] )
+    {
+        if ( m_anatomies.empty() )
+        {
+            Logger::getInstance()->print( wxT( "No anatomy file loaded" ), LOGLEVEL_ERROR );
+        }
+        else
+        {
+            result = loadMaximas( filename, pHeader, pBody );
+        }
+    }
+    else
+    {
+        if ( m_anatomies.empty() )
+        {
+            Logger::getInstance()->print( wxT( "No anatomy file loaded" ), LOGLEVEL_ERROR );
+        }
+        else
+        {
+            result = loadODF( filename, pHeader, pBody );
+        }
+    }
+
+    return result;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+bool DatasetManager::isAnatomyNifti( const nifti_image *pHeader )
+{
+    if( 16 != pHeader->datatype || 4 != pHeader->ndim )
+    {
+        return true;
+    }
+
+    // Number of values per voxel of the tensors (6), ODFs and maximas layouts.
+    static const int GLYPH_DIMS[] = { 0, 6, 9, 12, 15, 28, 45, 66, 91, 120, 153 };
+
+    return std::find( GLYPH_DIMS, GLYPH_DIMS + sizeof( GLYPH_DIMS ) / sizeof( int ), pHeader->dim[4] ) == GLYPH_DIMS + sizeof( GLYPH_DIMS ) / sizeof( int );
+}
+
+//////////////////////////////////////////////////////////////////////////
+
 void DatasetManager::remove( const DatasetIndex index )
 {
     map<DatasetIndex, DatasetInfo *>::iterator it = m_datasets.find( index );
@@ -552,27 +572,34 @@ DatasetIndex DatasetManager::loadAnatomy( const wxString &filename, nifti_image
     Anatomy *pAnatomy = new Anatomy( filename );
     if( pAnatomy->load( pHeader, pBody ) )
     {
-        Logger::getInstance()->print( wxT( "Assigning attributes" ), LOGLEVEL_DEBUG );
-        pAnatomy->setThreshold( THRESHOLD );
-        pAnatomy->setAlpha( ALPHA );
-        pAnatomy->setShow( SHOW );
-        pAnatomy->setShowFS( SHOW_FS );
-        pAnatomy->setUseTex( USE_TEX );
+        return addAnatomy( pAnatomy );
+    }
 
-        DatasetIndex index = insert( pAnatomy );
+    delete pAnatomy;
+    return BAD_INDEX;
+}
 
-        SelectionTree::SelectionObjectVector objs = SceneManager::getInstance()->getSelectionTree().getAllObjects();
-        
-        for( SelectionTree::SelectionObjectVector::iterator objsIt = objs.begin(); objsIt != objs.end(); ++objsIt )
-        {
-            (*objsIt)->update();
-        }
+//////////////////////////////////////////////////////////////////////////
 
-        return index;
+DatasetIndex DatasetManager::addAnatomy( Anatomy *pAnatomy )
+{
+    Logger::getInstance()->print( wxT( "Assigning attributes" ), LOGLEVEL_DEBUG );
+    pAnatomy->setThreshold( THRESHOLD );
+    pAnatomy->setAlpha( ALPHA );
+    pAnatomy->setShow( SHOW );
+    pAnatomy->setShowFS( SHOW_FS );
+    pAnatomy->setUseTex( USE_TEX );
+
+    DatasetIndex index = insert( pAnatomy );
+
+    SelectionTree::SelectionObjectVector objs = SceneManager::getInstance()->getSelectionTree().getAllObjects();
+    
+    for( SelectionTree::SelectionObjectVector::iterator objsIt = objs.begin(); objsIt != objs.end(); ++objsIt )
+    {
+        (*objsIt)->update();
     }
 
-    delete pAnatomy;
-    return BAD_INDEX;
+    return index;
 }
 
 //////////////////////////////////////////////////////////////////////////
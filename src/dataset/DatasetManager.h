@@ -70,6 +70,12 @@ public:
     // Check with DatasetIndex::isOk() method to know if index is valid
     DatasetIndex load( const wxString &filename, const wxString &extension );
 
+    // Same as above for a nifti file already read, the images are not freed.
+    DatasetIndex load( const wxString &filename, nifti_image *pHeader, nifti_image *pBody );
+
+    // False for the tensors, ODFs and maximas layouts.
+    static bool isAnatomyNifti( const nifti_image *pHeader );
+
     // return index of the created dataset
     DatasetIndex createAnatomy()                                                 { return insert( new Anatomy() ); }
     DatasetIndex createAnatomy( DatasetType type )                               { return insert( new Anatomy( type ) ); }
@@ -83,6 +89,7 @@ public:
     void remove( const DatasetIndex index );
 	DatasetIndex createFibers( std::vector<std::vector<Vector> >* RTT );
     DatasetIndex addFibers( Fibers* fibers );
+    DatasetIndex addAnatomy( Anatomy *pAnatomy );
 
 protected:
     DatasetManager(void);
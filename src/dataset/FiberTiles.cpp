@@ -0,0 +1,600 @@
+#include "FiberTiles.h"
+
+#include "DatasetManager.h"
+#include "../Logger.h"
+#include "../gui/SelectionObject.h"
+#include "../gui/SelectionVOI.h"
+#include "../misc/BitSet.h"
+
+#include <GL/glew.h>
+#include <wx/filename.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+using std::vector;
+
+namespace
+{
+    // Number of tiles along each axis of the anatomy.
+    const int TILES_PER_AXIS = 8;
+
+    // Size of the per tile write buffer used while building.
+    const size_t TILE_WRITE_BUFFER_SIZE = 256 * 1024;
+
+    // Tile of the fibers without points, which are in none.
+    const unsigned short NO_TILE = 0xFFFF;
+}
+
+FiberTiles::Tile::Tile()
+:   m_countPoints( 0 ),
+    m_chunks(),
+    m_writeBuffer(),
+    m_isResident( false ),
+    m_fiberIds(),
+    m_linePointers(),
+    m_points(),
+    m_colors()
+{
+    m_min[0] = m_min[1] = m_min[2] =  1e30f;
+    m_max[0] = m_max[1] = m_max[2] = -1e30f;
+}
+
+FiberTiles::FiberTiles( float sizeX, float sizeY, float sizeZ, int fibersCount, int residentPointsBudget )
+:   m_residentPointsBudget( residentPointsBudget ),
+    m_residentPoints( 0 ),
+    m_filename(),
+    m_file(),
+    m_tiles( TILES_PER_AXIS * TILES_PER_AXIS * TILES_PER_AXIS ),
+    m_fiberTile( fibersCount, NO_TILE ),
+    m_lru(),
+    m_hasReadError( false )
+{
+    m_size[0] = sizeX;
+    m_size[1] = sizeY;
+    m_size[2] = sizeZ;
+}
+
+FiberTiles::~FiberTiles()
+{
+    if( m_file.IsOpened() )
+    {
+        m_file.Close();
+    }
+
+    if( !m_filename.IsEmpty() )
+    {
+        wxRemoveFile( m_filename );
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Creates the temporary file backing the tiles.
+//////////////////////////////////////////////////////////////////////////
+bool FiberTiles::create()
+{
+    m_filename = wxFileName::CreateTempFileName( wxT( "fnav" ) );
+
+    if( m_filename.IsEmpty() || !m_file.Open( m_filename, wxFile::read_write ) )
+    {
+        Logger::getInstance()->print( wxT( "Cannot create the temporary file for the fiber tiles." ), LOGLEVEL_ERROR );
+        return false;
+    }
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Appends a fiber to the tile containing its middle point. The fibers must
+// be added in increasing id order, this keeps the ids of each tile sorted.
+//////////////////////////////////////////////////////////////////////////
+void FiberTiles::addFiber( int fiberId, const float *pPoints, int nbPoints )
+{
+    if( nbPoints <= 0 )
+    {
+        return;
+    }
+
+    const float *pMiddle = &pPoints[( nbPoints / 2 ) * 3];
+    int tileIdx = getTileIndex( pMiddle[0], pMiddle[1], pMiddle[2] );
+    Tile &tile = m_tiles[tileIdx];
+
+    m_fiberTile[fiberId] = tileIdx;
+
+    for( int i = 0; i < nbPoints * 3; i += 3 )
+    {
+        for( int k = 0; k < 3; ++k )
+        {
+            tile.m_min[k] = std::min( tile.m_min[k], pPoints[i + k] );
+            tile.m_max[k] = std::max( tile.m_max[k], pPoints[i + k] );
+        }
+    }
+
+    // Global color, the normalized direction between the fiber extremities.
+    const float *pLast = &pPoints[( nbPoints - 1 ) * 3];
+    float color[3] = { std::abs( pPoints[0] - pLast[0] ), std::abs( pPoints[1] - pLast[1] ), std::abs( pPoints[2] - pLast[2] ) };
+    float norm = std::sqrt( color[0] * color[0] + color[1] * color[1] + color[2] * color[2] );
+
+    if( norm > 0.0f )
+    {
+        color[0] /= norm;
+        color[1] /= norm;
+        color[2] /= norm;
+    }
+
+    // Record: fiber id, number of points, color, points.
+    size_t pos = tile.m_writeBuffer.size();
+    tile.m_writeBuffer.resize( pos + 2 * sizeof( int ) + 3 * sizeof( float ) + nbPoints * 3 * sizeof( float ) );
+
+    char *pDest = &tile.m_writeBuffer[pos];
+    memcpy( pDest, &fiberId, sizeof( int ) );
+    pDest += sizeof( int );
+    memcpy( pDest, &nbPoints, sizeof( int ) );
+    pDest += sizeof( int );
+    memcpy( pDest, color, 3 * sizeof( float ) );
+    pDest += 3 * sizeof( float );
+    memcpy( pDest, pPoints, nbPoints * 3 * sizeof( float ) );
+
+    tile.m_countPoints += nbPoints;
+
+    if( tile.m_writeBuffer.size() >= TILE_WRITE_BUFFER_SIZE )
+    {
+        flushTile( tile );
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Writes the remaining buffered fibers, the tiles can be queried after that.
+//////////////////////////////////////////////////////////////////////////
+bool FiberTiles::finish()
+{
+    for( unsigned int i = 0; i < m_tiles.size(); ++i )
+    {
+        flushTile( m_tiles[i] );
+        vector< char >().swap( m_tiles[i].m_writeBuffer );
+    }
+
+    return m_file.Error() == false;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Sets o_inBox to true for the fibers having at least one point inside
+// the selection object. Only the tiles overlapping the object are paged in.
+//////////////////////////////////////////////////////////////////////////
+void FiberTiles::getFibersInside( SelectionObject *pSelObj, BitSet &o_inBox )
+{
+    o_inBox.assign( m_fiberTile.size(), false );
+
+    Vector center = pSelObj->getAppliedCenter();
+    Vector size   = pSelObj->getAppliedSize();
+
+    float voxelX = DatasetManager::getInstance()->getVoxelX();
+    float voxelY = DatasetManager::getInstance()->getVoxelY();
+    float voxelZ = DatasetManager::getInstance()->getVoxelZ();
+
+    float boxMin[3] = { center.x - size.x / 2 * voxelX, center.y - size.y / 2 * voxelY, center.z - size.z / 2 * voxelZ };
+    float boxMax[3] = { center.x + size.x / 2 * voxelX, center.y + size.y / 2 * voxelY, center.z + size.z / 2 * voxelZ };
+
+    float radius[3];
+    float middle[3];
+    for( int k = 0; k < 3; ++k )
+    {
+        radius[k] = ( boxMax[k] - boxMin[k] ) / 2.0f;
+        middle[k] = boxMax[k] - radius[k];
+    }
+
+    ObjectType type = pSelObj->getSelectionType();
+    SelectionVOI *pSelVOI = VOI_TYPE == type ? static_cast< SelectionVOI * >( pSelObj ) : NULL;
+
+    for( unsigned int tileIdx = 0; tileIdx < m_tiles.size(); ++tileIdx )
+    {
+        if( m_tiles[tileIdx].m_countPoints == 0 || !intersects( m_tiles[tileIdx], boxMin, boxMax ) )
+        {
+            continue;
+        }
+
+        Tile &tile = pageIn( tileIdx );
+
+        for( unsigned int k = 0; k < tile.m_fiberIds.size(); ++k )
+        {
+            int fiberId = tile.m_fiberIds[k];
+
+            for( int p = tile.m_linePointers[k]; p < tile.m_linePointers[k + 1]; ++p )
+            {
+                float x = tile.m_points[p * 3];
+                float y = tile.m_points[p * 3 + 1];
+                float z = tile.m_points[p * 3 + 2];
+
+                if( x < boxMin[0] || x > boxMax[0] || y < boxMin[1] || y > boxMax[1] || z < boxMin[2] || z > boxMax[2] )
+                {
+                    continue;
+                }
+
+                bool inside( true );
+                if( ELLIPSOID_TYPE == type )
+                {
+                    inside = ( x - middle[0] ) * ( x - middle[0] ) / ( radius[0] * radius[0] ) +
+                             ( y - middle[1] ) * ( y - middle[1] ) / ( radius[1] * radius[1] ) +
+                             ( z - middle[2] ) * ( z - middle[2] ) / ( radius[2] * radius[2] ) <= 1.0f;
+                }
+                else if( NULL != pSelVOI )
+                {
+                    inside = pSelVOI->isPointInside( x, y, z );
+                }
+
+                if( inside )
+                {
+                    o_inBox[fiberId] = true;
+                    break;
+                }
+            }
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Returns the points of a fiber. The pointer stays valid until the next
+// call to any query of this object, since it may page the tile out.
+//////////////////////////////////////////////////////////////////////////
+const float * FiberTiles::getFiberPoints( int fiberId )
+{
+    if( NO_TILE == m_fiberTile[fiberId] )
+    {
+        return NULL;
+    }
+
+    Tile &tile = pageIn( m_fiberTile[fiberId] );
+    int k = findFiber( tile, fiberId );
+
+    return &tile.m_points[tile.m_linePointers[k] * 3];
+}
+
+void FiberTiles::getFiberColor( int fiberId, float o_color[3] )
+{
+    if( NO_TILE == m_fiberTile[fiberId] )
+    {
+        o_color[0] = o_color[1] = o_color[2] = 1.0f;
+        return;
+    }
+
+    Tile &tile = pageIn( m_fiberTile[fiberId] );
+    int k = findFiber( tile, fiberId );
+
+    o_color[0] = tile.m_colors[k * 3];
+    o_color[1] = tile.m_colors[k * 3 + 1];
+    o_color[2] = tile.m_colors[k * 3 + 2];
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Visits the fibers set in fibers. Only the tiles holding some of them are
+// paged in, each once, so a pass reads every tile at most once whatever
+// the order of the fiber ids.
+//////////////////////////////////////////////////////////////////////////
+void FiberTiles::visitFibers( const BitSet &fibers, Visitor &visitor )
+{
+    vector< bool > isVisited( m_tiles.size(), false );
+
+    for( size_t fiberId = fibers.findNext( 0 ); fiberId < m_fiberTile.size(); fiberId = fibers.findNext( fiberId + 1 ) )
+    {
+        if( NO_TILE == m_fiberTile[fiberId] )
+        {
+            visitor.visit( fiberId, NULL, 0, NULL );
+        }
+        else
+        {
+            isVisited[m_fiberTile[fiberId]] = true;
+        }
+    }
+
+    for( unsigned int tileIdx = 0; tileIdx < m_tiles.size(); ++tileIdx )
+    {
+        if( !isVisited[tileIdx] )
+        {
+            continue;
+        }
+
+        Tile &tile = pageIn( tileIdx );
+
+        for( unsigned int k = 0; k < tile.m_fiberIds.size(); ++k )
+        {
+            const int fiberId  = tile.m_fiberIds[k];
+            const int nbPoints = tile.m_linePointers[k + 1] - tile.m_linePointers[k];
+
+            if( fibers[fiberId] )
+            {
+                visitor.visit( fiberId, nbPoints > 0 ? &tile.m_points[tile.m_linePointers[k] * 3] : NULL,
+                               nbPoints, &tile.m_colors[k * 3] );
+            }
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Fills o_fiberIds with the fibers set in fibers, in the order visitFibers
+// visits them. Nothing is paged in.
+//////////////////////////////////////////////////////////////////////////
+void FiberTiles::getVisitOrder( const BitSet &fibers, vector< int > &o_fiberIds ) const
+{
+    // Counting sort on the tiles, the empty fibers in the first bucket.
+    vector< int > starts( m_tiles.size() + 2, 0 );
+
+    for( size_t fiberId = fibers.findNext( 0 ); fiberId < m_fiberTile.size(); fiberId = fibers.findNext( fiberId + 1 ) )
+    {
+        ++starts[NO_TILE == m_fiberTile[fiberId] ? 1 : m_fiberTile[fiberId] + 2];
+    }
+
+    for( size_t bucket = 1; bucket < starts.size(); ++bucket )
+    {
+        starts[bucket] += starts[bucket - 1];
+    }
+
+    o_fiberIds.resize( starts.back() );
+
+    for( size_t fiberId = fibers.findNext( 0 ); fiberId < m_fiberTile.size(); fiberId = fibers.findNext( fiberId + 1 ) )
+    {
+        o_fiberIds[starts[NO_TILE == m_fiberTile[fiberId] ? 0 : m_fiberTile[fiberId] + 1]++] = fiberId;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Draws the shown fibers of the tiles inside the current view frustum.
+//////////////////////////////////////////////////////////////////////////
+void FiberTiles::draw( const BitSet &selected, const BitSet &filtered, bool showAll )
+{
+    GLfloat projection[16];
+    GLfloat modelview[16];
+    glGetFloatv( GL_PROJECTION_MATRIX, projection );
+    glGetFloatv( GL_MODELVIEW_MATRIX,  modelview );
+
+    // Clip matrix, then the 6 frustum planes (left, right, bottom, top, near, far).
+    float clip[16];
+    for( int c = 0; c < 4; ++c )
+    {
+        for( int r = 0; r < 4; ++r )
+        {
+            clip[c * 4 + r] = 0.0f;
+            for( int k = 0; k < 4; ++k )
+            {
+                clip[c * 4 + r] += projection[k * 4 + r] * modelview[c * 4 + k];
+            }
+        }
+    }
+
+    float planes[6][4];
+    for( int p = 0; p < 6; ++p )
+    {
+        int   row  = p / 2;
+        float sign = ( p % 2 == 0 ) ? 1.0f : -1.0f;
+
+        for( int c = 0; c < 4; ++c )
+        {
+            planes[p][c] = clip[c * 4 + 3] + sign * clip[c * 4 + row];
+        }
+    }
+
+    glEnableClientState( GL_VERTEX_ARRAY );
+
+    for( unsigned int tileIdx = 0; tileIdx < m_tiles.size(); ++tileIdx )
+    {
+        const Tile &candidate = m_tiles[tileIdx];
+
+        if( candidate.m_countPoints == 0 )
+        {
+            continue;
+        }
+
+        bool visible( true );
+        for( int p = 0; p < 6 && visible; ++p )
+        {
+            float x = planes[p][0] > 0.0f ? candidate.m_max[0] : candidate.m_min[0];
+            float y = planes[p][1] > 0.0f ? candidate.m_max[1] : candidate.m_min[1];
+            float z = planes[p][2] > 0.0f ? candidate.m_max[2] : candidate.m_min[2];
+
+            visible = planes[p][0] * x + planes[p][1] * y + planes[p][2] * z + planes[p][3] >= 0.0f;
+        }
+
+        if( !visible )
+        {
+            continue;
+        }
+
+        Tile &tile = pageIn( tileIdx );
+        glVertexPointer( 3, GL_FLOAT, 0, &tile.m_points[0] );
+
+        for( unsigned int k = 0; k < tile.m_fiberIds.size(); ++k )
+        {
+            int fiberId = tile.m_fiberIds[k];
+
+            if( ( selected[fiberId] || showAll ) && !filtered[fiberId] )
+            {
+                glColor3fv( &tile.m_colors[k * 3] );
+                glDrawArrays( GL_LINE_STRIP, tile.m_linePointers[k], tile.m_linePointers[k + 1] - tile.m_linePointers[k] );
+            }
+        }
+    }
+
+    glDisableClientState( GL_VERTEX_ARRAY );
+}
+
+int FiberTiles::getTileIndex( float x, float y, float z ) const
+{
+    float pos[3] = { x, y, z };
+    int   idx[3];
+
+    for( int k = 0; k < 3; ++k )
+    {
+        idx[k] = m_size[k] > 0.0f ? static_cast< int >( pos[k] / m_size[k] * TILES_PER_AXIS ) : 0;
+        idx[k] = std::min( TILES_PER_AXIS - 1, std::max( 0, idx[k] ) );
+    }
+
+    return idx[0] + idx[1] * TILES_PER_AXIS + idx[2] * TILES_PER_AXIS * TILES_PER_AXIS;
+}
+
+void FiberTiles::flushTile( Tile &tile )
+{
+    if( tile.m_writeBuffer.empty() )
+    {
+        return;
+    }
+
+    Chunk chunk;
+    chunk.offset = m_file.SeekEnd();
+    chunk.size   = tile.m_writeBuffer.size();
+
+    m_file.Write( &tile.m_writeBuffer[0], chunk.size );
+    tile.m_chunks.push_back( chunk );
+    tile.m_writeBuffer.clear();
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Makes a tile resident and most recently used, evicting the least
+// recently used tiles while the resident points exceed the budget.
+//////////////////////////////////////////////////////////////////////////
+FiberTiles::Tile & FiberTiles::pageIn( int tileIdx )
+{
+    Tile &tile = m_tiles[tileIdx];
+
+    if( tile.m_isResident )
+    {
+        m_lru.remove( tileIdx );
+        m_lru.push_front( tileIdx );
+        return tile;
+    }
+
+    if( !readTile( tile ) )
+    {
+        Logger::getInstance()->print( wxString::Format( wxT( "Cannot read tile %d back from \"%s\", its fibers are left without points." ),
+                                                        tileIdx, m_filename.c_str() ), LOGLEVEL_ERROR );
+        dropTile( tileIdx );
+    }
+
+    tile.m_isResident = true;
+    m_residentPoints += tile.m_countPoints;
+    m_lru.push_front( tileIdx );
+
+    while( m_residentPoints > m_residentPointsBudget && m_lru.size() > 1 )
+    {
+        int evictedIdx = m_lru.back();
+        m_lru.pop_back();
+        pageOut( m_tiles[evictedIdx] );
+    }
+
+    return tile;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Reads the chunks of a tile, false if one of them is short or holds a
+// fiber running past its end.
+//////////////////////////////////////////////////////////////////////////
+bool FiberTiles::readTile( Tile &tile )
+{
+    tile.m_points.reserve( tile.m_countPoints * 3 );
+    tile.m_linePointers.push_back( 0 );
+
+    const size_t headerSize = 2 * sizeof( int ) + 3 * sizeof( float );
+    vector< char > buffer;
+
+    for( unsigned int c = 0; c < tile.m_chunks.size(); ++c )
+    {
+        buffer.resize( tile.m_chunks[c].size );
+
+        if( wxInvalidOffset == m_file.Seek( tile.m_chunks[c].offset ) ||
+            m_file.Read( &buffer[0], buffer.size() ) != static_cast< ssize_t >( buffer.size() ) )
+        {
+            return false;
+        }
+
+        size_t pos = 0;
+        while( pos < buffer.size() )
+        {
+            int fiberId;
+            int nbPoints;
+
+            if( buffer.size() - pos < headerSize )
+            {
+                return false;
+            }
+
+            memcpy( &fiberId,  &buffer[pos], sizeof( int ) );
+            pos += sizeof( int );
+            memcpy( &nbPoints, &buffer[pos], sizeof( int ) );
+            pos += sizeof( int );
+
+            const float *pColor  = reinterpret_cast< const float * >( &buffer[pos] );
+            pos += 3 * sizeof( float );
+
+            if( nbPoints < 0 || ( buffer.size() - pos ) / ( 3 * sizeof( float ) ) < static_cast< size_t >( nbPoints ) )
+            {
+                return false;
+            }
+
+            const float *pPoints = reinterpret_cast< const float * >( &buffer[pos] );
+            pos += nbPoints * 3 * sizeof( float );
+
+            tile.m_fiberIds.push_back( fiberId );
+            tile.m_colors.insert( tile.m_colors.end(), pColor, pColor + 3 );
+            tile.m_points.insert( tile.m_points.end(), pPoints, pPoints + nbPoints * 3 );
+            tile.m_linePointers.push_back( tile.m_linePointers.back() + nbPoints );
+        }
+    }
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Empties a tile that cannot be read, its fibers are kept without points
+// for the visit paging it in. They move to no tile, so the next queries
+// see them without points instead of reading the tile again.
+//////////////////////////////////////////////////////////////////////////
+void FiberTiles::dropTile( int tileIdx )
+{
+    Tile &tile = m_tiles[tileIdx];
+
+    tile.m_fiberIds.clear();
+    vector< float >().swap( tile.m_points );
+    tile.m_chunks.clear();
+    tile.m_countPoints = 0;
+
+    for( size_t fiberId = 0; fiberId < m_fiberTile.size(); ++fiberId )
+    {
+        if( tileIdx == m_fiberTile[fiberId] )
+        {
+            tile.m_fiberIds.push_back( fiberId );
+            m_fiberTile[fiberId] = NO_TILE;
+        }
+    }
+
+    tile.m_linePointers.assign( tile.m_fiberIds.size() + 1, 0 );
+    tile.m_colors.assign( tile.m_fiberIds.size() * 3, 1.0f );
+
+    m_hasReadError = true;
+}
+
+void FiberTiles::pageOut( Tile &tile )
+{
+    m_residentPoints -= tile.m_countPoints;
+    tile.m_isResident = false;
+
+    vector< int >().swap( tile.m_fiberIds );
+    vector< int >().swap( tile.m_linePointers );
+    vector< float >().swap( tile.m_points );
+    vector< float >().swap( tile.m_colors );
+}
+
+int FiberTiles::findFiber( const Tile &tile, int fiberId ) const
+{
+    return std::lower_bound( tile.m_fiberIds.begin(), tile.m_fiberIds.end(), fiberId ) - tile.m_fiberIds.begin();
+}
+
+bool FiberTiles::intersects( const Tile &tile, const float boxMin[3], const float boxMax[3] ) const
+{
+    for( int k = 0; k < 3; ++k )
+    {
+        if( tile.m_max[k] < boxMin[k] || tile.m_min[k] > boxMax[k] )
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
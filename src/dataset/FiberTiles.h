@@ -0,0 +1,114 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:            FiberTiles.h
+//
+// Description: Out-of-core storage for fiber sets too large for memory.
+//
+// The fibers are split into a regular grid of spatial tiles covering the
+// anatomy. Each fiber belongs to the tile containing its middle point,
+// and each tile keeps the bounding box of all its fibers. The tiles are
+// written to a temporary file while the fibers are loaded and only a
+// bounded set of them is kept resident, evicted in LRU order. Selection
+// and drawing only page in the tiles they actually touch.
+/////////////////////////////////////////////////////////////////////////////
+#ifndef FIBERTILES_H_
+#define FIBERTILES_H_
+
+#include <wx/file.h>
+#include <wx/string.h>
+
+#include <list>
+#include <vector>
+
+class BitSet;
+class SelectionObject;
+
+class FiberTiles
+{
+public:
+    // Receives the fibers of visitFibers. The points are only valid during
+    // the call, pColor is the global color of the fiber.
+    class Visitor
+    {
+    public:
+        virtual ~Visitor() {}
+        virtual void visit( int fiberId, const float *pPoints, int nbPoints, const float *pColor ) = 0;
+    };
+
+    FiberTiles( float sizeX, float sizeY, float sizeZ, int fibersCount, int residentPointsBudget );
+    ~FiberTiles();
+
+    // Building, done once while the fibers are loaded.
+    bool            create();
+    void            addFiber( int fiberId, const float *pPoints, int nbPoints );
+    bool            finish();
+
+    // Queries
+    void            getFibersInside( SelectionObject *pSelObj, BitSet &o_inBox );
+    const float *   getFiberPoints( int fiberId );
+    void            getFiberColor( int fiberId, float o_color[3] );
+
+    // Batch queries: the tiles are paged in one after the other and all
+    // their fibers visited before the next one, in the order given by
+    // getVisitOrder. The fibers without points come first.
+    void            visitFibers( const BitSet &fibers, Visitor &visitor );
+    void            getVisitOrder( const BitSet &fibers, std::vector< int > &o_fiberIds ) const;
+
+    void            draw( const BitSet &selected, const BitSet &filtered, bool showAll );
+
+    int             getResidentTilesCount() const { return m_lru.size(); }
+
+    // True once a tile could not be read back from the temporary file, its
+    // fibers are then left without points.
+    bool            hasReadError() const { return m_hasReadError; }
+
+private:
+    FiberTiles( const FiberTiles & );
+    FiberTiles &operator=( const FiberTiles & );
+
+    struct Chunk
+    {
+        wxFileOffset offset;
+        size_t       size;
+    };
+
+    struct Tile
+    {
+        Tile();
+
+        // Bounding box of every point of the fibers of this tile.
+        float                   m_min[3];
+        float                   m_max[3];
+        int                     m_countPoints;
+        std::vector< Chunk >    m_chunks;
+        std::vector< char >     m_writeBuffer;
+
+        // Resident data, empty when the tile is paged out.
+        bool                    m_isResident;
+        std::vector< int >      m_fiberIds;
+        std::vector< int >      m_linePointers;
+        std::vector< float >    m_points;
+        std::vector< float >    m_colors;
+    };
+
+    int             getTileIndex( float x, float y, float z ) const;
+    void            flushTile( Tile &tile );
+    Tile &          pageIn( int tileIdx );
+    bool            readTile( Tile &tile );
+    void            dropTile( int tileIdx );
+    void            pageOut( Tile &tile );
+    int             findFiber( const Tile &tile, int fiberId ) const;
+    bool            intersects( const Tile &tile, const float boxMin[3], const float boxMax[3] ) const;
+
+private:
+    float                       m_size[3];
+    int                         m_residentPointsBudget;
+    int                         m_residentPoints;
+    wxString                    m_filename;
+    wxFile                      m_file;
+    std::vector< Tile >         m_tiles;
+    std::vector< unsigned short > m_fiberTile;
+    std::list< int >            m_lru;
+    bool                        m_hasReadError;
+};
+
+#endif // FIBERTILES_H_
@@ -0,0 +1,183 @@
+#include "FiberVoxelIndex.h"
+
+#include "DatasetManager.h"
+#include "../Logger.h"
+#include "../gui/SelectionVOI.h"
+#include "../misc/BitSet.h"
+
+#include <vector>
+using std::vector;
+
+namespace
+{
+    void putVarUInt( vector< unsigned char > &o_bytes, unsigned int value )
+    {
+        while( value >= 0x80 )
+        {
+            o_bytes.push_back( static_cast< unsigned char >( value | 0x80 ) );
+            value >>= 7;
+        }
+        o_bytes.push_back( static_cast< unsigned char >( value ) );
+    }
+
+    unsigned int getVarUInt( const unsigned char *&pBytes )
+    {
+        unsigned int value( 0 );
+        for( int shift = 0; ; shift += 7 )
+        {
+            unsigned char byte = *pBytes++;
+            value |= static_cast< unsigned int >( byte & 0x7f ) << shift;
+
+            if( byte < 0x80 )
+            {
+                return value;
+            }
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+// The fibers are visited in increasing order, so the list of a voxel is
+// sorted and a fiber already added is always the last one of the list.
+//////////////////////////////////////////////////////////////////////////
+FiberVoxelIndex::FiberVoxelIndex( const vector< float > &pointArray, const vector< int > &linePointers, int fibersCount )
+:   m_fibersCount( fibersCount )
+{
+    DatasetManager *pDM = DatasetManager::getInstance();
+    m_columns = pDM->getColumns();
+    m_rows    = pDM->getRows();
+    m_frames  = pDM->getFrames();
+
+    const float voxelSize[3] = { pDM->getVoxelX(), pDM->getVoxelY(), pDM->getVoxelZ() };
+    const int   dims[3]      = { m_columns, m_rows, m_frames };
+    const size_t nbVoxels    = static_cast< size_t >( m_columns ) * m_rows * m_frames;
+
+    Logger::getInstance()->print( wxT( "Building voxel index..." ), LOGLEVEL_MESSAGE );
+
+    // Voxel of each point, -1 outside of the grid.
+    vector< int > pointVoxels( linePointers[fibersCount], -1 );
+
+    for( size_t p = 0; p < pointVoxels.size(); ++p )
+    {
+        int coords[3];
+        bool inside( true );
+
+        for( int k = 0; k < 3; ++k )
+        {
+            float pos = pointArray[p * 3 + k] / voxelSize[k];
+            coords[k] = pos >= 0.0f ? static_cast< int >( pos ) : -1;
+            inside &= coords[k] >= 0 && coords[k] < dims[k];
+        }
+
+        if( inside )
+        {
+            pointVoxels[p] = ( coords[2] * m_rows + coords[1] ) * m_columns + coords[0];
+        }
+    }
+
+    // Count the fibers of each voxel, then store them contiguously.
+    vector< int > lastFiber( nbVoxels, -1 );
+    vector< unsigned int > starts( nbVoxels + 1, 0 );
+
+    for( int fiber = 0; fiber < fibersCount; ++fiber )
+    {
+        for( int p = linePointers[fiber]; p < linePointers[fiber + 1]; ++p )
+        {
+            const int voxel = pointVoxels[p];
+
+            if( voxel >= 0 && lastFiber[voxel] != fiber )
+            {
+                lastFiber[voxel] = fiber;
+                ++starts[voxel + 1];
+            }
+        }
+    }
+
+    for( size_t v = 0; v < nbVoxels; ++v )
+    {
+        starts[v + 1] += starts[v];
+    }
+
+    vector< int > fibers( starts[nbVoxels] );
+    vector< unsigned int > fills( starts.begin(), starts.end() - 1 );
+    lastFiber.assign( nbVoxels, -1 );
+
+    for( int fiber = 0; fiber < fibersCount; ++fiber )
+    {
+        for( int p = linePointers[fiber]; p < linePointers[fiber + 1]; ++p )
+        {
+            const int voxel = pointVoxels[p];
+
+            if( voxel >= 0 && lastFiber[voxel] != fiber )
+            {
+                lastFiber[voxel] = fiber;
+                fibers[fills[voxel]++] = fiber;
+            }
+        }
+    }
+
+    vector< int >().swap( pointVoxels );
+    vector< int >().swap( lastFiber );
+    vector< unsigned int >().swap( fills );
+
+    for( size_t v = 0; v < nbVoxels; ++v )
+    {
+        if( starts[v] == starts[v + 1] )
+        {
+            continue;
+        }
+
+        m_voxels.push_back( v );
+        m_offsets.push_back( m_postings.size() );
+
+        int previous( 0 );
+        for( unsigned int i = starts[v]; i < starts[v + 1]; ++i )
+        {
+            putVarUInt( m_postings, fibers[i] - previous );
+            previous = fibers[i];
+        }
+    }
+    m_offsets.push_back( m_postings.size() );
+
+    Logger::getInstance()->print( wxString::Format( wxT( "Voxel index done, %d voxels, %d entries in %.1f MB" ),
+                                                    static_cast< int >( m_voxels.size() ), static_cast< int >( fibers.size() ),
+                                                    getMemorySize() / ( 1024.0f * 1024.0f ) ), LOGLEVEL_MESSAGE );
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+bool FiberVoxelIndex::getFibersInside( const SelectionVOI *pVOI, BitSet &o_inBox ) const
+{
+    const vector< bool > &includedVoxels = pVOI->getIncludedVoxels();
+
+    if( includedVoxels.size() != static_cast< size_t >( m_columns ) * m_rows * m_frames )
+    {
+        return false;
+    }
+
+    o_inBox.assign( m_fibersCount, false );
+
+    for( size_t i = 0; i < m_voxels.size(); ++i )
+    {
+        if( !includedVoxels[m_voxels[i]] )
+        {
+            continue;
+        }
+
+        const unsigned char *pBytes = &m_postings[m_offsets[i]];
+        const unsigned char *pEnd   = pBytes + ( m_offsets[i + 1] - m_offsets[i] );
+
+        for( unsigned int fiber( 0 ); pBytes < pEnd; )
+        {
+            fiber += getVarUInt( pBytes );
+            o_inBox[fiber] = true;
+        }
+    }
+
+    return true;
+}
+
+size_t FiberVoxelIndex::getMemorySize() const
+{
+    return m_voxels.size() * sizeof( unsigned int ) + m_offsets.size() * sizeof( unsigned int ) + m_postings.size();
+}
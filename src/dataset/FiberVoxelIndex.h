@@ -0,0 +1,44 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:            FiberVoxelIndex.h
+//
+// Description: Inverted index from the anatomy voxels to the fibers going
+// through them, used to select the fibers of a VOI.
+//
+// Only the voxels reached by a fiber are kept. The fibers of a voxel are
+// stored once each, in increasing order, as variable length deltas. A VOI
+// query merges the lists of the voxels of its mask instead of testing the
+// points of every octree node overlapping the VOI.
+/////////////////////////////////////////////////////////////////////////////
+#ifndef FIBERVOXELINDEX_H_
+#define FIBERVOXELINDEX_H_
+
+#include <cstddef>
+#include <vector>
+
+class BitSet;
+class SelectionVOI;
+
+class FiberVoxelIndex
+{
+public:
+    // Indexes the points on the voxel grid of the DatasetManager.
+    FiberVoxelIndex( const std::vector< float > &pointArray, const std::vector< int > &linePointers, int fibersCount );
+
+    // Flags the fibers with a point in the VOI. Returns false if the VOI is
+    // not on the grid of the index, o_inBox is then left unchanged.
+    bool getFibersInside( const SelectionVOI *pVOI, BitSet &o_inBox ) const;
+
+    size_t getMemorySize() const;
+
+private:
+    int m_columns;
+    int m_rows;
+    int m_frames;
+    int m_fibersCount;
+
+    std::vector< unsigned int >     m_voxels;   // Reached voxels, increasing
+    std::vector< unsigned int >     m_offsets;  // Start of the list of each voxel in m_postings
+    std::vector< unsigned char >    m_postings; // Fiber deltas, 7 bits per byte
+};
+
+#endif // FIBERVOXELINDEX_H_
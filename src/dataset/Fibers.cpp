@@ -8,7 +8,12 @@
 
 #include "Anatomy.h"
 #include "DatasetManager.h"
+#include "FiberTiles.h"
+#include "FiberVoxelIndex.h"
+#include "FibersWriter.h"
+#include "QuickBundles.h"
 #include "RTTrackingHelper.h"
+#include "SegmentTree.h"
 
 #include "../main.h"
 #include "../Logger.h"
@@ -16,9 +21,12 @@
 #include "../gui/MainFrame.h"
 #include "../gui/SceneManager.h"
 #include "../gui/SelectionTree.h"
+#include "../misc/MappedFile.h"
+#include "../misc/ParallelFor.h"
 #include "../misc/Fantom/FMatrix.h"
 
 #include <wx/file.h>
+#include <wx/filefn.h>
 #include <wx/tglbtn.h>
 #include <wx/tokenzr.h>
 #include <wx/xml/xml.h>
@@ -26,6 +34,8 @@
 #include <algorithm>
 #include <cfloat>
 #include <cmath>
+#include <cstddef>
+#include <cstring>
 #include <fstream>
 using std::ofstream;
 
@@ -48,6 +58,16 @@ using std::vector;
 #define LINEAR_GRADIENT_THRESHOLD 0.085f
 #define MIN_ALPHA_VALUE 0.017f
 
+namespace
+{
+    // Compact buffers store the colors and normals as normalized signed bytes.
+    GLbyte toNormalizedByte( float value )
+    {
+        value = std::min( 1.0f, std::max( -1.0f, value ) );
+        return static_cast< GLbyte >( value < 0.0f ? value * 127.0f - 0.5f : value * 127.0f + 0.5f );
+    }
+}
+
 Fibers::Fibers()
 :   DatasetInfo(),
     m_isSpecialFiberDisplay( false ),
@@ -70,6 +90,19 @@ Fibers::Fibers()
     m_length(),
     m_maxLength( 0.0f ),
     m_minLength( 0.0f ),
+    m_scalarColumns(),
+    m_propertyColumns(),
+    m_scalarNames(),
+    m_propertyNames(),
+    m_selectedColumn( -1 ),
+    m_columnFiberValues(),
+    m_columnMin( 0.0f ),
+    m_columnMax( 0.0f ),
+    m_columnFilterMin( 0.0f ),
+    m_columnFilterMax( 0.0f ),
+    m_clusterIds(),
+    m_clusterSizes(),
+    m_clusterMinSize( 1 ),
     m_localizedAlpha(),
     m_cachedThreshold( 0.0f ),
     m_fibersInverted( false ),
@@ -78,6 +111,11 @@ Fibers::Fibers()
     m_isColorationUpdated( false ),
     m_fiberColorationMode( NORMAL_COLOR ),
     m_pOctree( NULL ),
+    m_pSegmentTree( NULL ),
+    m_pVoxelIndex( NULL ),
+    m_pTiles( NULL ),
+    m_isCompact( false ),
+    m_pLoadCancel( NULL ),
     m_cfDrawDirty( true ),
     m_axialShown(    SceneManager::getInstance()->isAxialDisplayed() ),
     m_coronalShown(  SceneManager::getInstance()->isCoronalDisplayed() ),
@@ -103,7 +141,13 @@ Fibers::Fibers()
     m_pRadMinDistanceAnchoring( NULL ),
     m_pRadCurvature( NULL ),
     m_pRadTorsion( NULL ),
-    m_pRadConstant( NULL )
+    m_pRadConstant( NULL ),
+    m_pRadColumn( NULL ),
+    m_pChoiceColumn( NULL ),
+    m_pSliderColumnFilterMin( NULL ),
+    m_pSliderColumnFilterMax( NULL ),
+    m_pRadClusters( NULL ),
+    m_pSliderClusterMinSize( NULL )
 {
     m_bufferObjects = new GLuint[3];
 }
@@ -125,6 +169,24 @@ Fibers::~Fibers()
         m_pOctree = NULL;
     }
 
+    if( m_pSegmentTree )
+    {
+        delete m_pSegmentTree;
+        m_pSegmentTree = NULL;
+    }
+
+    if( m_pVoxelIndex )
+    {
+        delete m_pVoxelIndex;
+        m_pVoxelIndex = NULL;
+    }
+
+    if( m_pTiles )
+    {
+        delete m_pTiles;
+        m_pTiles = NULL;
+    }
+
     m_lineArray.clear();
     m_linePointers.clear();
     m_reverse.clear();
@@ -133,8 +195,35 @@ Fibers::~Fibers()
     m_colorArray.clear();
 }
 
-bool Fibers::load( const wxString &filename )
+SegmentTree* Fibers::getSegmentTree() const
+{
+    // Built on the first box or ellipsoid query, the loaders only build the octree.
+    if( m_pSegmentTree == NULL && m_pTiles == NULL && m_countLines > 0 )
+    {
+        m_pSegmentTree = new SegmentTree( m_pointArray, m_linePointers, m_countLines );
+    }
+
+    return m_pSegmentTree;
+}
+
+FiberVoxelIndex* Fibers::getVoxelIndex() const
+{
+    if( m_pVoxelIndex == NULL && m_pTiles == NULL && m_countLines > 0 )
+    {
+        m_pVoxelIndex = new FiberVoxelIndex( m_pointArray, m_linePointers, m_countLines );
+    }
+
+    return m_pVoxelIndex;
+}
+
+bool Fibers::load( const wxString &filename, const volatile bool *pCancel )
 {
+    if( loadCache( filename ) )
+    {
+        return true;
+    }
+
+    m_pLoadCancel = pCancel;
     bool res( false );
 
     wxString extension = filename.AfterLast( '.' );
@@ -144,7 +233,7 @@ bool Fibers::load( const wxString &filename )
         {
             res = true;
         }
-        else
+        else if( !isLoadCancelled() )
         {
             res = loadDmri( filename );
         }
@@ -166,40 +255,388 @@ bool Fibers::load( const wxString &filename )
         res = loadMRtrix( filename );
     }
 
+    // The parse may have ended on the last fibers, the set is dropped anyway.
+    const bool isCancelled = isLoadCancelled();
+    m_pLoadCancel = NULL;
+
+    if( isCancelled )
+    {
+        Logger::getInstance()->print( wxString::Format( wxT( "Loading of \"%s\" cancelled" ), filename.c_str() ), LOGLEVEL_MESSAGE );
+        return false;
+    }
+
+    // Out-of-core fibers are classified by their tiles, and are not cached.
+    if( isOutOfCore() )
+    {
+        return res;
+    }
+
     /* OcTree points classification */
-    m_pOctree = new Octree( 2, m_pointArray, m_countPoints );
+    m_pOctree = new Octree( m_pointArray, m_countPoints );
+
+    if( res )
+    {
+        setFibersLength();
+        saveCache( filename );
+    }
     
     return res;
 }
 
+//////////////////////////////////////////////////////////////////////////
+// Fibers cache (.fnc)
+//
+// A sidecar file written next to the source tractogram the first time it
+// is loaded. It holds the navigator arrays exactly as they are in memory
+// (points, line pointers, lengths, colors, normals, scalar and property
+// columns) followed by the serialized octree, so a later load is a handful of bulk copies from a
+// mapped file instead of a full parse. The cache is keyed on the source
+// size and modification time and on the anatomy geometry, since the
+// loaders bring the fibers into the anatomy space.
+//////////////////////////////////////////////////////////////////////////
+namespace
+{
+    const char     FIBERS_CACHE_MAGIC[8] = { 'F', 'I', 'B', 'N', 'A', 'V', 'C', '\0' };
+    const wxUint32 FIBERS_CACHE_VERSION  = 4;
+
+    struct FibersCacheHeader
+    {
+        char     magic[8];
+        wxUint32 version;
+        wxUint32 headerSize;
+        wxUint64 sourceSize;
+        wxInt64  sourceModTime;
+        wxInt32  columns;
+        wxInt32  rows;
+        wxInt32  frames;
+        float    voxelX;
+        float    voxelY;
+        float    voxelZ;
+        float    niftiTransform[16];
+        // Everything above is the key, everything below describes the content.
+        wxInt32  countLines;
+        wxInt32  countPoints;
+        float    minLength;
+        float    maxLength;
+        wxUint64 octreeSize;
+        wxUint32 scalarCount;
+        wxUint32 propertyCount;
+        wxUint32 namesSize;     // Column names, in full, each ended by a '\0'. Padded to keep the columns aligned
+    };
+
+    // Column names of the cache, as written after the normals.
+    std::string getCacheNames( const vector< wxString > &names )
+    {
+        std::string result;
+
+        for( size_t i = 0; i < names.size(); ++i )
+        {
+            result += std::string( names[i].mb_str( wxConvUTF8 ) );
+            result += '\0';
+        }
+        result.resize( ( result.size() + 3 ) / 4 * 4, '\0' );
+        return result;
+    }
+
+    wxString getCacheFilename( const wxString &filename )
+    {
+        return filename + wxT( ".fnc" );
+    }
+
+    bool fillCacheKey( const wxString &filename, FibersCacheHeader &header )
+    {
+        memset( &header, 0, sizeof( FibersCacheHeader ) );
+
+        wxFile sourceFile;
+        if( !sourceFile.Open( filename ) )
+        {
+            return false;
+        }
+
+        wxFileOffset sourceSize = sourceFile.Length();
+        sourceFile.Close();
+
+        time_t modTime = wxFileModificationTime( filename );
+        if( wxInvalidOffset == sourceSize || modTime <= 0 )
+        {
+            return false;
+        }
+
+        DatasetManager *pDatasetManager = DatasetManager::getInstance();
+
+        memcpy( header.magic, FIBERS_CACHE_MAGIC, sizeof( header.magic ) );
+        header.version       = FIBERS_CACHE_VERSION;
+        header.headerSize    = sizeof( FibersCacheHeader );
+        header.sourceSize    = sourceSize;
+        header.sourceModTime = modTime;
+        header.columns       = pDatasetManager->getColumns();
+        header.rows          = pDatasetManager->getRows();
+        header.frames        = pDatasetManager->getFrames();
+        header.voxelX        = pDatasetManager->getVoxelX();
+        header.voxelY        = pDatasetManager->getVoxelY();
+        header.voxelZ        = pDatasetManager->getVoxelZ();
+
+        for( int i = 0; i < 4; ++i )
+        {
+            for( int j = 0; j < 4; ++j )
+            {
+                header.niftiTransform[i * 4 + j] = pDatasetManager->getNiftiTransform()( i, j );
+            }
+        }
+
+        return true;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Loads the fibers from the cache of filename, if there is an up to date one.
+//
+// Returns false if there is no usable cache, the fibers are then untouched.
+//////////////////////////////////////////////////////////////////////////
+bool Fibers::loadCache( const wxString &filename )
+{
+    wxString cacheFilename = getCacheFilename( filename );
+    FibersCacheHeader expected;
+    FibersCacheHeader header;
+    MappedFile cacheFile;
+
+    if( !wxFileExists( cacheFilename ) || !fillCacheKey( filename, expected ) || !cacheFile.open( cacheFilename ) || cacheFile.getSize() < sizeof( FibersCacheHeader ) )
+    {
+        return false;
+    }
+
+    memcpy( &header, cacheFile.getData(), sizeof( FibersCacheHeader ) );
+
+    if( 0 != memcmp( &header, &expected, offsetof( FibersCacheHeader, countLines ) ) )
+    {
+        Logger::getInstance()->print( wxT( "Fibers cache is out of date, it will be rebuilt." ), LOGLEVEL_MESSAGE );
+        return false;
+    }
+
+    const size_t countLines  = header.countLines;
+    const size_t countPoints = header.countPoints;
+    const size_t nbColumns   = header.scalarCount + header.propertyCount;
+    const size_t dataSize    = sizeof( float ) * countPoints * 3 * 3 + sizeof( int ) * ( countLines + 1 ) + sizeof( float ) * countLines
+                             + header.namesSize
+                             + sizeof( float ) * ( countPoints * header.scalarCount + countLines * header.propertyCount );
+
+    if( header.countLines <= 0 || header.countPoints <= 0 || 
+        cacheFile.getSize() != sizeof( FibersCacheHeader ) + dataSize + header.octreeSize )
+    {
+        Logger::getInstance()->print( wxT( "Fibers cache is corrupted, it will be rebuilt." ), LOGLEVEL_WARNING );
+        return false;
+    }
+
+    // Fibers this large are loaded out-of-core by the TRK loader, as they
+    // would be without a cache.
+    if( header.countPoints > FIBERS_OUT_OF_CORE_POINTS )
+    {
+        Logger::getInstance()->print( wxT( "Fibers cache is too large to be loaded in memory, it is ignored." ), LOGLEVEL_MESSAGE );
+        return false;
+    }
+
+    const char *pData = reinterpret_cast< const char * >( cacheFile.getData() ) + sizeof( FibersCacheHeader );
+
+    const float *pPoints = reinterpret_cast< const float * >( pData );
+    pData += sizeof( float ) * countPoints * 3;
+
+    // The line pointers index every other array, a truncated or corrupted
+    // cache must not give ranges outside of them.
+    const int *pLinePointers = reinterpret_cast< const int * >( pData );
+    bool validPointers = 0 == pLinePointers[0] && header.countPoints == pLinePointers[countLines];
+    for( size_t i = 0; validPointers && i < countLines; ++i )
+    {
+        validPointers = pLinePointers[i] <= pLinePointers[i + 1];
+    }
+
+    if( !validPointers )
+    {
+        Logger::getInstance()->print( wxT( "Fibers cache is corrupted, it will be rebuilt." ), LOGLEVEL_WARNING );
+        return false;
+    }
+
+    Logger::getInstance()->print( wxT( "Loading fibers from cache..." ), LOGLEVEL_MESSAGE );
+
+    m_pointArray.assign( pPoints, pPoints + countPoints * 3 );
+    m_linePointers.assign( pLinePointers, pLinePointers + countLines + 1 );
+    pData += sizeof( int ) * ( countLines + 1 );
+
+    const float *pLengths = reinterpret_cast< const float * >( pData );
+    m_length.assign( pLengths, pLengths + countLines );
+    pData += sizeof( float ) * countLines;
+
+    const float *pColors = reinterpret_cast< const float * >( pData );
+    m_colorArray.assign( pColors, pColors + countPoints * 3 );
+    pData += sizeof( float ) * countPoints * 3;
+
+    const float *pNormals = reinterpret_cast< const float * >( pData );
+    m_normalArray.assign( pNormals, pNormals + countPoints * 3 );
+    pData += sizeof( float ) * countPoints * 3;
+
+    m_scalarNames.clear();
+    m_propertyNames.clear();
+
+    const char *pNamesEnd = pData + header.namesSize;
+    for( size_t i = 0; i < nbColumns; ++i )
+    {
+        const char *pNameEnd = std::find( pData, pNamesEnd, '\0' );
+        wxString name( std::string( pData, pNameEnd ).c_str(), wxConvUTF8 );
+        ( i < header.scalarCount ? m_scalarNames : m_propertyNames ).push_back( name );
+        pData = std::min( pNameEnd + 1, pNamesEnd );
+    }
+    pData = pNamesEnd;
+
+    m_scalarColumns.resize( header.scalarCount );
+    for( size_t i = 0; i < header.scalarCount; ++i )
+    {
+        const float *pColumn = reinterpret_cast< const float * >( pData );
+        m_scalarColumns[i].assign( pColumn, pColumn + countPoints );
+        pData += sizeof( float ) * countPoints;
+    }
+
+    m_propertyColumns.resize( header.propertyCount );
+    for( size_t i = 0; i < header.propertyCount; ++i )
+    {
+        const float *pColumn = reinterpret_cast< const float * >( pData );
+        m_propertyColumns[i].assign( pColumn, pColumn + countLines );
+        pData += sizeof( float ) * countLines;
+    }
+
+    m_countLines  = header.countLines;
+    m_countPoints = header.countPoints;
+    m_minLength   = header.minLength;
+    m_maxLength   = header.maxLength;
+
+    m_reverse.resize( m_countPoints );
+    m_selected.assign( m_countLines, false );
+    m_filtered.assign( m_countLines, false );
+
+    for( int i = 0; i < m_countLines; ++i )
+    {
+        std::fill( m_reverse.begin() + m_linePointers[i], m_reverse.begin() + m_linePointers[i + 1], i );
+    }
+
+    m_pOctree = new Octree( m_pointArray, m_countPoints, pData, header.octreeSize );
+
+    m_type = FIBERS;
+    m_fullPath = filename;
+
+#ifdef __WXMSW__
+    m_name = wxT( "-" ) + filename.AfterLast( '\\' );
+#else
+    m_name = wxT( "-" ) + filename.AfterLast( '/' );
+#endif
+
+    Logger::getInstance()->print( wxT( "Fibers loaded from cache" ), LOGLEVEL_MESSAGE );
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Writes the cache of filename. Failing to write it is not an error, the
+// next load will simply parse the source file again.
+//////////////////////////////////////////////////////////////////////////
+void Fibers::saveCache( const wxString &filename )
+{
+    FibersCacheHeader header;
+
+    // Fibers too large for memory would not be loaded from the cache anyway.
+    if( NULL == m_pOctree || m_countLines <= 0 || m_countPoints <= 0 || m_countPoints > FIBERS_OUT_OF_CORE_POINTS ||
+        m_pointArray.size()  != static_cast< size_t >( m_countPoints * 3 ) ||
+        m_colorArray.size()  != static_cast< size_t >( m_countPoints * 3 ) ||
+        m_normalArray.size() != static_cast< size_t >( m_countPoints * 3 ) ||
+        m_linePointers.size() != static_cast< size_t >( m_countLines + 1 ) ||
+        m_length.size()       != static_cast< size_t >( m_countLines ) ||
+        !fillCacheKey( filename, header ) )
+    {
+        return;
+    }
+
+    header.countLines  = m_countLines;
+    header.countPoints = m_countPoints;
+    header.minLength   = m_minLength;
+    header.maxLength   = m_maxLength;
+    header.octreeSize  = m_pOctree->getSerializedSize();
+    header.scalarCount   = m_scalarColumns.size();
+    header.propertyCount = m_propertyColumns.size();
+
+    vector< wxString > columnNames;
+    for( size_t i = 0; i < getColumnCount(); ++i )
+    {
+        columnNames.push_back( getColumnName( i ) );
+    }
+    const std::string names = getCacheNames( columnNames );
+    header.namesSize = names.size();
+
+    // Write to a temporary file first so that an interrupted write never
+    // leaves a truncated cache behind.
+    wxString cacheFilename = getCacheFilename( filename );
+    wxString tmpFilename   = cacheFilename + wxT( ".tmp" );
+
+    ofstream cacheFile( std::string( tmpFilename.mb_str() ).c_str(), std::ios::out | std::ios::binary );
+    if( !cacheFile.is_open() )
+    {
+        Logger::getInstance()->print( wxT( "Cannot write fibers cache " ) + cacheFilename, LOGLEVEL_DEBUG );
+        return;
+    }
+
+    cacheFile.write( reinterpret_cast< const char * >( &header ),            sizeof( FibersCacheHeader ) );
+    cacheFile.write( reinterpret_cast< const char * >( &m_pointArray[0] ),   sizeof( float ) * m_pointArray.size() );
+    cacheFile.write( reinterpret_cast< const char * >( &m_linePointers[0] ), sizeof( int )   * m_linePointers.size() );
+    cacheFile.write( reinterpret_cast< const char * >( &m_length[0] ),       sizeof( float ) * m_length.size() );
+    cacheFile.write( reinterpret_cast< const char * >( &m_colorArray[0] ),   sizeof( float ) * m_colorArray.size() );
+    cacheFile.write( reinterpret_cast< const char * >( &m_normalArray[0] ),  sizeof( float ) * m_normalArray.size() );
+
+    cacheFile.write( names.data(), names.size() );
+
+    for( size_t i = 0; i < m_scalarColumns.size(); ++i )
+    {
+        cacheFile.write( reinterpret_cast< const char * >( &m_scalarColumns[i][0] ), sizeof( float ) * m_countPoints );
+    }
+
+    for( size_t i = 0; i < m_propertyColumns.size(); ++i )
+    {
+        cacheFile.write( reinterpret_cast< const char * >( &m_propertyColumns[i][0] ), sizeof( float ) * m_countLines );
+    }
+
+    m_pOctree->serialize( cacheFile );
+
+    bool success = cacheFile.good();
+    cacheFile.close();
+
+    if( !success || !wxRenameFile( tmpFilename, cacheFilename, true ) )
+    {
+        Logger::getInstance()->print( wxT( "Cannot write fibers cache " ) + cacheFilename, LOGLEVEL_DEBUG );
+        wxRemoveFile( tmpFilename );
+        return;
+    }
+
+    Logger::getInstance()->print( wxT( "Fibers cache written to " ) + cacheFilename, LOGLEVEL_MESSAGE );
+}
+
+
 bool Fibers::loadTRK( const wxString &filename )
 {
     stringstream ss;
     Logger::getInstance()->print( wxT( "Loading TRK file..." ), LOGLEVEL_MESSAGE );
-    wxFile dataFile;
-    wxFileOffset nSize( 0 );
+    MappedFile dataFile;
     converterByteINT16 cbi;
     converterByteINT32 cbi32;
     converterByteFloat cbf;
 
-    if( !dataFile.Open( filename ) )
+    // The file is mapped rather than read, so the header and the tracks are
+    // parsed straight from the page cache without any intermediate copy.
+    if( !dataFile.open( filename ) || dataFile.getSize() < 1000 )
     {
         return false;
     }
 
-    nSize = dataFile.Length();
-
-    if( nSize == wxInvalidOffset )
-    {
-        return false;
-    }
+    const size_t nSize = dataFile.getSize();
 
     ////
     // READ HEADER
     ////
-    //Read file header. [1000 bytes]
-    wxUint8 *pBuffer = new wxUint8[1000];
-    dataFile.Read( pBuffer, ( size_t )1000 );
+    //File header, parsed in place. [1000 bytes]
+    const wxUint8 *pBuffer = dataFile.getData();
     
     //ID String for track file. The first 5 characters must match "TRACK". [6 bytes]
     char idString[6];
@@ -406,179 +843,281 @@ bool Fibers::loadTRK( const wxString &filename )
     ss << "HDR size: " << hdrSize;
     Logger::getInstance()->print( wxString( ss.str().c_str(), wxConvUTF8 ), LOGLEVEL_MESSAGE );
 
+    if( hdrSize < 1000 || hdrSize > nSize )
+    {
+        Logger::getInstance()->print( wxT( "Invalid TRK header size (byte swapped files are not supported)." ), LOGLEVEL_ERROR );
+        return false;
+    }
+
+    float columns = DatasetManager::getInstance()->getColumns();
+    float rows    = DatasetManager::getInstance()->getRows();
+    float frames  = DatasetManager::getInstance()->getFrames();
+    float voxelX  = DatasetManager::getInstance()->getVoxelX();
+    float voxelY  = DatasetManager::getInstance()->getVoxelY();
+    float voxelZ  = DatasetManager::getInstance()->getVoxelZ();
+
+    if( voxelSize[0] == 0 && voxelSize[1] == 0 && voxelSize[2] == 0 )
+    {
+        ss.str( "" );
+        ss << "Using anatomy's voxel size: [" << voxelX << ", " << voxelY << ", " << voxelZ << "]";
+        Logger::getInstance()->print( wxString( ss.str().c_str(), wxConvUTF8 ), LOGLEVEL_MESSAGE );
+        voxelSize[0] = voxelX;
+        voxelSize[1] = voxelY;
+        voxelSize[2] = voxelZ;
+        ss.str( "" );
+        ss << "Centering with respect to the anatomy: [" << columns / 2 << "," << rows / 2 << "," << frames / 2 << "]";
+        Logger::getInstance()->print( wxString( ss.str().c_str(), wxConvUTF8 ), LOGLEVEL_MESSAGE );
+        origin[0] = columns / 2;
+        origin[1] = rows / 2;
+        origin[2] = frames / 2;
+    }
+
+    float flipX = ( invertX ) ? -1. : 1.;
+    float flipY = ( invertY ) ? -1. : 1.;
+    float flipZ = ( invertZ ) ? -1. : 1.;
+    float anatomy[3];
+    anatomy[0] = ( flipX - 1. ) * columns * voxelX / -2.;
+    anatomy[1] = ( flipY - 1. ) * rows    * voxelY / -2.;
+    anatomy[2] = ( flipZ - 1. ) * frames  * voxelZ / -2.;
+
+    float scale[3];
+    scale[0] = flipX * voxelX / voxelSize[0];
+    scale[1] = flipY * voxelY / voxelSize[1];
+    scale[2] = flipZ * voxelZ / voxelSize[2];
+
     ////
-    // READ DATA
+    // FIRST PASS: walk the track lengths only, to size the arrays once.
     ////
-    delete[] pBuffer;
-    pBuffer = NULL;
-    vector<float> tmpPoints;
+    const size_t ptsSize = 3 + nbScalars;
+    const wxUint8 *pData = dataFile.getData();
+    size_t offset( hdrSize );
 
-    //File size - header size (used when the number of fiber was not stored)
-    int remainingBytes = nSize - hdrSize;
-
-    vector< vector< float > > lines;
+    m_linePointers.clear();
+    if( nbCount < nSize / 4 )
+    {
+        m_linePointers.reserve( nbCount + 1 );
+    }
+    m_linePointers.push_back( 0 );
     m_countPoints = 0;
-    vector< float > colors;
 
-    //if( nbCount == 0 )
-    //{
-    //   return false; //TODO: handle it. (0 means the number was NOT stored.)
-    //}
-
-    for( unsigned int i = 0; i < nbCount || remainingBytes > 0; ++i )
-    //for( unsigned int i = 0; i != nbCount ; ++i )
+    while( offset + 4 <= nSize )
     {
         //Number of points in this track. [4 bytes]
-        wxUint32 nbPoints;
-        dataFile.Read( cbi32.b, ( size_t )4 );
-        nbPoints = cbi32.i;
-        
-        //Read data of one track.
-        size_t ptsSize = 3 + nbScalars;
-        size_t tractSize = 4 * ( nbPoints * ( ptsSize ) + nbProperties );
-        pBuffer = new wxUint8[tractSize];
-        dataFile.Read( pBuffer, tractSize );
-        vector< float > curLine;
+        memcpy( cbi32.b, &pData[offset], 4 );
+        wxUint32 nbPoints = cbi32.i;
+        size_t tractSize = 4 * ( nbPoints * ptsSize + nbProperties );
 
-        for( unsigned int j = 0; j != nbPoints; ++j )
+        if( offset + 4 + tractSize > nSize )
         {
-            //Read coordinates (x,y,z) and scalars associated to each point.
-            for( unsigned int k = 0; k != ptsSize; ++k )
-            {
-                memcpy( cbf.b, &pBuffer[4 * ( j * ptsSize + k )], 4 );
-
-                if( k >= 6 ) //TODO: incorporate other scalars in the navigator.
-                {
-                    break;
-                }
-                else if( k >= 3 ) //RGB color of each point.
-                {
-                    colors.push_back( cbf.f );
-                }
-                else
-                {
-                    curLine.push_back( cbf.f );
-                }
-            }
+            Logger::getInstance()->print( wxT( "TRK file is truncated, ignoring the last track." ), LOGLEVEL_WARNING );
+            break;
         }
 
-        //TODO: incorporate properties in the navigator.
-//         for( unsigned int j = 0; j != nbProperties; ++j ) 
-//         {}
-
-        m_countPoints += curLine.size() / 3;
-        lines.push_back( curLine );
-        delete[] pBuffer;
-        pBuffer = NULL;
-
-       //Adjust remainingBytes
-       remainingBytes -= 1*4; //Number of points (4 bytes)
-       remainingBytes -= 3*nbPoints * 4; //Coordinates (4 bytes)
-       remainingBytes -= nbScalars*nbPoints * 4; //Scalars (4 bytes)
-       remainingBytes -= nbProperties * 4; //Properties (4 bytes)
-       //cout <<  "i : " << i << ", remainingBytes : " << remainingBytes << "\n";
+        m_countPoints += nbPoints;
+        m_linePointers.push_back( m_countPoints );
+        offset += 4 + tractSize;
     }
 
-    dataFile.Close();
-    
-    ////
-    //POST PROCESS: set all the data in the right format for the navigator
-    ////
-    Logger::getInstance()->print( wxT( "Setting data in right format for the navigator..." ), LOGLEVEL_MESSAGE );
-    m_countLines = lines.size();
-    m_pointArray.max_size();
-    m_colorArray.max_size();
-    m_linePointers.resize( m_countLines + 1 );
-    m_pointArray.resize( m_countPoints * 3 );
-    m_colorArray.resize( m_countPoints * 3 );
-    m_linePointers[m_countLines] = m_countPoints;
-    m_reverse.resize( m_countPoints );
-    m_selected.resize( m_countLines, false );
-    m_filtered.resize( m_countLines, false );
+    m_countLines = m_linePointers.size() - 1;
+
     ss.str( "" );
     ss << "m_countLines: " << m_countLines;
     Logger::getInstance()->print( wxString( ss.str().c_str(), wxConvUTF8 ), LOGLEVEL_MESSAGE );
     ss.str( "" );
     ss << "m_countPoints: " << m_countPoints;
     Logger::getInstance()->print( wxString( ss.str().c_str(), wxConvUTF8 ), LOGLEVEL_MESSAGE );
-    m_linePointers[0] = 0;
 
-    for( int i = 0; i < m_countLines; ++i )
-    {
-        m_linePointers[i + 1] = m_linePointers[i] + lines[i].size() / 3;
+    ////
+    // SECOND PASS: fill the navigator arrays straight from the mapped pages.
+    ////
+    // The first 3 scalars, when present, hold the RGB color of each point.
+    const bool hasColors = nbScalars >= 3;
+
+    if( m_countPoints > FIBERS_OUT_OF_CORE_POINTS )
+    {
+        return loadTRKOutOfCore( filename, dataFile, hdrSize, ptsSize, nbProperties, scale, origin, anatomy );
     }
 
-    int lineCounter = 0;
+    m_pointArray.resize( m_countPoints * 3 );
+    m_colorArray.resize( hasColors ? m_countPoints * 3 : 0 );
+    m_reverse.resize( m_countPoints );
+    m_selected.resize( m_countLines, false );
+    m_filtered.resize( m_countLines, false );
 
-    for( int i = 0; i < m_countPoints; ++i )
+    // Every scalar and property is kept as a column, the RGB scalars included.
+    m_scalarColumns.assign( nbScalars, vector< float >( m_countPoints ) );
+    m_propertyColumns.assign( nbProperties, vector< float >( m_countLines ) );
+    m_scalarNames.clear();
+    m_propertyNames.clear();
+
+    for( int i = 0; i < nbScalars; ++i )
     {
-        if( i == m_linePointers[lineCounter + 1] )
-        {
-            ++lineCounter;
-        }
+        m_scalarNames.push_back( i < 10 ? wxString( std::string( scalarNames[i], std::find( scalarNames[i], scalarNames[i] + 20, '\0' ) ).c_str(), wxConvUTF8 ) : wxString() );
+    }
 
-        m_reverse[i] = lineCounter;
+    for( int i = 0; i < nbProperties; ++i )
+    {
+        m_propertyNames.push_back( i < 10 ? wxString( std::string( propertyNames[i], std::find( propertyNames[i], propertyNames[i] + 20, '\0' ) ).c_str(), wxConvUTF8 ) : wxString() );
     }
 
-    unsigned int pos( 0 );
-    vector< vector< float > >::iterator it;
+    offset = hdrSize;
+    size_t pos( 0 );
 
-    for( it = lines.begin(); it < lines.end(); it++ )
+    for( int i = 0; i < m_countLines; ++i )
     {
-        vector< float >::iterator it2;
+        if( isLoadCancelled() )
+        {
+            return false;
+        }
 
-        for( it2 = ( *it ).begin(); it2 < ( *it ).end(); it2++ )
-        {   
-            if (colors.size() > 0)
+        const wxUint8 *pTrack = &pData[offset + 4];
+        int nbPoints = m_linePointers[i + 1] - m_linePointers[i];
+
+        for( int j = 0; j < nbPoints; ++j )
+        {
+            const wxUint8 *pPoint = &pTrack[4 * j * ptsSize];
+
+            for( int k = 0; k < 3; ++k )
+            {
+                memcpy( cbf.b, &pPoint[4 * k], 4 );
+                m_pointArray[pos + k] = scale[k] * ( cbf.f - origin[k] ) + anatomy[k];
+
+                if( hasColors )
+                {
+                    memcpy( cbf.b, &pPoint[4 * ( 3 + k )], 4 );
+                    m_colorArray[pos + k] = cbf.f / 255.;
+                }
+            }
+
+            for( int k = 0; k < nbScalars; ++k )
             {
-                m_colorArray[pos] = colors[pos] / 255.;
+                memcpy( cbf.b, &pPoint[4 * ( 3 + k )], 4 );
+                m_scalarColumns[k][m_linePointers[i] + j] = cbf.f;
             }
-            m_pointArray[pos++] = *it2;
+
+            m_reverse[m_linePointers[i] + j] = i;
+            pos += 3;
+        }
+
+        const wxUint8 *pProperties = &pTrack[4 * nbPoints * ptsSize];
+
+        for( int k = 0; k < nbProperties; ++k )
+        {
+            memcpy( cbf.b, &pProperties[4 * k], 4 );
+            m_propertyColumns[k][i] = cbf.f;
         }
+
+        offset += 4 + 4 * ( nbPoints * ptsSize + nbProperties );
     }
 
-    float columns = DatasetManager::getInstance()->getColumns();
-    float rows    = DatasetManager::getInstance()->getRows();
-    float frames  = DatasetManager::getInstance()->getFrames();
-    float voxelX  = DatasetManager::getInstance()->getVoxelX();
-    float voxelY  = DatasetManager::getInstance()->getVoxelY();
-    float voxelZ  = DatasetManager::getInstance()->getVoxelZ();
+    dataFile.close();
 
-    if( voxelSize[0] == 0 && voxelSize[1] == 0 && voxelSize[2] == 0 )
+    Logger::getInstance()->print( wxT( "TRK file loaded" ), LOGLEVEL_MESSAGE );
+    createColorArray( hasColors );
+    m_type = FIBERS;
+    m_fullPath = filename;
+
+#ifdef __WXMSW__
+    m_name = wxT( "-" ) + filename.AfterLast( '\\' );
+#else
+    m_name = wxT( "-" ) + filename.AfterLast( '/' );
+#endif
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Second pass of loadTRK for fiber sets too large to be held in memory.
+// The transformed fibers are streamed into spatial tiles backed by a
+// temporary file, only the per fiber arrays (line pointers, lengths,
+// selection and filter states) stay in memory.
+//////////////////////////////////////////////////////////////////////////
+bool Fibers::loadTRKOutOfCore( const wxString &filename, const MappedFile &dataFile, size_t hdrSize, size_t ptsSize,
+                               int nbProperties, const float scale[3], const float origin[3], const float anatomy[3] )
+{
+    Logger::getInstance()->print( wxT( "Too many points to hold in memory, loading the fibers out-of-core." ), LOGLEVEL_MESSAGE );
+
+    DatasetManager *pDatasetManager = DatasetManager::getInstance();
+    float voxelX = pDatasetManager->getVoxelX();
+    float voxelY = pDatasetManager->getVoxelY();
+    float voxelZ = pDatasetManager->getVoxelZ();
+
+    m_pTiles = new FiberTiles( pDatasetManager->getColumns() * voxelX,
+                               pDatasetManager->getRows()    * voxelY,
+                               pDatasetManager->getFrames()  * voxelZ,
+                               m_countLines, FIBERS_RESIDENT_POINTS );
+
+    if( !m_pTiles->create() )
     {
-        ss.str( "" );
-        ss << "Using anatomy's voxel size: [" << voxelX << ", " << voxelY << ", " << voxelZ << "]";
-        Logger::getInstance()->print( wxString( ss.str().c_str(), wxConvUTF8 ), LOGLEVEL_MESSAGE );
-        voxelSize[0] = voxelX;
-        voxelSize[1] = voxelY;
-        voxelSize[2] = voxelZ;
-        ss.str( "" );
-        ss << "Centering with respect to the anatomy: [" << columns / 2 << "," << rows / 2 << "," << frames / 2 << "]";
-        Logger::getInstance()->print( wxString( ss.str().c_str(), wxConvUTF8 ), LOGLEVEL_MESSAGE );
-        origin[0] = columns / 2;
-        origin[1] = rows / 2;
-        origin[2] = frames / 2;
+        delete m_pTiles;
+        m_pTiles = NULL;
+        return false;
     }
 
-    float flipX = ( invertX ) ? -1. : 1.;
-    float flipY = ( invertY ) ? -1. : 1.;
-    float flipZ = ( invertZ ) ? -1. : 1.;
-    float anatomy[3];
-    anatomy[0] = ( flipX - 1. ) * columns * voxelX / -2.;
-    anatomy[1] = ( flipY - 1. ) * rows    * voxelY / -2.;
-    anatomy[2] = ( flipZ - 1. ) * frames  * voxelZ / -2.;
+    converterByteFloat cbf;
+    const wxUint8 *pData = dataFile.getData();
+    size_t offset( hdrSize );
+    vector< float > fiberPoints;
 
-    for( int i = 0; i < m_countPoints * 3; ++i )
+    m_length.resize( m_countLines );
+    m_selected.resize( m_countLines, false );
+    m_filtered.resize( m_countLines, false );
+    m_maxLength = 0;
+    m_minLength = 1000000;
+
+    for( int i = 0; i < m_countLines; ++i )
     {
-        m_pointArray[i] = flipX * ( m_pointArray[i] - origin[0] ) * voxelX / voxelSize[0] + anatomy[0];
-        ++i;
-        m_pointArray[i] = flipY * ( m_pointArray[i] - origin[1] ) * voxelY / voxelSize[1] + anatomy[1];
-        ++i;
-        m_pointArray[i] = flipZ * ( m_pointArray[i] - origin[2] ) * voxelZ / voxelSize[2] + anatomy[2];
+        if( isLoadCancelled() )
+        {
+            delete m_pTiles;
+            m_pTiles = NULL;
+            return false;
+        }
+
+        const wxUint8 *pTrack = &pData[offset + 4];
+        int nbPoints = m_linePointers[i + 1] - m_linePointers[i];
+
+        fiberPoints.resize( nbPoints * 3 );
+        m_length[i] = 0;
+
+        for( int j = 0; j < nbPoints; ++j )
+        {
+            const wxUint8 *pPoint = &pTrack[4 * j * ptsSize];
+
+            for( int k = 0; k < 3; ++k )
+            {
+                memcpy( cbf.b, &pPoint[4 * k], 4 );
+                fiberPoints[j * 3 + k] = scale[k] * ( cbf.f - origin[k] ) + anatomy[k];
+            }
+
+            if( j > 0 )
+            {
+                float dx = ( fiberPoints[j * 3]     - fiberPoints[j * 3 - 3] ) * voxelX;
+                float dy = ( fiberPoints[j * 3 + 1] - fiberPoints[j * 3 - 2] ) * voxelY;
+                float dz = ( fiberPoints[j * 3 + 2] - fiberPoints[j * 3 - 1] ) * voxelZ;
+                m_length[i] += std::sqrt( dx * dx + dy * dy + dz * dz );
+            }
+        }
+
+        m_maxLength = std::max( m_maxLength, m_length[i] );
+        m_minLength = std::min( m_minLength, m_length[i] );
+
+        if( nbPoints > 0 )
+        {
+            m_pTiles->addFiber( i, &fiberPoints[0], nbPoints );
+        }
+
+        offset += 4 + 4 * ( nbPoints * ptsSize + nbProperties );
+    }
+
+    if( !m_pTiles->finish() )
+    {
+        Logger::getInstance()->print( wxT( "Cannot write the fiber tiles." ), LOGLEVEL_ERROR );
+        delete m_pTiles;
+        m_pTiles = NULL;
+        return false;
     }
 
     Logger::getInstance()->print( wxT( "TRK file loaded" ), LOGLEVEL_MESSAGE );
-    createColorArray( colors.size() > 0 );
     m_type = FIBERS;
     m_fullPath = filename;
 
@@ -618,6 +1157,12 @@ bool Fibers::loadCamino( const wxString &filename )
 
     while( pc < nSize )
     {
+        if( isLoadCancelled() )
+        {
+            delete[] pBuffer;
+            return false;
+        }
+
         ++m_countLines;
         cbf.b[3] = pBuffer[pc++];
         cbf.b[2] = pBuffer[pc++];
@@ -705,190 +1250,192 @@ bool Fibers::loadCamino( const wxString &filename )
 bool Fibers::loadMRtrix( const wxString &filename )
 {
     Logger::getInstance()->print( wxT( "Loading MRtrix file" ), LOGLEVEL_MESSAGE );
-    wxFile dataFile;
-    long int nSize = 0;
-    long int pc = 0, nodes = 0;
-    converterByteFloat cbf;
-    float x, y, z, x2, y2, z2;
-    std::vector< float > tmpPoints;
-    vector< vector< float > > lines;
+    MappedFile dataFile;
+
+    if( !dataFile.open( filename ) )
+    {
+        return false;
+    }
+
+    const char  *pData = reinterpret_cast< const char * >( dataFile.getData() );
+    const size_t size  = dataFile.getSize();
 
-    //Open file
-    FILE *pFs = fopen( filename.ToAscii(), "r" ) ;
     ////
     // read header
     ////
-    char lineBuffer[200];
-    std::string readLine("");
-    bool countFieldFound( false );
+    long int dataOffset( 0 );
+    long int countField( 0 );
+    bool     isBigEndian( false );
+    size_t   pos( 0 );
 
-    while(readLine.find( "END" ) == std::string::npos)
+    while( pos < size )
     {
-        fgets( lineBuffer, 200, pFs );
+        size_t start = pos;
+        while( pos < size && pData[pos] != '\n' )
+        {
+            ++pos;
+        }
 
-        readLine = std::string( lineBuffer );
+        std::string readLine( &pData[start], pos - start );
+        ++pos;
 
-        if( readLine.find( "file" ) != std::string::npos )
+        if( readLine.find( "END" ) == 0 )
         {
-            sscanf( lineBuffer, "file: . %ld", &pc );
+            break;
         }
 
-        if( readLine.find( "count" ) != std::string::npos && !countFieldFound )
+        if( readLine.find( "file:" ) == 0 )
         {
-            sscanf( lineBuffer, "count: %i", &m_countLines );
-            countFieldFound = true;
+            sscanf( readLine.c_str(), "file: . %ld", &dataOffset );
         }
-    }
-
-    fclose( pFs );
-
-    if( dataFile.Open( filename ) )
-    {
-        nSize = dataFile.Length();
-
-        if( nSize < 1 )
+        else if( readLine.find( "count:" ) == 0 )
         {
-            return false;
+            sscanf( readLine.c_str(), "count: %ld", &countField );
+        }
+        else if( readLine.find( "datatype:" ) == 0 )
+        {
+            isBigEndian = readLine.find( "Float32BE" ) != std::string::npos;
         }
     }
 
-    nSize -= pc;
-    dataFile.Seek( pc );
-    wxUint8 *pBuffer = new wxUint8[nSize];
-    dataFile.Read( pBuffer, nSize );
-    dataFile.Close();
+    if( dataOffset <= 0 || static_cast< size_t >( dataOffset ) > size )
+    {
+        return false;
+    }
     
+    // The MrTrix fibers are defined in the same geometric reference
+    // as the anatomical file. That is, the fibers coordinates are related to 
+    // the anatomy in world space. The transformation from local to world space
+    // for the anatomy is encoded in the m_dh->m_niftiTransform member.
+    // Since we do not consider this tranform when loading the anatomy, we must 
+    // bring back the fibers in the same reference, using the inverse of the 
+    // local to world transformation. A further problem arises when loading an
+    // anatomy that has voxels with dimensions differing from 1x1x1. The 
+    // scaling factor is encoded in the transformation matrix, but we do not,
+    // for the moment, use this scaling. Therefore, we must remove it from the
+    // the transformation matrix before computing its inverse.
+    FMatrix invertedTransform( 4, 4 );
+    invertedTransform = invert( getLocalToWorld() );
+
+    ////
+    // Stream the tracks straight into the navigator arrays. Each track is
+    // a list of (x,y,z) float triplets ended by a NaN triplet, the file is
+    // ended by an Inf triplet.
+    ////
     Logger::getInstance()->print( wxT( "Reading fibers" ), LOGLEVEL_DEBUG );
-    pc = 0;
-    m_countPoints = 0; // number of points
+    const size_t maxPoints = ( size - dataOffset ) / 12;
 
-    for( int i = 0; i < m_countLines; i++ )
+    m_pointArray.clear();
+    m_linePointers.clear();
+    m_pointArray.reserve( maxPoints * 3 );
+    m_linePointers.reserve( std::min( static_cast< size_t >( std::max( countField, 0L ) ), maxPoints ) + 1 );
+    m_linePointers.push_back( 0 );
+    m_countPoints = 0;
+
+    float x( 0.0f ), y( 0.0f ), z( 0.0f );
+    bool  isNewTrack( true );
+
+    for( pos = dataOffset; pos + 12 <= size; pos += 12 )
     {
-        tmpPoints.clear();
-        nodes = 0;
-        // read one tract
-        cbf.b[0] = pBuffer[pc++];
-        cbf.b[1] = pBuffer[pc++];
-        cbf.b[2] = pBuffer[pc++];
-        cbf.b[3] = pBuffer[pc++];
-        x = cbf.f;
-        cbf.b[0] = pBuffer[pc++];
-        cbf.b[1] = pBuffer[pc++];
-        cbf.b[2] = pBuffer[pc++];
-        cbf.b[3] = pBuffer[pc++];
-        y = cbf.f;
-        cbf.b[0] = pBuffer[pc++];
-        cbf.b[1] = pBuffer[pc++];
-        cbf.b[2] = pBuffer[pc++];
-        cbf.b[3] = pBuffer[pc++];
-        z = cbf.f;
-        //add first point
-        tmpPoints.push_back( x );
-        tmpPoints.push_back( y );
-        tmpPoints.push_back( z );
-        ++nodes;
-        x2 = x;
-        cbf.f = x2;
-
-        //Read points (x,y,z) until x2 equals NaN (0x0000C07F), meaning end of the tract.
-        while( !( cbf.b[0] == 0x00 && cbf.b[1] == 0x00 && cbf.b[2] == 0xC0 && cbf.b[3] == 0x7F ) )
-        {
-            cbf.b[0] = pBuffer[pc++];   // get next float
-            cbf.b[1] = pBuffer[pc++];
-            cbf.b[2] = pBuffer[pc++];
-            cbf.b[3] = pBuffer[pc++];
-            x2 = cbf.f;
-            cbf.b[0] = pBuffer[pc++];
-            cbf.b[1] = pBuffer[pc++];
-            cbf.b[2] = pBuffer[pc++];
-            cbf.b[3] = pBuffer[pc++];
-            y2 = cbf.f;
-            cbf.b[0] = pBuffer[pc++];
-            cbf.b[1] = pBuffer[pc++];
-            cbf.b[2] = pBuffer[pc++];
-            cbf.b[3] = pBuffer[pc++];
-            z2 = cbf.f;
+        wxUint32 words[3];
+        memcpy( words, &pData[pos], 12 );
 
-            // downsample fibers: take only points in distance of min 0.75 mm
-            if( ( ( x - x2 ) * ( x - x2 ) + ( y - y2 ) * ( y - y2 ) + ( z - z2 ) * ( z - z2 ) ) >= 0.2 )
+        float point[3];
+        for( int k = 0; k < 3; ++k )
+        {
+            words[k] = isBigEndian ? wxUINT32_SWAP_ON_LE( words[k] ) : wxUINT32_SWAP_ON_BE( words[k] );
+            memcpy( &point[k], &words[k], 4 );
+        }
+
+        // NaN, end of the track.
+        if( point[0] != point[0] )
+        {
+            if( isLoadCancelled() )
             {
-                x = x2;
-                y = y2;
-                z = z2;
-                tmpPoints.push_back( x );
-                tmpPoints.push_back( y );
-                tmpPoints.push_back( z );
-                ++nodes;
+                return false;
             }
 
-            cbf.f = x2;
+            if( !isNewTrack )
+            {
+                m_linePointers.push_back( m_countPoints );
+            }
+
+            isNewTrack = true;
+            continue;
         }
 
-        // put the tract in the line array
-        lines.push_back( tmpPoints );
+        // Inf, end of the file.
+        if( point[0] > FLT_MAX || point[0] < -FLT_MAX )
+        {
+            break;
+        }
 
-        for( int i = 0; i < nodes ; i++ )
+        // downsample fibers: take only points in distance of min 0.75 mm
+        if( !isNewTrack && ( ( x - point[0] ) * ( x - point[0] ) + ( y - point[1] ) * ( y - point[1] ) + ( z - point[2] ) * ( z - point[2] ) ) < 0.2 )
         {
-            m_countPoints++;
+            continue;
         }
+
+        x = point[0];
+        y = point[1];
+        z = point[2];
+        isNewTrack = false;
+
+        for( int i = 0; i < 3; ++i )
+        {
+            m_pointArray.push_back( invertedTransform( i, 0 ) * x + invertedTransform( i, 1 ) * y
+                                  + invertedTransform( i, 2 ) * z + invertedTransform( i, 3 ) );
+        }
+
+        ++m_countPoints;
+    }
+
+    // A last track without its NaN delimiter.
+    if( !isNewTrack )
+    {
+        m_linePointers.push_back( m_countPoints );
+    }
+
+    dataFile.close();
+
+    m_countLines = m_linePointers.size() - 1;
+
+    if( countField > 0 && countField != m_countLines )
+    {
+        Logger::getInstance()->print( wxString::Format( wxT( "The TCK header announces %ld tracks, %d were read." ), countField, m_countLines ), LOGLEVEL_WARNING );
     }
 
-    delete[] pBuffer;
-    pBuffer = NULL;
-    
     ////
     //POST PROCESS: set all the data in the right format for the navigator
     ////
-    m_pointArray.max_size();
-    m_linePointers.resize( m_countLines + 1 );
-    m_pointArray.resize( m_countPoints * 3 );
-    m_linePointers[m_countLines] = m_countPoints;
     m_reverse.resize( m_countPoints );
     m_selected.resize( m_countLines, false );
     m_filtered.resize( m_countLines, false );
-    m_linePointers[0] = 0;
 
     for( int i = 0; i < m_countLines; ++i )
     {
-        m_linePointers[i + 1] = m_linePointers[i] + lines[i].size() / 3;
-    }
-
-    int lineCounter = 0;
-
-    for( int i = 0; i < m_countPoints; ++i )
-    {
-        if( i == m_linePointers[lineCounter + 1] )
-        {
-            ++lineCounter;
-        }
-
-        m_reverse[i] = lineCounter;
+        std::fill( m_reverse.begin() + m_linePointers[i], m_reverse.begin() + m_linePointers[i + 1], i );
     }
 
-    unsigned int pos = 0;
-    vector< vector< float > >::iterator it;
+    Logger::getInstance()->print( wxT( "TCK file loaded" ), LOGLEVEL_MESSAGE );
+    createColorArray( false );
+    m_type = FIBERS;
+    m_fullPath = filename;
 
-    for( it = lines.begin(); it < lines.end(); it++ )
-    {
-        vector< float >::iterator it2;
+#ifdef __WXMSW__
+    m_name = wxT( "-" ) + filename.AfterLast( '\\' );
+#else
+    m_name = wxT( "-" ) + filename.AfterLast( '/' );
+#endif
+    return true;
+}
 
-        for( it2 = ( *it ).begin(); it2 < ( *it ).end(); it2++ )
-        {
-            m_pointArray[pos++] = *it2;
-        }
-    }
-    
-    // The MrTrix fibers are defined in the same geometric reference
-    // as the anatomical file. That is, the fibers coordinates are related to 
-    // the anatomy in world space. The transformation from local to world space
-    // for the anatomy is encoded in the m_dh->m_niftiTransform member.
-    // Since we do not consider this tranform when loading the anatomy, we must 
-    // bring back the fibers in the same reference, using the inverse of the 
-    // local to world transformation. A further problem arises when loading an
-    // anatomy that has voxels with dimensions differing from 1x1x1. The 
-    // scaling factor is encoded in the transformation matrix, but we do not,
-    // for the moment, use this scaling. Therefore, we must remove it from the
-    // the transformation matrix before computing its inverse.
+//////////////////////////////////////////////////////////////////////////
+// Transform from the navigator space to the world space of the MRtrix
+// files, see loadMRtrix.
+//////////////////////////////////////////////////////////////////////////
+FMatrix Fibers::getLocalToWorld()
+{
     FMatrix localToWorld = FMatrix( DatasetManager::getInstance()->getNiftiTransform() );
 
     float voxelX = DatasetManager::getInstance()->getVoxelX();
@@ -909,38 +1456,8 @@ bool Fibers::loadMRtrix( const wxString &filename )
         
         localToWorld.setSubMatrix( 0, 0, rotMat );
     }
-       
-    FMatrix invertedTransform( 4, 4 );
-    invertedTransform = invert( localToWorld );
-
-    for( int i = 0; i < m_countPoints * 3; ++i )
-    {
-        FMatrix curPoint( 4, 1 );
-        curPoint( 0, 0 ) = m_pointArray[i];
-        curPoint( 1, 0 ) = m_pointArray[i + 1];
-        curPoint( 2, 0 ) = m_pointArray[i + 2];
-        curPoint( 3, 0 ) = 1;
-        
-        FMatrix invertedPoint = invertedTransform * curPoint;
-        
-        m_pointArray[i] = invertedPoint( 0, 0 );
-        m_pointArray[i + 1] = invertedPoint( 1, 0 );
-        m_pointArray[i + 2] = invertedPoint( 2, 0 );
-        
-        i += 2;
-    }
-
-    Logger::getInstance()->print( wxT( "TCK file loaded" ), LOGLEVEL_MESSAGE );
-    createColorArray( false );
-    m_type = FIBERS;
-    m_fullPath = filename;
 
-#ifdef __WXMSW__
-    m_name = wxT( "-" ) + filename.AfterLast( '\\' );
-#else
-    m_name = wxT( "-" ) + filename.AfterLast( '/' );
-#endif
-    return true;
+    return localToWorld;
 }
 
 bool Fibers::loadPTK( const wxString &filename )
@@ -968,6 +1485,12 @@ bool Fibers::loadPTK( const wxString &filename )
 
     while( pc < nSize )
     {
+        if( isLoadCancelled() )
+        {
+            delete[] pBuffer;
+            return false;
+        }
+
         ++m_countLines;
         cbi.b[0] = pBuffer[pc++];
         cbi.b[1] = pBuffer[pc++];
@@ -1063,220 +1586,562 @@ bool Fibers::loadPTK( const wxString &filename )
     return true;
 }
 
-bool Fibers::loadVTK( const wxString &filename )
+//////////////////////////////////////////////////////////////////////////
+// VTK polydata parsing helpers.
+//
+// The file is mapped and its sections (POINTS, LINES, COLOR_SCALARS) are
+// read in order. The ASCII number blocks are split at whitespace and parsed
+// in parallel chunks. Binary files store big endian values, swapped word by
+// word in parallel chunks.
+//////////////////////////////////////////////////////////////////////////
+namespace
 {
-    Logger::getInstance()->print( wxT( "Loading VTK file" ), LOGLEVEL_MESSAGE );
-    wxFile dataFile;
-    wxFileOffset nSize = 0;
+    bool isVTKSpace( const char c )
+    {
+        return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+    }
 
-    if( dataFile.Open( filename ) )
+    // Returns the trimmed line starting at pos and moves pos after it.
+    wxString readVTKLine( const char *pData, const size_t size, size_t &pos )
     {
-        nSize = dataFile.Length();
+        size_t start = pos;
 
-        if( nSize == wxInvalidOffset )
+        while( pos < size && pData[pos] != '\n' )
+        {
+            ++pos;
+        }
+
+        wxString line( &pData[start], wxConvUTF8, pos - start );
+
+        if( pos < size )
+        {
+            ++pos;
+        }
+
+        return line.Strip( wxString::both );
+    }
+
+    // A section keyword line starts with 2 uppercase letters or underscores.
+    // Numbers never do, even in exponent notation or for NaN.
+    bool isVTKKeywordLine( const char *pData, const size_t size, size_t pos )
+    {
+        while( pos < size && ( pData[pos] == ' ' || pData[pos] == '\t' ) )
+        {
+            ++pos;
+        }
+
+        return pos + 1 < size
+            && pData[pos]     >= 'A' && pData[pos]     <= 'Z' && pData[pos] != 'E'
+            && ( ( pData[pos + 1] >= 'A' && pData[pos + 1] <= 'Z' ) || pData[pos + 1] == '_' );
+    }
+
+    // Returns the position of the next keyword line at or after pos, or size.
+    size_t findVTKKeywordLine( const char *pData, const size_t size, size_t pos )
+    {
+        while( pos < size && !isVTKKeywordLine( pData, size, pos ) )
+        {
+            const void *pNewLine = memchr( &pData[pos], '\n', size - pos );
+
+            if( NULL == pNewLine )
+            {
+                return size;
+            }
+
+            pos = static_cast< const char * >( pNewLine ) - pData + 1;
+        }
+
+        return std::min( pos, size );
+    }
+
+    // Parses one ASCII number at p and moves p after it. This does not
+    // depend on the current locale, unlike strtod.
+    bool parseVTKNumber( const char *&p, const char *pEnd, float &value )
+    {
+        while( p < pEnd && isVTKSpace( *p ) )
+        {
+            ++p;
+        }
+
+        bool negative( false );
+        if( p < pEnd && ( *p == '-' || *p == '+' ) )
+        {
+            negative = *p == '-';
+            ++p;
+        }
+
+        double mantissa( 0.0 );
+        int    exponent( 0 );
+        int    nbDigits( 0 );
+
+        for( ; p < pEnd && *p >= '0' && *p <= '9'; ++p, ++nbDigits )
+        {
+            mantissa = mantissa * 10.0 + ( *p - '0' );
+        }
+
+        if( p < pEnd && *p == '.' )
+        {
+            for( ++p; p < pEnd && *p >= '0' && *p <= '9'; ++p, ++nbDigits )
+            {
+                mantissa = mantissa * 10.0 + ( *p - '0' );
+                --exponent;
+            }
+        }
+
+        if( nbDigits == 0 )
+        {
             return false;
+        }
+
+        if( p < pEnd && ( *p == 'e' || *p == 'E' ) )
+        {
+            ++p;
+            bool negativeExponent( false );
+            if( p < pEnd && ( *p == '-' || *p == '+' ) )
+            {
+                negativeExponent = *p == '-';
+                ++p;
+            }
+
+            int explicitExponent( 0 );
+            for( ; p < pEnd && *p >= '0' && *p <= '9'; ++p )
+            {
+                explicitExponent = explicitExponent * 10 + ( *p - '0' );
+            }
+
+            exponent += negativeExponent ? -explicitExponent : explicitExponent;
+        }
+
+        value = static_cast< float >( ( negative ? -mantissa : mantissa ) * pow( 10.0, exponent ) );
+        return true;
     }
 
-    wxUint8 *pBuffer = new wxUint8[255];
-    dataFile.Read( pBuffer, ( size_t )255 );
-    
-    int pointOffset         = 0;
-    int lineOffset          = 0;
-    int pointColorOffset    = 0;
-    int lineColorOffset     = 0;
-    int fileOffset          = 0;
-    int j                   = 0;
+    bool parseVTKNumber( const char *&p, const char *pEnd, int &value )
+    {
+        while( p < pEnd && isVTKSpace( *p ) )
+        {
+            ++p;
+        }
 
-    bool colorsLoadedFromFile( false );
+        bool negative( false );
+        if( p < pEnd && *p == '-' )
+        {
+            negative = true;
+            ++p;
+        }
+
+        const char *pStart = p;
+        value = 0;
+
+        for( ; p < pEnd && *p >= '0' && *p <= '9'; ++p )
+        {
+            value = value * 10 + ( *p - '0' );
+        }
+
+        value = negative ? -value : value;
+        return p != pStart;
+    }
+
+    // Converts big endian 32 bit words to the host byte order.
+    class SwapWordsTask : public ParallelTask
+    {
+    public:
+        SwapWordsTask( const wxUint8 *pSource, wxUint32 *pDest )
+        :   m_pSource( pSource ),
+            m_pDest( pDest )
+        {
+        }
+
+        virtual void run( size_t begin, size_t end )
+        {
+            for( size_t i = begin; i < end; ++i )
+            {
+                wxUint32 word;
+                memcpy( &word, &m_pSource[i * 4], 4 );
+                m_pDest[i] = wxUINT32_SWAP_ON_LE( word );
+            }
+        }
+
+    private:
+        const wxUint8 *m_pSource;
+        wxUint32      *m_pDest;
+    };
+
+    // Counts (m_pDest NULL), then parses, the ASCII numbers of each chunk.
+    // The chunk bounds fall between two numbers.
+    template< typename T >
+    class AsciiNumbersTask : public ParallelTask
+    {
+    public:
+        AsciiNumbersTask( const char *pData, const vector< size_t > &bounds, vector< size_t > &counts, vector< char > &errors, T *pDest )
+        :   m_pData( pData ),
+            m_bounds( bounds ),
+            m_counts( counts ),
+            m_errors( errors ),
+            m_pDest( pDest )
+        {
+        }
+
+        virtual void run( size_t begin, size_t end )
+        {
+            for( size_t chunk = begin; chunk < end; ++chunk )
+            {
+                const char *p    = &m_pData[m_bounds[chunk]];
+                const char *pEnd = &m_pData[m_bounds[chunk + 1]];
+
+                if( NULL == m_pDest )
+                {
+                    size_t count( 0 );
+                    for( bool inValue( false ); p < pEnd; ++p )
+                    {
+                        bool isSpace = isVTKSpace( *p );
+                        count += ( !isSpace && !inValue ) ? 1 : 0;
+                        inValue = !isSpace;
+                    }
+                    m_counts[chunk] = count;
+                }
+                else
+                {
+                    T *pOut    = &m_pDest[m_counts[chunk]];
+                    T *pOutEnd = &m_pDest[m_counts[chunk + 1]];
+
+                    for( ; pOut < pOutEnd; ++pOut )
+                    {
+                        if( !parseVTKNumber( p, pEnd, *pOut ) )
+                        {
+                            m_errors[chunk] = 1;
+                            break;
+                        }
+                    }
+                }
+            }
+        }
+
+    private:
+        const char             *m_pData;
+        const vector< size_t > &m_bounds;
+        vector< size_t >       &m_counts;
+        vector< char >         &m_errors;
+        T                      *m_pDest;
+    };
+
+    // Parses the ASCII numbers in [begin, end[ of pData into o_values, in
+    // parallel. Returns false if the block does not hold exactly
+    // o_values.size() numbers.
+    template< typename T >
+    bool parseVTKAsciiNumbers( const char *pData, const size_t begin, const size_t end, vector< T > &o_values )
+    {
+        size_t nbChunks = std::max( static_cast< size_t >( 1 ),
+                                    std::min( static_cast< size_t >( getParallelThreadsCount() * 4 ), ( end - begin ) / 65536 ) );
+
+        vector< size_t > bounds( nbChunks + 1, end );
+        bounds[0] = begin;
+
+        for( size_t chunk = 1; chunk < nbChunks; ++chunk )
+        {
+            size_t pos = std::max( bounds[chunk - 1], begin + ( end - begin ) / nbChunks * chunk );
+
+            while( pos < end && !isVTKSpace( pData[pos] ) )
+            {
+                ++pos;
+            }
+
+            bounds[chunk] = pos;
+        }
+
+        vector< size_t > counts( nbChunks + 1, 0 );
+        vector< char >   errors( nbChunks, 0 );
+
+        AsciiNumbersTask< T > countTask( pData, bounds, counts, errors, NULL );
+        parallelFor( nbChunks, countTask );
+
+        // Counts to start indices.
+        size_t total( 0 );
+        for( size_t chunk = 0; chunk <= nbChunks; ++chunk )
+        {
+            size_t count = counts[chunk];
+            counts[chunk] = total;
+            total += count;
+        }
+
+        if( total != o_values.size() )
+        {
+            return false;
+        }
+
+        if( total == 0 )
+        {
+            return true;
+        }
+
+        AsciiNumbersTask< T > parseTask( pData, bounds, counts, errors, &o_values[0] );
+        parallelFor( nbChunks, parseTask );
+
+        return std::find( errors.begin(), errors.end(), 1 ) == errors.end();
+    }
+}
 
-    char *pTemp = new char[256];
+bool Fibers::loadVTK( const wxString &filename )
+{
+    Logger::getInstance()->print( wxT( "Loading VTK file" ), LOGLEVEL_MESSAGE );
+    MappedFile dataFile;
 
-    // Ignore the first 2 lines.
-    while( pBuffer[fileOffset] != '\n' )
+    if( !dataFile.open( filename ) )
     {
-        ++fileOffset;
+        return false;
     }
 
-    ++fileOffset;
+    const char  *pData = reinterpret_cast< const char * >( dataFile.getData() );
+    const size_t size  = dataFile.getSize();
+    size_t pos( 0 );
 
-    while( pBuffer[fileOffset] != '\n' )
+    // Identification and title lines.
+    if( !readVTKLine( pData, size, pos ).StartsWith( wxT( "# vtk" ) ) )
     {
-        ++fileOffset;
+        return false;
     }
 
-    ++fileOffset;
+    readVTKLine( pData, size, pos );
 
     // Check the file type.
-    while( pBuffer[fileOffset] != '\n' )
+    wxString type = readVTKLine( pData, size, pos );
+    bool isBinary( type == wxT( "BINARY" ) );
+
+    if( !isBinary && type != wxT( "ASCII" ) )
     {
-        pTemp[j] = pBuffer[fileOffset];
-        ++fileOffset;
-        ++j;
+        // Something else, don't know what to do.
+        return false;
     }
 
-    ++fileOffset;
-    pTemp[j] = 0;
-    wxString type( pTemp, wxConvUTF8 );
-
-    if( type == wxT( "ASCII" ) )
+    if( readVTKLine( pData, size, pos ) != wxT( "DATASET POLYDATA" ) )
     {
-        // ASCII file, maybe later.
         return false;
     }
 
-    if( type != wxT( "BINARY" ) )
-    {
-        // Something else, don't know what to do.
-        return false;
-    }
+    long countPoints( -1 );
+    long countLines( -1 );
+    long lengthLines( 0 );
+    bool isPointData( false );
+    bool colorsLoadedFromFile( false );
+
+    vector< float > colors;
+
+    ////
+    // Locate and read the sections.
+    ////
+    while( pos < size )
+    {
+        if( isLoadCancelled() )
+        {
+            return false;
+        }
+
+        while( pos < size && isVTKSpace( pData[pos] ) )
+        {
+            ++pos;
+        }
+
+        if( pos >= size )
+        {
+            break;
+        }
+
+        if( !isVTKKeywordLine( pData, size, pos ) )
+        {
+            if( isBinary )
+            {
+                break;
+            }
+
+            readVTKLine( pData, size, pos );
+            continue;
+        }
+
+        wxString line = readVTKLine( pData, size, pos );
+        wxString keyword = line.BeforeFirst( ' ' );
+
+        if( keyword == wxT( "POINTS" ) )
+        {
+            wxString dataType = line.AfterLast( ' ' );
+
+            if( !line.AfterFirst( ' ' ).BeforeFirst( ' ' ).ToLong( &countPoints ) || countPoints < 0 )
+            {
+                return false; // Can't read point count.
+            }
+
+            if( isBinary && dataType != wxT( "float" ) )
+            {
+                Logger::getInstance()->print( wxT( "Only float points are supported in binary VTK files." ), LOGLEVEL_ERROR );
+                return false;
+            }
+
+            m_pointArray.resize( countPoints * 3 );
+
+            if( isBinary )
+            {
+                if( pos + countPoints * 12 > size )
+                {
+                    return false;
+                }
+
+                if( countPoints > 0 )
+                {
+                    SwapWordsTask swapTask( reinterpret_cast< const wxUint8 * >( &pData[pos] ), reinterpret_cast< wxUint32 * >( &m_pointArray[0] ) );
+                    parallelFor( countPoints * 3, swapTask, 65536 );
+                }
+
+                pos += countPoints * 12;
+            }
+            else
+            {
+                size_t blockEnd = findVTKKeywordLine( pData, size, pos );
+
+                if( !parseVTKAsciiNumbers( pData, pos, blockEnd, m_pointArray ) )
+                {
+                    Logger::getInstance()->print( wxT( "Invalid POINTS section in the VTK file." ), LOGLEVEL_ERROR );
+                    return false;
+                }
 
-    // Ignore line DATASET POLYDATA.
-    while( pBuffer[fileOffset] != '\n' )
-    {
-        ++fileOffset;
-    }
+                pos = blockEnd;
+            }
+        }
+        else if( keyword == wxT( "LINES" ) )
+        {
+            if( !line.AfterFirst( ' ' ).BeforeFirst( ' ' ).ToLong( &countLines ) || !line.AfterLast( ' ' ).ToLong( &lengthLines ) 
+                || countLines < 0 || lengthLines < 0 )
+            {
+                return false; // Can't read lines.
+            }
 
-    ++fileOffset;
-    j = 0;
+            m_lineArray.resize( lengthLines );
 
-    // Read POINTS.
-    while( pBuffer[fileOffset] != '\n' )
-    {
-        pTemp[j] = pBuffer[fileOffset];
-        ++fileOffset;
-        ++j;
-    }
+            if( isBinary )
+            {
+                if( pos + lengthLines * 4 > size )
+                {
+                    return false;
+                }
 
-    ++fileOffset;
-    pTemp[j] = 0;
-    wxString points( pTemp, wxConvUTF8 );
-    points = points.AfterFirst( ' ' );
-    points = points.BeforeFirst( ' ' );
-    long tempValue = 0;
+                if( lengthLines > 0 )
+                {
+                    SwapWordsTask swapTask( reinterpret_cast< const wxUint8 * >( &pData[pos] ), reinterpret_cast< wxUint32 * >( &m_lineArray[0] ) );
+                    parallelFor( lengthLines, swapTask, 65536 );
+                }
 
-    if( ! points.ToLong( &tempValue, 10 ) )
-    {
-        return false; // Can't read point count.
-    }
+                pos += lengthLines * 4;
+            }
+            else
+            {
+                size_t blockEnd = findVTKKeywordLine( pData, size, pos );
 
-    int countPoints = ( int )tempValue;
-    // Start position of the point array in the file.
-    pointOffset = fileOffset;
-    // Jump to postion after point array.
-    fileOffset += ( 12 * countPoints ) + 1;
-    j = 0;
-    dataFile.Seek( fileOffset );
-    dataFile.Read( pBuffer, ( size_t ) 255 );
+                if( !parseVTKAsciiNumbers( pData, pos, blockEnd, m_lineArray ) )
+                {
+                    Logger::getInstance()->print( wxT( "Invalid LINES section in the VTK file." ), LOGLEVEL_ERROR );
+                    return false;
+                }
 
-    while( pBuffer[j] != '\n' )
-    {
-        pTemp[j] = pBuffer[j];
-        ++fileOffset;
-        ++j;
-    }
+                pos = blockEnd;
+            }
+        }
+        else if( keyword == wxT( "POINT_DATA" ) || keyword == wxT( "CELL_DATA" ) )
+        {
+            isPointData = keyword == wxT( "POINT_DATA" );
+        }
+        else if( keyword == wxT( "COLOR_SCALARS" ) )
+        {
+            long nbValues( 0 );
+            if( !line.AfterLast( ' ' ).ToLong( &nbValues ) || nbValues < 1 )
+            {
+                return false;
+            }
 
-    ++fileOffset;
-    pTemp[j] = 0;
-    wxString sLines( pTemp, wxConvUTF8 );
-    wxString sLengthLines = sLines.AfterLast( ' ' );
+            long count = ( isPointData ? countPoints : countLines ) * nbValues;
+            if( count < 0 )
+            {
+                return false;
+            }
 
-    if( ! sLengthLines.ToLong( &tempValue, 10 ) )
-    {
-        return false; // Can't read size of lines array.
-    }
+            // Only the point colors are used, the first 3 values being RGB.
+            bool useColors( isPointData && nbValues >= 3 );
 
-    int lengthLines = ( int( tempValue ) );
-    sLines = sLines.AfterFirst( ' ' );
-    sLines = sLines.BeforeFirst( ' ' );
+            if( useColors )
+            {
+                colors.resize( count );
+            }
 
-    if( ! sLines.ToLong( &tempValue, 10 ) )
-    {
-        return false; // Can't read lines.
-    }
+            if( isBinary )
+            {
+                if( pos + count > size )
+                {
+                    return false;
+                }
 
-    int countLines = ( int ) tempValue;
-    // Start postion of the line array in the file.
-    lineOffset = fileOffset;
-    // Jump to postion after line array.
-    fileOffset += ( lengthLines * 4 ) + 1;
-    dataFile.Seek( fileOffset );
-    dataFile.Read( pBuffer, ( size_t ) 255 );
-    j = 0;
-    int k = 0;
+                for( long i = 0; useColors && i < count; ++i )
+                {
+                    colors[i] = static_cast< wxUint8 >( pData[pos + i] ) / 255.;
+                }
 
-    // TODO test if there's really a color array.
-    while( pBuffer[k] != '\n' )
-    {
-        pTemp[j] = pBuffer[k];
-        ++fileOffset;
-        ++j;
-        ++k;
-    }
+                pos += count;
+            }
+            else
+            {
+                size_t blockEnd = findVTKKeywordLine( pData, size, pos );
 
-    ++k;
-    ++fileOffset;
-    pTemp[j] = 0;
-    wxString tmpString( pTemp, wxConvUTF8 );
-    j = 0;
+                if( useColors && !parseVTKAsciiNumbers( pData, pos, blockEnd, colors ) )
+                {
+                    return false;
+                }
 
-    while( pBuffer[k] != '\n' )
-    {
-        pTemp[j] = pBuffer[k];
-        ++fileOffset;
-        ++j;
-        ++k;
-    }
+                pos = blockEnd;
+            }
 
-    ++fileOffset;
-    pTemp[j] = 0;
-    wxString tmpString2( pTemp, wxConvUTF8 );
+            if( useColors )
+            {
+                m_colorArray.resize( countPoints * 3 );
 
-    if( tmpString.BeforeFirst( ' ' ) == _T( "CELL_DATA" ) )
-    {
-        lineColorOffset = fileOffset;
-        fileOffset += ( countLines * 3 ) + 1;
-        dataFile.Seek( fileOffset );
-        dataFile.Read( pBuffer, ( size_t ) 255 );
-        // aa 2009/06/26 workaround if the pBuffer doesn't contain a string.
-        pBuffer[254] = '\n';
-        int k = j = 0;
+                for( long i = 0; i < countPoints; ++i )
+                {
+                    m_colorArray[i * 3]     = colors[i * nbValues];
+                    m_colorArray[i * 3 + 1] = colors[i * nbValues + 1];
+                    m_colorArray[i * 3 + 2] = colors[i * nbValues + 2];
+                }
 
-        // TODO test if there's really a color array.
-        while( pBuffer[k] != '\n' )
+                colorsLoadedFromFile = true;
+                vector< float >().swap( colors );
+            }
+        }
+        else if( isBinary )
         {
-            pTemp[j] = pBuffer[k];
-            ++fileOffset;
-            ++j;
-            ++k;
+            // The size of an unknown binary section cannot be known, stop here.
+            break;
         }
+    }
 
-        ++k;
-        ++fileOffset;
-        pTemp[j] = 0;
-        wxString tmpString3( pTemp, wxConvUTF8 );
-        tmpString = tmpString3;
-        j = 0;
+    if( countPoints < 0 || countLines < 0 || isLoadCancelled() )
+    {
+        return false;
+    }
 
-        while( pBuffer[k] != '\n' )
+    // Each line is its number of points followed by the point indices.
+    long totalPoints( 0 );
+    long pc( 0 );
+    for( long i = 0; i < countLines; ++i )
+    {
+        if( pc >= lengthLines || m_lineArray[pc] < 0 )
         {
-            pTemp[j] = pBuffer[k];
-            ++fileOffset;
-            ++j;
-            ++k;
+            return false;
         }
 
-        ++fileOffset;
-        pTemp[j] = 0;
-        wxString tmpString4( pTemp, wxConvUTF8 );
-        tmpString2 = tmpString4;
+        totalPoints += m_lineArray[pc];
+        pc += m_lineArray[pc] + 1;
     }
 
-    if( tmpString.BeforeFirst( ' ' ) == _T( "POINT_DATA" ) && tmpString2.BeforeFirst( ' ' ) == _T( "COLOR_SCALARS" ) )
+    if( pc > lengthLines || totalPoints != countPoints )
     {
-        pointColorOffset = fileOffset;
+        Logger::getInstance()->print( wxT( "Invalid LINES section in the VTK file." ), LOGLEVEL_ERROR );
+        return false;
     }
 
-    Logger::getInstance()->print( wxString::Format( wxT( "Loading %d points and %d lines" ), countPoints, countLines ), LOGLEVEL_MESSAGE );
+    Logger::getInstance()->print( wxString::Format( wxT( "Loading %d points and %d lines" ), (int)countPoints, (int)countLines ), LOGLEVEL_MESSAGE );
     m_countLines        = countLines;
     m_countPoints       = countPoints;
     
@@ -1285,31 +2150,9 @@ bool Fibers::loadVTK( const wxString &filename )
     m_reverse.resize( countPoints );
     m_filtered.resize( countLines, false );
     m_selected.resize( countLines, false );
-    m_pointArray.resize( countPoints * 3 );
-    m_lineArray.resize( lengthLines * 4 );
     m_colorArray.resize( countPoints * 3 );
-    
-    dataFile.Seek( pointOffset );
-    dataFile.Read( &m_pointArray[0], ( size_t )countPoints * 12 );
-    dataFile.Seek( lineOffset );
-    dataFile.Read( &m_lineArray[0], ( size_t )lengthLines * 4 );
-
-    if( pointColorOffset != 0 )
-    {
-        vector< wxUint8 > tmpColorArray( countPoints * 3, 0 );
-        dataFile.Seek( pointColorOffset );
-        dataFile.Read( &tmpColorArray[0], ( size_t ) countPoints * 3 );
-
-        for( size_t i = 0; i < tmpColorArray.size(); ++i )
-        {
-            m_colorArray[i] = tmpColorArray[i] / 255.;
-        }
-
-        colorsLoadedFromFile = true;
-    }
 
-    toggleEndianess();
-    Logger::getInstance()->print( wxT( "Move vertices" ), LOGLEVEL_MESSAGE );
+    dataFile.close();
 
     calculateLinePointers();
     createColorArray( colorsLoadedFromFile );
@@ -1322,8 +2165,6 @@ bool Fibers::loadVTK( const wxString &filename )
     m_name = wxT( "-" ) + filename.AfterLast( '/' );
 #endif
 
-    delete[] pBuffer;
-    delete[] pTemp;
     return true;
 }
 
@@ -1542,7 +2383,7 @@ bool Fibers::createFrom( const vector<Fibers*>& bundles, wxString name )
     m_fullPath = wxString(name);
     m_name = wxString(name);
 
-    m_pOctree = new Octree( 2, m_pointArray, m_countPoints );
+    m_pOctree = new Octree( m_pointArray, m_countPoints );
 
     return true;
 }
@@ -1662,6 +2503,12 @@ void Fibers::loadTestFibers()
 ///////////////////////////////////////////////////////////////////////////
 void Fibers::updateFibersColors()
 {
+    // Out-of-core fibers are always drawn with their global colors.
+    if( isOutOfCore() )
+    {
+        return;
+    }
+
     if( m_fiberColorationMode == NORMAL_COLOR )
     {
         resetColorArray();
@@ -1670,7 +2517,7 @@ void Fibers::updateFibersColors()
     {
         float *pColorData( NULL );
 
-        if( SceneManager::getInstance()->isUsingVBO() )
+        if( mapsColorBuffer() )
         {
             glBindBuffer( GL_ARRAY_BUFFER, m_bufferObjects[1] );
             pColorData = ( float * ) glMapBuffer( GL_ARRAY_BUFFER, GL_READ_WRITE );
@@ -1700,11 +2547,23 @@ void Fibers::updateFibersColors()
         {
             colorWithConstantColor( pColorData );
         }
+        else if( m_fiberColorationMode == COLUMN_COLOR )
+        {
+            colorWithColumn( pColorData );
+        }
+        else if( m_fiberColorationMode == CLUSTER_COLOR )
+        {
+            colorWithClusters( pColorData );
+        }
 
-        if( SceneManager::getInstance()->isUsingVBO() )
+        if( mapsColorBuffer() )
         {
             glUnmapBuffer( GL_ARRAY_BUFFER );
         }
+        else if( m_isCompact )
+        {
+            uploadCompactColors( 0, m_countPoints );
+        }
     }
 }
 
@@ -2101,10 +2960,175 @@ void Fibers::colorWithConstantColor( float *pColorData )
     }
 }
 
+///////////////////////////////////////////////////////////////////////////
+// This function will color the fibers with the selected column, from blue
+// for its minimum to red for its maximum. Scalars color each point, 
+// properties a whole fiber.
+//
+// pColorData      : A pointer to the fiber color info.
+///////////////////////////////////////////////////////////////////////////
+void Fibers::colorWithColumn( float *pColorData )
+{
+    if( pColorData == NULL || m_selectedColumn < 0 )
+    {
+        return;
+    }
+
+    const bool  isScalar = static_cast< size_t >( m_selectedColumn ) < m_scalarColumns.size();
+    const float range    = m_columnMax > m_columnMin ? m_columnMax - m_columnMin : 1.0f;
+
+    for( int i = 0; i < m_countLines; ++i )
+    {
+        for( int j = m_linePointers[i]; j < m_linePointers[i + 1]; ++j )
+        {
+            float value = isScalar ? m_scalarColumns[m_selectedColumn][j] : m_propertyColumns[m_selectedColumn - m_scalarColumns.size()][i];
+            float t     = std::min( 1.0f, std::max( 0.0f, ( value - m_columnMin ) / range ) );
+
+            pColorData[j * 3]     = std::max( 0.0f, 2.0f * t - 1.0f );
+            pColorData[j * 3 + 2] = std::max( 0.0f, 1.0f - 2.0f * t );
+            pColorData[j * 3 + 1] = 1.0f - pColorData[j * 3] - pColorData[j * 3 + 2];
+        }
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////
+// This function will color each cluster of fibers with its own hue, the
+// fibers that were not clustered are gray.
+//
+// pColorData      : A pointer to the fiber color info.
+///////////////////////////////////////////////////////////////////////////
+void Fibers::colorWithClusters( float *pColorData )
+{
+    if( pColorData == NULL || m_clusterIds.empty() )
+    {
+        return;
+    }
+
+    // Consecutive clusters get hues far apart, they are often neighbours.
+    vector< float > clusterColors( m_clusterSizes.size() * 3 );
+    for( size_t c = 0; c < m_clusterSizes.size(); ++c )
+    {
+        float hue = static_cast< float >( std::fmod( c * 0.618034, 1.0 ) );
+        Helper::HSLtoRGB( hue, 0.8f, 0.5f, clusterColors[c * 3], clusterColors[c * 3 + 1], clusterColors[c * 3 + 2] );
+    }
+
+    for( int i = 0; i < m_countLines; ++i )
+    {
+        const float gray[3] = { 0.5f, 0.5f, 0.5f };
+        const float *pColor = m_clusterIds[i] >= 0 ? &clusterColors[m_clusterIds[i] * 3] : gray;
+
+        for( int j = m_linePointers[i]; j < m_linePointers[i + 1]; ++j )
+        {
+            pColorData[j * 3]     = pColor[0];
+            pColorData[j * 3 + 1] = pColor[1];
+            pColorData[j * 3 + 2] = pColor[2];
+        }
+    }
+}
+
+wxString Fibers::getColumnName( const size_t column ) const
+{
+    wxString name = column < m_scalarNames.size() ? m_scalarNames[column] : m_propertyNames[column - m_scalarNames.size()];
+
+    if( name.IsEmpty() )
+    {
+        name = column < m_scalarNames.size() ? wxString::Format( wxT( "Scalar #%u" ), static_cast< unsigned int >( column ) )
+                                             : wxString::Format( wxT( "Property #%u" ), static_cast< unsigned int >( column - m_scalarNames.size() ) );
+    }
+    return name;
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Selects the column used for the coloring and the column filter. The per
+// fiber values and the range are computed once here, the filter and the
+// coloring only read them.
+///////////////////////////////////////////////////////////////////////////
+void Fibers::selectColumn( const int column )
+{
+    m_selectedColumn = ( column >= 0 && static_cast< size_t >( column ) < getColumnCount() ) ? column : -1;
+    m_columnFiberValues.clear();
+    m_columnMin = 0.0f;
+    m_columnMax = 0.0f;
+
+    // Without fibers, or points, there is no range to take.
+    if( m_selectedColumn < 0 || m_countLines <= 0 )
+    {
+        m_columnFilterMin = m_columnMin;
+        m_columnFilterMax = m_columnMax;
+        return;
+    }
+
+    m_columnFiberValues.resize( m_countLines );
+
+    if( static_cast< size_t >( m_selectedColumn ) < m_scalarColumns.size() )
+    {
+        const vector< float > &values = m_scalarColumns[m_selectedColumn];
+        if( !values.empty() )
+        {
+            m_columnMin = *std::min_element( values.begin(), values.end() );
+            m_columnMax = *std::max_element( values.begin(), values.end() );
+        }
+
+        for( int i = 0; i < m_countLines; ++i )
+        {
+            int nbPoints = m_linePointers[i + 1] - m_linePointers[i];
+            float sum = 0.0f;
+
+            for( int j = m_linePointers[i]; j < m_linePointers[i + 1]; ++j )
+            {
+                sum += values[j];
+            }
+            m_columnFiberValues[i] = nbPoints > 0 ? sum / nbPoints : 0.0f;
+        }
+    }
+    else
+    {
+        m_columnFiberValues = m_propertyColumns[m_selectedColumn - m_scalarColumns.size()];
+        m_columnMin = *std::min_element( m_columnFiberValues.begin(), m_columnFiberValues.end() );
+        m_columnMax = *std::max_element( m_columnFiberValues.begin(), m_columnFiberValues.end() );
+    }
+
+    m_columnFilterMin = m_columnMin;
+    m_columnFilterMax = m_columnMax;
+
+    if( m_pSliderColumnFilterMin != NULL )
+    {
+        m_pSliderColumnFilterMin->SetValue( 0 );
+        m_pSliderColumnFilterMax->SetValue( 100 );
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Clusters the fibers shown with QuickBundles, threshold is the largest
+// distance in mm between a fiber and the centroid of its cluster.
+///////////////////////////////////////////////////////////////////////////
+void Fibers::clusterFibers( const float threshold )
+{
+    // The fibers only hidden by the size of their previous cluster are
+    // clustered again.
+    m_clusterIds.clear();
+    m_clusterSizes.clear();
+    updateFibersFilters();
+
+    QuickBundles clusters( this, threshold );
+
+    m_clusterIds   = clusters.getClusterIds();
+    m_clusterSizes = clusters.getClusterSizes();
+
+    Logger::getInstance()->print( wxString::Format( wxT( "Fibers clustered in %d clusters." ), getClustersCount() ), LOGLEVEL_MESSAGE );
+
+    updateFibersFilters();
+}
+
 Anatomy* Fibers::generateFiberVolume()
 {
+    if( isOutOfCore() )
+    {
+        return generateFiberVolumeOutOfCore();
+    }
+
     float* pColorData( NULL );
-    if( SceneManager::getInstance()->isUsingVBO() )
+    if( mapsColorBuffer() )
     {
         glBindBuffer( GL_ARRAY_BUFFER, m_bufferObjects[1] );
 
@@ -2151,7 +3175,7 @@ Anatomy* Fibers::generateFiberVolume()
         ( *pTmpAnatomy->getFloatDataset() )[index * 3 + 2] += pColorData[i * 3 + 2] * m_localizedAlpha[i];
     }
 
-    if( SceneManager::getInstance()->isUsingVBO() )
+    if( mapsColorBuffer() )
     {
         glUnmapBuffer( GL_ARRAY_BUFFER );
     }
@@ -2159,52 +3183,66 @@ Anatomy* Fibers::generateFiberVolume()
     return pTmpAnatomy;
 }
 
-void Fibers::getFibersInfoToSave( vector<float>& pointsToSave,  vector<int>& linesToSave, vector<int>& colorsToSave, int& countLines )
+namespace
 {
-    int pointIndex( 0 );
-    countLines = 0;
-
-    float *pColorData( NULL );
-    
-    if( SceneManager::getInstance()->isUsingVBO() )
-    {
-        glBindBuffer( GL_ARRAY_BUFFER, m_bufferObjects[1] );
-        pColorData = ( float * ) glMapBuffer( GL_ARRAY_BUFFER, GL_READ_WRITE );
-    }
-    else
-    {
-        pColorData = &m_colorArray[0];
-    }
-
-    for( int l = 0; l < m_countLines; ++l )
+    // Adds the global color of each fiber to the voxels of its points.
+    class DensityVisitor : public FiberTiles::Visitor
     {
-        if( m_selected[l] && !m_filtered[l] )
+    public:
+        DensityVisitor( vector< float > &volume )
+        :   m_volume( volume )
         {
-            unsigned int pc = getStartIndexForLine( l ) * 3;
-            linesToSave.push_back( getPointsPerLine( l ) );
+            m_columns = DatasetManager::getInstance()->getColumns();
+            m_rows    = DatasetManager::getInstance()->getRows();
+            m_frames  = DatasetManager::getInstance()->getFrames();
+            m_voxelX  = DatasetManager::getInstance()->getVoxelX();
+            m_voxelY  = DatasetManager::getInstance()->getVoxelY();
+            m_voxelZ  = DatasetManager::getInstance()->getVoxelZ();
+        }
 
-            for( int j = 0; j < getPointsPerLine( l ); ++j )
+        virtual void visit( int fiberId, const float *pPoints, int nbPoints, const float *pColor )
+        {
+            for( int i = 0; i < nbPoints; ++i )
             {
-                pointsToSave.push_back( m_pointArray[pc] );
-                colorsToSave.push_back( ( wxUint8 )( pColorData[pc] * 255 ) );
-                ++pc;
-                pointsToSave.push_back( m_pointArray[pc] );
-                colorsToSave.push_back( ( wxUint8 )( pColorData[pc] * 255 ) );
-                ++pc;
-                pointsToSave.push_back( m_pointArray[pc] );
-                colorsToSave.push_back( ( wxUint8 )( pColorData[pc] * 255 ) );
-                ++pc;
-                linesToSave.push_back( pointIndex );
-                ++pointIndex;
+                int x     = std::min( m_columns - 1, std::max( 0, (int)( pPoints[i * 3 ]    / m_voxelX ) ) ) ;
+                int y     = std::min( m_rows    - 1, std::max( 0, (int)( pPoints[i * 3 + 1] / m_voxelY ) ) ) ;
+                int z     = std::min( m_frames  - 1, std::max( 0, (int)( pPoints[i * 3 + 2] / m_voxelZ ) ) ) ;
+                int index = x + y * m_columns + z * m_rows * m_columns;
+
+                m_volume[index * 3]     += pColor[0];
+                m_volume[index * 3 + 1] += pColor[1];
+                m_volume[index * 3 + 2] += pColor[2];
             }
-            ++countLines;
         }
-    }
 
-    if( SceneManager::getInstance()->isUsingVBO() )
-    {
-        glUnmapBuffer( GL_ARRAY_BUFFER );
-    }
+    private:
+        vector< float > &m_volume;
+        int             m_columns;
+        int             m_rows;
+        int             m_frames;
+        float           m_voxelX;
+        float           m_voxelY;
+        float           m_voxelZ;
+    };
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Same as generateFiberVolume, from the tiles and their global colors.
+//////////////////////////////////////////////////////////////////////////
+Anatomy* Fibers::generateFiberVolumeOutOfCore()
+{
+    DatasetIndex index = DatasetManager::getInstance()->createAnatomy( RGB );
+    Anatomy *pTmpAnatomy = (Anatomy *)DatasetManager::getInstance()->getDataset( index );
+    pTmpAnatomy->setName( m_name.BeforeFirst( '.' ) + wxT(" Fiber-Density Volume" ) );
+    
+    MyApp::frame->m_pListCtrl->InsertItem( index );
+
+    MyApp::frame->refreshAllGLWidgets();
+
+    DensityVisitor visitor( *pTmpAnatomy->getFloatDataset() );
+    m_pTiles->visitFibers( BitSet( m_countLines, true ), visitor );
+
+    return pTmpAnatomy;
 }
 
 void Fibers::getNbLines( int& nbLines )
@@ -2239,93 +3277,21 @@ void Fibers::loadDMRIFibersInFile( ofstream& myfile )
             myfile <<  m_pointArray[pc] << " " <<  m_pointArray[pc + 1] << " " <<  m_pointArray[pc + 2] << " 0\n";
         }
     }
-}
-
-/**
- * Save using the VTK binary format.
- */
-void Fibers::save( wxString filename )
-{
-    ofstream myfile;
-    char *pFn;
-    vector<char> vBuffer;
-    converterByteINT32 c;
-    converterByteFloat f;
-    vector<float> pointsToSave;
-    vector<int> linesToSave;
-    vector<int> colorsToSave;
-    int countLines = 0;
-
-    if( filename.AfterLast( '.' ) != _T( "fib" ) )
-    {
-        filename += _T( ".fib" );
-    }
-
-    pFn = ( char * ) malloc( filename.length() );
-    strcpy( pFn, ( const char * ) filename.mb_str( wxConvUTF8 ) );
-    myfile.open( pFn, std::ios::binary );
-
-    getFibersInfoToSave( pointsToSave, linesToSave, colorsToSave, countLines );
-
-    string header1 = "# vtk DataFile Version 3.0\nvtk output\nBINARY\nDATASET POLYDATA\nPOINTS ";
-    header1 += intToString( pointsToSave.size() / 3 );
-    header1 += " float\n";
-    for( unsigned int i = 0; i < header1.size(); ++i )
-    {
-        vBuffer.push_back( header1[i] );
-    }
-    for( unsigned int i = 0; i < pointsToSave.size(); ++i )
-    {
-        f.f = pointsToSave[i];
-        vBuffer.push_back( f.b[3] );
-        vBuffer.push_back( f.b[2] );
-        vBuffer.push_back( f.b[1] );
-        vBuffer.push_back( f.b[0] );
-    }
-
-    vBuffer.push_back( '\n' );
-    string header2 = "LINES " + intToString( countLines ) + " " + intToString( linesToSave.size() ) + "\n";
-    for( unsigned int i = 0; i < header2.size(); ++i )
-    {
-        vBuffer.push_back( header2[i] );
-    }
-    for( unsigned int i = 0; i < linesToSave.size(); ++i )
-    {
-        c.i = linesToSave[i];
-        vBuffer.push_back( c.b[3] );
-        vBuffer.push_back( c.b[2] );
-        vBuffer.push_back( c.b[1] );
-        vBuffer.push_back( c.b[0] );
-    }
-
-    vBuffer.push_back( '\n' );
-    string header3 = "POINT_DATA ";
-    header3 += intToString( pointsToSave.size() / 3 );
-    header3 += " float\n";
-    header3 += "COLOR_SCALARS scalars 3\n";
-    for( unsigned int i = 0; i < header3.size(); ++i )
-    {
-        vBuffer.push_back( header3[i] );
-    }
-    for( unsigned int i = 0; i < colorsToSave.size(); ++i )
-    {
-        vBuffer.push_back( colorsToSave[i] );
-    }
-    vBuffer.push_back( '\n' );
-
-    // Put the buffer vector into a char* array.
-    char* pBuffer = new char[vBuffer.size()];
+}
 
-    for( unsigned int i = 0; i < vBuffer.size(); ++i )
+/**
+ * Save the selected fibers using the VTK binary format, or the TrackVis
+ * and MRtrix formats for the .trk and .tck extensions.
+ */
+void Fibers::save( wxString filename )
+{
+    if( FibersWriter::getFormat( filename ) == FibersWriter::FORMAT_VTK && filename.AfterLast( '.' ) != _T( "fib" ) )
     {
-        pBuffer[i] = vBuffer[i];
+        filename += _T( ".fib" );
     }
 
-    myfile.write( pBuffer, vBuffer.size() );
-    myfile.close();
-
-    delete[] pBuffer;
-    pBuffer = NULL;
+    FibersWriter writer( vector< Fibers * >( 1, this ), filename );
+    writer.write();
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -2344,6 +3310,12 @@ bool Fibers::save( wxXmlNode *pNode ) const
 
 void Fibers::saveDMRI( wxString filename )
 {
+    if( isOutOfCore() )
+    {
+        Logger::getInstance()->print( wxT( "Saving out-of-core fibers in the DMRI format is not supported." ), LOGLEVEL_ERROR );
+        return;
+    }
+
     ofstream myfile;
     int nbrlines;
     char *pFn;
@@ -2367,43 +3339,6 @@ void Fibers::saveDMRI( wxString filename )
     myfile.close();
 }
 
-string Fibers::intToString( const int number )
-{
-    stringstream out;
-    out << number;
-    return out.str();
-}
-
-void Fibers::toggleEndianess()
-{
-    Logger::getInstance()->print( wxT( "Toggle Endianess" ), LOGLEVEL_MESSAGE );
-    wxUint8 temp = 0;
-    wxUint8 *pPointBytes = ( wxUint8 * )&m_pointArray[0];
-
-    for( int i = 0; i < m_countPoints * 12; i += 4 )
-    {
-        temp = pPointBytes[i];
-        pPointBytes[i] = pPointBytes[i + 3];
-        pPointBytes[i + 3] = temp;
-        temp = pPointBytes[i + 1];
-        pPointBytes[i + 1] = pPointBytes[i + 2];
-        pPointBytes[i + 2] = temp;
-    }
-
-    // Toggle endianess for the line array.
-    wxUint8 *pLineBytes = ( wxUint8 * )&m_lineArray[0];
-
-    for( size_t i = 0; i < m_lineArray.size() * 4; i += 4 )
-    {
-        temp = pLineBytes[i];
-        pLineBytes[i] = pLineBytes[i + 3];
-        pLineBytes[i + 3] = temp;
-        temp = pLineBytes[i + 1];
-        pLineBytes[i + 1] = pLineBytes[i + 2];
-        pLineBytes[i + 2] = temp;
-    }
-}
-
 int Fibers::getPointsPerLine( const int lineId )
 {
     return ( m_linePointers[lineId + 1] - m_linePointers[lineId] );
@@ -2416,6 +3351,12 @@ int Fibers::getStartIndexForLine( const int lineId )
 
 int Fibers::getLineForPoint( const int pointIdx )
 {
+    // Out-of-core fibers have no reverse index, their line pointers are searched instead.
+    if( isOutOfCore() )
+    {
+        return std::upper_bound( m_linePointers.begin(), m_linePointers.end(), pointIdx ) - m_linePointers.begin() - 1;
+    }
+
     return m_reverse[pointIdx];
 }
 
@@ -2548,11 +3489,16 @@ void Fibers::createColorArray( const bool colorsLoadedFromFile )
 
 void Fibers::resetColorArray()
 {
+    if( isOutOfCore() )
+    {
+        return;
+    }
+
     Logger::getInstance()->print( wxT( "Reset color arrays" ), LOGLEVEL_MESSAGE );
     float *pColorData( NULL );
     float *pColorData2( &m_colorArray[0] );
 
-    if( SceneManager::getInstance()->isUsingVBO() )
+    if( mapsColorBuffer() )
     {
         glBindBuffer( GL_ARRAY_BUFFER, m_bufferObjects[1] );
         pColorData = ( float * ) glMapBuffer( GL_ARRAY_BUFFER, GL_READ_WRITE );
@@ -2613,10 +3559,14 @@ void Fibers::resetColorArray()
         }
     }
 
-    if( SceneManager::getInstance()->isUsingVBO() )
+    if( mapsColorBuffer() )
     {
         glUnmapBuffer( GL_ARRAY_BUFFER );
     }
+    else if( m_isCompact )
+    {
+        uploadCompactColors( 0, m_countPoints );
+    }
 
     m_fiberColorationMode = NORMAL_COLOR;
 }
@@ -2625,9 +3575,14 @@ void Fibers::setFiberColor( const int fiberIdx, const wxColour &col )
 {
     assert(fiberIdx < m_countLines );
 
+    if( isOutOfCore() )
+    {
+        return;
+    }
+
     float *pColorData( NULL );
 
-    if( SceneManager::getInstance()->isUsingVBO() )
+    if( mapsColorBuffer() )
     {
         glBindBuffer( GL_ARRAY_BUFFER, m_bufferObjects[1] );
         pColorData = ( float * ) glMapBuffer( GL_ARRAY_BUFFER, GL_READ_WRITE );
@@ -2646,19 +3601,32 @@ void Fibers::setFiberColor( const int fiberIdx, const wxColour &col )
         pColorData[curPointStart + 2] = col.Blue() / 255.0f;
     }
     
-    if( SceneManager::getInstance()->isUsingVBO() )
+    if( mapsColorBuffer() )
     {
         glUnmapBuffer( GL_ARRAY_BUFFER );
     }
+    else if( m_isCompact )
+    {
+        uploadCompactColors( getStartIndexForLine( fiberIdx ), getPointsPerLine( fiberIdx ) );
+    }
 }
 
 wxColour Fibers::getFiberPointColor( const int fiberIdx, const int ptIdx )
 {
     assert(fiberIdx < m_countLines );
+
+    if( isOutOfCore() )
+    {
+        float color[3];
+        m_pTiles->getFiberColor( fiberIdx, color );
+        return wxColour( static_cast<unsigned char>( color[0] * 255.0f ),
+                         static_cast<unsigned char>( color[1] * 255.0f ),
+                         static_cast<unsigned char>( color[2] * 255.0f ) );
+    }
     
     float *pColorData( NULL );
     
-    if( SceneManager::getInstance()->isUsingVBO() )
+    if( mapsColorBuffer() )
     {
         glBindBuffer( GL_ARRAY_BUFFER, m_bufferObjects[1] );
         pColorData = ( float * ) glMapBuffer( GL_ARRAY_BUFFER, GL_READ_WRITE );
@@ -2675,7 +3643,7 @@ wxColour Fibers::getFiberPointColor( const int fiberIdx, const int ptIdx )
                static_cast<unsigned char>(pColorData[curPointStart + 1] * 255.0f), 
                static_cast<unsigned char>(pColorData[curPointStart + 2] * 255.0f));
     
-    if( SceneManager::getInstance()->isUsingVBO() )
+    if( mapsColorBuffer() )
     {
         glUnmapBuffer( GL_ARRAY_BUFFER );
     }
@@ -2688,7 +3656,7 @@ void Fibers::resetLinesShown()
     m_selected.assign( m_countLines, false );
 }
 
-void Fibers::updateLinesShown()
+void Fibers::updateLinesShown( const bool updateSelection )
 {
     SelectionTree::SelectionObjectVector selectionObjects = SceneManager::getInstance()->getSelectionTree().getAllObjects();
     
@@ -2709,14 +3677,18 @@ void Fibers::updateLinesShown()
         return;
     }
 
-    m_selected = SceneManager::getInstance()->getSelectionTree().getSelectedFibers( this );
+    if( updateSelection )
+    {
+        m_selected = SceneManager::getInstance()->getSelectionTree().getSelectedFibers( this );
+    }
+    else
+    {
+        m_selected = SceneManager::getInstance()->getSelectionTree().getLastSelectedFibers( this );
+    }
     
     if( m_fibersInverted )
     {
-        for( int k = 0; k < m_countLines; ++k )
-        {
-            m_selected[k] = !m_selected[k];
-        }
+        m_selected.flip();
     }
     
     // TODO selection convex hull
@@ -2738,6 +3710,19 @@ void Fibers::initializeBuffer()
     bool isOK = true;
     
     glGenBuffers( 3, m_bufferObjects );
+
+    if( SceneManager::getInstance()->isUsingCompactFibers() )
+    {
+        m_isCompact = initializeCompactBuffers();
+
+        if( m_isCompact )
+        {
+            return;
+        }
+
+        Logger::getInstance()->print( wxT( "Cannot create the compact fibers buffers, using full precision." ), LOGLEVEL_WARNING );
+    }
+
     glBindBuffer( GL_ARRAY_BUFFER, m_bufferObjects[0] );
     glBufferData( GL_ARRAY_BUFFER, sizeof( GLfloat ) * m_countPoints * 3, &m_pointArray[0], GL_STATIC_DRAW );
 
@@ -2774,8 +3759,115 @@ void Fibers::initializeBuffer()
     }
 }
 
+//////////////////////////////////////////////////////////////////////////
+// Compact buffers: the positions are stored as 16 bit fixed point values
+// relative to the fibers bounding box, the colors and normals as 8 bit
+// normalized values. This takes 12 bytes per point on the graphics card
+// instead of 36. The positions are decoded by the fibers vertex shader,
+// the drawing modes not using it read the host arrays instead.
+//
+// Returns false if the buffers could not be allocated.
+//////////////////////////////////////////////////////////////////////////
+bool Fibers::initializeCompactBuffers()
+{
+    glBindBuffer( GL_ARRAY_BUFFER, m_bufferObjects[1] );
+    glBufferData( GL_ARRAY_BUFFER, sizeof( GLbyte ) * m_countPoints * 3, NULL, GL_STATIC_DRAW );
+    uploadCompactColors( 0, m_countPoints );
+
+    vector< GLbyte > normals( m_countPoints * 3 );
+    for( unsigned int i = 0; i < normals.size(); ++i )
+    {
+        normals[i] = toNormalizedByte( m_normalArray[i] );
+    }
+
+    glBindBuffer( GL_ARRAY_BUFFER, m_bufferObjects[2] );
+    glBufferData( GL_ARRAY_BUFFER, sizeof( GLbyte ) * m_countPoints * 3, &normals[0], GL_STATIC_DRAW );
+
+    uploadCompactPoints();
+
+    if( Logger::getInstance()->printIfGLError( wxT( "initialize compact vbo" ) ) )
+    {
+        glDeleteBuffers( 3, m_bufferObjects );
+        glGenBuffers( 3, m_bufferObjects );
+        return false;
+    }
+
+    Logger::getInstance()->print( wxT( "Using compact buffers for the fibers." ), LOGLEVEL_DEBUG );
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Computes the fibers bounding box and uploads the quantized positions.
+//////////////////////////////////////////////////////////////////////////
+void Fibers::uploadCompactPoints()
+{
+    m_boxMin.assign( 3,  FLT_MAX );
+    m_boxMax.assign( 3, -FLT_MAX );
+
+    for( int i = 0; i < m_countPoints * 3; i += 3 )
+    {
+        for( int k = 0; k < 3; ++k )
+        {
+            m_boxMin[k] = std::min( m_boxMin[k], m_pointArray[i + k] );
+            m_boxMax[k] = std::max( m_boxMax[k], m_pointArray[i + k] );
+        }
+    }
+
+    vector< GLshort > points( m_countPoints * 3 );
+
+    for( int i = 0; i < m_countPoints * 3; i += 3 )
+    {
+        for( int k = 0; k < 3; ++k )
+        {
+            float range = m_boxMax[k] - m_boxMin[k];
+            float t     = range > 0.0f ? ( m_pointArray[i + k] - m_boxMin[k] ) / range : 0.0f;
+            points[i + k] = static_cast< GLshort >( static_cast< int >( t * 65535.0f + 0.5f ) - 32768 );
+        }
+    }
+
+    glBindBuffer( GL_ARRAY_BUFFER, m_bufferObjects[0] );
+    glBufferData( GL_ARRAY_BUFFER, sizeof( GLshort ) * m_countPoints * 3, &points[0], GL_STATIC_DRAW );
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Uploads the quantized global colors of countPoints points, starting at
+// firstPoint. In compact mode, the host color array is the reference.
+//////////////////////////////////////////////////////////////////////////
+void Fibers::uploadCompactColors( const int firstPoint, const int countPoints )
+{
+    if( countPoints <= 0 )
+    {
+        return;
+    }
+
+    vector< GLbyte > colors( countPoints * 3 );
+    for( int i = 0; i < countPoints * 3; ++i )
+    {
+        colors[i] = toNormalizedByte( m_colorArray[firstPoint * 3 + i] );
+    }
+
+    glBindBuffer( GL_ARRAY_BUFFER, m_bufferObjects[1] );
+    glBufferSubData( GL_ARRAY_BUFFER, sizeof( GLbyte ) * firstPoint * 3, sizeof( GLbyte ) * countPoints * 3, &colors[0] );
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Returns true if the colors are read and written through the mapped
+// color buffer, false if the host color array must be used.
+//////////////////////////////////////////////////////////////////////////
+bool Fibers::mapsColorBuffer() const
+{
+    return SceneManager::getInstance()->isUsingVBO() && !m_isCompact;
+}
+
 void Fibers::draw()
 {
+    // Out-of-core fibers are drawn tile by tile, with their global colors only.
+    if( isOutOfCore() )
+    {
+        m_pTiles->draw( m_selected, m_filtered, !SceneManager::getInstance()->getActivateAllSelObj() );
+        return;
+    }
+
     setShader();
 
     if( m_cachedThreshold != m_threshold )
@@ -2815,8 +3907,17 @@ void Fibers::draw()
     glEnableClientState( GL_COLOR_ARRAY );
     glEnableClientState( GL_NORMAL_ARRAY );
 
-    if( !SceneManager::getInstance()->isUsingVBO() )
+    // The compact positions can only be decoded by the fibers shader, the
+    // crossing fibers shader and the fixed pipeline get the float arrays.
+    const bool isFibersShaderBound = !m_useTex && !( SceneManager::getInstance()->isFibersGeomShaderActive() && m_useIntersectedFibers );
+
+    if( !SceneManager::getInstance()->isUsingVBO() || ( m_isCompact && !isFibersShaderBound ) )
     {
+        if( m_isCompact )
+        {
+            glBindBuffer( GL_ARRAY_BUFFER, 0 );
+        }
+
         glVertexPointer( 3, GL_FLOAT, 0, &m_pointArray[0] );
 
         if( m_showFS )
@@ -2830,6 +3931,38 @@ void Fibers::draw()
 
         glNormalPointer( GL_FLOAT, 0, &m_normalArray[0] );
     }
+    else if( m_isCompact )
+    {
+        GLfloat scale[3];
+        GLfloat offset[3];
+
+        for( int k = 0; k < 3; ++k )
+        {
+            scale[k]  = ( m_boxMax[k] - m_boxMin[k] ) / 65535.0f;
+            offset[k] = m_boxMin[k] + 32768.0f * scale[k];
+        }
+
+        ShaderHelper::getInstance()->getFibersShader()->setUniInt( "isQuantized", true );
+        ShaderHelper::getInstance()->getFibersShader()->setUni3Float( "quantizedScale", scale );
+        ShaderHelper::getInstance()->getFibersShader()->setUni3Float( "quantizedOffset", offset );
+
+        glBindBuffer( GL_ARRAY_BUFFER, m_bufferObjects[0] );
+        glVertexPointer( 3, GL_SHORT, 0, 0 );
+
+        if( m_showFS )
+        {
+            glBindBuffer( GL_ARRAY_BUFFER, m_bufferObjects[1] );
+            glColorPointer( 3, GL_BYTE, 0, 0 );
+        }
+        else
+        {
+            glBindBuffer( GL_ARRAY_BUFFER, m_bufferObjects[2] );
+            glColorPointer( 3, GL_BYTE, 0, 0 );
+        }
+
+        glBindBuffer( GL_ARRAY_BUFFER, m_bufferObjects[2] );
+        glNormalPointer( GL_BYTE, 0, 0 );
+    }
     else
     {
         glBindBuffer( GL_ARRAY_BUFFER, m_bufferObjects[0] );
@@ -3022,7 +4155,7 @@ void Fibers::drawSortedLines()
     float *pColors  = NULL;
     float *pNormals = NULL;
 
-    if( SceneManager::getInstance()->isUsingVBO() )
+    if( mapsColorBuffer() )
     {
         glBindBuffer( GL_ARRAY_BUFFER, m_bufferObjects[1] );
         pColors = ( float * ) glMapBuffer( GL_ARRAY_BUFFER, GL_READ_ONLY );
@@ -3116,8 +4249,13 @@ void Fibers::drawCrossingFibers()
     glEnableClientState( GL_COLOR_ARRAY );
     glEnableClientState( GL_NORMAL_ARRAY );
 
-    if( !SceneManager::getInstance()->isUsingVBO() )
+    if( !SceneManager::getInstance()->isUsingVBO() || m_isCompact )
     {
+        if( m_isCompact )
+        {
+            glBindBuffer( GL_ARRAY_BUFFER, 0 );
+        }
+
         glVertexPointer( 3, GL_FLOAT, 0, &m_pointArray[0] );
 
         if( m_showFS )
@@ -3166,6 +4304,11 @@ void Fibers::drawCrossingFibers()
 
 void Fibers::switchNormals( bool positive )
 {
+    if( isOutOfCore() )
+    {
+        return;
+    }
+
     float *pNormals = NULL;
     pNormals = &m_normalArray[0];
 
@@ -3256,9 +4399,104 @@ void Fibers::freeArrays()
 
 float Fibers::getPointValue( int ptIndex )
 {
+    if( isOutOfCore() )
+    {
+        int pointIdx = ptIndex / 3;
+        int lineId   = getLineForPoint( pointIdx );
+
+        // NULL when the tile of the fiber could not be read.
+        const float *pPoints = m_pTiles->getFiberPoints( lineId );
+        return NULL != pPoints ? pPoints[( pointIdx - m_linePointers[lineId] ) * 3 + ptIndex % 3] : 0.0f;
+    }
+
     return m_pointArray[ptIndex];
 }
 
+namespace
+{
+    // Chunks per thread, the selected fibers are rarely spread evenly.
+    const size_t VISIT_CHUNKS_PER_THREAD( 4 );
+
+    // Visits the fibers of the chunks [begin, end[ of visitFibersInChunks,
+    // or the fibers of the tiles in chunk 0.
+    class VisitChunksTask : public ParallelTask, public FiberTiles::Visitor
+    {
+    public:
+        VisitChunksTask( const vector< float > &pointArray, const vector< int > &linePointers,
+                         const BitSet &fibers, size_t nbChunks, Fibers::ChunkVisitor &visitor )
+        :   m_pointArray( pointArray ),
+            m_linePointers( linePointers ),
+            m_fibers( fibers ),
+            m_nbChunks( nbChunks ),
+            m_visitor( visitor )
+        {
+        }
+
+        virtual void run( size_t begin, size_t end )
+        {
+            for( size_t chunk = begin; chunk < end; ++chunk )
+            {
+                const size_t first = m_fibers.size() * chunk / m_nbChunks;
+                const size_t last  = m_fibers.size() * ( chunk + 1 ) / m_nbChunks;
+
+                for( size_t fiberId = m_fibers.findNext( first ); fiberId < last; fiberId = m_fibers.findNext( fiberId + 1 ) )
+                {
+                    const int nbPoints = m_linePointers[fiberId + 1] - m_linePointers[fiberId];
+                    m_visitor.visit( chunk, fiberId, nbPoints > 0 ? &m_pointArray[m_linePointers[fiberId] * 3] : NULL, nbPoints );
+                }
+            }
+        }
+
+        virtual void visit( int fiberId, const float *pPoints, int nbPoints, const float * )
+        {
+            m_visitor.visit( 0, fiberId, pPoints, nbPoints );
+        }
+
+    private:
+        const vector< float >   &m_pointArray;
+        const vector< int >     &m_linePointers;
+        const BitSet            &m_fibers;
+        size_t                  m_nbChunks;
+        Fibers::ChunkVisitor    &m_visitor;
+    };
+}
+
+void Fibers::visitFibers( const BitSet &fibers, FiberTiles::Visitor &visitor ) const
+{
+    if( isOutOfCore() )
+    {
+        m_pTiles->visitFibers( fibers, visitor );
+        return;
+    }
+
+    for( size_t fiberId = fibers.findNext( 0 ); fiberId < fibers.size(); fiberId = fibers.findNext( fiberId + 1 ) )
+    {
+        const int nbPoints = m_linePointers[fiberId + 1] - m_linePointers[fiberId];
+        visitor.visit( fiberId, nbPoints > 0 ? &m_pointArray[m_linePointers[fiberId] * 3] : NULL, nbPoints, NULL );
+    }
+}
+
+size_t Fibers::getVisitChunksCount() const
+{
+    // The tiles are paged in and out, they cannot be read by several threads.
+    return isOutOfCore() ? 1 : getParallelThreadsCount() * VISIT_CHUNKS_PER_THREAD;
+}
+
+void Fibers::visitFibersInChunks( const BitSet &fibers, size_t nbChunks, ChunkVisitor &visitor ) const
+{
+    nbChunks = std::max( nbChunks, static_cast< size_t >( 1 ) );
+    VisitChunksTask task( m_pointArray, m_linePointers, fibers, nbChunks, visitor );
+
+    if( isOutOfCore() )
+    {
+        m_pTiles->visitFibers( fibers, task );
+    }
+    else
+    {
+        parallelFor( nbChunks, task );
+    }
+}
+
 int Fibers::getLineCount()
 {
     return m_countLines;
@@ -3350,14 +4588,35 @@ void Fibers::updateFibersFilters()
     int subSampling = m_pSliderFibersSampling->GetValue();
     int maxSubSampling = m_pSliderFibersSampling->GetMax() + 1;
 
+    // The column sliders are in percent of the range of the selected column.
+    if( m_pSliderColumnFilterMin != NULL && !m_columnFiberValues.empty() )
+    {
+        int sliderMin = m_pSliderColumnFilterMin->GetValue();
+        int sliderMax = m_pSliderColumnFilterMax->GetValue();
+
+        // The ends of the sliders are exact, rounding must not filter the extreme fibers out.
+        m_columnFilterMin = sliderMin == 0   ? m_columnMin : m_columnMin + ( m_columnMax - m_columnMin ) * sliderMin / 100.0f;
+        m_columnFilterMax = sliderMax == 100 ? m_columnMax : m_columnMin + ( m_columnMax - m_columnMin ) * sliderMax / 100.0f;
+    }
+
+    if( m_pSliderClusterMinSize != NULL )
+    {
+        m_clusterMinSize = m_pSliderClusterMinSize->GetValue();
+    }
+
     updateFibersFilters(min, max, subSampling, maxSubSampling);
 }
 
 void Fibers::updateFibersFilters(int minLength, int maxLength, int minSubsampling, int maxSubsampling)
 {
+    const bool useColumn   = !m_columnFiberValues.empty();
+    const bool useClusters = !m_clusterIds.empty();
+
     for( int i = 0; i < m_countLines; ++i )
     {
-        m_filtered[i] = !( ( i % maxSubsampling ) >= minSubsampling && m_length[i] >= minLength && m_length[i] <= maxLength );
+        m_filtered[i] = !( ( i % maxSubsampling ) >= minSubsampling && m_length[i] >= minLength && m_length[i] <= maxLength
+                           && ( !useColumn || ( m_columnFiberValues[i] >= m_columnFilterMin && m_columnFiberValues[i] <= m_columnFilterMax ) )
+                           && ( !useClusters || m_clusterIds[i] < 0 || m_clusterSizes[m_clusterIds[i]] >= m_clusterMinSize ) );
     }
     
     SceneManager::getInstance()->getSelectionTree().notifyAllObjectsNeedUpdating();
@@ -3371,28 +4630,26 @@ void Fibers::updateFibersFilters(int minLength, int maxLength, int minSubsamplin
 
 }
 
-vector< bool > Fibers::getFilteredFibers()
-{
-    return m_filtered;
-}
-
 void Fibers::flipAxis( AxisType i_axe )
 {
+    if( isOutOfCore() )
+    {
+        Logger::getInstance()->print( wxT( "Cannot flip out-of-core fibers." ), LOGLEVEL_ERROR );
+        return;
+    }
+
     unsigned int i = 0;
 
     switch ( i_axe )
     {
         case X_AXIS:
             i = 0;
-            m_pOctree->flipX();
             break;
         case Y_AXIS:
             i = 1;
-            m_pOctree->flipY();
             break;
         case Z_AXIS:
             i = 2;
-            m_pOctree->flipZ();
             break;
         default:
             Logger::getInstance()->print( wxT( "Cannot flip fibers. The specified axis is undefined" ), LOGLEVEL_ERROR );
@@ -3410,7 +4667,17 @@ void Fibers::flipAxis( AxisType i_axe )
         axisShift = (pDatMan->getRows() * pDatMan->getVoxelY()) / 2.0f;
     else if( i_axe == Z_AXIS )
         axisShift = (pDatMan->getFrames() * pDatMan->getVoxelZ()) / 2.0f;
+    
+    // The points and their indices must not be read by a selection update meanwhile.
+    SceneManager::getInstance()->getSelectionTree().waitForSelectionUpdate();
         
+    m_pOctree->flip( i, axisShift );
+
+    // The indices are rebuilt from the flipped points when needed.
+    delete m_pSegmentTree;
+    m_pSegmentTree = NULL;
+    delete m_pVoxelIndex;
+    m_pVoxelIndex = NULL;
 
     // Translate fibers at origin, flip them and move them back.
     for ( ; i < m_pointArray.size(); i += 3 )
@@ -3418,9 +4685,17 @@ void Fibers::flipAxis( AxisType i_axe )
         m_pointArray[i] = -( m_pointArray[i] - axisShift ) + axisShift;
     }
 
-    glBindBuffer( GL_ARRAY_BUFFER, m_bufferObjects[0] );
-    glBufferData( GL_ARRAY_BUFFER, sizeof( GLfloat ) * m_countPoints * 3, &m_pointArray[0], GL_STATIC_DRAW );
+    if( m_isCompact )
+    {
+        uploadCompactPoints();
+    }
+    else
+    {
+        glBindBuffer( GL_ARRAY_BUFFER, m_bufferObjects[0] );
+        glBufferData( GL_ARRAY_BUFFER, sizeof( GLfloat ) * m_countPoints * 3, &m_pointArray[0], GL_STATIC_DRAW );
+    }
 
+    SceneManager::getInstance()->getSelectionTree().notifyFibersChanged( getName() );
     SceneManager::getInstance()->getSelectionTree().notifyAllObjectsNeedUpdating();
 }
 
@@ -3428,7 +4703,10 @@ void Fibers::createPropertiesSizer( PropertiesWindow *pParent )
 {
     DatasetInfo::createPropertiesSizer( pParent );
 
-    setFibersLength();
+    if( m_length.size() != static_cast< size_t >( m_countLines ) )
+    {
+        setFibersLength();
+    }
 
     wxBoxSizer *pBoxMain = new wxBoxSizer( wxVERTICAL );
 
@@ -3450,6 +4728,8 @@ void Fibers::createPropertiesSizer( PropertiesWindow *pParent )
 
 #if !_USE_LIGHT_GUI
     wxButton *pBtnGeneratesDensityVolume = new wxButton( pParent, wxID_ANY, wxT( "New Density Volume" ) );
+    wxButton *pBtnConnectivityMatrix     = new wxButton( pParent, wxID_ANY, wxT( "Connectivity Matrix..." ) );
+    wxButton *pBtnClusterFibers          = new wxButton( pParent, wxID_ANY, wxT( "Cluster Fibers..." ) );
 #endif
     
     m_pToggleLocalColoring  = new wxToggleButton(   pParent, wxID_ANY, wxT( "Local Coloring" ) );
@@ -3466,6 +4746,30 @@ void Fibers::createPropertiesSizer( PropertiesWindow *pParent )
 #endif
     
     m_pRadConstant             = new wxRadioButton( pParent, wxID_ANY, wxT( "Constant" ) );
+    m_pRadClusters             = new wxRadioButton( pParent, wxID_ANY, wxT( "Clusters" ) );
+
+    // Fibers of the clusters smaller than this are hidden.
+    m_pSliderClusterMinSize    = new wxSlider( pParent, wxID_ANY, m_clusterMinSize, 1, 100, DEF_POS, DEF_SIZE, wxSL_HORIZONTAL | wxSL_AUTOTICKS );
+
+    // Scalars and properties read from the file, if any.
+    if( getColumnCount() > 0 )
+    {
+        m_pChoiceColumn = new wxChoice( pParent, wxID_ANY, DEF_POS, wxSize( 140, -1 ) );
+
+        for( size_t i = 0; i < getColumnCount(); ++i )
+        {
+            m_pChoiceColumn->Append( getColumnName( i ) );
+        }
+
+        m_pRadColumn              = new wxRadioButton( pParent, wxID_ANY, wxT( "Column" ) );
+        m_pSliderColumnFilterMin  = new wxSlider( pParent, wxID_ANY, 0,   0, 100, DEF_POS, DEF_SIZE, wxSL_HORIZONTAL | wxSL_AUTOTICKS );
+        m_pSliderColumnFilterMax  = new wxSlider( pParent, wxID_ANY, 100, 0, 100, DEF_POS, DEF_SIZE, wxSL_HORIZONTAL | wxSL_AUTOTICKS );
+
+        if( m_selectedColumn >= 0 )
+        {
+            m_pChoiceColumn->SetSelection( m_selectedColumn );
+        }
+    }
 
     //////////////////////////////////////////////////////////////////////////
 
@@ -3483,6 +4787,21 @@ void Fibers::createPropertiesSizer( PropertiesWindow *pParent )
     pGridSliders->Add( new wxStaticText( pParent, wxID_ANY, wxT( "Thickness" ) ), 0, wxALIGN_RIGHT | wxALIGN_CENTER_VERTICAL | wxALL, 1 );
     pGridSliders->Add( m_pSliderInterFibersThickness, 0, wxALIGN_LEFT | wxEXPAND | wxALL, 1 );
 
+    pGridSliders->Add( new wxStaticText( pParent, wxID_ANY, wxT( "Min Cluster" ) ), 0, wxALIGN_RIGHT | wxALIGN_CENTER_VERTICAL | wxALL, 1 );
+    pGridSliders->Add( m_pSliderClusterMinSize, 0, wxALIGN_LEFT | wxEXPAND | wxALL, 1 );
+
+    if( m_pChoiceColumn != NULL )
+    {
+        pGridSliders->Add( new wxStaticText( pParent, wxID_ANY, wxT( "Column" ) ), 0, wxALIGN_RIGHT | wxALIGN_CENTER_VERTICAL | wxALL, 1 );
+        pGridSliders->Add( m_pChoiceColumn, 0, wxALIGN_LEFT | wxEXPAND | wxALL, 1 );
+
+        pGridSliders->Add( new wxStaticText( pParent, wxID_ANY, wxT( "Min Value" ) ), 0, wxALIGN_RIGHT | wxALIGN_CENTER_VERTICAL | wxALL, 1 );
+        pGridSliders->Add( m_pSliderColumnFilterMin, 0, wxALIGN_LEFT | wxEXPAND | wxALL, 1 );
+
+        pGridSliders->Add( new wxStaticText( pParent, wxID_ANY, wxT( "Max Value" ) ), 0, wxALIGN_RIGHT | wxALIGN_CENTER_VERTICAL | wxALL, 1 );
+        pGridSliders->Add( m_pSliderColumnFilterMax, 0, wxALIGN_LEFT | wxEXPAND | wxALL, 1 );
+    }
+
     pBoxMain->Add( pGridSliders, 0, wxEXPAND | wxALL, 2 );
 
     //////////////////////////////////////////////////////////////////////////
@@ -3491,6 +4810,8 @@ void Fibers::createPropertiesSizer( PropertiesWindow *pParent )
 
 #if !_USE_LIGHT_GUI
     pBoxMain->Add( pBtnGeneratesDensityVolume, 0, wxEXPAND | wxLEFT | wxRIGHT, 24 );
+    pBoxMain->Add( pBtnConnectivityMatrix,     0, wxEXPAND | wxLEFT | wxRIGHT, 24 );
+    pBoxMain->Add( pBtnClusterFibers,          0, wxEXPAND | wxLEFT | wxRIGHT, 24 );
 #endif
     
     pBoxMain->Add( m_pToggleLocalColoring,     0, wxEXPAND | wxLEFT | wxRIGHT, 24 );
@@ -3513,6 +4834,12 @@ void Fibers::createPropertiesSizer( PropertiesWindow *pParent )
 #endif
     
     pBoxColoringRadios->Add( m_pRadConstant,             0, wxALIGN_LEFT | wxALL, 1 );
+    pBoxColoringRadios->Add( m_pRadClusters,             0, wxALIGN_LEFT | wxALL, 1 );
+
+    if( m_pRadColumn != NULL )
+    {
+        pBoxColoringRadios->Add( m_pRadColumn,           0, wxALIGN_LEFT | wxALL, 1 );
+    }
     pBoxColoring->Add( pBoxColoringRadios, 0, wxALIGN_LEFT | wxLEFT, 32 );
 
     pBoxMain->Add( pBoxColoring, 0, wxFIXED_MINSIZE | wxEXPAND | wxTOP | wxBOTTOM, 8 );
@@ -3541,11 +4868,27 @@ void Fibers::createPropertiesSizer( PropertiesWindow *pParent )
 #endif
     
     pParent->Connect( m_pRadConstant->GetId(),                   wxEVT_COMMAND_RADIOBUTTON_SELECTED, wxCommandEventHandler( PropertiesWindow::OnColorWithConstantColor ) );
+    pParent->Connect( m_pRadClusters->GetId(),                   wxEVT_COMMAND_RADIOBUTTON_SELECTED, wxCommandEventHandler( PropertiesWindow::OnColorWithClusters ) );
+    pParent->Connect( m_pSliderClusterMinSize->GetId(),          wxEVT_COMMAND_SLIDER_UPDATED,       wxCommandEventHandler( PropertiesWindow::OnFibersFilter ) );
+
+    if( m_pChoiceColumn != NULL )
+    {
+        pParent->Connect( m_pChoiceColumn->GetId(),              wxEVT_COMMAND_CHOICE_SELECTED,      wxCommandEventHandler( PropertiesWindow::OnFibersColumn ) );
+        pParent->Connect( m_pRadColumn->GetId(),                 wxEVT_COMMAND_RADIOBUTTON_SELECTED, wxCommandEventHandler( PropertiesWindow::OnColorWithColumn ) );
+        pParent->Connect( m_pSliderColumnFilterMin->GetId(),     wxEVT_COMMAND_SLIDER_UPDATED,       wxCommandEventHandler( PropertiesWindow::OnFibersFilter ) );
+        pParent->Connect( m_pSliderColumnFilterMax->GetId(),     wxEVT_COMMAND_SLIDER_UPDATED,       wxCommandEventHandler( PropertiesWindow::OnFibersFilter ) );
+    }
     
 #if !_USE_LIGHT_GUI
     pParent->Connect( pBtnGeneratesDensityVolume->GetId(),
                       wxEVT_COMMAND_BUTTON_CLICKED,
                       wxCommandEventHandler( PropertiesWindow::OnGenerateFiberVolume ) );
+    pParent->Connect( pBtnConnectivityMatrix->GetId(),
+                      wxEVT_COMMAND_BUTTON_CLICKED,
+                      wxCommandEventHandler( PropertiesWindow::OnConnectivityMatrix ) );
+    pParent->Connect( pBtnClusterFibers->GetId(),
+                      wxEVT_COMMAND_BUTTON_CLICKED,
+                      wxCommandEventHandler( PropertiesWindow::OnClusterFibers ) );
 #endif
 
     m_pRadNormalColoring->SetValue( true );
@@ -3571,6 +4914,15 @@ void Fibers::updatePropertiesSizer()
 #endif
     
     m_pRadConstant->Enable(             getShowFS() );
+    m_pRadClusters->Enable(             getShowFS() && !m_clusterIds.empty() );
+    m_pSliderClusterMinSize->Enable(    !m_clusterIds.empty() );
+
+    if( m_pRadColumn != NULL )
+    {
+        m_pRadColumn->Enable( getShowFS() && m_selectedColumn >= 0 );
+        m_pSliderColumnFilterMin->Enable( m_selectedColumn >= 0 );
+        m_pSliderColumnFilterMax->Enable( m_selectedColumn >= 0 );
+    }
 
     m_pToggleFiltering->SetValue( false );
     m_pToggleCrossingFibers->SetValue( m_useIntersectedFibers );
@@ -3597,6 +4949,12 @@ void Fibers::updatePropertiesSizer()
 #endif
         
         m_pRadConstant->SetValue( m_fiberColorationMode == CONSTANT_COLOR );
+        m_pRadClusters->SetValue( m_fiberColorationMode == CLUSTER_COLOR );
+
+        if( m_pRadColumn != NULL )
+        {
+            m_pRadColumn->SetValue( m_fiberColorationMode == COLUMN_COLOR );
+        }
         m_isColorationUpdated = false;
     }
 
@@ -3813,6 +5171,7 @@ void Fibers::setShader()
         ShaderHelper::getInstance()->getFibersShader()->setUniInt( "useTex", !pDsInfo->getUseTex() );
 //         ShaderHelper::getInstance()->getFibersShader()->setUniInt( "useColorMap", SceneManager::getInstance()->getColorMap() );
         ShaderHelper::getInstance()->getFibersShader()->setUniInt( "useOverlay", pDsInfo->getShowFS() );
+        ShaderHelper::getInstance()->getFibersShader()->setUniInt( "isQuantized", false );
     }
 }
 
@@ -3922,5 +5281,5 @@ void Fibers::convertFromRTT( std::vector<std::vector<Vector> >* RTT )
 	wxString id = wxString::Format(_T("%d"), RTTrackingHelper::getInstance()->generateId());
     m_name = wxT( "RTTFibers" + id );
 
-	m_pOctree = new Octree( 2, m_pointArray, m_countPoints );
+	m_pOctree = new Octree( m_pointArray, m_countPoints );
 }
@@ -2,8 +2,10 @@
 #define FIBERS_H_
 
 #include "DatasetInfo.h"
+#include "FiberTiles.h"
 #include "Octree.h"
 #include "../gui/SelectionObject.h"
+#include "../misc/BitSet.h"
 #include "../misc/Fantom/FVector.h"
 
 #include <GL/glew.h>
@@ -17,6 +19,11 @@
 #include <string>
 #include <vector>
 
+class FiberVoxelIndex;
+class FMatrix;
+class MappedFile;
+class SegmentTree;
+
 enum FiberFileType
 {
     ASCII_FIBER = 0,
@@ -28,6 +35,11 @@ const int FIBERS_SUBSAMPLING_RANGE_MIN(0);
 const int FIBERS_SUBSAMPLING_RANGE_MAX(99);
 const int FIBERS_SUBSAMPLING_RANGE_START(0);
 
+// Fiber sets with more points than this are kept out-of-core, in spatial
+// tiles paged from disk, with at most FIBERS_RESIDENT_POINTS in memory.
+const int FIBERS_OUT_OF_CORE_POINTS(20000000);
+const int FIBERS_RESIDENT_POINTS(8000000);
+
 /**
  * This class represents a set of fibers.
  * It supports loading different fibers file types.
@@ -36,19 +48,24 @@ const int FIBERS_SUBSAMPLING_RANGE_START(0);
  */
 class Fibers : public DatasetInfo
 {
+    friend class ConnectivityMatrix;
+    friend class FibersStats;
+    friend class FibersWriter;
+    friend class QuickBundles;
+
 public:
     Fibers();
     virtual ~Fibers();
 
-    // Fibers loading methods
-    bool    load( const wxString &filename );
+    // Fibers loading methods. The load is aborted as soon as *pCancel is
+    // set, from any thread.
+    bool    load( const wxString &filename, const volatile bool *pCancel = NULL );
     bool    createFrom( const vector<Fibers*>& fibers, wxString name=wxT("Merged"));
 
     void    updateFibersColors();
 
     Anatomy* generateFiberVolume();
 
-    void    getFibersInfoToSave( std::vector<float> &pointsToSave, std::vector<int> &linesToSave, std::vector<int> &colorsToSave, int &countLines );
     void    getNbLines( int &nbLines );
     void    loadDMRIFibersInFile( std::ofstream &myfile );
 
@@ -66,7 +83,9 @@ public:
     void     setFiberColor( const int fiberIdx, const wxColour& col );
     wxColour getFiberPointColor( const int fiberIdx, const int ptIdx );
 
-    void    updateLinesShown();
+    // Without updateSelection, shows the selection found by the last update
+    // of the selection tree, see SelectionTree::requestSelectionUpdate.
+    void    updateLinesShown( const bool updateSelection = true );
 
     void    initializeBuffer();
 
@@ -96,16 +115,66 @@ public:
 
     void    updateFibersFilters();
     void    updateFibersFilters(int minLength, int maxLength, int minSubsampling, int maxSubsampling);
-    std::vector< bool >  getFilteredFibers();
+    const BitSet &       getFilteredFibers() const { return m_filtered; }
+
+    // Per-point scalars and per-fiber properties read with the fibers (TRK).
+    // Scalar columns are aligned with the points, property columns with the
+    // fibers. Columns are numbered scalars first, then properties.
+    size_t  getScalarCount()   const { return m_scalarColumns.size(); }
+    size_t  getPropertyCount() const { return m_propertyColumns.size(); }
+    size_t  getColumnCount()   const { return m_scalarColumns.size() + m_propertyColumns.size(); }
+    wxString getColumnName( const size_t column ) const;
+    const std::vector< float > & getScalarColumn(   const size_t scalar )   const { return m_scalarColumns[scalar]; }
+    const std::vector< float > & getPropertyColumn( const size_t property ) const { return m_propertyColumns[property]; }
+
+    // Column used by COLUMN_COLOR and by the column filter, -1 for none.
+    void    selectColumn( const int column );
+    int     getSelectedColumn() const { return m_selectedColumn; }
 
     void    flipAxis( AxisType i_axe );
     
     int     getFibersCount() const { return m_countLines; }
+
+    // Clusters the fibers not filtered out with QuickBundles. The clusters
+    // color the fibers (CLUSTER_COLOR) and the smallest can be filtered out.
+    void    clusterFibers( const float threshold );
+    int     getClustersCount() const { return m_clusterSizes.size(); }
+    const std::vector< int > & getClusterIds() const { return m_clusterIds; }
     
     // TODO check if we can set const
     Octree* getOctree() const { return m_pOctree; }
+
+    // Index of the fiber segments, built on first use.
+    SegmentTree* getSegmentTree() const;
+
+    // Index of the fibers of each voxel, built for the first VOI.
+    FiberVoxelIndex* getVoxelIndex() const;
     
-    vector< int > getReverseIdx() const { return m_reverse; }
+    const vector< int > & getReverseIdx() const { return m_reverse; }
+
+    bool        isOutOfCore()    const { return m_pTiles != NULL; }
+    FiberTiles* getFiberTiles()  const { return m_pTiles; }
+
+    // Calls the visitor on each fiber set in fibers, in id order from the
+    // point array with a NULL color, or tile by tile when out-of-core.
+    void        visitFibers( const BitSet &fibers, FiberTiles::Visitor &visitor ) const;
+
+    // Receives the fibers of visitFibersInChunks. Each chunk is visited by
+    // a single thread, the visitor keeps one accumulator per chunk.
+    class ChunkVisitor
+    {
+    public:
+        virtual ~ChunkVisitor() {}
+        virtual void visit( size_t chunk, int fiberId, const float *pPoints, int nbPoints ) = 0;
+    };
+
+    // Number of chunks visitFibersInChunks can use, a single one when
+    // out-of-core.
+    size_t      getVisitChunksCount() const;
+
+    // Splits the fiber ids in nbChunks ranges visited in parallel, each in
+    // id order. Out-of-core fibers are all visited in chunk 0, tile by tile.
+    void        visitFibersInChunks( const BitSet &fibers, size_t nbChunks, ChunkVisitor &visitor ) const;
 
     virtual void createPropertiesSizer( PropertiesWindow *pParent );
     virtual void updatePropertiesSizer();
@@ -157,6 +226,8 @@ private:
 
 private:
     bool            loadTRK(    const wxString &filename );
+    bool            loadTRKOutOfCore( const wxString &filename, const MappedFile &dataFile, size_t hdrSize, size_t ptsSize,
+                                      int nbProperties, const float scale[3], const float origin[3], const float anatomy[3] );
     bool            loadCamino( const wxString &filename );
     bool            loadMRtrix( const wxString &filename );
     bool            loadPTK(    const wxString &filename );
@@ -164,14 +235,22 @@ private:
     bool            loadDmri(   const wxString &filename );
     void            loadTestFibers();
 
+    static FMatrix  getLocalToWorld();
+
+    bool            loadCache( const wxString &filename );
+    void            saveCache( const wxString &filename );
+
+    bool            isLoadCancelled() const { return m_pLoadCancel != NULL && *m_pLoadCancel; }
+
     void            colorWithTorsion(       float *pColorData );
     void            colorWithCurvature(     float *pColorData );
     void            colorWithDistance(      float *pColorData );
     void            colorWithMinDistance(   float *pColorData );
     void            colorWithConstantColor( float *pColorData );
+    void            colorWithColumn(        float *pColorData );
+    void            colorWithClusters(      float *pColorData );
 
-    void            toggleEndianess();
-    std::string     intToString( const int number );
+    Anatomy*        generateFiberVolumeOutOfCore();
 
     void            calculateLinePointers();
     void            createColorArray( const bool colorsLoadedFromFile );
@@ -184,6 +263,11 @@ private:
 
     void            freeArrays();
 
+    bool            initializeCompactBuffers();
+    void            uploadCompactPoints();
+    void            uploadCompactColors( const int firstPoint, const int countPoints );
+    bool            mapsColorBuffer() const;
+
     void            setShader();
     void            releaseShader();
 
@@ -204,11 +288,25 @@ private:
     std::vector< float >  m_normalArray;
     bool                  m_normalsPositive;
     std::vector< int >    m_reverse;
-    std::vector< bool >   m_selected;
-    std::vector< bool >   m_filtered;
+    BitSet                m_selected;
+    BitSet                m_filtered;
     std::vector< float >  m_length;
     float                 m_maxLength;
     float                 m_minLength;
+
+    std::vector< std::vector< float > > m_scalarColumns;
+    std::vector< std::vector< float > > m_propertyColumns;
+    std::vector< wxString > m_scalarNames;
+    std::vector< wxString > m_propertyNames;
+    int                   m_selectedColumn;
+    std::vector< float >  m_columnFiberValues;  // Per fiber value of the selected column, the mean for scalars.
+    float                 m_columnMin;
+    float                 m_columnMax;
+    float                 m_columnFilterMin;
+    float                 m_columnFilterMax;
+    std::vector< int >    m_clusterIds;         // Cluster of each fiber, -1 if not clustered.
+    std::vector< int >    m_clusterSizes;
+    int                   m_clusterMinSize;
     std::vector< float  > m_localizedAlpha;
     float                 m_cachedThreshold;
     bool                  m_fibersInverted;
@@ -219,6 +317,11 @@ private:
     FibersColorationMode  m_fiberColorationMode;
 
     Octree                *m_pOctree;
+    mutable SegmentTree   *m_pSegmentTree;
+    mutable FiberVoxelIndex *m_pVoxelIndex;
+    FiberTiles            *m_pTiles;
+    bool                  m_isCompact;
+    const volatile bool   *m_pLoadCancel;         // Only set during load()
 
     bool            m_cfDrawDirty;
     bool            m_axialShown;
@@ -249,6 +352,12 @@ private:
     wxRadioButton  *m_pRadCurvature;
     wxRadioButton  *m_pRadTorsion;
     wxRadioButton  *m_pRadConstant;
+    wxRadioButton  *m_pRadColumn;
+    wxChoice       *m_pChoiceColumn;
+    wxSlider       *m_pSliderColumnFilterMin;
+    wxSlider       *m_pSliderColumnFilterMax;
+    wxRadioButton  *m_pRadClusters;
+    wxSlider       *m_pSliderClusterMinSize;
 };
 
 #endif /* FIBERS_H_ */
@@ -0,0 +1,384 @@
+#include "FibersCrossSections.h"
+
+#include "Fibers.h"
+#include "../misc/BitSet.h"
+#include "../misc/ParallelFor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <vector>
+using std::vector;
+
+namespace
+{
+    const float CROSSING_EPSILON( 0.000001f );
+
+    // Segments of a fiber bounded together.
+    const int BLOCK_SEGMENTS( 8 );
+
+    // Relative rounding of the distances to the planes, the blocks skipped
+    // stay strictly on one side of a plane despite it.
+    const float BLOCK_TOLERANCE( 0.00001f );
+
+    // Point of a cross section mapped on its plane, with its crossing.
+    struct PlanePoint
+    {
+        double x;
+        double y;
+        int    crossing;
+
+        bool operator<( const PlanePoint &other ) const
+        {
+            return x < other.x || ( x == other.x && y < other.y );
+        }
+    };
+
+    inline double turn( const PlanePoint &o, const PlanePoint &a, const PlanePoint &b )
+    {
+        return ( a.x - o.x ) * ( b.y - o.y ) - ( a.y - o.y ) * ( b.x - o.x );
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Cuts the fibers of each chunk with the planes, in the crossings of this
+// chunk.
+//////////////////////////////////////////////////////////////////////////
+class FibersCrossSections::CutTask : public Fibers::ChunkVisitor
+{
+public:
+    CutTask( const vector< Plane > &planes, size_t nbChunks )
+    :   m_planes( planes ),
+        m_centersExtent( 0.0f ),
+        m_chunks( nbChunks, vector< vector< float > >( planes.size() ) ),
+        m_blocks( nbChunks )
+    {
+        for( size_t plane = 0; plane < planes.size(); ++plane )
+        {
+            for( int axis = 0; axis < 3; ++axis )
+            {
+                m_centersExtent = std::max( m_centersExtent, std::fabs( planes[plane].m_center[axis] ) );
+            }
+        }
+    }
+
+    virtual void visit( size_t chunk, int, const float *pPoints, int nbPoints )
+    {
+        if( nbPoints > 1 )
+        {
+            cutFiber( pPoints, nbPoints, m_blocks[chunk], m_chunks[chunk] );
+        }
+    }
+
+    // Appends the crossings of the chunks, in the order of the fibers.
+    void merge( vector< vector< float > > &io_crossings ) const
+    {
+        for( size_t chunk = 0; chunk < m_chunks.size(); ++chunk )
+        {
+            for( size_t plane = 0; plane < m_planes.size(); ++plane )
+            {
+                io_crossings[plane].insert( io_crossings[plane].end(), m_chunks[chunk][plane].begin(), m_chunks[chunk][plane].end() );
+            }
+        }
+    }
+
+private:
+    // Bounding spheres of the blocks of segments of a fiber, center and
+    // radius. The radius is enlarged by the rounding of the distances.
+    void getBlocks( const float *pPoints, int nbPoints, vector< float > &o_blocks ) const
+    {
+        const int nbBlocks = ( nbPoints - 2 ) / BLOCK_SEGMENTS + 1;
+        o_blocks.resize( nbBlocks * 4 );
+
+        for( int block = 0; block < nbBlocks; ++block )
+        {
+            const float *pFirst = pPoints + block * BLOCK_SEGMENTS * 3;
+            const int nbBlockPoints = std::min( BLOCK_SEGMENTS + 1, nbPoints - block * BLOCK_SEGMENTS );
+
+            float bbMin[3] = { pFirst[0], pFirst[1], pFirst[2] };
+            float bbMax[3] = { pFirst[0], pFirst[1], pFirst[2] };
+
+            for( int p = 1; p < nbBlockPoints; ++p )
+            {
+                for( int axis = 0; axis < 3; ++axis )
+                {
+                    bbMin[axis] = std::min( bbMin[axis], pFirst[p * 3 + axis] );
+                    bbMax[axis] = std::max( bbMax[axis], pFirst[p * 3 + axis] );
+                }
+            }
+
+            float *pBlock = &o_blocks[block * 4];
+            float extent( 0.0f );
+
+            for( int axis = 0; axis < 3; ++axis )
+            {
+                pBlock[axis] = ( bbMin[axis] + bbMax[axis] ) * 0.5f;
+                extent = std::max( extent, std::max( std::fabs( bbMin[axis] ), std::fabs( bbMax[axis] ) ) );
+            }
+
+            float squaredRadius( 0.0f );
+
+            for( int p = 0; p < nbBlockPoints; ++p )
+            {
+                const float dx = pFirst[p * 3]     - pBlock[0];
+                const float dy = pFirst[p * 3 + 1] - pBlock[1];
+                const float dz = pFirst[p * 3 + 2] - pBlock[2];
+                squaredRadius = std::max( squaredRadius, dx * dx + dy * dy + dz * dz );
+            }
+
+            pBlock[3] = std::sqrt( squaredRadius ) * ( 1.0f + BLOCK_TOLERANCE ) + BLOCK_TOLERANCE * ( extent + m_centersExtent );
+        }
+    }
+
+    // Keeps the crossing of the fiber closest to the center of each plane.
+    // A segment crosses a plane when its ends are not strictly on the same
+    // side. The points of a block are no farther than its radius from its
+    // center, the blocks farther than that from a plane are not tested.
+    void cutFiber( const float *pPoints, int nbPoints, vector< float > &io_blocks, vector< vector< float > > &io_crossings ) const
+    {
+        getBlocks( pPoints, nbPoints, io_blocks );
+        const int nbBlocks = io_blocks.size() / 4;
+
+        for( size_t plane = 0; plane < m_planes.size(); ++plane )
+        {
+            const Plane &curPlane = m_planes[plane];
+            float bestDistance = std::numeric_limits< float >::max();
+            float bestPoint[3];
+
+            for( int block = 0; block < nbBlocks; ++block )
+            {
+                if( std::fabs( curPlane.getDistance( &io_blocks[block * 4] ) ) > io_blocks[block * 4 + 3] )
+                {
+                    continue;
+                }
+
+                const int first = block * BLOCK_SEGMENTS;
+                const int last  = std::min( first + BLOCK_SEGMENTS, nbPoints - 1 );
+                float distA = curPlane.getDistance( pPoints + first * 3 );
+
+                for( int a = first; a < last; ++a )
+                {
+                    const float *pA = pPoints + a * 3;
+                    const float *pB = pA + 3;
+                    const float distB = curPlane.getDistance( pB );
+                    const bool sameSide = ( distA > 0.0f && distB > 0.0f ) || ( distA < 0.0f && distB < 0.0f );
+
+                    if( !sameSide )
+                    {
+                        float t( 0.5f );
+                        if( std::fabs( distA - distB ) > CROSSING_EPSILON )
+                        {
+                            t = distA / ( distA - distB );
+                        }
+
+                        float crossing[3];
+                        float distance( 0.0f );
+                        for( int axis = 0; axis < 3; ++axis )
+                        {
+                            crossing[axis] = pA[axis] + ( pB[axis] - pA[axis] ) * t;
+                            distance += ( crossing[axis] - curPlane.m_center[axis] ) * ( crossing[axis] - curPlane.m_center[axis] );
+                        }
+
+                        // Keeps the crossing closest to the mean fiber.
+                        if( distance < bestDistance )
+                        {
+                            bestDistance = distance;
+                            std::copy( crossing, crossing + 3, bestPoint );
+                        }
+                    }
+
+                    distA = distB;
+                }
+            }
+
+            if( bestDistance != std::numeric_limits< float >::max() )
+            {
+                io_crossings[plane].insert( io_crossings[plane].end(), bestPoint, bestPoint + 3 );
+            }
+        }
+    }
+
+private:
+    const vector< Plane >               &m_planes;
+    float                               m_centersExtent;
+
+    // Crossings of each chunk with each plane, and its bounding spheres.
+    vector< vector< vector< float > > > m_chunks;
+    vector< vector< float > >           m_blocks;
+};
+
+//////////////////////////////////////////////////////////////////////////
+// Builds the convex hulls of the planes [begin, end[ with Andrew's
+// monotone chain, the buffers are reused from one plane to the next.
+//////////////////////////////////////////////////////////////////////////
+class FibersCrossSections::HullTask : public ParallelTask
+{
+public:
+    HullTask( FibersCrossSections &sections )
+    :   m_sections( sections )
+    {
+    }
+
+    virtual void run( size_t begin, size_t end )
+    {
+        vector< PlanePoint > points;
+        vector< PlanePoint > hull;
+
+        for( size_t plane = begin; plane < end; ++plane )
+        {
+            const vector< float > &crossings = m_sections.m_crossings[plane];
+            const int nbCrossings = crossings.size() / 3;
+
+            if( nbCrossings < 3 )
+            {
+                continue;
+            }
+
+            mapOnPlane( m_sections.m_planes[plane], crossings, points );
+            buildHull( points, hull );
+
+            if( hull.size() < 3 )
+            {
+                continue;
+            }
+
+            double area( 0.0 );
+            vector< Vector > &hull3D = m_sections.m_hulls[plane];
+            hull3D.reserve( hull.size() );
+
+            for( size_t i = 0; i < hull.size(); ++i )
+            {
+                const PlanePoint &cur  = hull[i];
+                const PlanePoint &next = hull[( i + 1 ) % hull.size()];
+                area += cur.x * next.y - next.x * cur.y;
+
+                const float *pCrossing = &crossings[cur.crossing * 3];
+                hull3D.push_back( Vector( pCrossing[0], pCrossing[1], pCrossing[2] ) );
+            }
+
+            m_sections.m_areas[plane] = std::fabs( area ) / 2.0;
+        }
+    }
+
+private:
+    // Coordinates in an orthonormal basis of the plane, around its center.
+    void mapOnPlane( const Plane &plane, const vector< float > &crossings, vector< PlanePoint > &o_points ) const
+    {
+        const float *n = plane.m_normal;
+
+        // Any axis not too close to the normal gives the first direction.
+        const int axis = std::fabs( n[0] ) < std::fabs( n[1] ) ? ( std::fabs( n[0] ) < std::fabs( n[2] ) ? 0 : 2 )
+                                                               : ( std::fabs( n[1] ) < std::fabs( n[2] ) ? 1 : 2 );
+        double u[3] = { 0.0, 0.0, 0.0 };
+        u[( axis + 1 ) % 3] =  n[( axis + 2 ) % 3];
+        u[( axis + 2 ) % 3] = -n[( axis + 1 ) % 3];
+
+        const double norm = std::sqrt( u[0] * u[0] + u[1] * u[1] + u[2] * u[2] );
+        for( int i = 0; i < 3; ++i )
+        {
+            u[i] /= norm;
+        }
+
+        const double v[3] = { n[1] * u[2] - n[2] * u[1], n[2] * u[0] - n[0] * u[2], n[0] * u[1] - n[1] * u[0] };
+
+        o_points.resize( crossings.size() / 3 );
+
+        for( size_t i = 0; i < o_points.size(); ++i )
+        {
+            const double dx = crossings[i * 3]     - plane.m_center[0];
+            const double dy = crossings[i * 3 + 1] - plane.m_center[1];
+            const double dz = crossings[i * 3 + 2] - plane.m_center[2];
+
+            o_points[i].x        = dx * u[0] + dy * u[1] + dz * u[2];
+            o_points[i].y        = dx * v[0] + dy * v[1] + dz * v[2];
+            o_points[i].crossing = i;
+        }
+    }
+
+    // Counter clockwise hull, without collinear points.
+    void buildHull( vector< PlanePoint > &io_points, vector< PlanePoint > &o_hull ) const
+    {
+        std::sort( io_points.begin(), io_points.end() );
+        o_hull.resize( io_points.size() * 2 );
+
+        size_t size( 0 );
+
+        for( size_t i = 0; i < io_points.size(); ++i )
+        {
+            while( size >= 2 && turn( o_hull[size - 2], o_hull[size - 1], io_points[i] ) <= 0.0 )
+            {
+                --size;
+            }
+            o_hull[size++] = io_points[i];
+        }
+
+        for( size_t i = io_points.size() - 1, lowerSize = size + 1; i > 0; --i )
+        {
+            while( size >= lowerSize && turn( o_hull[size - 2], o_hull[size - 1], io_points[i - 1] ) <= 0.0 )
+            {
+                --size;
+            }
+            o_hull[size++] = io_points[i - 1];
+        }
+
+        // The first point closes the chain.
+        o_hull.resize( size - 1 );
+    }
+
+private:
+    FibersCrossSections &m_sections;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+FibersCrossSections::FibersCrossSections( const vector< Vector > &meanFiber )
+{
+    if( meanFiber.size() < 2 )
+    {
+        return;
+    }
+
+    m_planes.resize( meanFiber.size() );
+    m_normals.resize( meanFiber.size() );
+    m_crossings.resize( meanFiber.size() );
+
+    for( size_t i = 0; i < meanFiber.size(); ++i )
+    {
+        // The last plane takes the direction of the last segment.
+        Vector normal = i + 1 < meanFiber.size() ? meanFiber[i + 1] - meanFiber[i] : meanFiber[i] - meanFiber[i - 1];
+        normal.normalize();
+
+        m_normals[i] = normal;
+        m_planes[i].m_center[0] = meanFiber[i].x;
+        m_planes[i].m_center[1] = meanFiber[i].y;
+        m_planes[i].m_center[2] = meanFiber[i].z;
+        m_planes[i].m_normal[0] = normal.x;
+        m_planes[i].m_normal[1] = normal.y;
+        m_planes[i].m_normal[2] = normal.z;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void FibersCrossSections::addFibers( Fibers *pFibers, const BitSet &selected )
+{
+    if( m_planes.empty() )
+    {
+        return;
+    }
+
+    const size_t nbChunks = pFibers->getVisitChunksCount();
+
+    CutTask task( m_planes, nbChunks );
+    pFibers->visitFibersInChunks( selected, nbChunks, task );
+    task.merge( m_crossings );
+}
+
+void FibersCrossSections::computeHulls()
+{
+    m_hulls.assign( m_planes.size(), vector< Vector >() );
+    m_areas.assign( m_planes.size(), 0.0 );
+
+    HullTask task( *this );
+    parallelFor( m_planes.size(), task );
+}
@@ -0,0 +1,73 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:            FibersCrossSections.h
+//
+// Description: Cross sections of a bundle, cut by the planes perpendicular
+// to its mean fiber at each of its points.
+//
+// Each fiber gives the point where it crosses a plane closest to the mean
+// fiber, and the convex hull of these points is the cross section. The
+// segments of a fiber are bounded by blocks in spheres, and a plane only
+// tests the segments of the blocks it passes through. The crossings are
+// the same as when testing every segment against every plane, whatever
+// the orientation of the fiber or the bend of the bundle. The fibers are
+// cut in parallel chunks, then the hulls of the planes are built in
+// parallel.
+/////////////////////////////////////////////////////////////////////////////
+#ifndef FIBERSCROSSSECTIONS_H_
+#define FIBERSCROSSSECTIONS_H_
+
+#include "../misc/IsoSurface/Vector.h"
+
+#include <cstddef>
+#include <vector>
+
+class BitSet;
+class Fibers;
+
+class FibersCrossSections
+{
+public:
+    FibersCrossSections( const std::vector< Vector > &meanFiber );
+
+    // Cuts the selected fibers of a set, the sets can be added one after
+    // the other before computing the hulls.
+    void    addFibers( Fibers *pFibers, const BitSet &selected );
+    void    computeHulls();
+
+    size_t  getPlanesCount() const                          { return m_planes.size(); }
+    const Vector & getNormal( size_t plane ) const          { return m_normals[plane]; }
+
+    // A plane crossed by less than 3 fibers has no hull and no area.
+    bool    hasHull( size_t plane ) const                   { return !m_hulls[plane].empty(); }
+    double  getArea( size_t plane ) const                   { return m_areas[plane]; }
+    const std::vector< Vector > & getHull( size_t plane ) const { return m_hulls[plane]; }
+
+private:
+    class CutTask;
+    class HullTask;
+
+    struct Plane
+    {
+        float m_center[3];
+        float m_normal[3];
+
+        float getDistance( const float *pPoint ) const
+        {
+            return ( pPoint[0] - m_center[0] ) * m_normal[0] +
+                   ( pPoint[1] - m_center[1] ) * m_normal[1] +
+                   ( pPoint[2] - m_center[2] ) * m_normal[2];
+        }
+    };
+
+private:
+    std::vector< Plane >                    m_planes;
+    std::vector< Vector >                   m_normals;
+
+    // Crossing points of each plane, x, y, z packed.
+    std::vector< std::vector< float > >     m_crossings;
+
+    std::vector< std::vector< Vector > >    m_hulls;
+    std::vector< double >                   m_areas;
+};
+
+#endif // FIBERSCROSSSECTIONS_H_
@@ -7,6 +7,7 @@
 
 #include "Anatomy.h"
 #include "DatasetManager.h"
+#include "FibersWriter.h"
 #include "../Logger.h"
 #include "../main.h"
 #include "../gui/MainFrame.h"
@@ -64,13 +65,6 @@ FibersGroup::~FibersGroup()
     Logger::getInstance()->print( wxT( "Executing FibersGroup destructor" ), LOGLEVEL_DEBUG );
 }
 
-string FibersGroup::intToString( const int number )
-{
-    stringstream out;
-    out << number;
-    return out.str();
-}
-
 
 void FibersGroup::saveDMRI( wxString filename )
 {
@@ -108,122 +102,18 @@ void FibersGroup::saveDMRI( wxString filename )
 }
 
 /**
- * Save using the VTK binary format.
+ * Save the selected fibers of every set using the VTK binary format, or
+ * the TrackVis and MRtrix formats for the .trk and .tck extensions.
  */
 void FibersGroup::save( wxString filename )
 {
-    ofstream myfile;
-    char *pFn = NULL;
-    converterByteINT32 c;
-    converterByteFloat f;
-    vector<char> vBuffer;
-    vector<vector< float > > allPointsToSave;
-    vector<vector< int > > allLinesToSave;
-    vector<vector< int > > allColorsToSave;
-    int allCountLines = 0;
-    float pointsSize = 0.0;
-    int linesSize = 0;
-    int colorsSize = 0;
-
-    if( filename.AfterLast( '.' ) != _T( "fib" ) )
+    if( FibersWriter::getFormat( filename ) == FibersWriter::FORMAT_VTK && filename.AfterLast( '.' ) != _T( "fib" ) )
     {
         filename += _T( ".fib" );
     }
 
-    pFn = ( char * ) malloc( filename.length() );
-    strcpy( pFn, ( const char * ) filename.mb_str( wxConvUTF8 ) );
-    myfile.open( pFn, std::ios::binary );
-
-    vector<Fibers *> fibers = DatasetManager::getInstance()->getFibers();
-    for( vector<Fibers *>::const_iterator it = fibers.begin(); it != fibers.end(); ++it )
-    {
-        vector<float> pointsToSave;
-        vector<int> linesToSave;
-        vector<int> colorsToSave;
-        int countLines = 0;
-        (*it)->getFibersInfoToSave( pointsToSave, linesToSave, colorsToSave, countLines );
-
-        allPointsToSave.push_back( pointsToSave );
-        allLinesToSave.push_back( linesToSave );
-        allColorsToSave.push_back( colorsToSave );
-        pointsSize += pointsToSave.size();
-        linesSize += linesToSave.size();
-        colorsSize += colorsToSave.size();
-        allCountLines += countLines;
-    }
-
-    string header1 = "# vtk DataFile Version 3.0\nvtk output\nBINARY\nDATASET POLYDATA\nPOINTS ";
-
-    header1 += intToString( pointsSize / 3 );
-    header1 += " float\n";
-    for( unsigned int i = 0; i < header1.size(); ++i )
-    {
-        vBuffer.push_back( header1[i] );
-    }
-
-    for(int j = 0; j < (int)allPointsToSave.size(); j++)
-    {
-        for( unsigned int i = 0; i < allPointsToSave[j].size(); ++i )
-        {
-            f.f = allPointsToSave[j][i];
-            vBuffer.push_back( f.b[3] );
-            vBuffer.push_back( f.b[2] );
-            vBuffer.push_back( f.b[1] );
-            vBuffer.push_back( f.b[0] );
-        }
-    }
-
-    vBuffer.push_back( '\n' );
-    string header2 = "LINES " + intToString( allCountLines ) + " " + intToString( linesSize ) + "\n";
-    for( unsigned int i = 0; i < header2.size(); ++i )
-    {
-        vBuffer.push_back( header2[i] );
-    }
-
-    for(int j = 0; j < (int)allLinesToSave.size(); j++)
-    {
-        for( unsigned int i = 0; i < allLinesToSave[j].size(); ++i )
-        {
-            c.i = allLinesToSave[j][i];
-            vBuffer.push_back( c.b[3] );
-            vBuffer.push_back( c.b[2] );
-            vBuffer.push_back( c.b[1] );
-            vBuffer.push_back( c.b[0] );
-        }
-    }
-    
-    vBuffer.push_back( '\n' );
-    string header3 = "POINT_DATA ";
-    header3 += intToString( pointsSize / 3 );
-    header3 += " float\n";
-    header3 += "COLOR_SCALARS scalars 3\n";
-    for( unsigned int i = 0; i < header3.size(); ++i )
-    {
-        vBuffer.push_back( header3[i] );
-    }
-
-    for(int j = 0; j < (int)allColorsToSave.size(); j++)
-    {
-        for( unsigned int i = 0; i < allColorsToSave[j].size(); ++i )
-        {
-            vBuffer.push_back( allColorsToSave[j][i] );
-        }
-    }
-    vBuffer.push_back( '\n' );
-
-    // Put the buffer vector into a char* array.
-    char* pBuffer = new char[vBuffer.size()];
-
-    for( unsigned int i = 0; i < vBuffer.size(); ++i )
-    {
-        pBuffer[i] = vBuffer[i];
-    }
-
-    myfile.write( pBuffer, vBuffer.size() );
-    myfile.close();
-
-    delete[] pBuffer;
-    pBuffer = NULL;
+    FibersWriter writer( DatasetManager::getInstance()->getFibers(), filename );
+    writer.write();
 }
 
 //////////////////////////////////////////////////////////////////////////
@@ -93,8 +93,6 @@ private:
     bool m_isNormalColoringStateChanged;
     bool m_isLocalColoringStateChanged;
 
-    std::string intToString( const int number );
-
     // GUI members
     wxButton *m_pBtnIntensity;
     wxButton *m_pBtnOpacity;
@@ -0,0 +1,209 @@
+#include "FibersStats.h"
+
+#include "Anatomy.h"
+#include "DatasetManager.h"
+#include "FiberTiles.h"
+#include "Fibers.h"
+#include "../misc/BitSet.h"
+#include "../misc/FiberResampling.h"
+
+#include <algorithm>
+#include <limits>
+#include <vector>
+using std::vector;
+
+FibersStats::Accumulator::Accumulator()
+:   m_count( 0 ),
+    m_lengthSum( 0.0 ),
+    m_minLength( std::numeric_limits< float >::max() ),
+    m_maxLength( 0.0f ),
+    m_valueSum( 0.0 ),
+    m_valuePointsCount( 0 )
+{
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Accumulates the fibers of each chunk in the accumulator of this chunk.
+//////////////////////////////////////////////////////////////////////////
+class FibersStats::ChunkTask : public Fibers::ChunkVisitor
+{
+public:
+    ChunkTask( const Fibers &fibers, Anatomy *pValues, unsigned int meanFiberPointsCount,
+               const float *pReference, size_t nbChunks )
+    :   m_fibers( fibers ),
+        m_pValues( NULL ),
+        m_meanFiberPointsCount( meanFiberPointsCount ),
+        m_pReference( pReference ),
+        m_accumulators( nbChunks ),
+        m_resampled( nbChunks, vector< float >( meanFiberPointsCount * 3 ) )
+    {
+        DatasetManager *pDM = DatasetManager::getInstance();
+        m_voxelSize[0] = pDM->getVoxelX();
+        m_voxelSize[1] = pDM->getVoxelY();
+        m_voxelSize[2] = pDM->getVoxelZ();
+
+        if( pValues != NULL )
+        {
+            m_pValues  = pValues->getFloatDataset();
+            m_columns  = pValues->getColumns();
+            m_rows     = pValues->getRows();
+            m_frames   = pValues->getFrames();
+            m_bands    = pValues->getBands();
+        }
+
+        for( size_t chunk = 0; chunk < nbChunks; ++chunk )
+        {
+            m_accumulators[chunk].m_meanFiberSum.assign( meanFiberPointsCount * 3, 0.0 );
+        }
+    }
+
+    virtual void visit( size_t chunk, int fiberId, const float *pPoints, int nbPoints )
+    {
+        if( nbPoints > 0 )
+        {
+            addFiber( pPoints, nbPoints, m_fibers.getFiberLength( fiberId ), m_accumulators[chunk], m_resampled[chunk] );
+        }
+    }
+
+    // The totals are kept in the accumulator of the first chunk.
+    Accumulator & reduce()
+    {
+        Accumulator &total = m_accumulators[0];
+
+        for( size_t chunk = 1; chunk < m_accumulators.size(); ++chunk )
+        {
+            const Accumulator &acc = m_accumulators[chunk];
+
+            total.m_count            += acc.m_count;
+            total.m_lengthSum        += acc.m_lengthSum;
+            total.m_minLength         = std::min( total.m_minLength, acc.m_minLength );
+            total.m_maxLength         = std::max( total.m_maxLength, acc.m_maxLength );
+            total.m_valueSum         += acc.m_valueSum;
+            total.m_valuePointsCount += acc.m_valuePointsCount;
+
+            for( size_t i = 0; i < total.m_meanFiberSum.size(); ++i )
+            {
+                total.m_meanFiberSum[i] += acc.m_meanFiberSum[i];
+            }
+        }
+
+        return total;
+    }
+
+private:
+    void addFiber( const float *pPoints, int nbPoints, float length, Accumulator &io_acc, vector< float > &io_resampled ) const
+    {
+        ++io_acc.m_count;
+        io_acc.m_lengthSum += length;
+        io_acc.m_minLength  = std::min( io_acc.m_minLength, length );
+        io_acc.m_maxLength  = std::max( io_acc.m_maxLength, length );
+
+        if( m_pValues != NULL )
+        {
+            addValues( pPoints, nbPoints, io_acc );
+        }
+
+        if( m_meanFiberPointsCount >= 2 )
+        {
+            bool flipped( false );
+            resampleFiber( pPoints, nbPoints, m_meanFiberPointsCount, &io_resampled[0] );
+            getMdfDistance( m_pReference, &io_resampled[0], m_meanFiberPointsCount, &flipped );
+            addFiberPoints( &io_resampled[0], m_meanFiberPointsCount, flipped, &io_acc.m_meanFiberSum[0] );
+        }
+    }
+
+    void addValues( const float *pPoints, int nbPoints, Accumulator &io_acc ) const
+    {
+        for( int p = 0; p < nbPoints; ++p )
+        {
+            const int col   = static_cast< int >( pPoints[p * 3]     / m_voxelSize[0] );
+            const int row   = static_cast< int >( pPoints[p * 3 + 1] / m_voxelSize[1] );
+            const int frame = static_cast< int >( pPoints[p * 3 + 2] / m_voxelSize[2] );
+
+            if( col < 0 || row < 0 || frame < 0 || col >= m_columns || row >= m_rows || frame >= m_frames )
+            {
+                continue;
+            }
+
+            const size_t pos = ( ( static_cast< size_t >( frame ) * m_rows + row ) * m_columns + col ) * m_bands;
+
+            for( int band = 0; band < m_bands; ++band )
+            {
+                io_acc.m_valueSum += (*m_pValues)[pos + band];
+            }
+
+            ++io_acc.m_valuePointsCount;
+        }
+    }
+
+private:
+    const Fibers                &m_fibers;
+
+    const vector< float >       *m_pValues;
+    int                         m_columns;
+    int                         m_rows;
+    int                         m_frames;
+    int                         m_bands;
+    float                       m_voxelSize[3];
+
+    unsigned int                m_meanFiberPointsCount;
+    const float                 *m_pReference;
+
+    vector< Accumulator >       m_accumulators;
+    vector< vector< float > >   m_resampled;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+FibersStats::FibersStats( Fibers *pFibers, const BitSet &selected, Anatomy *pValues, unsigned int meanFiberPointsCount )
+:   m_count( 0 ),
+    m_lengthSum( 0.0 ),
+    m_minLength( 0.0f ),
+    m_maxLength( 0.0f ),
+    m_valueSum( 0.0 ),
+    m_valuePointsCount( 0 )
+{
+    const size_t firstFiber = selected.findNext( 0 );
+
+    if( firstFiber >= selected.size() )
+    {
+        return;
+    }
+
+    if( meanFiberPointsCount < 2 )
+    {
+        meanFiberPointsCount = 0;
+    }
+
+    // The fibers are oriented like the first one, it is resampled here as
+    // the tiles holding it may be paged out meanwhile.
+    vector< float > reference( std::max( meanFiberPointsCount, 2u ) * 3 );
+    const float *pFirst = pFibers->isOutOfCore() ? pFibers->getFiberTiles()->getFiberPoints( firstFiber )
+                                                 : &pFibers->m_pointArray[pFibers->m_linePointers[firstFiber] * 3];
+    const int firstPointsCount = pFibers->m_linePointers[firstFiber + 1] - pFibers->m_linePointers[firstFiber];
+
+    if( meanFiberPointsCount > 0 && firstPointsCount > 0 && NULL != pFirst )
+    {
+        resampleFiber( pFirst, firstPointsCount, meanFiberPointsCount, &reference[0] );
+    }
+
+    const size_t nbChunks = pFibers->getVisitChunksCount();
+
+    ChunkTask task( *pFibers, pValues, meanFiberPointsCount, &reference[0], nbChunks );
+    pFibers->visitFibersInChunks( selected, nbChunks, task );
+    const Accumulator &total = task.reduce();
+
+    m_count            = total.m_count;
+    m_lengthSum        = total.m_lengthSum;
+    m_minLength        = total.m_minLength;
+    m_maxLength        = total.m_maxLength;
+    m_valueSum         = total.m_valueSum;
+    m_valuePointsCount = total.m_valuePointsCount;
+
+    for( unsigned int k = 0; k < meanFiberPointsCount; ++k )
+    {
+        m_meanFiber.push_back( Vector( total.m_meanFiberSum[k * 3]     / m_count,
+                                       total.m_meanFiberSum[k * 3 + 1] / m_count,
+                                       total.m_meanFiberSum[k * 3 + 2] / m_count ) );
+    }
+}
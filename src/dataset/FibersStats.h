@@ -0,0 +1,70 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:            FibersStats.h
+//
+// Description: Statistics of the selected fibers of a fiber set, computed
+// in one pass reading the points in place.
+//
+// The selected fibers are split in chunks accumulated on separate threads:
+// count and lengths, the values of an anatomy along the fibers and the sum
+// of the fibers resampled for the mean fiber. The accumulators of the chunks
+// are reduced at the end.
+/////////////////////////////////////////////////////////////////////////////
+#ifndef FIBERSSTATS_H_
+#define FIBERSSTATS_H_
+
+#include "../misc/IsoSurface/Vector.h"
+
+#include <cstddef>
+#include <vector>
+
+class Anatomy;
+class BitSet;
+class Fibers;
+
+class FibersStats
+{
+public:
+    // Accumulates the fibers of selected. The mean value is computed when
+    // pValues is not NULL, the mean fiber when meanFiberPointsCount >= 2.
+    FibersStats( Fibers *pFibers, const BitSet &selected, Anatomy *pValues, unsigned int meanFiberPointsCount );
+
+    int     getCount() const        { return m_count; }
+    float   getMeanLength() const   { return m_count > 0 ? static_cast< float >( m_lengthSum / m_count ) : 0.0f; }
+    float   getMinLength() const    { return m_count > 0 ? m_minLength : 0.0f; }
+    float   getMaxLength() const    { return m_maxLength; }
+
+    // Mean of the values of pValues at every point of the fibers.
+    float   getMeanValue() const    { return m_valuePointsCount > 0 ? static_cast< float >( m_valueSum / m_valuePointsCount ) : 0.0f; }
+
+    // The fibers are resampled by arc length to the same number of points
+    // and oriented like the first one, by their MDF distance, before being
+    // averaged. Empty without fibers.
+    const std::vector< Vector > & getMeanFiber() const { return m_meanFiber; }
+
+private:
+    class ChunkTask;
+
+    struct Accumulator
+    {
+        Accumulator();
+
+        int                     m_count;
+        double                  m_lengthSum;
+        float                   m_minLength;
+        float                   m_maxLength;
+        double                  m_valueSum;
+        size_t                  m_valuePointsCount;
+        std::vector< double >   m_meanFiberSum;     // x, y, z of each resampled point
+    };
+
+private:
+    int                     m_count;
+    double                  m_lengthSum;
+    float                   m_minLength;
+    float                   m_maxLength;
+    double                  m_valueSum;
+    size_t                  m_valuePointsCount;
+    std::vector< Vector >   m_meanFiber;
+};
+
+#endif // FIBERSSTATS_H_
@@ -0,0 +1,667 @@
+#include "FibersWriter.h"
+
+#include "DatasetManager.h"
+#include "Fibers.h"
+#include "FiberTiles.h"
+#include "../Logger.h"
+#include "../misc/Fantom/FMatrix.h"
+
+#include <GL/glew.h>
+
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <string>
+
+extern const wxEventType wxEVT_FIBERS_WRITER_EVENT = wxNewEventType();
+
+namespace
+{
+    // Size of the output buffer, the only memory used while writing.
+    const size_t WRITE_BUFFER_SIZE = 1 << 20;
+
+    const size_t TRK_NAME_SIZE  = 20;
+    const size_t TRK_NAMES_SIZE = 200;
+
+    std::string toString( const int number )
+    {
+        std::stringstream out;
+        out << number;
+        return out.str();
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Writes the out-of-core fibers tile by tile, with their global color.
+//////////////////////////////////////////////////////////////////////////
+class FibersWriter::TileWriter : public FiberTiles::Visitor
+{
+public:
+    TileWriter( FibersWriter &writer, Section section )
+    :   m_writer( writer ),
+        m_section( section )
+    {
+    }
+
+    virtual void visit( int, const float *pPoints, int nbPoints, const float *pColor )
+    {
+        const wxUint8 *pSnapshot( NULL );
+        m_writer.writeFiber( m_section, pPoints, nbPoints, NULL, pColor, pSnapshot );
+    }
+
+private:
+    FibersWriter    &m_writer;
+    Section         m_section;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+FibersWriter::FibersWriter( const std::vector< Fibers * > &fibers, const wxString &filename )
+:   m_fibers( fibers ),
+    m_filename( filename.c_str() ),
+    m_format( getFormat( filename ) ),
+    m_exported( fibers.size() ),
+    m_countLines( 0 ),
+    m_countPoints( 0 ),
+    m_pointSnapshots(),
+    m_colorSnapshots(),
+    m_file(),
+    m_buffer(),
+    m_bufferPos( 0 ),
+    m_pWorker( NULL ),
+    m_pHandler( NULL ),
+    m_id( 0 )
+{
+    for( size_t f = 0; f < m_fibers.size(); ++f )
+    {
+        Fibers *pFibers = m_fibers[f];
+        m_exported[f] = pFibers->m_selected;
+        m_exported[f].andNot( pFibers->m_filtered );
+
+        for( size_t l = m_exported[f].findNext( 0 ); l < m_exported[f].size(); l = m_exported[f].findNext( l + 1 ) )
+        {
+            ++m_countLines;
+            m_countPoints += pFibers->getPointsPerLine( l );
+        }
+    }
+
+    DatasetManager *pDatasetManager = DatasetManager::getInstance();
+    m_dim[0]       = pDatasetManager->getColumns();
+    m_dim[1]       = pDatasetManager->getRows();
+    m_dim[2]       = pDatasetManager->getFrames();
+    m_voxelSize[0] = pDatasetManager->getVoxelX();
+    m_voxelSize[1] = pDatasetManager->getVoxelY();
+    m_voxelSize[2] = pDatasetManager->getVoxelZ();
+
+    if( FORMAT_TCK == m_format )
+    {
+        FMatrix localToWorld = Fibers::getLocalToWorld();
+
+        for( int i = 0; i < 3; ++i )
+        {
+            for( int j = 0; j < 4; ++j )
+            {
+                m_toWorld[i][j] = localToWorld( i, j );
+            }
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+FibersWriter::~FibersWriter()
+{
+    wait();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+FibersWriter::Format FibersWriter::getFormat( const wxString &filename )
+{
+    wxString extension = filename.AfterLast( '.' ).Lower();
+
+    if( wxT( "trk" ) == extension )
+    {
+        return FORMAT_TRK;
+    }
+    else if( wxT( "tck" ) == extension )
+    {
+        return FORMAT_TCK;
+    }
+    return FORMAT_VTK;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+bool FibersWriter::write()
+{
+    wait();
+    return writeFile();
+}
+
+//////////////////////////////////////////////////////////////////////////
+// The points and colors may change on the main thread while the worker
+// writes them, and the worker cannot map the GL buffers. The exported
+// points are copied here first, with their colors as the 3 bytes per point
+// written anyway.
+//////////////////////////////////////////////////////////////////////////
+bool FibersWriter::start( wxEvtHandler *pHandler, int id )
+{
+    wait();
+
+    for( size_t f = 0; f < m_fibers.size(); ++f )
+    {
+        if( m_fibers[f]->isOutOfCore() )
+        {
+            return false;
+        }
+    }
+
+    m_pointSnapshots.assign( m_fibers.size(), std::vector< float >() );
+    m_colorSnapshots.assign( m_fibers.size(), std::vector< wxUint8 >() );
+
+    for( size_t f = 0; f < m_fibers.size(); ++f )
+    {
+        Fibers *pFibers = m_fibers[f];
+        std::vector< float > &points = m_pointSnapshots[f];
+
+        for( size_t l = m_exported[f].findNext( 0 ); l < m_exported[f].size(); l = m_exported[f].findNext( l + 1 ) )
+        {
+            const float *pFiberPoints = &pFibers->m_pointArray[pFibers->getStartIndexForLine( l ) * 3];
+            points.insert( points.end(), pFiberPoints, pFiberPoints + pFibers->getPointsPerLine( l ) * 3 );
+        }
+
+        if( FORMAT_TCK == m_format )
+        {
+            continue;
+        }
+
+        const float *pColors( NULL );
+
+        if( pFibers->mapsColorBuffer() )
+        {
+            glBindBuffer( GL_ARRAY_BUFFER, pFibers->m_bufferObjects[1] );
+            pColors = static_cast< const float * >( glMapBuffer( GL_ARRAY_BUFFER, GL_READ_ONLY ) );
+
+            if( NULL == pColors )
+            {
+                m_pointSnapshots.clear();
+                m_colorSnapshots.clear();
+                return false;
+            }
+        }
+        else if( !pFibers->m_colorArray.empty() )
+        {
+            pColors = &pFibers->m_colorArray[0];
+        }
+
+        // Left empty, the fibers are written white.
+        std::vector< wxUint8 > &snapshot = m_colorSnapshots[f];
+
+        for( size_t l = m_exported[f].findNext( 0 ); NULL != pColors && l < m_exported[f].size(); l = m_exported[f].findNext( l + 1 ) )
+        {
+            const float *pFiberColors = &pColors[pFibers->getStartIndexForLine( l ) * 3];
+            for( int i = 0; i < pFibers->getPointsPerLine( l ) * 3; ++i )
+            {
+                snapshot.push_back( static_cast< wxUint8 >( pFiberColors[i] * 255 ) );
+            }
+        }
+
+        if( pFibers->mapsColorBuffer() )
+        {
+            glUnmapBuffer( GL_ARRAY_BUFFER );
+        }
+    }
+
+    m_pHandler = pHandler;
+    m_id       = id;
+    m_pWorker  = new Worker( *this );
+
+    if( wxTHREAD_NO_ERROR != m_pWorker->Create() || wxTHREAD_NO_ERROR != m_pWorker->Run() )
+    {
+        Logger::getInstance()->print( wxT( "Cannot start the writing thread" ), LOGLEVEL_ERROR );
+        delete m_pWorker;
+        m_pWorker = NULL;
+        m_pointSnapshots.clear();
+        m_colorSnapshots.clear();
+        return false;
+    }
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void FibersWriter::wait()
+{
+    if( NULL != m_pWorker )
+    {
+        m_pWorker->Wait();
+        delete m_pWorker;
+        m_pWorker = NULL;
+        m_pointSnapshots.clear();
+        m_colorSnapshots.clear();
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+bool FibersWriter::isRunning()
+{
+    return NULL != m_pWorker && m_pWorker->IsRunning();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+wxThread::ExitCode FibersWriter::Worker::Entry()
+{
+    bool success = m_writer.writeFile();
+
+    wxCommandEvent event( wxEVT_FIBERS_WRITER_EVENT, m_writer.m_id );
+    event.SetInt( success ? 1 : 0 );
+    event.SetString( m_writer.m_filename.c_str() );
+    m_writer.m_pHandler->AddPendingEvent( event );
+
+    return 0;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+bool FibersWriter::writeFile()
+{
+    m_file.open( m_filename.mb_str( wxConvUTF8 ), std::ios::binary );
+
+    if( !m_file.is_open() )
+    {
+        Logger::getInstance()->print( wxString::Format( wxT( "Cannot open \"%s\" for writing." ), m_filename.c_str() ), LOGLEVEL_ERROR );
+        return false;
+    }
+
+    m_buffer.resize( WRITE_BUFFER_SIZE );
+    m_bufferPos = 0;
+
+    switch( m_format )
+    {
+        case FORMAT_TRK:
+            writeTRK();
+            break;
+        case FORMAT_TCK:
+            writeTCK();
+            break;
+        default:
+            writeVTK();
+            break;
+    }
+
+    flush();
+    bool success = m_file.good();
+    m_file.close();
+
+    // The fibers of a tile that could not be read were written without
+    // points, the counts of the file do not match them.
+    for( size_t f = 0; f < m_fibers.size(); ++f )
+    {
+        if( m_fibers[f]->isOutOfCore() && m_fibers[f]->getFiberTiles()->hasReadError() )
+        {
+            success = false;
+        }
+    }
+
+    std::vector< char >().swap( m_buffer );
+
+    if( !success )
+    {
+        Logger::getInstance()->print( wxString::Format( wxT( "Error while writing \"%s\"." ), m_filename.c_str() ), LOGLEVEL_ERROR );
+    }
+    else
+    {
+        Logger::getInstance()->print( wxString::Format( wxT( "%d fibers saved to \"%s\"" ), m_countLines, m_filename.c_str() ), LOGLEVEL_MESSAGE );
+    }
+    return success;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Binary VTK polydata, big endian.
+//////////////////////////////////////////////////////////////////////////
+void FibersWriter::writeVTK()
+{
+    put( "# vtk DataFile Version 3.0\nvtk output\nBINARY\nDATASET POLYDATA\nPOINTS " + toString( m_countPoints ) + " float\n" );
+    writeSection( SECTION_VTK_POINTS );
+
+    put( "\nLINES " + toString( m_countLines ) + " " + toString( m_countLines + m_countPoints ) + "\n" );
+
+    // The lines only need the point counts.
+    int pointIndex( 0 );
+
+    for( size_t f = 0; f < m_fibers.size(); ++f )
+    {
+        // In the order the points were written.
+        std::vector< int > fiberIds;
+
+        if( m_fibers[f]->isOutOfCore() )
+        {
+            m_fibers[f]->getFiberTiles()->getVisitOrder( m_exported[f], fiberIds );
+        }
+        else
+        {
+            for( size_t l = m_exported[f].findNext( 0 ); l < m_exported[f].size(); l = m_exported[f].findNext( l + 1 ) )
+            {
+                fiberIds.push_back( l );
+            }
+        }
+
+        for( size_t i = 0; i < fiberIds.size(); ++i )
+        {
+            int nbPoints = m_fibers[f]->getPointsPerLine( fiberIds[i] );
+            putInt32BE( nbPoints );
+
+            for( int j = 0; j < nbPoints; ++j )
+            {
+                putInt32BE( pointIndex++ );
+            }
+        }
+    }
+
+    put( "\nPOINT_DATA " + toString( m_countPoints ) + " float\nCOLOR_SCALARS scalars 3\n" );
+    writeSection( SECTION_VTK_COLORS );
+    put( "\n" );
+}
+
+//////////////////////////////////////////////////////////////////////////
+// TrackVis file, little endian. The points are written in the anatomy
+// space with a null origin and the colors as the first 3 scalars, which
+// is how Fibers::loadTRK reads them back.
+//////////////////////////////////////////////////////////////////////////
+void FibersWriter::writeTRK()
+{
+    const char *scalarNames[3] = { "color_r", "color_g", "color_b" };
+
+    put( "TRACK", 6 );
+
+    for( int i = 0; i < 3; ++i )
+    {
+        putInt16LE( m_dim[i] );
+    }
+    for( int i = 0; i < 3; ++i )
+    {
+        putFloatLE( m_voxelSize[i] );
+    }
+    putZeros( 3 * 4 );                  // Origin
+
+    putInt16LE( 3 );
+    for( int i = 0; i < 3; ++i )
+    {
+        char name[TRK_NAME_SIZE] = { 0 };
+        strncpy( name, scalarNames[i], TRK_NAME_SIZE - 1 );
+        put( name, TRK_NAME_SIZE );
+    }
+    putZeros( TRK_NAMES_SIZE - 3 * TRK_NAME_SIZE );
+
+    putInt16LE( 0 );                    // Properties
+    putZeros( TRK_NAMES_SIZE );
+
+    putZeros( 16 * 4 );                 // vox_to_ras, not recorded
+    putZeros( 444 );                    // Reserved
+    putZeros( 4 + 4 );                  // Voxel order and padding
+    putZeros( 6 * 4 + 2 );              // Image orientation and padding
+    putZeros( 6 );                      // Inversion and swap flags
+
+    putInt32LE( m_countLines );
+    putInt32LE( 2 );                    // Version
+    putInt32LE( 1000 );                 // Header size
+
+    writeSection( SECTION_TRK_TRACKS );
+}
+
+//////////////////////////////////////////////////////////////////////////
+// MRtrix tracks, little endian, in the world space of the anatomy.
+//////////////////////////////////////////////////////////////////////////
+void FibersWriter::writeTCK()
+{
+    std::string header = "mrtrix tracks\ndatatype: Float32LE\ncount: " + toString( m_countLines ) + "\n";
+    const std::string end = "END\n";
+
+    // The data offset is part of the header it points past.
+    int dataOffset = header.size() + end.size();
+    std::string fileLine;
+
+    do
+    {
+        fileLine   = "file: . " + toString( dataOffset ) + "\n";
+        dataOffset = header.size() + fileLine.size() + end.size();
+    }
+    while( fileLine != "file: . " + toString( dataOffset ) + "\n" );
+
+    put( header + fileLine + end );
+    writeSection( SECTION_TCK_TRACKS );
+
+    const float inf = std::numeric_limits< float >::infinity();
+    for( int k = 0; k < 3; ++k )
+    {
+        putFloatLE( inf );
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Walks the points of the exported fibers: from the snapshots of start()
+// when writing on the worker, otherwise in place, tile by tile for
+// out-of-core sets and from the point array in id order for the others.
+//////////////////////////////////////////////////////////////////////////
+void FibersWriter::writeSection( Section section )
+{
+    const bool needsColors = SECTION_VTK_COLORS == section || SECTION_TRK_TRACKS == section;
+
+    for( size_t f = 0; f < m_fibers.size(); ++f )
+    {
+        Fibers *pFibers = m_fibers[f];
+        const float   *pColors( NULL );
+        const wxUint8 *pSnapshot( NULL );
+        bool isMapped( false );
+
+        if( pFibers->isOutOfCore() )
+        {
+            TileWriter tileWriter( *this, section );
+            pFibers->m_pTiles->visitFibers( m_exported[f], tileWriter );
+            continue;
+        }
+
+        if( !m_pointSnapshots.empty() )
+        {
+            const float *pPoints = m_pointSnapshots[f].empty() ? NULL : &m_pointSnapshots[f][0];
+            pSnapshot = m_colorSnapshots[f].empty() ? NULL : &m_colorSnapshots[f][0];
+
+            for( size_t l = m_exported[f].findNext( 0 ); l < m_exported[f].size(); l = m_exported[f].findNext( l + 1 ) )
+            {
+                const int nbPoints = pFibers->getPointsPerLine( l );
+                writeFiber( section, pPoints, nbPoints, NULL, NULL, pSnapshot );
+                pPoints += nbPoints * 3;
+            }
+            continue;
+        }
+
+        if( needsColors )
+        {
+            if( pFibers->mapsColorBuffer() )
+            {
+                glBindBuffer( GL_ARRAY_BUFFER, pFibers->m_bufferObjects[1] );
+                pColors  = static_cast< const float * >( glMapBuffer( GL_ARRAY_BUFFER, GL_READ_ONLY ) );
+                isMapped = NULL != pColors;
+            }
+            else if( !pFibers->m_colorArray.empty() )
+            {
+                pColors = &pFibers->m_colorArray[0];
+            }
+        }
+
+        for( size_t l = m_exported[f].findNext( 0 ); l < m_exported[f].size(); l = m_exported[f].findNext( l + 1 ) )
+        {
+            const int start = pFibers->getStartIndexForLine( l );
+
+            writeFiber( section, &pFibers->m_pointArray[start * 3], pFibers->getPointsPerLine( l ),
+                        NULL != pColors ? &pColors[start * 3] : NULL, NULL, pSnapshot );
+        }
+
+        if( isMapped )
+        {
+            glUnmapBuffer( GL_ARRAY_BUFFER );
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Writes one fiber of a section. Its colors are taken, in this order, from
+// io_pSnapshot, which is moved past them, from pPointColors, from pFiberColor,
+// and are white otherwise.
+//////////////////////////////////////////////////////////////////////////
+void FibersWriter::writeFiber( Section section, const float *pPoints, int nbPoints,
+                               const float *pPointColors, const float *pFiberColor, const wxUint8 *&io_pSnapshot )
+{
+    const bool  needsColors = SECTION_VTK_COLORS == section || SECTION_TRK_TRACKS == section;
+    const float nan         = std::numeric_limits< float >::quiet_NaN();
+    const float white[3]    = { 1.0f, 1.0f, 1.0f };
+
+    if( NULL == pFiberColor )
+    {
+        pFiberColor = white;
+    }
+
+    if( SECTION_TRK_TRACKS == section )
+    {
+        putInt32LE( nbPoints );
+    }
+
+    for( int j = 0; j < nbPoints; ++j )
+    {
+        const float *pPoint = &pPoints[j * 3];
+        float color[3];
+
+        for( int k = 0; needsColors && k < 3; ++k )
+        {
+            if( NULL != io_pSnapshot )
+            {
+                color[k] = *io_pSnapshot++ / 255.0f;
+            }
+            else
+            {
+                color[k] = NULL != pPointColors ? pPointColors[j * 3 + k] : pFiberColor[k];
+            }
+        }
+
+        switch( section )
+        {
+            case SECTION_VTK_POINTS:
+                putFloatBE( pPoint[0] );
+                putFloatBE( pPoint[1] );
+                putFloatBE( pPoint[2] );
+                break;
+
+            case SECTION_VTK_COLORS:
+                for( int k = 0; k < 3; ++k )
+                {
+                    wxUint8 value = static_cast< wxUint8 >( color[k] * 255 );
+                    put( &value, 1 );
+                }
+                break;
+
+            case SECTION_TRK_TRACKS:
+                putFloatLE( pPoint[0] );
+                putFloatLE( pPoint[1] );
+                putFloatLE( pPoint[2] );
+                putFloatLE( color[0] * 255 );
+                putFloatLE( color[1] * 255 );
+                putFloatLE( color[2] * 255 );
+                break;
+
+            case SECTION_TCK_TRACKS:
+                for( int k = 0; k < 3; ++k )
+                {
+                    putFloatLE( m_toWorld[k][0] * pPoint[0] + m_toWorld[k][1] * pPoint[1] + m_toWorld[k][2] * pPoint[2] + m_toWorld[k][3] );
+                }
+                break;
+        }
+    }
+
+    // A NaN triplet ends each MRtrix track.
+    if( SECTION_TCK_TRACKS == section )
+    {
+        putFloatLE( nan );
+        putFloatLE( nan );
+        putFloatLE( nan );
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void FibersWriter::put( const void *pData, size_t size )
+{
+    if( m_bufferPos + size > m_buffer.size() )
+    {
+        flush();
+
+        if( size > m_buffer.size() )
+        {
+            m_file.write( static_cast< const char * >( pData ), size );
+            return;
+        }
+    }
+
+    memcpy( &m_buffer[m_bufferPos], pData, size );
+    m_bufferPos += size;
+}
+
+void FibersWriter::put( const std::string &text )
+{
+    put( text.c_str(), text.size() );
+}
+
+void FibersWriter::putInt16LE( wxUint16 value )
+{
+    value = wxUINT16_SWAP_ON_BE( value );
+    put( &value, 2 );
+}
+
+void FibersWriter::putInt32LE( wxUint32 value )
+{
+    value = wxUINT32_SWAP_ON_BE( value );
+    put( &value, 4 );
+}
+
+void FibersWriter::putInt32BE( wxUint32 value )
+{
+    value = wxUINT32_SWAP_ON_LE( value );
+    put( &value, 4 );
+}
+
+void FibersWriter::putFloatLE( float value )
+{
+    wxUint32 word;
+    memcpy( &word, &value, 4 );
+    putInt32LE( word );
+}
+
+void FibersWriter::putFloatBE( float value )
+{
+    wxUint32 word;
+    memcpy( &word, &value, 4 );
+    putInt32BE( word );
+}
+
+void FibersWriter::putZeros( size_t size )
+{
+    static const char zeros[64] = { 0 };
+
+    for( ; size > sizeof( zeros ); size -= sizeof( zeros ) )
+    {
+        put( zeros, sizeof( zeros ) );
+    }
+    put( zeros, size );
+}
+
+void FibersWriter::flush()
+{
+    if( m_bufferPos > 0 )
+    {
+        m_file.write( &m_buffer[0], m_bufferPos );
+        m_bufferPos = 0;
+    }
+}
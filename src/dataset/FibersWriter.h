@@ -0,0 +1,122 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:            FibersWriter.h
+//
+// Description: Streams the selected fibers of one or more fiber sets to a
+// VTK (.fib), TrackVis (.trk) or MRtrix (.tck) file.
+//
+// write() reads the points and colors in place from the fiber sets and
+// writes them through a fixed size buffer. start() copies the points and
+// colors of the exported fibers first, so the fiber sets may be recolored
+// or flipped while the worker thread writes them. The fibers to write are
+// fixed when the writer is created, so the selection may change too.
+/////////////////////////////////////////////////////////////////////////////
+#ifndef FIBERSWRITER_H_
+#define FIBERSWRITER_H_
+
+#include "../misc/BitSet.h"
+
+#include <wx/event.h>
+#include <wx/string.h>
+#include <wx/thread.h>
+
+#include <fstream>
+#include <vector>
+
+class Fibers;
+
+extern const wxEventType wxEVT_FIBERS_WRITER_EVENT;
+
+class FibersWriter
+{
+public:
+    enum Format { FORMAT_VTK, FORMAT_TRK, FORMAT_TCK };
+
+    FibersWriter( const std::vector< Fibers * > &fibers, const wxString &filename );
+    ~FibersWriter();
+
+    // Format matching the extension of the file, VTK by default.
+    static Format getFormat( const wxString &filename );
+
+    // Writes the file on the calling thread, which must own the GL context.
+    bool write();
+
+    // Writes the file on a worker thread and posts wxEVT_FIBERS_WRITER_EVENT
+    // to pHandler when done, GetInt() is 1 on success. The fiber sets must
+    // not be deleted meanwhile, wait() blocks until the file is written.
+    // Returns false if the file cannot be written in the background,
+    // out-of-core fiber sets can only be written by write().
+    bool start( wxEvtHandler *pHandler, int id );
+    void wait();
+    bool isRunning();
+
+    const wxString & getFilename() const { return m_filename; }
+
+private:
+    FibersWriter( const FibersWriter & );
+    FibersWriter &operator=( const FibersWriter & );
+
+    class Worker : public wxThread
+    {
+    public:
+        Worker( FibersWriter &writer ) : wxThread( wxTHREAD_JOINABLE ), m_writer( writer ) {}
+
+    protected:
+        virtual ExitCode Entry();
+
+    private:
+        FibersWriter &m_writer;
+    };
+
+    // What is written for each point of the fibers.
+    enum Section { SECTION_VTK_POINTS, SECTION_VTK_COLORS, SECTION_TRK_TRACKS, SECTION_TCK_TRACKS };
+
+    class TileWriter;
+
+    bool    writeFile();
+    void    writeVTK();
+    void    writeTRK();
+    void    writeTCK();
+    void    writeSection( Section section );
+    void    writeFiber( Section section, const float *pPoints, int nbPoints,
+                        const float *pPointColors, const float *pFiberColor, const wxUint8 *&io_pSnapshot );
+
+    void    put( const void *pData, size_t size );
+    void    put( const std::string &text );
+    void    putInt16LE( wxUint16 value );
+    void    putInt32LE( wxUint32 value );
+    void    putInt32BE( wxUint32 value );
+    void    putFloatLE( float value );
+    void    putFloatBE( float value );
+    void    putZeros( size_t size );
+    void    flush();
+
+private:
+    std::vector< Fibers * >                 m_fibers;
+    wxString                                m_filename;
+    Format                                  m_format;
+
+    // Fibers to write for each set, and their total size.
+    std::vector< BitSet >                   m_exported;
+    int                                     m_countLines;
+    int                                     m_countPoints;
+
+    // Points of the exported fibers of each set, in id order, and their
+    // colors in bytes. Filled by start() on the main thread, empty for write().
+    std::vector< std::vector< float > >     m_pointSnapshots;
+    std::vector< std::vector< wxUint8 > >   m_colorSnapshots;
+
+    // Anatomy geometry, read once on the main thread.
+    int                                     m_dim[3];
+    float                                   m_voxelSize[3];
+    float                                   m_toWorld[3][4];
+
+    std::ofstream                           m_file;
+    std::vector< char >                     m_buffer;
+    size_t                                  m_bufferPos;
+
+    Worker                                  *m_pWorker;
+    wxEvtHandler                            *m_pHandler;
+    int                                     m_id;
+};
+
+#endif // FIBERSWRITER_H_
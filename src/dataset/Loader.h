@@ -1,6 +1,7 @@
 #ifndef LOADER_H_
 #define LOADER_H_
 
+#include "AsyncLoader.h"
 #include "DatasetInfo.h"
 #include "DatasetManager.h"
 #include "../Logger.h"
@@ -78,38 +79,7 @@ public:
                 
                 if( result.isOk() )
                 {
-                    DatasetInfo *pDataset = DatasetManager::getInstance()->getDataset( result );
-
-                    switch( pDataset->getType() )
-                    {
-                        case HEAD_BYTE:
-                        case HEAD_SHORT:
-                        case OVERLAY:
-                        case RGB:
-                        {
-                            if( 1 == DatasetManager::getInstance()->getAnatomyCount() )
-                            {
-                                m_pMainFrame->updateSliders();
-                            }
-                            break;
-                        }
-                        case FIBERS:
-                        {
-                            if( !DatasetManager::getInstance()->isFibersGroupLoaded() )
-                            {
-                                DatasetIndex result = DatasetManager::getInstance()->createFibersGroup();
-                                m_pListCtrl->InsertItem( result );
-                            }
-                            break;
-                        }
-                        default:
-                            break;
-                    }
-
-                    m_pListCtrl->InsertItem( result );
-
-                    m_pMainFrame->GetStatusBar()->SetStatusText( wxT( "Ready" ), 1 );
-                    m_pMainFrame->GetStatusBar()->SetStatusText( wxString::Format( wxT( "%s loaded" ), name.c_str() ), 2 );
+                    onLoaded( result, name );
                 }
                 else
                 {
@@ -118,6 +88,79 @@ public:
             }
         }
     }
+
+    // Inserts a file parsed by the AsyncLoader, on the main thread.
+    void operator()( AsyncLoader &asyncLoader, AsyncLoadResult *pResult )
+    {
+        if( asyncLoader.isCancelled( pResult ) )
+        {
+            AsyncLoader::discard( pResult );
+            return;
+        }
+
+        wxString filename = pResult->filename;
+
+        if( wxT( "scn" ) == pResult->extension )
+        {
+            AsyncLoader::discard( pResult );
+            (*this)( filename );
+            return;
+        }
+
+        DatasetIndex result = asyncLoader.insert( pResult );
+
+        if( result.isOk() )
+        {
+            #ifdef __WXMSW__
+            char separator = '\\';
+            #else
+            char separator = '/';
+            #endif
+
+            onLoaded( result, filename.AfterLast( separator ) );
+        }
+        else
+        {
+            ++m_error;
+        }
+    }
+
+private:
+    void onLoaded( DatasetIndex result, const wxString &name )
+    {
+        DatasetInfo *pDataset = DatasetManager::getInstance()->getDataset( result );
+
+        switch( pDataset->getType() )
+        {
+            case HEAD_BYTE:
+            case HEAD_SHORT:
+            case OVERLAY:
+            case RGB:
+            {
+                if( 1 == DatasetManager::getInstance()->getAnatomyCount() )
+                {
+                    m_pMainFrame->updateSliders();
+                }
+                break;
+            }
+            case FIBERS:
+            {
+                if( !DatasetManager::getInstance()->isFibersGroupLoaded() )
+                {
+                    DatasetIndex result = DatasetManager::getInstance()->createFibersGroup();
+                    m_pListCtrl->InsertItem( result );
+                }
+                break;
+            }
+            default:
+                break;
+        }
+
+        m_pListCtrl->InsertItem( result );
+
+        m_pMainFrame->GetStatusBar()->SetStatusText( wxT( "Ready" ), 1 );
+        m_pMainFrame->GetStatusBar()->SetStatusText( wxString::Format( wxT( "%s loaded" ), name.c_str() ), 2 );
+    }
 };
 
 #endif // LOADER_H_
@@ -4,715 +4,783 @@
 #include "../Logger.h"
 #include "../gui/SelectionObject.h"
 #include "../gui/SelectionVOI.h"
+#include "../misc/Morton.h"
+#include "../misc/ParallelFor.h"
 
 #include <algorithm>
+#include <cstring>
+#include <utility>
 #include <vector>
 using std::vector;
 
 //////////////////////////////////////////
-/*Constructor*/
+// Point tests used by the queries. A node
+// overlapping the object is visited, a node
+// contained in it is taken whole.
 //////////////////////////////////////////
-Octree::Octree( int lvl, const std::vector< float > &pointArray, int nb )
-:   m_level(lvl),
-    m_countPoints(nb),
-    m_pointArray(pointArray)    
+class Octree::BoxTest
 {
-    Logger::getInstance()->print( wxT( "Building Octree..." ), LOGLEVEL_MESSAGE );
-    
-    findBoundingBox();
-    classifyPoints();
-    
-    Logger::getInstance()->print( wxT( "Octree done" ), LOGLEVEL_MESSAGE );
-}
-
-//////////////////////////////////////////
-/*Destructor*/
-//////////////////////////////////////////
-Octree::~Octree()
-{
-}
+public:
+    BoxTest( const float boxMin[3], const float boxMax[3] )
+    {
+        for( int k = 0; k < 3; ++k )
+        {
+            m_min[k] = boxMin[k];
+            m_max[k] = boxMax[k];
+        }
+    }
 
-//////////////////////////////////////////
-//Bounding box of the points
-//////////////////////////////////////////
-void Octree::findBoundingBox()
-{
-    m_maxPointX = m_pointArray[0];
-    m_maxPointY = m_pointArray[1];
-    m_maxPointZ = m_pointArray[2];
+    bool overlaps( const float nodeMin[3], const float nodeMax[3] ) const
+    {
+        for( int k = 0; k < 3; ++k )
+        {
+            if( nodeMax[k] < m_min[k] || nodeMin[k] > m_max[k] )
+            {
+                return false;
+            }
+        }
+        return true;
+    }
 
-    m_minPointX = m_pointArray[0];
-    m_minPointY = m_pointArray[1];
-    m_minPointZ = m_pointArray[2];
+    bool contains( const float nodeMin[3], const float nodeMax[3] ) const
+    {
+        return isInside( nodeMin ) && isInside( nodeMax );
+    }
 
-    //Find the bounding box for the dataSet
-    for(int i=0; i < m_countPoints; i++)
+    bool isInside( const float *pPoint ) const
     {
-        if(m_pointArray[i*3] > m_maxPointX)
-            m_maxPointX = m_pointArray[i*3];
+        return pPoint[0] >= m_min[0] && pPoint[0] <= m_max[0]
+            && pPoint[1] >= m_min[1] && pPoint[1] <= m_max[1]
+            && pPoint[2] >= m_min[2] && pPoint[2] <= m_max[2];
+    }
 
-        if(m_pointArray[i*3+1] > m_maxPointY)
-            m_maxPointY = m_pointArray[i*3+1];
+protected:
+    float m_min[3];
+    float m_max[3];
+};
 
-        if(m_pointArray[i*3+2] > m_maxPointZ)
-            m_maxPointZ = m_pointArray[i*3+2];
+class Octree::EllipsoidTest : public Octree::BoxTest
+{
+public:
+    EllipsoidTest( const float boxMin[3], const float boxMax[3] )
+    :   BoxTest( boxMin, boxMax )
+    {
+        for( int k = 0; k < 3; ++k )
+        {
+            m_radius[k] = ( boxMax[k] - boxMin[k] ) / 2.0f;
+            m_center[k] = boxMax[k] - m_radius[k];
+        }
+    }
 
-        if(m_pointArray[i*3] < m_minPointX)
-            m_minPointX = m_pointArray[i*3];
+    // The ellipsoid is convex, it contains the node if it contains its 8 corners.
+    bool contains( const float nodeMin[3], const float nodeMax[3] ) const
+    {
+        for( int corner = 0; corner < 8; ++corner )
+        {
+            float point[3] = { ( corner & 1 ) ? nodeMax[0] : nodeMin[0],
+                               ( corner & 2 ) ? nodeMax[1] : nodeMin[1],
+                               ( corner & 4 ) ? nodeMax[2] : nodeMin[2] };
+            if( !isInside( point ) )
+            {
+                return false;
+            }
+        }
+        return true;
+    }
 
-        if(m_pointArray[i*3+1] < m_minPointY)
-            m_minPointY = m_pointArray[i*3+1];
+    bool isInside( const float *pPoint ) const
+    {
+        float sum( 0.0f );
 
-        if(m_pointArray[i*3+2] < m_minPointZ)
-            m_minPointZ = m_pointArray[i*3+2];
+        for( int k = 0; k < 3; ++k )
+        {
+            sum += ( pPoint[k] - m_center[k] ) * ( pPoint[k] - m_center[k] ) / ( m_radius[k] * m_radius[k] );
+        }
+        return sum <= 1.0f;
     }
-}
 
-//////////////////////////////////////////
-//Classify points from a dataset into specifics octree divisions
-// front:   in front of XY plane
-// back:    behind XY plane
-// bottom:  under XZ plane
-// up:      over XZ plane
-// left:    left of YZ plane
-// right:   right of YZ plane
-/////////////////////////////////////////
-void Octree::classifyPoints()
+private:
+    float m_center[3];
+    float m_radius[3];
+};
+
+class Octree::VOITest : public Octree::BoxTest
 {
-    vector<int> bigVolume1;
-    vector<int> bigVolume2;
-    vector<int> bigVolume3;
-    vector<int> bigVolume4;
-    vector<int> bigVolume5;
-    vector<int> bigVolume6;
-    vector<int> bigVolume7;
-    vector<int> bigVolume8;
-
-    //Cutting planes
-    float midX = (m_maxPointX + m_minPointX) / 2.0f;
-    float midY = (m_maxPointY + m_minPointY) / 2.0f;
-    float midZ = (m_maxPointZ + m_minPointZ) / 2.0f;
-
-    float posX, posY, posZ;
-        
-    //fill the tree 
-    for(int i=0; i < m_countPoints; i++)
-    {
-        posX = m_pointArray[i*3];
-        posY = m_pointArray[i*3+1];
-        posZ = m_pointArray[i*3+2];
-         
-        if(posX <= midX && posY <= midY && posZ <= midZ)  //front bottom left   
-            bigVolume1.push_back(i);
-
-        else if(posX <= midX && posY > midY && posZ <= midZ) //front up left
-            bigVolume2.push_back(i);    
-
-        else if(posX > midX && posY <= midY && posZ <= midZ) //front bottom right
-            bigVolume3.push_back(i);  
-
-        else if(posX > midX && posY > midY && posZ <= midZ) //front up right
-            bigVolume4.push_back(i);
-
-        else if(posX <= midX && posY <= midY && posZ > midZ) //back bottom left
-            bigVolume5.push_back(i);
-    
-        else if(posX <= midX && posY > midY && posZ > midZ) //back up left
-            bigVolume6.push_back(i);
-   
-        else if(posX > midX && posY <= midY && posZ > midZ) //back bottom right
-            bigVolume7.push_back(i);
-
-        else //back up right
-            bigVolume8.push_back(i);
-    }
-    
-    //Split each of the 8 boxes, into 8miniboxes
-    subClassifyPoints( bigVolume1, m_minPointX, m_minPointY, m_minPointZ, midX, midY, midZ, m_quad1 ); //front bottom left 
-    subClassifyPoints( bigVolume2, m_minPointX, midY, m_minPointZ, midX, m_maxPointY, midZ, m_quad2 ); //front up left
-    subClassifyPoints( bigVolume3, midX, m_minPointY, m_minPointZ, m_maxPointX, midY, midZ, m_quad3 ); //front bottom right
-    subClassifyPoints( bigVolume4, midX, midY, m_minPointZ, m_maxPointX, m_maxPointY, midZ, m_quad4 ); //front up right
-    subClassifyPoints( bigVolume5, m_minPointX, m_minPointY, midZ, midX, midY, m_maxPointZ, m_quad5 ); //back bottom left
-    subClassifyPoints( bigVolume6, m_minPointX, midY, midZ, midX, m_maxPointY, m_maxPointZ, m_quad6 ); //back up left
-    subClassifyPoints( bigVolume7, midX, m_minPointY, midZ, m_maxPointX, midY, m_maxPointZ, m_quad7 ); //back bottom right
-    subClassifyPoints( bigVolume8 ,midX, midY, midZ, m_maxPointX, m_maxPointY, m_maxPointZ, m_quad8 ); //back up right
+public:
+    VOITest( const float boxMin[3], const float boxMax[3], const SelectionVOI *pVOI )
+    :   BoxTest( boxMin, boxMax ),
+        m_pVOI( pVOI )
+    {
+    }
 
-}
+    bool contains( const float *, const float * ) const
+    {
+        return false;
+    }
 
-//////////////////////////////////////////
-//Subdivide the space
-//////////////////////////////////////////
-void Octree::subClassifyPoints( vector<int> i_bigVolume, int i_xmin, int i_ymin, int i_zmin, int i_xmax, int i_ymax, int i_zmax, vector<vector<int > >& o_tree )
-{
-    vector<int> volume1;
-    vector<int> volume2;
-    vector<int> volume3;
-    vector<int> volume4;
-    vector<int> volume5;
-    vector<int> volume6;
-    vector<int> volume7;
-    vector<int> volume8;
-
-    //Cuting planes
-    float midX = (i_xmax + i_xmin) / 2.0f;
-    float midY = (i_ymax + i_ymin) / 2.0f;
-    float midZ = (i_zmax + i_zmin) / 2.0f;
-
-    float posX,posY,posZ;
-    int indice;
-        
-    //fill the tree 
-    for(unsigned int i=0; i < i_bigVolume.size(); i++)
-    {
-        indice = i_bigVolume[i];
-        posX = m_pointArray[indice*3];
-        posY = m_pointArray[indice*3+1];
-        posZ = m_pointArray[indice*3+2];
-         
-        if(posX <= midX && posY <= midY && posZ <= midZ)  //front bottom left   
-            volume1.push_back(indice);
-
-        else if(posX <= midX && posY > midY && posZ <= midZ) //front up left
-            volume2.push_back(indice);    
-
-        else if(posX > midX && posY <= midY && posZ <= midZ) //front bottom right
-            volume3.push_back(indice);  
-
-        else if(posX > midX && posY > midY && posZ <= midZ) //front up right
-            volume4.push_back(indice);
-
-        else if(posX <= midX && posY <= midY && posZ > midZ) //back bottom left
-            volume5.push_back(indice);
-    
-        else if(posX <= midX && posY > midY && posZ > midZ) //back up left
-            volume6.push_back(indice);
-   
-        else if(posX > midX && posY <= midY && posZ > midZ) //back bottom right
-            volume7.push_back(indice);
-
-        else //back up right
-            volume8.push_back(indice);
-    }
-    
-    o_tree.push_back(volume1);
-    o_tree.push_back(volume2);
-    o_tree.push_back(volume3);
-    o_tree.push_back(volume4);
-    o_tree.push_back(volume5);
-    o_tree.push_back(volume6);
-    o_tree.push_back(volume7);
-    o_tree.push_back(volume8);
+    bool isInside( const float *pPoint ) const
+    {
+        return m_pVOI->isPointInside( pPoint[0], pPoint[1], pPoint[2] );
+    }
 
-}
+private:
+    const SelectionVOI *m_pVOI;
+};
 
 //////////////////////////////////////////
-//Return points that are inside a BOX or an ELLPISOID
+// Parallel build. The points are cut in
+// fixed chunks, the radix sort passes
+// count then scatter the codes per chunk.
 //////////////////////////////////////////
-vector<int> Octree::getPointsInside( SelectionObject* i_selectionObject )
+namespace
 {
-    Vector l_center = i_selectionObject->getCenter();
-    Vector l_size   = i_selectionObject->getSize();
+    const int    OCTREE_PARALLEL_CHUNK = 65536;
+    const int    RADIX_BUCKETS         = 1 << MORTON_BITS;
 
-    m_boxMin.resize( 3 );
-    m_boxMax.resize( 3 );
-
-    float voxelX = DatasetManager::getInstance()->getVoxelX();
-    float voxelY = DatasetManager::getInstance()->getVoxelY();
-    float voxelZ = DatasetManager::getInstance()->getVoxelZ();
+    size_t getChunksCount( size_t count )
+    {
+        return std::max( static_cast< size_t >( 1 ),
+                         std::min( static_cast< size_t >( getParallelThreadsCount() ), count / OCTREE_PARALLEL_CHUNK ) );
+    }
 
-    m_boxMin[0] = l_center.x - l_size.x / 2 * voxelX;
-    m_boxMax[0] = l_center.x + l_size.x / 2 * voxelX;
-    m_boxMin[1] = l_center.y - l_size.y / 2 * voxelY;
-    m_boxMax[1] = l_center.y + l_size.y / 2 * voxelY;
-    m_boxMin[2] = l_center.z - l_size.z / 2 * voxelZ;
-    m_boxMax[2] = l_center.z + l_size.z / 2 * voxelZ;
-    
-    m_id.clear();
-    if(i_selectionObject->getSelectionType() == BOX_TYPE)
-        boxTest( m_minPointX, m_minPointY, m_minPointZ, m_maxPointX, m_maxPointY, m_maxPointZ, 0, m_quad1 );
-    else  if( i_selectionObject->getSelectionType() == ELLIPSOID_TYPE )
+    size_t getChunkBegin( size_t count, size_t nbChunks, size_t chunk )
     {
-        ellipsoidTest( m_minPointX, m_minPointY, m_minPointZ, m_maxPointX, m_maxPointY, m_maxPointZ, 0, m_quad1 );
+        return count / nbChunks * chunk + std::min( chunk, count % nbChunks );
     }
-    else
+
+    class BoundsTask : public ParallelTask
     {
-        VOITest( m_minPointX, m_minPointY, m_minPointZ, m_maxPointX, m_maxPointY, m_maxPointZ, 0, m_quad1, i_selectionObject );
+    public:
+        BoundsTask( const float *pPoints, size_t count, size_t nbChunks, vector< float > &bounds )
+        :   m_pPoints( pPoints ),
+            m_count( count ),
+            m_nbChunks( nbChunks ),
+            m_bounds( bounds )
+        {
+        }
+
+        virtual void run( size_t begin, size_t end )
+        {
+            for( size_t chunk = begin; chunk < end; ++chunk )
+            {
+                const size_t first = getChunkBegin( m_count, m_nbChunks, chunk );
+                const size_t last  = getChunkBegin( m_count, m_nbChunks, chunk + 1 );
+                float *pBounds = &m_bounds[chunk * 6];
+
+                for( int k = 0; k < 3; ++k )
+                {
+                    pBounds[k] = pBounds[k + 3] = m_pPoints[first * 3 + k];
+                }
+
+                for( size_t i = first + 1; i < last; ++i )
+                {
+                    for( int k = 0; k < 3; ++k )
+                    {
+                        pBounds[k]     = std::min( pBounds[k],     m_pPoints[i * 3 + k] );
+                        pBounds[k + 3] = std::max( pBounds[k + 3], m_pPoints[i * 3 + k] );
+                    }
+                }
+            }
+        }
+
+    private:
+        const float     *m_pPoints;
+        size_t          m_count;
+        size_t          m_nbChunks;
+        vector< float > &m_bounds;
+    };
+
+    void getPointsBounds( const float *pPoints, size_t count, float minPoint[3], float maxPoint[3] )
+    {
+        const size_t nbChunks = getChunksCount( count );
+        vector< float > bounds( nbChunks * 6 );
+
+        BoundsTask task( pPoints, count, nbChunks, bounds );
+        parallelFor( nbChunks, task );
+
+        for( int k = 0; k < 3; ++k )
+        {
+            minPoint[k] = bounds[k];
+            maxPoint[k] = bounds[k + 3];
+
+            for( size_t chunk = 1; chunk < nbChunks; ++chunk )
+            {
+                minPoint[k] = std::min( minPoint[k], bounds[chunk * 6 + k] );
+                maxPoint[k] = std::max( maxPoint[k], bounds[chunk * 6 + k + 3] );
+            }
+        }
     }
 
-    return m_id;
+    class MortonCodesTask : public ParallelTask
+    {
+    public:
+        MortonCodesTask( const MortonGrid &grid, const float *pPoints, unsigned int *pCodes, int *pIndices )
+        :   m_grid( grid ),
+            m_pPoints( pPoints ),
+            m_pCodes( pCodes ),
+            m_pIndices( pIndices )
+        {
+        }
 
-}
+        virtual void run( size_t begin, size_t end )
+        {
+            for( size_t i = begin; i < end; ++i )
+            {
+                m_pCodes[i]   = m_grid.getCode( &m_pPoints[i * 3] );
+                m_pIndices[i] = i;
+            }
+        }
 
-//////////////////////////////////////////
-// Return points that are inside a bounding box
-// defined from the coordinates of its corners.
-//////////////////////////////////////////
-vector< int > Octree::getPointsInBoundingBox( int xMin, int yMin, int zMin, int xMax, int yMax, int zMax )
-{
-    m_id.clear();
-    m_boxMin.resize( 3 );
-    m_boxMax.resize( 3 );
-    
-    float voxelX = DatasetManager::getInstance()->getVoxelX();
-    float voxelY = DatasetManager::getInstance()->getVoxelY();
-    float voxelZ = DatasetManager::getInstance()->getVoxelZ();
+    private:
+        const MortonGrid &m_grid;
+        const float      *m_pPoints;
+        unsigned int     *m_pCodes;
+        int              *m_pIndices;
+    };
 
-    m_boxMin[0] = xMin * voxelX;
-    m_boxMin[1] = yMin * voxelY;
-    m_boxMin[2] = zMin * voxelZ;
-    m_boxMax[0] = xMax * voxelX;
-    m_boxMax[1] = yMax * voxelY;
-    m_boxMax[2] = zMax * voxelZ;
-    
-    boxTest( m_minPointX, m_minPointY, m_minPointZ, m_maxPointX, m_maxPointY, m_maxPointZ, 0, m_quad1 );
-    
-    return m_id;
-}
+    // Counts the digits of each chunk (m_pKeysOut NULL), or moves the
+    // chunk entries to their offsets, which keeps the sort stable.
+    class RadixPassTask : public ParallelTask
+    {
+    public:
+        RadixPassTask( const unsigned int *pKeys, const int *pValues, unsigned int *pKeysOut, int *pValuesOut,
+                       size_t count, size_t nbChunks, int shift, vector< size_t > &offsets )
+        :   m_pKeys( pKeys ),
+            m_pValues( pValues ),
+            m_pKeysOut( pKeysOut ),
+            m_pValuesOut( pValuesOut ),
+            m_count( count ),
+            m_nbChunks( nbChunks ),
+            m_shift( shift ),
+            m_offsets( offsets )
+        {
+        }
 
-void Octree::flipX()
-{
-    std::swap( m_quad1, m_quad3 );
-    std::swap( m_quad2, m_quad4 );
-    std::swap( m_quad5, m_quad7 );
-    std::swap( m_quad6, m_quad8 );
-    
-    flipXInternalVector( m_quad1 );
-    flipXInternalVector( m_quad2 );
-    flipXInternalVector( m_quad3 );
-    flipXInternalVector( m_quad4 );
-    flipXInternalVector( m_quad5 );
-    flipXInternalVector( m_quad6 );
-    flipXInternalVector( m_quad7 );
-    flipXInternalVector( m_quad8 );
-}
+        virtual void run( size_t begin, size_t end )
+        {
+            for( size_t chunk = begin; chunk < end; ++chunk )
+            {
+                const size_t first = getChunkBegin( m_count, m_nbChunks, chunk );
+                const size_t last  = getChunkBegin( m_count, m_nbChunks, chunk + 1 );
+                size_t *pOffsets = &m_offsets[chunk * RADIX_BUCKETS];
 
-void Octree::flipY()
-{
-    std::swap( m_quad1, m_quad2 );
-    std::swap( m_quad3, m_quad4 );
-    std::swap( m_quad5, m_quad6 );
-    std::swap( m_quad7, m_quad8 );
-    
-    flipYInternalVector( m_quad1 );
-    flipYInternalVector( m_quad2 );
-    flipYInternalVector( m_quad3 );
-    flipYInternalVector( m_quad4 );
-    flipYInternalVector( m_quad5 );
-    flipYInternalVector( m_quad6 );
-    flipYInternalVector( m_quad7 );
-    flipYInternalVector( m_quad8 );
+                for( size_t i = first; i < last; ++i )
+                {
+                    const unsigned int digit = ( m_pKeys[i] >> m_shift ) & ( RADIX_BUCKETS - 1 );
+
+                    if( NULL == m_pKeysOut )
+                    {
+                        ++pOffsets[digit];
+                    }
+                    else
+                    {
+                        const size_t pos = pOffsets[digit]++;
+                        m_pKeysOut[pos]   = m_pKeys[i];
+                        m_pValuesOut[pos] = m_pValues[i];
+                    }
+                }
+            }
+        }
+
+    private:
+        const unsigned int  *m_pKeys;
+        const int           *m_pValues;
+        unsigned int        *m_pKeysOut;
+        int                 *m_pValuesOut;
+        size_t              m_count;
+        size_t              m_nbChunks;
+        int                 m_shift;
+        vector< size_t >    &m_offsets;
+    };
+
+    // Sorts the Morton codes and their point indices, one pass per axis level group.
+    void radixSort( vector< unsigned int > &keys, vector< int > &values )
+    {
+        const size_t count    = keys.size();
+        const size_t nbChunks = getChunksCount( count );
+
+        vector< unsigned int > keysOut( count );
+        vector< int >          valuesOut( count );
+        vector< size_t >       offsets( nbChunks * RADIX_BUCKETS );
+
+        for( int shift = 0; shift < 3 * MORTON_BITS; shift += MORTON_BITS )
+        {
+            std::fill( offsets.begin(), offsets.end(), 0 );
+
+            RadixPassTask countTask( &keys[0], &values[0], NULL, NULL, count, nbChunks, shift, offsets );
+            parallelFor( nbChunks, countTask );
+
+            // Counts to start positions, by digit then by chunk.
+            size_t total( 0 );
+            for( int digit = 0; digit < RADIX_BUCKETS; ++digit )
+            {
+                for( size_t chunk = 0; chunk < nbChunks; ++chunk )
+                {
+                    size_t digitCount = offsets[chunk * RADIX_BUCKETS + digit];
+                    offsets[chunk * RADIX_BUCKETS + digit] = total;
+                    total += digitCount;
+                }
+            }
+
+            RadixPassTask scatterTask( &keys[0], &values[0], &keysOut[0], &valuesOut[0], count, nbChunks, shift, offsets );
+            parallelFor( nbChunks, scatterTask );
+
+            keys.swap( keysOut );
+            values.swap( valuesOut );
+        }
+    }
 }
 
-void Octree::flipZ()
+// Builds the subtrees below the given (node, level) roots, each one in its own array.
+class Octree::SubtreeTask : public ParallelTask
 {
-    std::swap( m_quad1, m_quad5 );
-    std::swap( m_quad3, m_quad7 );
-    std::swap( m_quad2, m_quad6 );
-    std::swap( m_quad4, m_quad8 );
-    
-    flipZInternalVector( m_quad1 );
-    flipZInternalVector( m_quad2 );
-    flipZInternalVector( m_quad3 );
-    flipZInternalVector( m_quad4 );
-    flipZInternalVector( m_quad5 );
-    flipZInternalVector( m_quad6 );
-    flipZInternalVector( m_quad7 );
-    flipZInternalVector( m_quad8 );
-}
+public:
+    SubtreeTask( const Octree &octree, const vector< unsigned int > &codes,
+                 const vector< std::pair< int, int > > &roots, vector< vector< Octree::Node > > &subtrees )
+    :   m_octree( octree ),
+        m_codes( codes ),
+        m_roots( roots ),
+        m_subtrees( subtrees )
+    {
+    }
+
+    virtual void run( size_t begin, size_t end )
+    {
+        for( size_t i = begin; i < end; ++i )
+        {
+            m_subtrees[i].assign( 1, m_octree.m_nodes[m_roots[i].first] );
+            m_octree.buildNode( m_subtrees[i], 0, m_codes, m_roots[i].second );
+        }
+    }
 
-void Octree::flipXInternalVector( vector< vector< int > > &vectToFlip )
+private:
+    const Octree                            &m_octree;
+    const vector< unsigned int >            &m_codes;
+    const vector< std::pair< int, int > >   &m_roots;
+    vector< vector< Octree::Node > >        &m_subtrees;
+};
+
+//////////////////////////////////////////
+/*Constructor*/
+//////////////////////////////////////////
+Octree::Octree( const std::vector< float > &pointArray, int nb, int leafCapacity )
+:   m_leafCapacity( std::max( 1, leafCapacity ) ),
+    m_countPoints( nb ),
+    m_pointArray( pointArray )
 {
-    std::swap( vectToFlip[0], vectToFlip[2] );
-    std::swap( vectToFlip[1], vectToFlip[3] );
-    std::swap( vectToFlip[4], vectToFlip[6] );
-    std::swap( vectToFlip[5], vectToFlip[7] );
+    Logger::getInstance()->print( wxT( "Building Octree..." ), LOGLEVEL_MESSAGE );
+
+    build();
+
+    Logger::getInstance()->print( wxString::Format( wxT( "Octree done, %d nodes" ), getNodesCount() ), LOGLEVEL_MESSAGE );
 }
 
-void Octree::flipYInternalVector( vector< vector< int > > &vectToFlip )
+//////////////////////////////////////////
+/*Constructor from serialized data*/
+// Falls back to a regular build if the
+// data does not match the points.
+//////////////////////////////////////////
+Octree::Octree( const std::vector< float > &pointArray, int nb, const char *pSerialized, size_t size )
+:   m_leafCapacity( OCTREE_LEAF_CAPACITY ),
+    m_countPoints( nb ),
+    m_pointArray( pointArray )
 {
-    std::swap( vectToFlip[0], vectToFlip[1] );
-    std::swap( vectToFlip[2], vectToFlip[3] );
-    std::swap( vectToFlip[4], vectToFlip[5] );
-    std::swap( vectToFlip[6], vectToFlip[7] );
+    if( !deserialize( pSerialized, size ) )
+    {
+        Logger::getInstance()->print( wxT( "Invalid serialized Octree, building it again..." ), LOGLEVEL_WARNING );
+
+        m_leafCapacity = OCTREE_LEAF_CAPACITY;
+        build();
+    }
 }
 
-void Octree::flipZInternalVector( vector< vector< int > > &vectToFlip )
+//////////////////////////////////////////
+/*Destructor*/
+//////////////////////////////////////////
+Octree::~Octree()
 {
-    std::swap( vectToFlip[0], vectToFlip[4] );
-    std::swap( vectToFlip[2], vectToFlip[6] );
-    std::swap( vectToFlip[1], vectToFlip[5] );
-    std::swap( vectToFlip[3], vectToFlip[7] );
 }
 
 //////////////////////////////////////////
-// BOX case
+// Sorts the points along the Morton curve
+// of their bounding box, then splits the
+// root until the leaves are small enough.
+// The top levels are split here, the
+// subtrees below are built in parallel.
 //////////////////////////////////////////
-void Octree::boxTest( int i_minx, int i_miny, int i_minz, int i_maxx, int i_maxy, int i_maxz, int lvl, const vector<vector<int > >& currSub )
+void Octree::build()
 {
-    if(lvl == 2)
+    m_nodes.clear();
+    m_points.clear();
+
+    if( m_countPoints <= 0 )
+    {
         return;
+    }
 
-    int indice;
+    float minPoint[3];
+    float maxPoint[3];
+    getPointsBounds( &m_pointArray[0], m_countPoints, minPoint, maxPoint );
 
-    //Box extremities
-    float xMin = m_boxMin[0];
-    float xMax = m_boxMax[0];
-    float yMin = m_boxMin[1];
-    float yMax = m_boxMax[1];
-    float zMin = m_boxMin[2];
-    float zMax = m_boxMax[2];
+    // The depth of the tree is bounded by the MORTON_BITS levels of the grid.
+    MortonGrid grid( minPoint, maxPoint );
+    vector< unsigned int > codes( m_countPoints );
+    m_points.resize( m_countPoints );
 
-    //Octree planes cutting
-    float midX = (i_maxx + i_minx)  / 2.0f;
-    float midY = (i_maxy + i_miny) / 2.0f;
-    float midZ = (i_maxz + i_minz) / 2.0f;
-    
+    MortonCodesTask codesTask( grid, &m_pointArray[0], &codes[0], &m_points[0] );
+    parallelFor( m_countPoints, codesTask, OCTREE_PARALLEL_CHUNK );
 
-    //Checks in which Octree the selection Box is
-    vector<bool> inBoxes(8, false);
+    radixSort( codes, m_points );
 
-    if(xMin < midX && xMax > i_minx)
-        if(yMin < midY && yMax > i_miny)
-            if(zMin < midZ && zMax > i_minz)
-            {
-                inBoxes[0] = true;
-                boxTest( i_minx, i_miny, i_minz, midX, midY, midZ, lvl+1, m_quad1 ); // Front Bottom Left
+    Node root;
+    root.m_begin = 0;
+    root.m_end   = m_countPoints;
+    m_nodes.push_back( root );
 
-            }
+    // Split the top levels breadth first, until there are enough subtrees
+    // to keep the threads busy. The nodes split here get their bounds last.
+    vector< std::pair< int, int > > subtreeRoots( 1, std::make_pair( 0, 0 ) );
+    vector< int > splitNodes;
+    const size_t subtreesTarget = m_countPoints > OCTREE_PARALLEL_CHUNK ? getParallelThreadsCount() * 8 : 1;
 
-   if(xMin < midX && xMax > i_minx)
-        if(yMin < i_maxy && yMax > midY)
-            if(zMin < midZ && zMax > i_minz)
-            {
-                inBoxes[1] = true;
-                boxTest( i_minx, midY, i_minz, midX, i_maxy, midZ, lvl+1, m_quad2 ); //Front Up Left
-            }
+    while( !subtreeRoots.empty() && subtreeRoots.size() < subtreesTarget )
+    {
+        vector< std::pair< int, int > > nextRoots;
 
-    if(xMin < i_maxx && xMax > midX)
-        if(yMin < midY && yMax > i_miny)
-            if(zMin < midZ && zMax > i_minz)
-            {
-                inBoxes[2] = true;
-                boxTest( midX, i_miny, i_minz, i_maxx, midY, midZ, lvl+1, m_quad3 ); //Front Bottom Right
-            }
+        for( size_t i = 0; i < subtreeRoots.size(); ++i )
+        {
+            const int nodeIdx = subtreeRoots[i].first;
+            const int level   = subtreeRoots[i].second;
 
-    if(xMin < i_maxx && xMax > midX)
-        if(yMin < i_maxy && yMax > midY)
-            if(zMin < midZ && zMax > i_minz)
+            if( splitNode( m_nodes, nodeIdx, codes, level ) )
             {
-                inBoxes[3] = true;
-                boxTest( midX, midY, i_minz, i_maxx, i_maxy, midZ, lvl+1, m_quad4 ); //Front Up Right
+                splitNodes.push_back( nodeIdx );
+
+                for( int c = 0; c < m_nodes[nodeIdx].m_childCount; ++c )
+                {
+                    nextRoots.push_back( std::make_pair( m_nodes[nodeIdx].m_firstChild + c, level + 1 ) );
+                }
             }
+        }
+
+        subtreeRoots.swap( nextRoots );
+    }
+
+    vector< vector< Node > > subtrees( subtreeRoots.size() );
+    SubtreeTask subtreeTask( *this, codes, subtreeRoots, subtrees );
+    parallelFor( subtreeRoots.size(), subtreeTask );
 
-    if(xMin < midX && xMax > i_minx)
-        if(yMin < midY && yMax > i_miny)
-            if(zMin < i_maxz && zMax > midZ)
+    // Each subtree root replaces its node, the rest is appended.
+    for( size_t i = 0; i < subtrees.size(); ++i )
+    {
+        const int offset = m_nodes.size() - 1;
+
+        for( size_t j = 0; j < subtrees[i].size(); ++j )
+        {
+            Node node = subtrees[i][j];
+            node.m_firstChild += node.m_firstChild >= 0 ? offset : 0;
+
+            if( j == 0 )
             {
-                inBoxes[4] = true;
-                boxTest( i_minx, i_miny, midZ, midX, midY, i_maxz, lvl+1, m_quad5); //Back Bottom Left
+                m_nodes[subtreeRoots[i].first] = node;
             }
-
-    if(xMin < midX && xMax > i_minx)
-        if(yMin < i_maxy && yMax > midY)
-            if(zMin < i_maxz && zMax > midZ)
+            else
             {
-                inBoxes[5] = true;
-                boxTest( i_minx, midY, midZ, midX, i_maxy, i_maxz, lvl+1, m_quad6 ); //Back Up Left
+                m_nodes.push_back( node );
             }
+        }
 
-    if(xMin < i_maxx && xMax > midX)
-        if(yMin < midY && yMax > i_miny)
-            if(zMin < i_maxz && zMax > midZ)
-            {
-                inBoxes[6] = true;
-                boxTest(midX, i_miny, midZ, i_maxx, midY, i_maxz, lvl+1, m_quad7 ); //Back Bottom Right
+        vector< Node >().swap( subtrees[i] );
+    }
 
-            }
+    for( size_t i = splitNodes.size(); i > 0; --i )
+    {
+        mergeChildrenBounds( m_nodes, splitNodes[i - 1] );
+    }
+}
 
-    if(xMin < i_maxx && xMax > midX)
-        if(yMin < i_maxy && yMax > midY)
-            if(zMin < i_maxz && zMax > midZ)
-            {
-                inBoxes[7] = true;
-                boxTest(midX, midY , midZ, i_maxx, i_maxy, i_maxz, lvl+1, m_quad8 ); //Back up Right
-            }  
+//////////////////////////////////////////
+// Builds the subtree below a node, in
+// nodes which may not be m_nodes.
+//////////////////////////////////////////
+void Octree::buildNode( vector< Node > &nodes, int nodeIdx, const vector< unsigned int > &codes, int level ) const
+{
+    if( !splitNode( nodes, nodeIdx, codes, level ) )
+    {
+        return;
+    }
+
+    const int firstChild = nodes[nodeIdx].m_firstChild;
+    const int childCount = nodes[nodeIdx].m_childCount;
+
+    for( int c = 0; c < childCount; ++c )
+    {
+        buildNode( nodes, firstChild + c, codes, level + 1 );
+    }
+
+    mergeChildrenBounds( nodes, nodeIdx );
+}
+
+//////////////////////////////////////////
+// The codes of a node share their high
+// bits, its children are the runs of equal
+// octant bits at the next level. Returns
+// false for a leaf, which gets its bounds.
+//////////////////////////////////////////
+bool Octree::splitNode( vector< Node > &nodes, int nodeIdx, const vector< unsigned int > &codes, int level ) const
+{
+    const int begin = nodes[nodeIdx].m_begin;
+    const int end   = nodes[nodeIdx].m_end;
+
+    nodes[nodeIdx].m_firstChild = -1;
+    nodes[nodeIdx].m_childCount = 0;
 
-    if(lvl == 1)
+    if( end - begin <= m_leafCapacity || level == MORTON_BITS )
     {
-        float posX,posY,posZ;
-        //Checks if any fibers are INSIDE the selection box, for Octree regions that are TRUE
-        for(unsigned int k=0; k < inBoxes.size(); k++)
+        Node &leaf = nodes[nodeIdx];
+        const float *pFirst = &m_pointArray[m_points[begin] * 3];
+
+        for( int k = 0; k < 3; ++k )
         {
-            if(inBoxes[k])
-            {
-                for(unsigned int i = 0; i < currSub[k].size(); i++)
-                {
-                    indice = currSub[k][i];
-                    posX = m_pointArray[indice*3];
-                    posY = m_pointArray[indice*3+1];
-                    posZ = m_pointArray[indice*3+2];
+            leaf.m_min[k] = leaf.m_max[k] = pFirst[k];
+        }
 
+        for( int i = begin + 1; i < end; ++i )
+        {
+            const float *pPoint = &m_pointArray[m_points[i] * 3];
 
-                    if(posX <= m_boxMax[0] && posX >= m_boxMin[0] && 
-                       posY <= m_boxMax[1] && posY >= m_boxMin[1] &&
-                       posZ <= m_boxMax[2] && posZ >= m_boxMin[2] ) //If INTO the box
-                    {
-                        m_id.push_back(indice);
-                    }
-           
-                }
+            for( int k = 0; k < 3; ++k )
+            {
+                leaf.m_min[k] = std::min( leaf.m_min[k], pPoint[k] );
+                leaf.m_max[k] = std::max( leaf.m_max[k], pPoint[k] );
             }
         }
+        return false;
+    }
+
+    const int shift      = 3 * ( MORTON_BITS - 1 - level );
+    const int firstChild = nodes.size();
+
+    for( int childBegin = begin; childBegin < end; )
+    {
+        unsigned int nextPrefix = ( ( codes[childBegin] >> shift ) + 1 ) << shift;
+        int childEnd = std::lower_bound( codes.begin() + childBegin, codes.begin() + end, nextPrefix ) - codes.begin();
+
+        Node child;
+        child.m_begin = childBegin;
+        child.m_end   = childEnd;
+        nodes.push_back( child );
+
+        childBegin = childEnd;
+    }
+
+    nodes[nodeIdx].m_firstChild = firstChild;
+    nodes[nodeIdx].m_childCount = nodes.size() - firstChild;
+    return true;
+}
+
+void Octree::mergeChildrenBounds( vector< Node > &nodes, int nodeIdx )
+{
+    Node &node = nodes[nodeIdx];
+    const int firstChild = node.m_firstChild;
+
+    for( int k = 0; k < 3; ++k )
+    {
+        node.m_min[k] = nodes[firstChild].m_min[k];
+        node.m_max[k] = nodes[firstChild].m_max[k];
+
+        for( int c = 1; c < node.m_childCount; ++c )
+        {
+            node.m_min[k] = std::min( node.m_min[k], nodes[firstChild + c].m_min[k] );
+            node.m_max[k] = std::max( node.m_max[k], nodes[firstChild + c].m_max[k] );
+        }
     }
 }
 
 //////////////////////////////////////////
-//ELLIPSOID case
+//Return points that are inside a BOX, an
+//ELLIPSOID or a VOI
 //////////////////////////////////////////
-void Octree::ellipsoidTest( int i_minx, int i_miny, int i_minz, int i_maxx, int i_maxy, int i_maxz, int lvl, const vector<vector<int > >& currSub )
+vector<int> Octree::getPointsInside( SelectionObject* i_selectionObject )
 {
-    if(lvl == 2)
-        return;
-
-    int indice;
+    Vector l_center = i_selectionObject->getAppliedCenter();
+    Vector l_size   = i_selectionObject->getAppliedSize();
 
-    //Box extremities
-    float xMin = m_boxMin[0];
-    float xMax = m_boxMax[0];
-    float yMin = m_boxMin[1];
-    float yMax = m_boxMax[1];
-    float zMin = m_boxMin[2];
-    float zMax = m_boxMax[2];
+    float voxelX = DatasetManager::getInstance()->getVoxelX();
+    float voxelY = DatasetManager::getInstance()->getVoxelY();
+    float voxelZ = DatasetManager::getInstance()->getVoxelZ();
 
-    //Octree planes cutting
-    float midX = (i_maxx + i_minx)  / 2.0f;
-    float midY = (i_maxy + i_miny) / 2.0f;
-    float midZ = (i_maxz + i_minz) / 2.0f;
-    
+    float boxMin[3] = { l_center.x - l_size.x / 2 * voxelX, l_center.y - l_size.y / 2 * voxelY, l_center.z - l_size.z / 2 * voxelZ };
+    float boxMax[3] = { l_center.x + l_size.x / 2 * voxelX, l_center.y + l_size.y / 2 * voxelY, l_center.z + l_size.z / 2 * voxelZ };
 
-    //Checks in which Octree the selection Box is 
-    vector<bool> inBoxes(8, false);
+    if( i_selectionObject->getSelectionType() == BOX_TYPE )
+    {
+        return query( BoxTest( boxMin, boxMax ) );
+    }
+    else if( i_selectionObject->getSelectionType() == ELLIPSOID_TYPE )
+    {
+        return query( EllipsoidTest( boxMin, boxMax ) );
+    }
 
-    if(xMin < midX && xMax > i_minx)
-        if(yMin < midY && yMax > i_miny)
-            if(zMin < midZ && zMax > i_minz)
-            {
-                inBoxes[0] = true;
-                boxTest( i_minx, i_miny, i_minz, midX, midY, midZ, lvl+1, m_quad1 ); // Front Bottom Left
+    return query( VOITest( boxMin, boxMax, static_cast< SelectionVOI * >( i_selectionObject ) ) );
+}
 
-            }
+//////////////////////////////////////////
+// Return points that are inside a bounding box
+// defined from the coordinates of its corners.
+//////////////////////////////////////////
+vector< int > Octree::getPointsInBoundingBox( int xMin, int yMin, int zMin, int xMax, int yMax, int zMax )
+{
+    float voxelX = DatasetManager::getInstance()->getVoxelX();
+    float voxelY = DatasetManager::getInstance()->getVoxelY();
+    float voxelZ = DatasetManager::getInstance()->getVoxelZ();
 
-   if(xMin < midX && xMax > i_minx)
-        if(yMin < i_maxy && yMax > midY)
-            if(zMin < midZ && zMax > i_minz)
-            {
-                inBoxes[1] = true;
-                boxTest( i_minx, midY, i_minz, midX, i_maxy, midZ, lvl+1, m_quad2 ); //Front Up Left
-            }
+    float boxMin[3] = { xMin * voxelX, yMin * voxelY, zMin * voxelZ };
+    float boxMax[3] = { xMax * voxelX, yMax * voxelY, zMax * voxelZ };
 
-    if(xMin < i_maxx && xMax > midX)
-        if(yMin < midY && yMax > i_miny)
-            if(zMin < midZ && zMax > i_minz)
-            {
-                inBoxes[2] = true;
-                boxTest( midX, i_miny, i_minz, i_maxx, midY, midZ, lvl+1, m_quad3 ); //Front Bottom Right
-            }
+    return query( BoxTest( boxMin, boxMax ) );
+}
 
-    if(xMin < i_maxx && xMax > midX)
-        if(yMin < i_maxy && yMax > midY)
-            if(zMin < midZ && zMax > i_minz)
-            {
-                inBoxes[3] = true;
-                boxTest( midX, midY, i_minz, i_maxx, i_maxy, midZ, lvl+1, m_quad4 ); //Front Up Right
-            }
+//////////////////////////////////////////
+// Visits the nodes overlapping the object,
+// only the leaves it partially covers have
+// their points tested.
+//////////////////////////////////////////
+template< class Test >
+vector< int > Octree::query( const Test &test ) const
+{
+    vector< int > inside;
 
-    if(xMin < midX && xMax > i_minx)
-        if(yMin < midY && yMax > i_miny)
-            if(zMin < i_maxz && zMax > midZ)
-            {
-                inBoxes[4] = true;
-                boxTest( i_minx, i_miny, midZ, midX, midY, i_maxz, lvl+1, m_quad5 ); //Back Bottom Left
-            }
+    if( m_nodes.empty() )
+    {
+        return inside;
+    }
 
-    if(xMin < midX && xMax > i_minx)
-        if(yMin < i_maxy && yMax > midY)
-            if(zMin < i_maxz && zMax > midZ)
-            {
-                inBoxes[5] = true;
-                boxTest( i_minx, midY, midZ, midX, i_maxy, i_maxz, lvl+1, m_quad6 ); //Back Up Left
-            }
+    vector< int > stack( 1, 0 );
 
-    if(xMin < i_maxx && xMax > midX)
-        if(yMin < midY && yMax > i_miny)
-            if(zMin < i_maxz && zMax > midZ)
-            {
-                inBoxes[6] = true;
-                boxTest( midX, i_miny, midZ, i_maxx, midY, i_maxz, lvl+1, m_quad7 ); //Back Bottom Right
+    while( !stack.empty() )
+    {
+        const Node &node = m_nodes[stack.back()];
+        stack.pop_back();
 
-            }
+        if( !test.overlaps( node.m_min, node.m_max ) )
+        {
+            continue;
+        }
 
-    if(xMin < i_maxx && xMax > midX)
-        if(yMin < i_maxy && yMax > midY)
-            if(zMin < i_maxz && zMax > midZ)
-            {
-                inBoxes[7] = true;
-                boxTest( midX, midY ,midZ, i_maxx, i_maxy, i_maxz, lvl+1, m_quad8 ); //Back up Right
-            }  
-
-    if(lvl == 1)
-    {
-        float posX,posY,posZ;
-        float l_axisRadius  = ( m_boxMax[0]  - m_boxMin[0] ) / 2.0f;
-        float l_axis1Radius = ( m_boxMax[1] - m_boxMin[1] ) / 2.0f;
-        float l_axis2Radius = ( m_boxMax[2] - m_boxMin[2] ) / 2.0f;
-        float l_axisCenter  = m_boxMax[0]  - l_axisRadius;
-        float l_axis1Center = m_boxMax[1] - l_axis1Radius;
-        float l_axis2Center = m_boxMax[2] - l_axis2Radius;
-
-        //Checks if any fibers are INSIDE the selection box, for Octree regions that are TRUE
-        for(unsigned int k=0; k < inBoxes.size(); k++)
+        if( test.contains( node.m_min, node.m_max ) )
         {
-            if(inBoxes[k])
+            inside.insert( inside.end(), m_points.begin() + node.m_begin, m_points.begin() + node.m_end );
+        }
+        else if( node.m_firstChild < 0 )
+        {
+            for( int i = node.m_begin; i < node.m_end; ++i )
             {
-                for(unsigned int i = 0; i < currSub[k].size(); i++)
+                if( test.isInside( &m_pointArray[m_points[i] * 3] ) )
                 {
-                    indice = currSub[k][i];
-                    posX = m_pointArray[indice*3];
-                    posY = m_pointArray[indice*3+1];
-                    posZ = m_pointArray[indice*3+2];
-
-                    if( (posX  - l_axisCenter)*(posX  - l_axisCenter) / ( l_axisRadius  * l_axisRadius  ) + 
-                        (posY - l_axis1Center)*(posY - l_axis1Center) / ( l_axis1Radius * l_axis1Radius ) + 
-                        (posZ - l_axis2Center)*(posZ - l_axis2Center) / ( l_axis2Radius * l_axis2Radius ) <= 1.0f )
-                    {
-                        m_id.push_back(indice);
-                    }
+                    inside.push_back( m_points[i] );
                 }
             }
         }
+        else
+        {
+            for( int c = 0; c < node.m_childCount; ++c )
+            {
+                stack.push_back( node.m_firstChild + c );
+            }
+        }
     }
+
+    return inside;
 }
 
 //////////////////////////////////////////
-// VOI case
+// The points are mirrored, so are the node
+// bounds. The Morton order is not needed
+// by the queries and is left as is.
 //////////////////////////////////////////
-void Octree::VOITest( int i_minx, int i_miny, int i_minz, 
-                     int i_maxx, int i_maxy, int i_maxz, 
-                     int lvl, const vector<vector<int > >& currSub,
-                     SelectionObject *pSelObj )
+void Octree::flip( int axis, float mirror )
 {
-    if(lvl == 2)
-        return;
-    
-    int indice;
-    
-    //Box extremities
-    float xMin = m_boxMin[0];
-    float xMax = m_boxMax[0];
-    float yMin = m_boxMin[1];
-    float yMax = m_boxMax[1];
-    float zMin = m_boxMin[2];
-    float zMax = m_boxMax[2];
-    
-    //Octree planes cutting
-    float midX = (i_maxx + i_minx) / 2.0f;
-    float midY = (i_maxy + i_miny) / 2.0f;
-    float midZ = (i_maxz + i_minz) / 2.0f;
-    
-    
-    //Checks in which Octree the selection Box is 
-    vector<bool> inBoxes(8, false);
-    
-    if(xMin < midX && xMax > i_minx)
-        if(yMin < midY && yMax > i_miny)
-            if(zMin < midZ && zMax > i_minz)
-            {
-                inBoxes[0] = true;
-                VOITest( i_minx, i_miny, i_minz, midX, midY, midZ, lvl+1, m_quad1, pSelObj ); // Front Bottom Left
-                
-            }
-    
-    if(xMin < midX && xMax > i_minx)
-        if(yMin < i_maxy && yMax > midY)
-            if(zMin < midZ && zMax > i_minz)
-            {
-                inBoxes[1] = true;
-                VOITest( i_minx, midY, i_minz, midX, i_maxy, midZ, lvl+1, m_quad2, pSelObj ); //Front Up Left
-            }
-    
-    if(xMin < i_maxx && xMax > midX)
-        if(yMin < midY && yMax > i_miny)
-            if(zMin < midZ && zMax > i_minz)
-            {
-                inBoxes[2] = true;
-                VOITest( midX, i_miny, i_minz, i_maxx, midY, midZ, lvl+1, m_quad3, pSelObj ); //Front Bottom Right
-            }
-    
-    if(xMin < i_maxx && xMax > midX)
-        if(yMin < i_maxy && yMax > midY)
-            if(zMin < midZ && zMax > i_minz)
-            {
-                inBoxes[3] = true;
-                VOITest( midX, midY, i_minz, i_maxx, i_maxy, midZ, lvl+1, m_quad4, pSelObj ); //Front Up Right
-            }
-    
-    if(xMin < midX && xMax > i_minx)
-        if(yMin < midY && yMax > i_miny)
-            if(zMin < i_maxz && zMax > midZ)
-            {
-                inBoxes[4] = true;
-                VOITest( i_minx, i_miny, midZ, midX, midY, i_maxz, lvl+1, m_quad5, pSelObj ); //Back Bottom Left
-            }
-    
-    if(xMin < midX && xMax > i_minx)
-        if(yMin < i_maxy && yMax > midY)
-            if(zMin < i_maxz && zMax > midZ)
-            {
-                inBoxes[5] = true;
-                VOITest( i_minx, midY, midZ, midX, i_maxy, i_maxz, lvl+1, m_quad6, pSelObj ); //Back Up Left
-            }
-    
-    if(xMin < i_maxx && xMax > midX)
-        if(yMin < midY && yMax > i_miny)
-            if(zMin < i_maxz && zMax > midZ)
-            {
-                inBoxes[6] = true;
-                VOITest( midX, i_miny, midZ, i_maxx, midY, i_maxz, lvl+1, m_quad7, pSelObj ); //Back Bottom Right
-                
-            }
-    
-    if(xMin < i_maxx && xMax > midX)
-        if(yMin < i_maxy && yMax > midY)
-            if(zMin < i_maxz && zMax > midZ)
-            {
-                inBoxes[7] = true;
-                VOITest( midX, midY ,midZ, i_maxx, i_maxy, i_maxz, lvl+1, m_quad8, pSelObj ); //Back up Right
-            }  
-    
-    SelectionVOI *pSelVOI = (SelectionVOI*)pSelObj;
-    if(lvl == 1)
-    {
-        float posX,posY,posZ;
-        
-        //Checks if any fibers are INSIDE the selection box, for Octree regions that are TRUE
-        for( unsigned int k( 0 ); k < inBoxes.size(); ++k)
+    for( vector< Node >::iterator it = m_nodes.begin(); it != m_nodes.end(); ++it )
+    {
+        float min = 2.0f * mirror - it->m_max[axis];
+        it->m_max[axis] = 2.0f * mirror - it->m_min[axis];
+        it->m_min[axis] = min;
+    }
+}
+
+//////////////////////////////////////////
+// Serialization layout: the leaf capacity,
+// the nodes and points counts, then the
+// nodes and the sorted point indices.
+//////////////////////////////////////////
+size_t Octree::getSerializedSize() const
+{
+    return 3 * sizeof( int ) + sizeof( Node ) * m_nodes.size() + sizeof( int ) * m_points.size();
+}
+
+void Octree::serialize( std::ostream &out ) const
+{
+    int header[3] = { m_leafCapacity, static_cast< int >( m_nodes.size() ), static_cast< int >( m_points.size() ) };
+
+    out.write( reinterpret_cast< const char * >( header ), sizeof( header ) );
+
+    if( !m_nodes.empty() )
+    {
+        out.write( reinterpret_cast< const char * >( &m_nodes[0] ), sizeof( Node ) * m_nodes.size() );
+        out.write( reinterpret_cast< const char * >( &m_points[0] ), sizeof( int ) * m_points.size() );
+    }
+}
+
+bool Octree::deserialize( const char *pData, size_t size )
+{
+    int header[3];
+
+    if( NULL == pData || size < sizeof( header ) )
+    {
+        return false;
+    }
+
+    memcpy( header, pData, sizeof( header ) );
+
+    const int nodesCount  = header[1];
+    const int pointsCount = header[2];
+
+    if( header[0] < 1 || nodesCount < 0 || pointsCount != m_countPoints || ( nodesCount == 0 ) != ( pointsCount == 0 )
+        || size != sizeof( header ) + sizeof( Node ) * nodesCount + sizeof( int ) * pointsCount )
+    {
+        return false;
+    }
+
+    m_leafCapacity = header[0];
+    m_nodes.resize( nodesCount );
+    m_points.resize( pointsCount );
+
+    if( nodesCount > 0 )
+    {
+        memcpy( &m_nodes[0],  pData + sizeof( header ), sizeof( Node ) * nodesCount );
+        memcpy( &m_points[0], pData + sizeof( header ) + sizeof( Node ) * nodesCount, sizeof( int ) * pointsCount );
+    }
+
+    // A corrupted cache must not send the queries out of the arrays.
+    for( int i = 0; i < nodesCount; ++i )
+    {
+        const Node &node = m_nodes[i];
+
+        if( node.m_begin < 0 || node.m_begin > node.m_end || node.m_end > pointsCount
+            || ( node.m_firstChild >= 0 && ( node.m_firstChild <= i || node.m_childCount < 1 || node.m_firstChild + node.m_childCount > nodesCount ) ) )
         {
-            if( inBoxes[k] )
-            {
-                for(unsigned int i = 0; i < currSub[k].size(); i++)
-                {
-                    indice = currSub[k][i];
-                    
-                    posX = m_pointArray[indice*3];
-                    posY = m_pointArray[indice*3+1];
-                    posZ = m_pointArray[indice*3+2];
-                    
-                    if( pSelVOI->isPointInside( posX, posY, posZ ) )
-                    {
-                        m_id.push_back(indice);
-                    }
-                }
-            }
+            return false;
+        }
+    }
+
+    for( int i = 0; i < pointsCount; ++i )
+    {
+        if( m_points[i] < 0 || m_points[i] >= m_countPoints )
+        {
+            return false;
         }
     }
-}
\ No newline at end of file
+
+    return true;
+}
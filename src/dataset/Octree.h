@@ -5,74 +5,80 @@
 //
 // Description: Octree class.
 //
-//The implementation is "Hardcoded" for a level 2 Octree so far
-//and further ameliorations will be made for recursion.
+// Adaptive octree over the fiber points. The points are sorted along a
+// Morton (Z-order) curve of a 1024^3 grid covering their bounding box,
+// so every node owns a contiguous range of the sorted point indices.
+// Nodes are split until they hold at most the leaf capacity, and are
+// kept in a flat array with the children of a node stored contiguously.
+// Each node keeps the tight bounding box of its points, queries only
+// visit the nodes overlapping the selection object.
 /////////////////////////////////////////////////////////////////////////////
 #ifndef OCTREE_H_
 #define OCTREE_H_
 
+#include <cstddef>
+#include <ostream>
 #include <vector>
 
 using std::vector;
 
 class SelectionObject;
 
-class Octree 
+// Maximum number of points in a leaf, nodes are split beyond that.
+const int OCTREE_LEAF_CAPACITY(64);
+
+class Octree
 {
 public:
-    Octree( int lvl, const std::vector< float > &pointArray, int nb ); //Constructor
+    Octree( const std::vector< float > &pointArray, int nb, int leafCapacity = OCTREE_LEAF_CAPACITY ); //Constructor
+    Octree( const std::vector< float > &pointArray, int nb, const char *pSerialized, size_t size ); //Restores a serialized octree
     ~Octree(); //Destructor
 
     //Functions
     std::vector< int > getPointsInside( SelectionObject* selectionObject );
     std::vector< int > getPointsInBoundingBox( int xMin, int yMin, int zMin, int xMax, int yMax, int zMax );
-    
-    // Updates the data to represent the fiber structure when fibers are flipped.
-    void flipX();
-    void flipY();
-    void flipZ();
+
+    // Updates the node bounds when the points are mirrored around
+    // the given position along an axis (0: X, 1: Y, 2: Z).
+    void flip( int axis, float mirror );
+
+    // Binary (de)serialization, used by the fibers cache.
+    size_t getSerializedSize() const;
+    void   serialize( std::ostream &out ) const;
+
+    int    getNodesCount() const { return m_nodes.size(); }
 
 private:
-    //Octree divisions
-    std::vector< std::vector<int> > m_quad1; 
-    std::vector< std::vector<int> > m_quad2;
-    std::vector< std::vector<int> > m_quad3;
-    std::vector< std::vector<int> > m_quad4;
-    std::vector< std::vector<int> > m_quad5;
-    std::vector< std::vector<int> > m_quad6;
-    std::vector< std::vector<int> > m_quad7;
-    std::vector< std::vector<int> > m_quad8;
-
-    std::vector<int> m_id; //Points selected
-
-    int m_level;  //Lvl of subdivision
+    struct Node
+    {
+        float   m_min[3];       // Bounding box of the points of the node
+        float   m_max[3];
+        int     m_firstChild;   // Index of the first child, -1 for a leaf
+        int     m_childCount;   // Non empty children, stored contiguously
+        int     m_begin;        // Range of the node in m_points
+        int     m_end;
+    };
+
+    class BoxTest;
+    class EllipsoidTest;
+    class VOITest;
+    class SubtreeTask;
+
+    std::vector< Node > m_nodes;    // Root first
+    std::vector< int >  m_points;   // Point indices, in Morton order
+
+    int m_leafCapacity;
     int m_countPoints; //Nb of points from dataset
-    float m_maxPointX; //Quad corner
-    float m_maxPointY; //Quad corner
-    float m_maxPointZ; //Quad corner
-    float m_minPointX; //Quad corner
-    float m_minPointY; //Quad corner
-    float m_minPointZ; //Quad corner
     const std::vector< float > &m_pointArray; // Points (x,y,z)
-    std::vector< float > m_boxMax; //SelectionObject
-    std::vector< float > m_boxMin; //SelectionObject
-    
-    void findBoundingBox(); //BB of the points
-    void classifyPoints(); //Classify the points according to their position
-    void subClassifyPoints( std::vector<int> i_bigVolume, int i_xmin, int i_ymin, int i_zmin, int i_xmax, int i_ymax, int i_zmax, std::vector< std::vector<int > > &o_tree); //Subclassify for lvl 2
-    
-    void flipXInternalVector( std::vector< std::vector< int > > &vectToFlip );
-    void flipYInternalVector( std::vector< std::vector< int > > &vectToFlip );
-    void flipZInternalVector( std::vector< std::vector< int > > &vectToFlip );
-    
-    void boxTest( int i_minx, int i_miny, int i_minz, int i_maxx, int i_maxy, int i_maxz, int lvl, const std::vector< std::vector<int > > &currSub);
-    void ellipsoidTest( int i_minx, int i_miny, int i_minz, int i_maxx, int i_maxy, int i_maxz, int lvl, const std::vector< std::vector<int > > &currSub);
-
-    void VOITest( int i_minx, int i_miny, int i_minz, 
-                 int i_maxx, int i_maxy, int i_maxz,
-                 int lvl, const vector< vector< int > > &currSub, 
-                 SelectionObject *pSelObj );
-    
+
+    void build(); //Sorts the points and splits the nodes
+    void buildNode( std::vector< Node > &nodes, int nodeIdx, const std::vector< unsigned int > &codes, int level ) const;
+    bool splitNode( std::vector< Node > &nodes, int nodeIdx, const std::vector< unsigned int > &codes, int level ) const;
+    static void mergeChildrenBounds( std::vector< Node > &nodes, int nodeIdx );
+    bool deserialize( const char *pData, size_t size ); //Restore the nodes from serialize()
+
+    template< class Test >
+    std::vector< int > query( const Test &test ) const;
 };
 
 #endif /*OCTREE_H_*/
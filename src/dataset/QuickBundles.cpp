@@ -0,0 +1,364 @@
+#include "QuickBundles.h"
+
+#include "DatasetManager.h"
+#include "FiberTiles.h"
+#include "Fibers.h"
+#include "../misc/BitSet.h"
+#include "../misc/FiberResampling.h"
+#include "../misc/ParallelFor.h"
+
+#include <algorithm>
+#include <cmath>
+#include <vector>
+using std::vector;
+
+namespace
+{
+    // Fibers per batch. The larger the batch, the more clusters created in
+    // it are compared to the fibers on one thread.
+    const int    QUICKBUNDLES_BATCH_SIZE( 8192 );
+    const size_t QUICKBUNDLES_MIN_CHUNK( 256 );
+
+    // The cells are made larger than the threshold beyond this.
+    const int    QUICKBUNDLES_MAX_CELLS_PER_AXIS( 256 );
+
+    void computeCenter( const float *pPoints, int count, float *o_center )
+    {
+        float sum[3] = { 0.0f, 0.0f, 0.0f };
+
+        for( int k = 0; k < count; ++k )
+        {
+            sum[0] += pPoints[k * 3];
+            sum[1] += pPoints[k * 3 + 1];
+            sum[2] += pPoints[k * 3 + 2];
+        }
+
+        o_center[0] = sum[0] / count;
+        o_center[1] = sum[1] / count;
+        o_center[2] = sum[2] / count;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Resamples the fibers [begin, end[ of the batch, unless they already are,
+// and searches their closest cluster among the clusters existing before
+// the batch. The clusters are only read.
+//////////////////////////////////////////////////////////////////////////
+class QuickBundles::SearchTask : public ParallelTask
+{
+public:
+    SearchTask( QuickBundles &clusters, const vector< float > &pointArray, const vector< int > &linePointers, bool resample )
+    :   m_clusters( clusters ),
+        m_pointArray( pointArray ),
+        m_linePointers( linePointers ),
+        m_resample( resample )
+    {
+    }
+
+    virtual void run( size_t begin, size_t end )
+    {
+        const int pointsCount = m_clusters.m_pointsCount;
+
+        for( size_t i = begin; i < end; ++i )
+        {
+            float *pFiber  = &m_clusters.m_batchPoints[i * pointsCount * 3];
+            float *pCenter = &m_clusters.m_batchCenters[i * 3];
+
+            if( m_resample )
+            {
+                const int fiber = m_clusters.m_batchFibers[i];
+                resampleFiber( &m_pointArray[m_linePointers[fiber] * 3], m_linePointers[fiber + 1] - m_linePointers[fiber], pointsCount, pFiber );
+            }
+            computeCenter( pFiber, pointsCount, pCenter );
+
+            m_clusters.m_batchDistances[i] = m_clusters.m_threshold;
+            m_clusters.m_batchClusters[i]  = m_clusters.findClosest( pFiber, pCenter, 0, m_clusters.m_firstBatchCluster, m_clusters.m_batchDistances[i] );
+        }
+    }
+
+private:
+    QuickBundles            &m_clusters;
+    const vector< float >   &m_pointArray;
+    const vector< int >     &m_linePointers;
+    bool                    m_resample;
+};
+
+//////////////////////////////////////////////////////////////////////////
+// Out-of-core fibers are visited tile by tile, the tiles are paged in and
+// out and cannot be read by several threads. Each fiber is resampled into
+// the batch as it is visited, a full batch is clustered right away.
+//////////////////////////////////////////////////////////////////////////
+class QuickBundles::BatchVisitor : public FiberTiles::Visitor
+{
+public:
+    BatchVisitor( QuickBundles &clusters, const Fibers &fibers )
+    :   m_clusters( clusters ),
+        m_fibers( fibers )
+    {
+    }
+
+    virtual void visit( int fiberId, const float *pPoints, int nbPoints, const float * )
+    {
+        if( nbPoints <= 0 )
+        {
+            return;
+        }
+
+        const int pointsCount = m_clusters.m_pointsCount;
+        resampleFiber( pPoints, nbPoints, pointsCount, &m_clusters.m_batchPoints[m_clusters.m_batchFibers.size() * pointsCount * 3] );
+        m_clusters.m_batchFibers.push_back( fiberId );
+
+        if( m_clusters.m_batchFibers.size() == static_cast< size_t >( QUICKBUNDLES_BATCH_SIZE ) )
+        {
+            m_clusters.processBatch( m_fibers, false );
+        }
+    }
+
+private:
+    QuickBundles    &m_clusters;
+    const Fibers    &m_fibers;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+QuickBundles::QuickBundles( Fibers *pFibers, float threshold, int pointsCount )
+:   m_pointsCount( std::max( pointsCount, 2 ) ),
+    m_threshold( threshold ),
+    m_cellSize( 1.0f ),
+    m_firstBatchCluster( 0 ),
+    m_clusterIds( pFibers->getFibersCount(), -1 )
+{
+    initializeGrid( threshold );
+
+    const int  fibersCount = pFibers->getFibersCount();
+    const BitSet &filtered = pFibers->getFilteredFibers();
+
+    m_batchPoints.resize( QUICKBUNDLES_BATCH_SIZE * m_pointsCount * 3 );
+    m_batchCenters.resize( QUICKBUNDLES_BATCH_SIZE * 3 );
+    m_batchClusters.resize( QUICKBUNDLES_BATCH_SIZE );
+    m_batchDistances.resize( QUICKBUNDLES_BATCH_SIZE );
+
+    if( pFibers->isOutOfCore() )
+    {
+        // The fibers are clustered in the order of the tiles.
+        BitSet shown( fibersCount, true );
+        shown.andNot( filtered );
+
+        BatchVisitor visitor( *this, *pFibers );
+        pFibers->visitFibers( shown, visitor );
+        processBatch( *pFibers, false );
+        return;
+    }
+
+    for( int fiber = 0; fiber < fibersCount; )
+    {
+        for( ; fiber < fibersCount && m_batchFibers.size() < static_cast< size_t >( QUICKBUNDLES_BATCH_SIZE ); ++fiber )
+        {
+            if( !filtered[fiber] && pFibers->m_linePointers[fiber + 1] > pFibers->m_linePointers[fiber] )
+            {
+                m_batchFibers.push_back( fiber );
+            }
+        }
+
+        processBatch( *pFibers, true );
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Clusters the fibers of the batch, and empties it.
+//
+// The closest cluster found on the threads was chosen against centroids
+// that the fibers before in the batch may have moved since. Its distance
+// is checked again against the centroid as it is now: the fiber still
+// joins it under the threshold, otherwise the clusters before the batch
+// are searched again. Another cluster that moved closer meanwhile is not
+// looked for, so the clusters can differ from the sequential QuickBundles.
+//////////////////////////////////////////////////////////////////////////
+void QuickBundles::processBatch( const Fibers &fibers, bool resample )
+{
+    if( m_batchFibers.empty() )
+    {
+        return;
+    }
+
+    m_firstBatchCluster = getClustersCount();
+
+    SearchTask task( *this, fibers.m_pointArray, fibers.m_linePointers, resample );
+    parallelFor( m_batchFibers.size(), task, QUICKBUNDLES_MIN_CHUNK );
+
+    const int size = m_pointsCount * 3;
+
+    for( size_t i = 0; i < m_batchFibers.size(); ++i )
+    {
+        const float *pFiber  = &m_batchPoints[i * size];
+        const float *pCenter = &m_batchCenters[i * 3];
+
+        float distance = m_threshold;
+        int   cluster  = m_batchClusters[i];
+
+        if( cluster != -1 )
+        {
+            distance = getMdfDistance( &m_centroids[cluster * size], pFiber, m_pointsCount );
+
+            if( distance >= m_threshold )
+            {
+                distance = m_threshold;
+                cluster  = findClosest( pFiber, pCenter, 0, m_firstBatchCluster, distance );
+            }
+        }
+
+        const int batchCluster = findClosest( pFiber, pCenter, m_firstBatchCluster, getClustersCount(), distance );
+
+        if( batchCluster != -1 )
+        {
+            cluster = batchCluster;
+        }
+
+        if( cluster == -1 )
+        {
+            cluster = getClustersCount();
+            createCluster( pFiber, pCenter );
+        }
+        else
+        {
+            addToCluster( cluster, pFiber );
+        }
+        m_clusterIds[m_batchFibers[i]] = cluster;
+    }
+
+    m_batchFibers.clear();
+}
+
+//////////////////////////////////////////////////////////////////////////
+// The grid covers the volume of the DatasetManager, the fibers outside go
+// to the cells of its border.
+//////////////////////////////////////////////////////////////////////////
+void QuickBundles::initializeGrid( float threshold )
+{
+    DatasetManager *pDM = DatasetManager::getInstance();
+    const float size[3] = { pDM->getColumns() * pDM->getVoxelX(),
+                            pDM->getRows()    * pDM->getVoxelY(),
+                            pDM->getFrames()  * pDM->getVoxelZ() };
+
+    m_cellSize = std::max( threshold, 0.001f );
+    for( int axis = 0; axis < 3; ++axis )
+    {
+        m_cellSize = std::max( m_cellSize, size[axis] / QUICKBUNDLES_MAX_CELLS_PER_AXIS );
+    }
+
+    for( int axis = 0; axis < 3; ++axis )
+    {
+        m_cellsCount[axis] = std::max( 1, static_cast< int >( std::ceil( size[axis] / m_cellSize ) ) );
+    }
+    m_cells.assign( m_cellsCount[0] * m_cellsCount[1] * m_cellsCount[2], vector< int >() );
+}
+
+int QuickBundles::getCellIndex( const float *pCenter, int axis ) const
+{
+    return std::min( m_cellsCount[axis] - 1, std::max( 0, static_cast< int >( std::floor( pCenter[axis] / m_cellSize ) ) ) );
+}
+
+int QuickBundles::getCell( const float *pCenter ) const
+{
+    return ( getCellIndex( pCenter, 2 ) * m_cellsCount[1] + getCellIndex( pCenter, 1 ) ) * m_cellsCount[0] + getCellIndex( pCenter, 0 );
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Searches the cluster among [firstCluster, endCluster[ closest to the
+// fiber, closer than io_distance. Returns -1 if there is none, otherwise
+// io_distance is set to the distance to the cluster found.
+//////////////////////////////////////////////////////////////////////////
+int QuickBundles::findClosest( const float *pFiber, const float *pCenter, int firstCluster, int endCluster, float &io_distance ) const
+{
+    if( firstCluster >= endCluster )
+    {
+        return -1;
+    }
+
+    const int index[3] = { getCellIndex( pCenter, 0 ), getCellIndex( pCenter, 1 ), getCellIndex( pCenter, 2 ) };
+
+    int closest( -1 );
+
+    for( int z = std::max( 0, index[2] - 1 ); z <= std::min( m_cellsCount[2] - 1, index[2] + 1 ); ++z )
+    {
+        for( int y = std::max( 0, index[1] - 1 ); y <= std::min( m_cellsCount[1] - 1, index[1] + 1 ); ++y )
+        {
+            for( int x = std::max( 0, index[0] - 1 ); x <= std::min( m_cellsCount[0] - 1, index[0] + 1 ); ++x )
+            {
+                const vector< int > &cell = m_cells[( z * m_cellsCount[1] + y ) * m_cellsCount[0] + x];
+
+                for( size_t i = 0; i < cell.size(); ++i )
+                {
+                    const int cluster = cell[i];
+                    if( cluster < firstCluster || cluster >= endCluster )
+                    {
+                        continue;
+                    }
+
+                    // The distance between the centers is a lower bound of the MDF distance.
+                    const float *pClusterCenter = &m_centers[cluster * 3];
+                    const float dx = pClusterCenter[0] - pCenter[0];
+                    const float dy = pClusterCenter[1] - pCenter[1];
+                    const float dz = pClusterCenter[2] - pCenter[2];
+                    if( dx * dx + dy * dy + dz * dz >= io_distance * io_distance )
+                    {
+                        continue;
+                    }
+
+                    const float distance = getMdfDistance( &m_centroids[cluster * m_pointsCount * 3], pFiber, m_pointsCount );
+                    if( distance < io_distance )
+                    {
+                        io_distance = distance;
+                        closest     = cluster;
+                    }
+                }
+            }
+        }
+    }
+
+    return closest;
+}
+
+void QuickBundles::createCluster( const float *pFiber, const float *pCenter )
+{
+    const int cluster = getClustersCount();
+    const int size    = m_pointsCount * 3;
+
+    m_centroids.insert( m_centroids.end(), pFiber, pFiber + size );
+    m_sums.insert( m_sums.end(), pFiber, pFiber + size );
+    m_centers.insert( m_centers.end(), pCenter, pCenter + 3 );
+    m_sizes.push_back( 1 );
+    m_clusterCells.push_back( getCell( pCenter ) );
+    m_cells[m_clusterCells.back()].push_back( cluster );
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Adds the fiber to the cluster in the orientation closest to its
+// centroid, and moves the centroid to its new cell if needed.
+//////////////////////////////////////////////////////////////////////////
+void QuickBundles::addToCluster( int cluster, const float *pFiber )
+{
+    const int size = m_pointsCount * 3;
+    float     *pCentroid = &m_centroids[cluster * size];
+    double    *pSum      = &m_sums[cluster * size];
+
+    bool flipped( false );
+    getMdfDistance( pCentroid, pFiber, m_pointsCount, &flipped );
+    addFiberPoints( pFiber, m_pointsCount, flipped, pSum );
+
+    const int count = ++m_sizes[cluster];
+    for( int i = 0; i < size; ++i )
+    {
+        pCentroid[i] = static_cast< float >( pSum[i] / count );
+    }
+    computeCenter( pCentroid, m_pointsCount, &m_centers[cluster * 3] );
+
+    const int cell = getCell( &m_centers[cluster * 3] );
+    if( cell != m_clusterCells[cluster] )
+    {
+        vector< int > &oldCell = m_cells[m_clusterCells[cluster]];
+        oldCell.erase( std::find( oldCell.begin(), oldCell.end(), cluster ) );
+        m_cells[cell].push_back( cluster );
+        m_clusterCells[cluster] = cell;
+    }
+}
@@ -0,0 +1,88 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:            QuickBundles.h
+//
+// Description: Clusters the fibers of a fiber set with QuickBundles.
+//
+// The fibers are resampled to the same number of points and compared to
+// the centroid of each cluster with their MDF distance. A fiber joins the
+// closest cluster under the threshold, or starts a new one; a centroid is
+// the mean of the fibers of its cluster, each in its orientation.
+//
+// The MDF distance of two fibers is at least the distance between the
+// means of their points, so the centroids are kept in a grid of cells as
+// large as the threshold, by the mean of their points, and a fiber is only
+// compared to the centroids of the 27 cells around its own mean.
+//
+// The fibers are processed in batches. The closest centroid of each fiber
+// of a batch is searched on several threads, among the clusters existing
+// before the batch. The fibers then join their clusters in order on one
+// thread, which checks the distance to the centroid found again, and
+// compares them to the clusters created in the batch. Out-of-core fibers
+// are taken in the order of their tiles.
+/////////////////////////////////////////////////////////////////////////////
+#ifndef QUICKBUNDLES_H_
+#define QUICKBUNDLES_H_
+
+#include <vector>
+
+class Fibers;
+
+// Points of the resampled fibers and centroids.
+const int QUICKBUNDLES_POINTS_COUNT( 12 );
+
+class QuickBundles
+{
+public:
+    // Clusters the fibers of pFibers that are not filtered out, threshold
+    // is the largest MDF distance to the centroid of a cluster, in mm.
+    QuickBundles( Fibers *pFibers, float threshold, int pointsCount = QUICKBUNDLES_POINTS_COUNT );
+
+    int     getClustersCount() const                    { return m_sizes.size(); }
+
+    // Cluster of each fiber, -1 for the fibers filtered out.
+    const std::vector< int > & getClusterIds() const    { return m_clusterIds; }
+    const std::vector< int > & getClusterSizes() const  { return m_sizes; }
+
+private:
+    class SearchTask;
+    class BatchVisitor;
+
+    void    processBatch( const Fibers &fibers, bool resample );
+
+    void    initializeGrid( float threshold );
+    int     getCellIndex( const float *pCenter, int axis ) const;
+    int     getCell( const float *pCenter ) const;
+
+    int     findClosest( const float *pFiber, const float *pCenter, int firstCluster, int endCluster, float &io_distance ) const;
+    void    createCluster( const float *pFiber, const float *pCenter );
+    void    addToCluster( int cluster, const float *pFiber );
+
+private:
+    int                                 m_pointsCount;
+    float                               m_threshold;
+
+    // Flat arrays of the clusters, x, y, z packed.
+    std::vector< float >                m_centroids;
+    std::vector< double >               m_sums;
+    std::vector< float >                m_centers;      // Mean of the points of each centroid
+    std::vector< int >                  m_sizes;
+    std::vector< int >                  m_clusterCells;
+
+    // Clusters of each cell of the grid.
+    std::vector< std::vector< int > >   m_cells;
+    int                                 m_cellsCount[3];
+    float                               m_cellSize;
+
+    // Fibers of the current batch, resampled, with their closest cluster
+    // among the clusters before m_firstBatchCluster.
+    std::vector< int >                  m_batchFibers;
+    std::vector< float >                m_batchPoints;
+    std::vector< float >                m_batchCenters;
+    std::vector< int >                  m_batchClusters;
+    std::vector< float >                m_batchDistances;
+    int                                 m_firstBatchCluster;
+
+    std::vector< int >                  m_clusterIds;
+};
+
+#endif // QUICKBUNDLES_H_
@@ -0,0 +1,485 @@
+#include "SegmentTree.h"
+
+#include "DatasetManager.h"
+#include "../Logger.h"
+#include "../gui/SelectionObject.h"
+#include "../misc/Morton.h"
+
+#include <algorithm>
+#include <utility>
+#include <vector>
+using std::vector;
+
+namespace
+{
+    const int SEGMENT_TREE_FAN_OUT = 8;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Segment tests used by the queries, the nodes are culled against the
+// bounding box of the object.
+//////////////////////////////////////////////////////////////////////////
+class SegmentTree::BoxTest
+{
+public:
+    BoxTest( const float boxMin[3], const float boxMax[3] )
+    {
+        for( int k = 0; k < 3; ++k )
+        {
+            m_min[k] = boxMin[k];
+            m_max[k] = boxMax[k];
+        }
+    }
+
+    bool overlaps( const float nodeMin[3], const float nodeMax[3] ) const
+    {
+        for( int k = 0; k < 3; ++k )
+        {
+            if( nodeMax[k] < m_min[k] || nodeMin[k] > m_max[k] )
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Clips the segment against the 3 slabs of the box.
+    bool crosses( const float *pStart, const float *pEnd ) const
+    {
+        float tMin( 0.0f );
+        float tMax( 1.0f );
+
+        for( int k = 0; k < 3; ++k )
+        {
+            float dir = pEnd[k] - pStart[k];
+
+            if( dir == 0.0f )
+            {
+                if( pStart[k] < m_min[k] || pStart[k] > m_max[k] )
+                {
+                    return false;
+                }
+                continue;
+            }
+
+            float t0 = ( m_min[k] - pStart[k] ) / dir;
+            float t1 = ( m_max[k] - pStart[k] ) / dir;
+
+            tMin = std::max( tMin, std::min( t0, t1 ) );
+            tMax = std::min( tMax, std::max( t0, t1 ) );
+
+            if( tMin > tMax )
+            {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    int count( const float *pStart, const float *pEnd ) const
+    {
+        return crosses( pStart, pEnd ) ? 1 : 0;
+    }
+
+    // Cuts this box minus other in at most 6 boxes, appended to o_boxes.
+    void subtract( const BoxTest &other, std::vector< BoxTest > &o_boxes ) const
+    {
+        if( !overlaps( other.m_min, other.m_max ) )
+        {
+            o_boxes.push_back( *this );
+            return;
+        }
+
+        BoxTest rest( *this );
+
+        for( int k = 0; k < 3; ++k )
+        {
+            if( rest.m_min[k] < other.m_min[k] )
+            {
+                BoxTest below( rest );
+                below.m_max[k] = other.m_min[k];
+                o_boxes.push_back( below );
+                rest.m_min[k] = other.m_min[k];
+            }
+            if( rest.m_max[k] > other.m_max[k] )
+            {
+                BoxTest above( rest );
+                above.m_min[k] = other.m_max[k];
+                o_boxes.push_back( above );
+                rest.m_max[k] = other.m_max[k];
+            }
+        }
+    }
+
+protected:
+    float m_min[3];
+    float m_max[3];
+};
+
+class SegmentTree::EllipsoidTest : public SegmentTree::BoxTest
+{
+public:
+    EllipsoidTest( const float boxMin[3], const float boxMax[3] )
+    :   BoxTest( boxMin, boxMax )
+    {
+        for( int k = 0; k < 3; ++k )
+        {
+            m_radius[k] = ( boxMax[k] - boxMin[k] ) / 2.0f;
+            m_center[k] = boxMax[k] - m_radius[k];
+        }
+    }
+
+    // In the space where the ellipsoid is the unit sphere, the point of
+    // the segment closest to the center must be inside the sphere.
+    bool crosses( const float *pStart, const float *pEnd ) const
+    {
+        float start[3];
+        float dir[3];
+        float dirDotDir( 0.0f );
+        float startDotDir( 0.0f );
+
+        for( int k = 0; k < 3; ++k )
+        {
+            start[k]     = ( pStart[k] - m_center[k] ) / m_radius[k];
+            dir[k]       = ( pEnd[k] - pStart[k] ) / m_radius[k];
+            dirDotDir   += dir[k] * dir[k];
+            startDotDir += start[k] * dir[k];
+        }
+
+        float t = dirDotDir > 0.0f ? std::min( 1.0f, std::max( 0.0f, -startDotDir / dirDotDir ) ) : 0.0f;
+        float distance( 0.0f );
+
+        for( int k = 0; k < 3; ++k )
+        {
+            float closest = start[k] + t * dir[k];
+            distance += closest * closest;
+        }
+        return distance <= 1.0f;
+    }
+
+private:
+    float m_center[3];
+    float m_radius[3];
+};
+
+// Segments entering (+1) or leaving (-1) a box moved from oldBox to newBox.
+// Only the nodes overlapping the slabs between the two boxes are visited.
+class SegmentTree::BoxDeltaTest
+{
+public:
+    BoxDeltaTest( const BoxTest &oldBox, const BoxTest &newBox )
+    :   m_oldBox( oldBox ),
+        m_newBox( newBox )
+    {
+        newBox.subtract( oldBox, m_slabs );
+        oldBox.subtract( newBox, m_slabs );
+    }
+
+    bool overlaps( const float nodeMin[3], const float nodeMax[3] ) const
+    {
+        for( size_t i = 0; i < m_slabs.size(); ++i )
+        {
+            if( m_slabs[i].overlaps( nodeMin, nodeMax ) )
+            {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    int count( const float *pStart, const float *pEnd ) const
+    {
+        return m_newBox.count( pStart, pEnd ) - m_oldBox.count( pStart, pEnd );
+    }
+
+private:
+    BoxTest                 m_oldBox;
+    BoxTest                 m_newBox;
+    std::vector< BoxTest >  m_slabs;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+SegmentTree::SegmentTree( const vector< float > &pointArray, const vector< int > &linePointers, int fibersCount )
+:   m_fibersCount( fibersCount ),
+    m_pointArray( pointArray )
+{
+    Logger::getInstance()->print( wxT( "Building segment tree..." ), LOGLEVEL_MESSAGE );
+
+    // Cut the fibers in runs of segments, sharing their end points.
+    vector< Leaf > leaves;
+
+    for( int fiber = 0; fiber < fibersCount; ++fiber )
+    {
+        const int lastPoint = linePointers[fiber + 1] - 1;
+
+        for( int first = linePointers[fiber]; first <= lastPoint; )
+        {
+            Leaf leaf;
+            leaf.m_fiber      = fiber;
+            leaf.m_firstPoint = first;
+            leaf.m_lastPoint  = std::min( first + SEGMENT_TREE_LEAF_SEGMENTS, lastPoint );
+            leaves.push_back( leaf );
+
+            // A single point fiber is a leaf without segment.
+            first = leaf.m_lastPoint == first ? first + 1 : leaf.m_lastPoint;
+            if( first == lastPoint )
+            {
+                break;
+            }
+        }
+    }
+
+    if( leaves.empty() )
+    {
+        return;
+    }
+
+    vector< Node > leafNodes( leaves.size() );
+    float minPoint[3] = { pointArray[leaves[0].m_firstPoint * 3], pointArray[leaves[0].m_firstPoint * 3 + 1], pointArray[leaves[0].m_firstPoint * 3 + 2] };
+    float maxPoint[3] = { minPoint[0], minPoint[1], minPoint[2] };
+
+    for( size_t i = 0; i < leaves.size(); ++i )
+    {
+        Node &node = leafNodes[i];
+        node.m_firstChild = -1;
+        node.m_childCount = 0;
+
+        for( int k = 0; k < 3; ++k )
+        {
+            node.m_min[k] = node.m_max[k] = pointArray[leaves[i].m_firstPoint * 3 + k];
+        }
+
+        for( int p = leaves[i].m_firstPoint + 1; p <= leaves[i].m_lastPoint; ++p )
+        {
+            for( int k = 0; k < 3; ++k )
+            {
+                node.m_min[k] = std::min( node.m_min[k], pointArray[p * 3 + k] );
+                node.m_max[k] = std::max( node.m_max[k], pointArray[p * 3 + k] );
+            }
+        }
+
+        for( int k = 0; k < 3; ++k )
+        {
+            minPoint[k] = std::min( minPoint[k], node.m_min[k] );
+            maxPoint[k] = std::max( maxPoint[k], node.m_max[k] );
+        }
+    }
+
+    // Sort the leaves along the Morton curve, so that the groups of 8
+    // consecutive nodes at each level are compact in space.
+    MortonGrid grid( minPoint, maxPoint );
+    vector< std::pair< unsigned int, int > > order( leaves.size() );
+
+    for( size_t i = 0; i < leaves.size(); ++i )
+    {
+        float center[3];
+        for( int k = 0; k < 3; ++k )
+        {
+            center[k] = ( leafNodes[i].m_min[k] + leafNodes[i].m_max[k] ) / 2.0f;
+        }
+        order[i] = std::make_pair( grid.getCode( center ), static_cast< int >( i ) );
+    }
+
+    std::sort( order.begin(), order.end() );
+
+    m_leaves.resize( leaves.size() );
+    m_nodes.reserve( leaves.size() + leaves.size() / ( SEGMENT_TREE_FAN_OUT - 1 ) + 1 );
+
+    for( size_t i = 0; i < order.size(); ++i )
+    {
+        m_leaves[i] = leaves[order[i].second];
+        m_nodes.push_back( leafNodes[order[i].second] );
+    }
+
+    // Group the nodes of each level up to a single root.
+    size_t levelBegin = 0;
+    size_t levelEnd   = m_nodes.size();
+
+    while( levelEnd - levelBegin > 1 )
+    {
+        for( size_t first = levelBegin; first < levelEnd; first += SEGMENT_TREE_FAN_OUT )
+        {
+            Node parent = m_nodes[first];
+            parent.m_firstChild = first;
+            parent.m_childCount = std::min( static_cast< size_t >( SEGMENT_TREE_FAN_OUT ), levelEnd - first );
+
+            for( int c = 1; c < parent.m_childCount; ++c )
+            {
+                for( int k = 0; k < 3; ++k )
+                {
+                    parent.m_min[k] = std::min( parent.m_min[k], m_nodes[first + c].m_min[k] );
+                    parent.m_max[k] = std::max( parent.m_max[k], m_nodes[first + c].m_max[k] );
+                }
+            }
+            m_nodes.push_back( parent );
+        }
+
+        levelBegin = levelEnd;
+        levelEnd   = m_nodes.size();
+    }
+
+    Logger::getInstance()->print( wxString::Format( wxT( "Segment tree done, %d leaves" ), static_cast< int >( m_leaves.size() ) ), LOGLEVEL_MESSAGE );
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////
+// The box counts are updated from the box they were computed for if the
+// two boxes overlap, otherwise all the segments in the box are counted.
+//////////////////////////////////////////////////////////////////////////
+void SegmentTree::updateFibersInside( SelectionObject *pSelObj, SelectionObject::SelectionState &io_state ) const
+{
+    Vector center = pSelObj->getAppliedCenter();
+    Vector size   = pSelObj->getAppliedSize();
+
+    float voxelX = DatasetManager::getInstance()->getVoxelX();
+    float voxelY = DatasetManager::getInstance()->getVoxelY();
+    float voxelZ = DatasetManager::getInstance()->getVoxelZ();
+
+    float boxMin[3] = { center.x - size.x / 2 * voxelX, center.y - size.y / 2 * voxelY, center.z - size.z / 2 * voxelZ };
+    float boxMax[3] = { center.x + size.x / 2 * voxelX, center.y + size.y / 2 * voxelY, center.z + size.z / 2 * voxelZ };
+
+    if( ELLIPSOID_TYPE == pSelObj->getSelectionType() )
+    {
+        io_state.m_segmentsInBox.clear();
+        query( EllipsoidTest( boxMin, boxMax ), io_state.m_inBox );
+        return;
+    }
+
+    BoxTest newBox( boxMin, boxMax );
+
+    if( static_cast< int >( io_state.m_segmentsInBox.size() ) == m_fibersCount && static_cast< int >( io_state.m_inBox.size() ) == m_fibersCount
+        && newBox.overlaps( io_state.m_countedMin, io_state.m_countedMax ) )
+    {
+        BoxTest oldBox( io_state.m_countedMin, io_state.m_countedMax );
+        accumulate( BoxDeltaTest( oldBox, newBox ), io_state.m_segmentsInBox, io_state.m_inBox );
+    }
+    else
+    {
+        io_state.m_segmentsInBox.assign( m_fibersCount, 0 );
+        io_state.m_inBox.assign( m_fibersCount, false );
+        accumulate( newBox, io_state.m_segmentsInBox, io_state.m_inBox );
+    }
+
+    for( int k = 0; k < 3; ++k )
+    {
+        io_state.m_countedMin[k] = boxMin[k];
+        io_state.m_countedMax[k] = boxMax[k];
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+// The leaves of the fibers already found are skipped.
+//////////////////////////////////////////////////////////////////////////
+template< class Test >
+void SegmentTree::query( const Test &test, BitSet &o_inBox ) const
+{
+    o_inBox.assign( m_fibersCount, false );
+
+    if( m_nodes.empty() )
+    {
+        return;
+    }
+
+    vector< int > stack( 1, m_nodes.size() - 1 );
+
+    while( !stack.empty() )
+    {
+        const int nodeIdx = stack.back();
+        const Node &node  = m_nodes[nodeIdx];
+        stack.pop_back();
+
+        if( !test.overlaps( node.m_min, node.m_max ) )
+        {
+            continue;
+        }
+
+        if( node.m_firstChild >= 0 )
+        {
+            for( int c = 0; c < node.m_childCount; ++c )
+            {
+                stack.push_back( node.m_firstChild + c );
+            }
+            continue;
+        }
+
+        const Leaf &leaf = m_leaves[nodeIdx];
+
+        if( o_inBox[leaf.m_fiber] )
+        {
+            continue;
+        }
+
+        const float *pPoint = &m_pointArray[leaf.m_firstPoint * 3];
+
+        if( leaf.m_firstPoint == leaf.m_lastPoint )
+        {
+            o_inBox[leaf.m_fiber] = test.crosses( pPoint, pPoint );
+            continue;
+        }
+
+        for( int p = leaf.m_firstPoint; p < leaf.m_lastPoint; ++p, pPoint += 3 )
+        {
+            if( test.crosses( pPoint, pPoint + 3 ) )
+            {
+                o_inBox[leaf.m_fiber] = true;
+                break;
+            }
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+template< class Test >
+void SegmentTree::accumulate( const Test &test, vector< int > &io_counts, BitSet &io_inBox ) const
+{
+    if( m_nodes.empty() )
+    {
+        return;
+    }
+
+    vector< int > stack( 1, m_nodes.size() - 1 );
+
+    while( !stack.empty() )
+    {
+        const int nodeIdx = stack.back();
+        const Node &node  = m_nodes[nodeIdx];
+        stack.pop_back();
+
+        if( !test.overlaps( node.m_min, node.m_max ) )
+        {
+            continue;
+        }
+
+        if( node.m_firstChild >= 0 )
+        {
+            for( int c = 0; c < node.m_childCount; ++c )
+            {
+                stack.push_back( node.m_firstChild + c );
+            }
+            continue;
+        }
+
+        const Leaf &leaf = m_leaves[nodeIdx];
+        const float *pPoint = &m_pointArray[leaf.m_firstPoint * 3];
+        int count( 0 );
+
+        if( leaf.m_firstPoint == leaf.m_lastPoint )
+        {
+            count = test.count( pPoint, pPoint );
+        }
+
+        for( int p = leaf.m_firstPoint; p < leaf.m_lastPoint; ++p, pPoint += 3 )
+        {
+            count += test.count( pPoint, pPoint + 3 );
+        }
+
+        if( count != 0 )
+        {
+            io_counts[leaf.m_fiber] += count;
+            io_inBox[leaf.m_fiber] = io_counts[leaf.m_fiber] > 0;
+        }
+    }
+}
@@ -0,0 +1,71 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:            SegmentTree.h
+//
+// Description: Bounding volume hierarchy over the fiber segments.
+//
+// The octree only knows the points, a selection object thinner than the
+// step between two points misses the fibers crossing it. The leaves of
+// this tree are runs of consecutive segments of one fiber, sorted along
+// the Morton curve of their centers and grouped 8 by 8 up to the root.
+// Box and ellipsoid queries test each segment of the leaves they reach,
+// a fiber is inside if any of its segments crosses the object. For a box,
+// the segments inside are counted per fiber: when the box moves, only the
+// leaves in the slabs it entered or left are visited to update the counts.
+/////////////////////////////////////////////////////////////////////////////
+#ifndef SEGMENTTREE_H_
+#define SEGMENTTREE_H_
+
+#include "../gui/SelectionObject.h"
+
+#include <vector>
+
+// Maximum number of segments in a leaf.
+const int SEGMENT_TREE_LEAF_SEGMENTS(8);
+
+class SegmentTree
+{
+public:
+    SegmentTree( const std::vector< float > &pointArray, const std::vector< int > &linePointers, int fibersCount );
+
+    // Flags in io_state.m_inBox the fibers crossing a box or an ellipsoid
+    // selection object. Boxes update the counts of io_state incrementally.
+    void updateFibersInside( SelectionObject *pSelObj, SelectionObject::SelectionState &io_state ) const;
+
+private:
+    struct Node
+    {
+        float   m_min[3];
+        float   m_max[3];
+        int     m_firstChild;   // -1 for a leaf
+        int     m_childCount;
+    };
+
+    // The segments between the consecutive points [m_firstPoint, m_lastPoint].
+    struct Leaf
+    {
+        int     m_fiber;
+        int     m_firstPoint;
+        int     m_lastPoint;
+    };
+
+    class BoxTest;
+    class EllipsoidTest;
+    class BoxDeltaTest;
+
+    template< class Test >
+    void query( const Test &test, BitSet &o_inBox ) const;
+
+    // Adds test.count() of the segments of the leaves overlapping the test
+    // to io_counts, and updates io_inBox for the fibers whose count changed.
+    template< class Test >
+    void accumulate( const Test &test, std::vector< int > &io_counts, BitSet &io_inBox ) const;
+
+private:
+    std::vector< Node > m_nodes;    // The leaves first, the root last
+    std::vector< Leaf > m_leaves;   // Same order as the leaf nodes
+
+    int m_fibersCount;
+    const std::vector< float > &m_pointArray;
+};
+
+#endif // SEGMENTTREE_H_
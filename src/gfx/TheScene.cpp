@@ -601,6 +601,25 @@ void TheScene::renderFibers()
 {
     glPushAttrib( GL_ALL_ATTRIB_BITS );
 
+    if( SceneManager::getInstance()->isSelBoxChanged() )
+    {
+        // Select in all the shown fiber sets together, in the background. They
+        // are drawn with their last selection until MainFrame gets the new one.
+        std::vector< Fibers * > shownFibers;
+
+        for( int i = 0; i < MyApp::frame->m_pListCtrl->GetItemCount(); ++i )
+        {
+            DatasetInfo* pDsInfo = DatasetManager::getInstance()->getDataset( MyApp::frame->m_pListCtrl->GetItem( i ) );
+
+            if( pDsInfo->getType() == FIBERS && pDsInfo->getShow() )
+            {
+                shownFibers.push_back( (Fibers*)pDsInfo );
+            }
+        }
+
+        SceneManager::getInstance()->getSelectionTree().requestSelectionUpdate( shownFibers, MyApp::frame, ID_SELECTION_UPDATE );
+    }
+
     for( int i = 0; i < MyApp::frame->m_pListCtrl->GetItemCount(); ++i )
     {
         DatasetInfo* pDsInfo = DatasetManager::getInstance()->getDataset( MyApp::frame->m_pListCtrl->GetItem( i ) );
@@ -610,11 +629,6 @@ void TheScene::renderFibers()
             Fibers* pFibers = (Fibers*)pDsInfo;
             if( pFibers != NULL )
             {
-                if( SceneManager::getInstance()->isSelBoxChanged() )
-                {
-                    pFibers->updateLinesShown();
-                }
-
                 if( pFibers->isUsingFakeTubes() )
                 {
                     pFibers->draw();
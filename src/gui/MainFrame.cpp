@@ -15,9 +15,11 @@
 #include "../main.h"
 #include "../Logger.h"
 #include "../dataset/Anatomy.h"
+#include "../dataset/AsyncLoader.h"
 #include "../dataset/DatasetManager.h"
 #include "../dataset/Fibers.h"
 #include "../dataset/FibersGroup.h"
+#include "../dataset/FibersWriter.h"
 #include "../dataset/Loader.h"
 #include "../dataset/ODFs.h"
 #include "../dataset/Tensors.h"
@@ -87,6 +89,16 @@ EVT_SLIDER( ID_Z_SLIDER,                                    MainFrame::onSliderM
 
 EVT_TIMER( -1,                                              MainFrame::onTimerEvent )
 
+// Background loading
+EVT_COMMAND( ID_ASYNC_LOAD, wxEVT_ASYNC_LOAD_EVENT,          MainFrame::onAsyncLoadEvent     )
+EVT_BUTTON( ID_LOAD_CANCEL,                                 MainFrame::onCancelLoad         )
+
+// Background saving
+EVT_COMMAND( ID_FIBERS_WRITER, wxEVT_FIBERS_WRITER_EVENT,   MainFrame::onFibersWritten      )
+
+// Background selection
+EVT_COMMAND( ID_SELECTION_UPDATE, wxEVT_SELECTION_UPDATE_EVENT, MainFrame::onSelectionUpdated )
+
 END_EVENT_TABLE()
 
 namespace
@@ -189,6 +201,13 @@ MainFrame::MainFrame( const wxString     &title,
 //     m_lastSelectedListItem( -1 ),
     m_lastPath( MyApp::respath + _T( "data" ) ),
     m_pTimer( NULL ),
+    m_pAsyncLoader( NULL ),
+    m_pLoadGauge( NULL ),
+    m_pLoadCancelButton( NULL ),
+    m_loadDone( 0 ),
+    m_loadTotal( 0 ),
+    m_loadErrors( 0 ),
+    m_pFibersWriter( NULL ),
     m_isDrawerToolActive( false ),
     m_drawSize( 2 ),
     m_drawRound( true ),
@@ -204,6 +223,8 @@ MainFrame::MainFrame( const wxString     &title,
     m_pTimer = new wxTimer( this );
     m_pTimer->Start( 100 );
 
+    m_pAsyncLoader = new AsyncLoader( this, ID_ASYNC_LOAD );
+
     m_pMenuBar = new MenuBar();
     m_pToolBar = new ToolBar(this);
     m_pToolBar->Realize();
@@ -348,6 +369,21 @@ void MainFrame::initLayout()
     pBoxLowerLeft->Add( pBoxTab, 1, wxEXPAND | wxALL, 0 );
 
     pBoxLeft->Add( pBoxLowerLeft, 1, wxEXPAND | wxBOTTOM, 0 );
+
+    //////////////////////////////////////////////////////////////////////////
+    // Loading progress, only shown while files are loaded in the background
+    wxBoxSizer *pBoxLoading = new wxBoxSizer( wxHORIZONTAL );
+
+    m_pLoadGauge        = new wxGauge( this, wxID_ANY, 1, wxDefaultPosition, wxDefaultSize, wxGA_HORIZONTAL | wxGA_SMOOTH );
+    m_pLoadCancelButton = new wxButton( this, ID_LOAD_CANCEL, wxT( "Cancel" ) );
+
+    pBoxLoading->Add( m_pLoadGauge,        1, wxALIGN_CENTER_VERTICAL | wxALL, 2 );
+    pBoxLoading->Add( m_pLoadCancelButton, 0, wxALL, 2 );
+
+    m_pLoadGauge->Hide();
+    m_pLoadCancelButton->Hide();
+
+    pBoxLeft->Add( pBoxLoading, 0, wxEXPAND | wxALL, 0 );
     
     pBoxMain->Add( pBoxLeft, 0, wxEXPAND | wxBOTTOM, 0 );
     pBoxMain->Add( m_pMainGL, 1, wxEXPAND | wxALL, 2 );
@@ -396,18 +432,7 @@ void MainFrame::onLoad( wxCommandEvent& WXUNUSED(event) )
     // Order list of files so fibers files will be at the end of the list.
     l_fileNames.Sort( compareInputFile );
 
-    unsigned int nbErrors = for_each( l_fileNames.begin(), l_fileNames.end(), Loader( this, m_pListCtrl ) ).getNbErrors();
-    if ( nbErrors )
-    {
-        wxString errorMsg = wxString::Format( ( nbErrors > 1 ? wxT( "Last error: %s\nFor a complete list of errors, please review the log" ) : wxT( "%s" ) ), Logger::getInstance()->getLastError().c_str() );
-
-        wxMessageBox( errorMsg, wxT( "Error while loading" ), wxOK | wxICON_ERROR, NULL );
-        GetStatusBar()->SetStatusText( wxT( "ERROR" ), 1 );
-        GetStatusBar()->SetStatusText( Logger::getInstance()->getLastError(), 2 );
-        return;
-    }
-
-    refreshAllGLWidgets();
+    loadInBackground( l_fileNames, false );
 }
 
 void MainFrame::onLoadAsPeaks( wxCommandEvent& WXUNUSED(event) )
@@ -426,18 +451,109 @@ void MainFrame::onLoadAsPeaks( wxCommandEvent& WXUNUSED(event) )
         dialog.GetPaths( fileNames );
     }
     
-    unsigned int nbErrors = for_each( fileNames.begin(), fileNames.end(), Loader( this, m_pListCtrl, true ) ).getNbErrors();
-    if ( nbErrors )
+    loadInBackground( fileNames, true );
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Queues the files in the AsyncLoader, the GUI stays usable while they are
+// parsed and each dataset appears in the list as soon as it is ready.
+//////////////////////////////////////////////////////////////////////////
+void MainFrame::loadInBackground( const wxArrayString &fileNames, const bool loadAsPeaks )
+{
+    if( !m_pAsyncLoader->isLoading() )
     {
-        wxString errorMsg = wxString::Format( ( nbErrors > 1 ? wxT( "Last error: %s\nFor a complete list of errors, please review the log" ) : wxT( "%s" ) ), Logger::getInstance()->getLastError().c_str() );
-        
+        m_loadDone   = 0;
+        m_loadTotal  = 0;
+        m_loadErrors = 0;
+    }
+
+    for( size_t i = 0; i < fileNames.GetCount(); ++i )
+    {
+        if( m_pAsyncLoader->push( fileNames[i], loadAsPeaks ) )
+        {
+            ++m_loadTotal;
+        }
+        else
+        {
+            // No worker thread available, load it right away.
+            Loader loader( this, m_pListCtrl, loadAsPeaks );
+            loader( fileNames[i] );
+            m_loadErrors += loader.getNbErrors();
+        }
+    }
+
+    updateLoadProgress();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void MainFrame::onAsyncLoadEvent( wxCommandEvent& evt )
+{
+    if( ASYNC_LOAD_STARTED == evt.GetInt() )
+    {
+        #ifdef __WXMSW__
+        char separator = '\\';
+        #else
+        char separator = '/';
+        #endif
+
+        GetStatusBar()->SetStatusText( wxT( "Loading" ), 1 );
+        GetStatusBar()->SetStatusText( wxString::Format( wxT( "%s (%u/%u)" ), evt.GetString().AfterLast( separator ).c_str(), m_loadDone + 1, m_loadTotal ), 2 );
+        return;
+    }
+
+    Loader loader( this, m_pListCtrl );
+    loader( *m_pAsyncLoader, static_cast< AsyncLoadResult * >( evt.GetClientData() ) );
+    m_loadErrors += loader.getNbErrors();
+    ++m_loadDone;
+
+    m_pAsyncLoader->acknowledge();
+
+    updateLoadProgress();
+    refreshAllGLWidgets();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void MainFrame::onCancelLoad( wxCommandEvent& WXUNUSED(event) )
+{
+    m_pAsyncLoader->cancel();
+
+    // Only the file being parsed, if any, is still to come.
+    m_loadTotal = m_loadDone + ( m_pAsyncLoader->isLoading() ? 1 : 0 );
+
+    GetStatusBar()->SetStatusText( wxT( "Cancelled" ), 1 );
+    updateLoadProgress();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void MainFrame::updateLoadProgress()
+{
+    bool isLoading = m_pAsyncLoader->isLoading();
+
+    if( isLoading )
+    {
+        m_pLoadGauge->SetRange( m_loadTotal );
+        m_pLoadGauge->SetValue( m_loadDone );
+    }
+
+    if( isLoading != m_pLoadGauge->IsShown() )
+    {
+        m_pLoadGauge->Show( isLoading );
+        m_pLoadCancelButton->Show( isLoading );
+        Layout();
+    }
+
+    if( !isLoading && m_loadErrors )
+    {
+        wxString errorMsg = wxString::Format( ( m_loadErrors > 1 ? wxT( "Last error: %s\nFor a complete list of errors, please review the log" ) : wxT( "%s" ) ), Logger::getInstance()->getLastError().c_str() );
+        m_loadErrors = 0;
+
         wxMessageBox( errorMsg, wxT( "Error while loading" ), wxOK | wxICON_ERROR, NULL );
         GetStatusBar()->SetStatusText( wxT( "ERROR" ), 1 );
         GetStatusBar()->SetStatusText( Logger::getInstance()->getLastError(), 2 );
-        return;
     }
-    
-    refreshAllGLWidgets();
 }
 
 //
@@ -542,7 +658,7 @@ void MainFrame::onSaveFibers( wxCommandEvent& WXUNUSED(event) )
     }
  
     wxString caption         = wxT( "Choose a file" );
-    wxString wildcard        = wxT( "VTK fiber files (*.fib)|*.fib|DMRI fiber files (*.fib)|*.fib|*.*|*.*" );
+    wxString wildcard        = wxT( "VTK fiber files (*.fib)|*.fib|DMRI fiber files (*.fib)|*.fib|TrackVis fiber files (*.trk)|*.trk|MRtrix fiber files (*.tck)|*.tck|*.*|*.*" );
     wxString defaultDir      = wxEmptyString;
     wxString defaultFilename = wxEmptyString;
     wxFileDialog dialog( this, caption, defaultDir, defaultFilename, wildcard, wxSAVE );
@@ -570,7 +686,7 @@ void MainFrame::onSaveFibers( wxCommandEvent& WXUNUSED(event) )
                         }
                         else
                         {
-                            pFibers->save( dialog.GetPath() );
+                            saveFibersInBackground( std::vector< Fibers * >( 1, pFibers ), dialog.GetPath(), dialog.GetFilterIndex() );
                         }
                     }
                 }
@@ -585,7 +701,7 @@ void MainFrame::onSaveFibers( wxCommandEvent& WXUNUSED(event) )
                 }
                 else
                 {
-                    l_fibersGroup->save( dialog.GetPath() );
+                    saveFibersInBackground( DatasetManager::getInstance()->getFibers(), dialog.GetPath(), dialog.GetFilterIndex() );
                 }
             }
             
@@ -593,6 +709,74 @@ void MainFrame::onSaveFibers( wxCommandEvent& WXUNUSED(event) )
     }
 }
 
+//////////////////////////////////////////////////////////////////////////
+// Streams the selected fibers to the file on a worker thread, or right
+// away when that is not possible (out-of-core fibers). The extension of
+// the chosen filter is added if missing.
+//////////////////////////////////////////////////////////////////////////
+void MainFrame::saveFibersInBackground( const std::vector< Fibers * > &fibers, wxString filename, const int filterIndex )
+{
+    wxString extension = filterIndex == 2 ? wxT( "trk" ) : filterIndex == 3 ? wxT( "tck" ) : wxT( "fib" );
+
+    if( filterIndex <= 3 && filename.AfterLast( '.' ) != extension )
+    {
+        filename += wxT( "." ) + extension;
+    }
+    else if( FibersWriter::getFormat( filename ) == FibersWriter::FORMAT_VTK && filename.AfterLast( '.' ) != wxT( "fib" ) )
+    {
+        filename += wxT( ".fib" );
+    }
+
+    // Only one file is written at a time.
+    delete m_pFibersWriter;
+    m_pFibersWriter = new FibersWriter( fibers, filename );
+
+    if( m_pFibersWriter->start( this, ID_FIBERS_WRITER ) )
+    {
+        GetStatusBar()->SetStatusText( wxT( "Saving" ), 1 );
+        GetStatusBar()->SetStatusText( filename, 2 );
+    }
+    else
+    {
+        m_pFibersWriter->write();
+        delete m_pFibersWriter;
+        m_pFibersWriter = NULL;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void MainFrame::onFibersWritten( wxCommandEvent& evt )
+{
+    if( NULL != m_pFibersWriter && m_pFibersWriter->getFilename() == evt.GetString() )
+    {
+        delete m_pFibersWriter;
+        m_pFibersWriter = NULL;
+    }
+
+    GetStatusBar()->SetStatusText( evt.GetInt() ? wxT( "Saved" ) : wxT( "ERROR" ), 1 );
+    GetStatusBar()->SetStatusText( evt.GetInt() ? evt.GetString() : Logger::getInstance()->getLastError(), 2 );
+}
+
+//////////////////////////////////////////////////////////////////////////
+// The selection thread is done, the fiber sets of an up to date result
+// show their new selection. A stale result starts a new update instead.
+//////////////////////////////////////////////////////////////////////////
+void MainFrame::onSelectionUpdated( wxCommandEvent& evt )
+{
+    std::vector< Fibers * > fibers = SceneManager::getInstance()->getSelectionTree().finishSelectionUpdate( evt );
+
+    for( std::vector< Fibers * >::iterator it = fibers.begin(); it != fibers.end(); ++it )
+    {
+        (*it)->updateLinesShown( false );
+    }
+
+    if( !fibers.empty() )
+    {
+        refreshAllGLWidgets();
+    }
+}
+
 void MainFrame::onSaveDataset( wxCommandEvent& WXUNUSED(event) )
 {
     Logger::getInstance()->print( _T("Event triggered - MainFrame::onSaveDataset"), LOGLEVEL_DEBUG );
@@ -1622,6 +1806,13 @@ void MainFrame::onUseGeometryShader( wxCommandEvent& event )
 
 //////////////////////////////////////////////////////////////////////////
 
+void MainFrame::onUseCompactFibers( wxCommandEvent& event )
+{
+    SceneManager::getInstance()->toggleCompactFibers();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
 void MainFrame::onResetColor(wxCommandEvent& WXUNUSED(event))
 {
     if (m_pCurrentSceneObject != NULL && m_currentListIndex != -1)
@@ -1936,6 +2127,12 @@ void MainFrame::deleteListItem()
     {       
         long tmp = m_currentListIndex;
 
+        // The fibers being written must outlive the writer.
+        if( NULL != m_pFibersWriter )
+        {
+            m_pFibersWriter->wait();
+        }
+
         deleteSceneObject();
         m_pListCtrl->DeleteItem( tmp );
         refreshAllGLWidgets();
@@ -1948,6 +2145,11 @@ void MainFrame::onDeleteAllListItems( wxListEvent& WXUNUSED(event) )
 {
     Logger::getInstance()->print( _T( "Event triggered - MainFrame::onDeleteAllListItems" ), LOGLEVEL_DEBUG );
 
+    if( NULL != m_pFibersWriter )
+    {
+        m_pFibersWriter->wait();
+    }
+
     DatasetManager::getInstance()->clear();
 }
 
@@ -2383,6 +2585,12 @@ MainFrame::~MainFrame()
     m_pTimer->Stop();
     Logger::getInstance()->print( wxT( "Timer stopped" ), LOGLEVEL_DEBUG );
 
+    delete m_pAsyncLoader;
+    m_pAsyncLoader = NULL;
+
+    delete m_pFibersWriter;
+    m_pFibersWriter = NULL;
+
     delete m_pTimer;
     m_pTimer = NULL;
 
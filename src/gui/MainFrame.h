@@ -10,11 +10,18 @@
 #include "MyListCtrl.h"
 #include "../misc/Algorithms/Helper.h"
 
+#include <wx/button.h>
 #include <wx/checkbox.h>
+#include <wx/gauge.h>
 #include <wx/grid.h>
 #include <wx/notebook.h>
 #include <wx/treectrl.h>
 
+#include <vector>
+
+class AsyncLoader;
+class Fibers;
+class FibersWriter;
 class SelectionObject;
 class DatasetInfo;
 class ToolBar;
@@ -140,6 +147,7 @@ private:
     void onResetColor                       ( wxCommandEvent& evt );
     void onUseTransparency                  ( wxCommandEvent& evt );
     void onUseGeometryShader                ( wxCommandEvent& evt );
+    void onUseCompactFibers                 ( wxCommandEvent& evt );
 
     // Options menu
     void onToggleLighting                   ( wxCommandEvent& evt );
@@ -189,6 +197,19 @@ private:
     void onGLEvent                          ( wxCommandEvent& evt );    
     void onSliderMoved                      ( wxCommandEvent& evt );
 
+    // Background loading
+    void loadInBackground( const wxArrayString &fileNames, const bool loadAsPeaks );
+    void onAsyncLoadEvent                   ( wxCommandEvent& evt );
+    void onCancelLoad                       ( wxCommandEvent& evt );
+    void updateLoadProgress();
+
+    // Background saving
+    void saveFibersInBackground( const std::vector< Fibers * > &fibers, wxString filename, const int filterIndex );
+    void onFibersWritten                    ( wxCommandEvent& evt );
+
+    // Background selection
+    void onSelectionUpdated                 ( wxCommandEvent& evt );
+
     void updateStatusBar();
     void updateMenus();
     void onTimerEvent                       ( wxTimerEvent&   evt );
@@ -229,6 +250,15 @@ private:
 
     wxTimer             *m_pTimer;
 
+    AsyncLoader         *m_pAsyncLoader;
+    wxGauge             *m_pLoadGauge;
+    wxButton            *m_pLoadCancelButton;
+    unsigned int        m_loadDone;
+    unsigned int        m_loadTotal;
+    unsigned int        m_loadErrors;
+
+    FibersWriter        *m_pFibersWriter;
+
     bool     m_isDrawerToolActive;
     DrawMode m_drawMode;
     int      m_drawSize;
@@ -257,4 +287,9 @@ DECLARE_EVENT_TABLE()
 #define ID_Y_SLIDER                                 302
 #define ID_Z_SLIDER                                 303
 
+#define ID_ASYNC_LOAD                               310
+#define ID_LOAD_CANCEL                              311
+#define ID_FIBERS_WRITER                            312
+#define ID_SELECTION_UPDATE                         313
+
 #endif /*MAINFRAME_H_*/
@@ -87,6 +87,7 @@ MenuBar::MenuBar()
     m_itemToggleUseFakeTubes = m_menuFibers->AppendCheckItem(wxID_ANY, wxT("Use Fake Tubes"));    
     m_itemToggleUseTransparency = m_menuFibers->AppendCheckItem(wxID_ANY, wxT("Use Transparent Fibers"));
     m_itemToggleUseGeometryShader = m_menuFibers->AppendCheckItem(wxID_ANY, wxT("Use Geometry Shader"));
+    m_itemToggleUseCompactFibers = m_menuFibers->AppendCheckItem(wxID_ANY, wxT("Use Compact Buffers For New Fibers"));
 #endif
     
     m_menuOptions = new wxMenu();
@@ -228,6 +229,7 @@ void MenuBar::initMenuBar( MainFrame *mf )
     
     mf->Connect(m_itemToggleUseTransparency->GetId(), wxEVT_COMMAND_TOOL_CLICKED, wxCommandEventHandler(MainFrame::onUseTransparency));
     mf->Connect(m_itemToggleUseGeometryShader->GetId(), wxEVT_COMMAND_TOOL_CLICKED, wxCommandEventHandler(MainFrame::onUseGeometryShader));
+    mf->Connect(m_itemToggleUseCompactFibers->GetId(), wxEVT_COMMAND_TOOL_CLICKED, wxCommandEventHandler(MainFrame::onUseCompactFibers));
 #endif
 
     mf->Connect(m_itemToggleDrawer->GetId(), wxEVT_COMMAND_TOOL_CLICKED, wxCommandEventHandler(MainFrame::onSwitchDrawer));
@@ -326,6 +328,7 @@ void MenuBar::updateMenuBar( MainFrame *mf )
     m_itemToggleUseFakeTubes->Enable(isFiberSelected);
     m_itemToggleUseFakeTubes->Check(isFiberUsingFakeTubes);
     m_itemToggleUseGeometryShader->Check( SceneManager::getInstance()->isFibersGeomShaderActive() );
+    m_itemToggleUseCompactFibers->Check( SceneManager::getInstance()->isUsingCompactFibers() );
 #if _COMPILE_GEO_SHADERS
     m_itemToggleUseGeometryShader->Enable( SceneManager::getInstance()->areGeometryShadersSupported() );
 #else
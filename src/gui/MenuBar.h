@@ -71,6 +71,7 @@ public:
         wxMenuItem  *m_itemToggleInvertFibersSelection;
         wxMenuItem  *m_itemToggleUseFakeTubes;
         wxMenuItem  *m_itemToggleUseGeometryShader;
+        wxMenuItem  *m_itemToggleUseCompactFibers;
 
     wxMenu      *m_menuOptions; 
         wxMenu      *m_menuRuler;
@@ -9,6 +9,7 @@
 #include "../Logger.h"
 #include "../main.h"
 #include "../dataset/Anatomy.h"
+#include "../dataset/ConnectivityMatrix.h"
 #include "../dataset/DatasetManager.h"
 #include "../dataset/Fibers.h"
 #include "../dataset/FibersGroup.h"
@@ -20,11 +21,80 @@
 #include "../misc/IsoSurface/CIsoSurface.h"
 #include "../misc/IsoSurface/TriangleMesh.h"
 
+#include <wx/choicdlg.h>
 #include <wx/colordlg.h>
+#include <wx/filedlg.h>
 #include <wx/notebook.h>
+#include <wx/numdlg.h>
 
 #include <algorithm>
 
+namespace
+{
+    // Adds the points of the fibers to the voxels of a texture, as a count
+    // or, with hit counts, as the colors of the points.
+    class FibersTextureVisitor : public FiberTiles::Visitor
+    {
+    public:
+        FibersTextureVisitor( Fibers *pFibers, std::vector< float > &dataset, std::vector< int > *pHitCounts )
+        :   m_pFibers( pFibers ),
+            m_dataset( dataset ),
+            m_pHitCounts( pHitCounts )
+        {
+            m_columns = DatasetManager::getInstance()->getColumns();
+            m_rows    = DatasetManager::getInstance()->getRows();
+            m_voxelX  = DatasetManager::getInstance()->getVoxelX();
+            m_voxelY  = DatasetManager::getInstance()->getVoxelY();
+            m_voxelZ  = DatasetManager::getInstance()->getVoxelZ();
+        }
+
+        virtual void visit( int fiberId, const float *pPoints, int nbPoints, const float *pColor )
+        {
+            for( int j = 0; j < nbPoints; ++j )
+            {
+                int curX = static_cast<int>( pPoints[j * 3] / m_voxelX );
+                int curY = static_cast<int>( pPoints[j * 3 + 1] / m_voxelY );
+                int curZ = static_cast<int>( pPoints[j * 3 + 2] / m_voxelZ );
+
+                int index = curX + curY * m_columns + curZ * m_columns * m_rows;
+
+                if( NULL == m_pHitCounts )
+                {
+                    m_dataset.at( index ) += 1.0f;
+                    continue;
+                }
+
+                // Out-of-core fibers only have their global color.
+                if( NULL != pColor )
+                {
+                    m_dataset.at( 3 * index )     += pColor[0];
+                    m_dataset.at( 3 * index + 1 ) += pColor[1];
+                    m_dataset.at( 3 * index + 2 ) += pColor[2];
+                }
+                else
+                {
+                    wxColour ptCol = m_pFibers->getFiberPointColor( fiberId, j );
+                    m_dataset.at( 3 * index )     += ptCol.Red()   / 255.0f;
+                    m_dataset.at( 3 * index + 1 ) += ptCol.Green() / 255.0f;
+                    m_dataset.at( 3 * index + 2 ) += ptCol.Blue()  / 255.0f;
+                }
+
+                m_pHitCounts->at( index ) += 1;
+            }
+        }
+
+    private:
+        Fibers                  *m_pFibers;
+        std::vector< float >    &m_dataset;
+        std::vector< int >      *m_pHitCounts;
+        int                     m_columns;
+        int                     m_rows;
+        float                   m_voxelX;
+        float                   m_voxelY;
+        float                   m_voxelZ;
+    };
+}
+
 IMPLEMENT_DYNAMIC_CLASS(PropertiesWindow, wxScrolledWindow)
 
 BEGIN_EVENT_TABLE( PropertiesWindow, wxScrolledWindow )
@@ -688,6 +758,116 @@ void PropertiesWindow::OnGenerateFiberVolume( wxCommandEvent& WXUNUSED(event) )
     }
 }
 
+///////////////////////////////////////////////////////////////////////////
+// Counts the shown fibers between the regions of a label volume, and saves
+// the counts and the mean lengths as two CSV matrices.
+///////////////////////////////////////////////////////////////////////////
+void PropertiesWindow::OnConnectivityMatrix( wxCommandEvent& WXUNUSED(event) )
+{
+    Logger::getInstance()->print( wxT( "Event triggered - PropertiesWindow::OnConnectivityMatrix" ), LOGLEVEL_DEBUG );
+
+    long index = MyApp::frame->getCurrentListIndex();
+    if( -1 == index )
+    {
+        return;
+    }
+
+    Fibers* pFibers = DatasetManager::getInstance()->getSelectedFibers( MyApp::frame->m_pListCtrl->GetItem( index ) );
+    if( pFibers == NULL )
+    {
+        return;
+    }
+
+    std::vector< Anatomy * > anatomies;
+    wxArrayString anatomyNames;
+    std::vector< Anatomy * > allAnatomies = DatasetManager::getInstance()->getAnatomies();
+
+    for( std::vector< Anatomy * >::iterator it = allAnatomies.begin(); it != allAnatomies.end(); ++it )
+    {
+        if( (*it)->getType() == HEAD_BYTE || (*it)->getType() == HEAD_SHORT || (*it)->getType() == OVERLAY )
+        {
+            anatomies.push_back( *it );
+            anatomyNames.Add( (*it)->getName() );
+        }
+    }
+
+    if( anatomies.empty() )
+    {
+        Logger::getInstance()->print( wxT( "Load a label volume to compute a connectivity matrix." ), LOGLEVEL_WARNING );
+        return;
+    }
+
+    wxSingleChoiceDialog labelsDialog( this, wxT( "Regions of the matrix:" ), wxT( "Connectivity Matrix" ), anatomyNames );
+    if( labelsDialog.ShowModal() != wxID_OK )
+    {
+        return;
+    }
+
+    wxArrayString memberships;
+    memberships.Add( wxT( "End points" ) );
+    memberships.Add( wxT( "Any point" ) );
+
+    wxSingleChoiceDialog membershipDialog( this, wxT( "A fiber joins the regions of its:" ), wxT( "Connectivity Matrix" ), memberships );
+    if( membershipDialog.ShowModal() != wxID_OK )
+    {
+        return;
+    }
+
+    wxFileDialog fileDialog( this, wxT( "Save the fiber counts" ), wxEmptyString, pFibers->getName().BeforeFirst( '.' ) + wxT( "_connectivity.csv" ),
+                             wxT( "CSV files (*.csv)|*.csv" ), wxSAVE | wxFD_OVERWRITE_PROMPT );
+    if( fileDialog.ShowModal() != wxID_OK )
+    {
+        return;
+    }
+
+    ConnectivityMatrix matrix( pFibers, anatomies[labelsDialog.GetSelection()],
+                               membershipDialog.GetSelection() == 0 ? ConnectivityMatrix::MEMBERSHIP_ENDPOINTS : ConnectivityMatrix::MEMBERSHIP_ANY_POINT );
+
+    if( !matrix.isEmpty() )
+    {
+        wxString countsPath = fileDialog.GetPath();
+        wxString lengthsPath = ( countsPath.Find( '.', true ) != wxNOT_FOUND ? countsPath.BeforeLast( '.' ) : countsPath ) + wxT( "_mean_length.csv" );
+
+        matrix.saveCSV( countsPath,  ConnectivityMatrix::VALUE_COUNT );
+        matrix.saveCSV( lengthsPath, ConnectivityMatrix::VALUE_MEAN_LENGTH );
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////
+// Clusters the fibers shown with QuickBundles and colors them by cluster.
+///////////////////////////////////////////////////////////////////////////
+void PropertiesWindow::OnClusterFibers( wxCommandEvent& WXUNUSED(event) )
+{
+    Logger::getInstance()->print( wxT( "Event triggered - PropertiesWindow::OnClusterFibers" ), LOGLEVEL_DEBUG );
+
+    long index = MyApp::frame->getCurrentListIndex();
+    if( -1 == index )
+    {
+        return;
+    }
+
+    Fibers* pFibers = DatasetManager::getInstance()->getSelectedFibers( MyApp::frame->m_pListCtrl->GetItem( index ) );
+    if( pFibers == NULL )
+    {
+        return;
+    }
+
+    long threshold = wxGetNumberFromUser( wxT( "Largest distance between a fiber and the centroid of its cluster." ),
+                                          wxT( "Threshold (mm)" ), wxT( "Cluster Fibers" ), 10, 1, 100, this );
+    if( threshold < 0 )
+    {
+        return;
+    }
+
+    wxBusyCursor busy;
+    pFibers->clusterFibers( threshold );
+
+    pFibers->setColorationMode( CLUSTER_COLOR );
+    pFibers->updateFibersColors();
+    pFibers->updateColorationMode();
+    pFibers->updatePropertiesSizer();
+}
+
 void PropertiesWindow::OnToggleUseTex( wxCommandEvent&  WXUNUSED(event) )
 {
     Logger::getInstance()->print( wxT( "Event triggered - PropertiesWindow::OnToggleUseTex" ), LOGLEVEL_DEBUG );
@@ -816,6 +996,84 @@ void PropertiesWindow::OnColorWithTorsion( wxCommandEvent& WXUNUSED(event) )
     }
 }
 
+///////////////////////////////////////////////////////////////////////////
+// This function will be triggered when the user click on the column coloring
+// radio button, the fibers are colored with the column picked in the list.
+///////////////////////////////////////////////////////////////////////////
+void PropertiesWindow::OnColorWithColumn( wxCommandEvent& WXUNUSED(event) )
+{
+    Logger::getInstance()->print( wxT( "Event triggered - PropertiesWindow::OnColorWithColumn" ), LOGLEVEL_DEBUG );
+
+    long index = MyApp::frame->getCurrentListIndex();
+    if( -1 != index )
+    {
+        Fibers* pFibers = DatasetManager::getInstance()->getSelectedFibers( MyApp::frame->m_pListCtrl->GetItem( index ) );
+        if( pFibers != NULL && pFibers->getSelectedColumn() >= 0 )
+        {
+            if( pFibers->getColorationMode() != COLUMN_COLOR )
+            {
+                pFibers->setColorationMode( COLUMN_COLOR );
+                pFibers->updateFibersColors();
+                pFibers->updateColorationMode();
+            }
+        }
+    }
+    else
+    {
+        Logger::getInstance()->print( wxT( "PropertiesWindow::OnColorWithColumn - Current index is -1" ), LOGLEVEL_ERROR );
+    }
+}
+
+///////////////////////////////////////////////////////////////////////////
+// This function will be triggered when the user click on the clusters
+// coloring radio button, available once the fibers are clustered.
+///////////////////////////////////////////////////////////////////////////
+void PropertiesWindow::OnColorWithClusters( wxCommandEvent& WXUNUSED(event) )
+{
+    Logger::getInstance()->print( wxT( "Event triggered - PropertiesWindow::OnColorWithClusters" ), LOGLEVEL_DEBUG );
+
+    long index = MyApp::frame->getCurrentListIndex();
+    if( -1 != index )
+    {
+        Fibers* pFibers = DatasetManager::getInstance()->getSelectedFibers( MyApp::frame->m_pListCtrl->GetItem( index ) );
+        if( pFibers != NULL && pFibers->getClustersCount() > 0 )
+        {
+            if( pFibers->getColorationMode() != CLUSTER_COLOR )
+            {
+                pFibers->setColorationMode( CLUSTER_COLOR );
+                pFibers->updateFibersColors();
+                pFibers->updateColorationMode();
+            }
+        }
+    }
+    else
+    {
+        Logger::getInstance()->print( wxT( "PropertiesWindow::OnColorWithClusters - Current index is -1" ), LOGLEVEL_ERROR );
+    }
+}
+
+void PropertiesWindow::OnFibersColumn( wxCommandEvent& event )
+{
+    Logger::getInstance()->print( wxT( "Event triggered - PropertiesWindow::OnFibersColumn" ), LOGLEVEL_DEBUG );
+
+    long index = MyApp::frame->getCurrentListIndex();
+    if( -1 != index )
+    {
+        Fibers* pFibers = DatasetManager::getInstance()->getSelectedFibers( MyApp::frame->m_pListCtrl->GetItem( index ) );
+        if( pFibers != NULL )
+        {
+            pFibers->selectColumn( event.GetSelection() );
+
+            if( pFibers->getColorationMode() == COLUMN_COLOR )
+            {
+                pFibers->updateFibersColors();
+            }
+            pFibers->updateFibersFilters();
+            pFibers->updatePropertiesSizer();
+        }
+    }
+}
+
 void PropertiesWindow::OnNormalColoring( wxCommandEvent& WXUNUSED(event) )
 {
     Logger::getInstance()->print( wxT( "Event triggered - PropertiesWindow::OnNormalColoring" ), LOGLEVEL_DEBUG );
@@ -1630,20 +1888,12 @@ void PropertiesWindow::OnAssignColor( wxCommandEvent& WXUNUSED(event) )
         
         for (vector<Fibers*>::iterator curFib(allFibs.begin()); curFib < allFibs.end(); ++curFib)
         {
-            vector<bool> selFibers = SceneManager::getInstance()->getSelectionTree().getSelectedFibers( *curFib );
-            
-            vector<bool> filteredFibs = (*curFib)->getFilteredFibers();
-
-            vector<bool>::iterator filteredIt(filteredFibs.begin());
+            BitSet selFibers = SceneManager::getInstance()->getSelectionTree().getSelectedFibers( *curFib );
+            selFibers.andNot( (*curFib)->getFilteredFibers() );
 
-            int fibItIdx(0);
-            
-            for( vector<bool>::iterator fibIt(selFibers.begin()); fibIt != selFibers.end(); ++fibIt, ++filteredIt, ++fibItIdx )
+            for( int fibItIdx = selFibers.findNext( 0 ); fibItIdx < static_cast< int >( selFibers.size() ); fibItIdx = selFibers.findNext( fibItIdx + 1 ) )
             {
-                if( *fibIt && !*filteredIt)
-                {
-                    (*curFib)->setFiberColor( fibItIdx, newCol );
-                }
+                (*curFib)->setFiberColor( fibItIdx, newCol );
             }
         }
         // TODO is this mandatory
@@ -1710,41 +1960,16 @@ void PropertiesWindow::OnCreateFibersDensityTexture( wxCommandEvent& WXUNUSED(ev
     
     std::vector<float>* pDataset = pNewAnatomy->getFloatDataset();
     
-    float voxelX = DatasetManager::getInstance()->getVoxelX();
-    float voxelY = DatasetManager::getInstance()->getVoxelY();
-    float voxelZ = DatasetManager::getInstance()->getVoxelZ();
-    
     // Iterate over all fibers.
     vector<Fibers*> allFibs(DatasetManager::getInstance()->getFibers());
     
     for (vector<Fibers*>::iterator curFib(allFibs.begin()); curFib < allFibs.end(); ++curFib)
     {
-        vector<bool> selFibers = SceneManager::getInstance()->getSelectionTree().getSelectedFibers( *curFib );
-        
-        vector<bool> filteredFibs = (*curFib)->getFilteredFibers();
-        
-        vector<bool>::iterator filteredIt(filteredFibs.begin());
-        
-        int fibItIdx(0);
-        
-        for( vector<bool>::iterator fibIt(selFibers.begin()); fibIt != selFibers.end(); ++fibIt, ++filteredIt, ++fibItIdx )
-        {
-            if( *fibIt && !*filteredIt)
-            {
-                unsigned int pc = (*curFib)->getStartIndexForLine( fibItIdx ) * 3;
-                
-                for( int j = 0; j < (*curFib)->getPointsPerLine( fibItIdx ) ; ++j, pc += 3 )
-                {
-                    int curX = static_cast<int>( (*curFib)->getPointValue( pc ) / voxelX );
-                    int curY = static_cast<int>( (*curFib)->getPointValue( pc + 1 ) / voxelY );
-                    int curZ = static_cast<int>( (*curFib)->getPointValue( pc + 2 ) / voxelZ );
-                    
-                    int index = curX + curY * columns + curZ * columns * rows;
-                    
-                    pDataset->at( index )     += 1.0f;
-                }
-            }
-        }
+        BitSet selFibers = SceneManager::getInstance()->getSelectionTree().getSelectedFibers( *curFib );
+        selFibers.andNot( (*curFib)->getFilteredFibers() );
+
+        FibersTextureVisitor visitor( *curFib, *pDataset, NULL );
+        (*curFib)->visitFibers( selFibers, visitor );
     }
     
     // Normalize all values.
@@ -1797,47 +2022,16 @@ void PropertiesWindow::OnCreateFibersColorTexture( wxCommandEvent& WXUNUSED(even
     
     std::vector<int> voxHitCount( pDataset->size() / 3, 0 );
 
-    float voxelX = DatasetManager::getInstance()->getVoxelX();
-    float voxelY = DatasetManager::getInstance()->getVoxelY();
-    float voxelZ = DatasetManager::getInstance()->getVoxelZ();
-    
     // Iterate over all fibers.
     vector<Fibers*> allFibs(DatasetManager::getInstance()->getFibers());
     
     for (vector<Fibers*>::iterator curFib(allFibs.begin()); curFib < allFibs.end(); ++curFib)
     {
-        vector<bool> selFibers = SceneManager::getInstance()->getSelectionTree().getSelectedFibers( *curFib );
-        
-        vector<bool> filteredFibs = (*curFib)->getFilteredFibers();
-        
-        vector<bool>::iterator filteredIt(filteredFibs.begin());
-        
-        int fibItIdx(0);
-        
-        for( vector<bool>::iterator fibIt(selFibers.begin()); fibIt != selFibers.end(); ++fibIt, ++filteredIt, ++fibItIdx )
-        {
-            if( *fibIt && !*filteredIt)
-            {
-                unsigned int pc = (*curFib)->getStartIndexForLine( fibItIdx ) * 3;
-                
-                for( int j = 0; j < (*curFib)->getPointsPerLine( fibItIdx ) ; ++j, pc += 3 )
-                {
-                    wxColour ptCol = (*curFib)->getFiberPointColor( fibItIdx, j );
-                    
-                    int curX = static_cast<int>( (*curFib)->getPointValue( pc ) / voxelX );
-                    int curY = static_cast<int>( (*curFib)->getPointValue( pc + 1 ) / voxelY );
-                    int curZ = static_cast<int>( (*curFib)->getPointValue( pc + 2 ) / voxelZ );
-                    
-                    int index = 3 * ( curX + curY * columns + curZ * columns * rows );
-                    
-                    pDataset->at( index )     += ptCol.Red()   / 255.0f;
-                    pDataset->at( index + 1 ) += ptCol.Green() / 255.0f;
-                    pDataset->at( index + 2 ) += ptCol.Blue()  / 255.0f;
-                    
-                    voxHitCount.at( index / 3 ) += 1;
-                }
-            }
-        }
+        BitSet selFibers = SceneManager::getInstance()->getSelectionTree().getSelectedFibers( *curFib );
+        selFibers.andNot( (*curFib)->getFilteredFibers() );
+
+        FibersTextureVisitor visitor( *curFib, *pDataset, &voxHitCount );
+        (*curFib)->visitFibers( selFibers, visitor );
     }
     
     // Normalize all values.
@@ -78,6 +78,8 @@ public:
 
     void OnFibersFilter                     ( wxCommandEvent& event );
     void OnGenerateFiberVolume              ( wxCommandEvent& event );
+    void OnConnectivityMatrix               ( wxCommandEvent& event );
+    void OnClusterFibers                    ( wxCommandEvent& event );
     void OnToggleUseTex                     ( wxCommandEvent& event );
     void OnListMenuDistance                 ( wxCommandEvent& event );
     void OnListMenuMinDistance              ( wxCommandEvent& event );
@@ -85,6 +87,9 @@ public:
     void OnNormalColoring                   ( wxCommandEvent& event );
     void OnColorWithTorsion                 ( wxCommandEvent& event );
     void OnColorWithConstantColor           ( wxCommandEvent& event );
+    void OnColorWithColumn                  ( wxCommandEvent& event );
+    void OnColorWithClusters                ( wxCommandEvent& event );
+    void OnFibersColumn                     ( wxCommandEvent& event );
     void OnSelectConstantColor              ( wxCommandEvent& event );
     void ColorFibers();
 
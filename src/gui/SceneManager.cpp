@@ -9,6 +9,7 @@
 #include "../Logger.h"
 #include "../main.h"
 #include "../dataset/AnatomyHelper.h"
+#include "../dataset/AsyncLoader.h"
 #include "../dataset/DatasetManager.h"
 #include "../dataset/Mesh.h"
 #include "../dataset/ODFs.h"
@@ -16,6 +17,7 @@
 #include "../dataset/Maximas.h"
 #include "../gfx/ShaderHelper.h"
 #include "../gfx/TheScene.h"
+#include "../misc/ParallelFor.h"
 #include "../misc/XmlHelper.h"
 
 #include <wx/xml/xml.h>
@@ -27,6 +29,63 @@ using std::map;
 #include <vector>
 using std::vector;
 
+namespace
+{
+    // Attributes of a dataset node of a scene file.
+    struct SceneDataset
+    {
+        bool     active;
+        bool     isFiberGroup;
+        bool     showFS;
+        bool     useTex;
+        double   alpha;
+        double   threshold;
+        long     position;
+        wxString path;
+    };
+
+    //////////////////////////////////////////////////////////////////////////
+    // Parses the datasets of a scene, each thread taking the next file
+    // as soon as it is done with one so a big fiber set does not hold
+    // back the files queued after it.
+    //////////////////////////////////////////////////////////////////////////
+    class SceneParseTask : public ParallelTask
+    {
+    public:
+        SceneParseTask( vector< AsyncLoadResult * > &results, size_t first )
+        :   m_results( results ),
+            m_next( first )
+        {
+        }
+
+        virtual void run( size_t WXUNUSED(begin), size_t WXUNUSED(end) )
+        {
+            while( true )
+            {
+                size_t i;
+                {
+                    wxMutexLocker lock( m_mutex );
+                    if( m_next >= m_results.size() )
+                    {
+                        return;
+                    }
+                    i = m_next++;
+                }
+
+                if( NULL != m_results[i] )
+                {
+                    AsyncLoader::parse( *m_results[i] );
+                }
+            }
+        }
+
+    private:
+        vector< AsyncLoadResult * > &m_results;
+        size_t  m_next;
+        wxMutex m_mutex;
+    };
+}
+
 
 namespace
 {
@@ -62,6 +121,7 @@ SceneManager::SceneManager(void)
     m_sliceY( 0.0f ),
     m_sliceZ( 0.0f ),
     m_useVBO( true ),
+    m_useCompactFibers( false ),
     m_quadrant( 6 ),
     m_segmentActive( false ),
     m_segmentMethod( FLOODFILL ),
@@ -505,79 +565,109 @@ bool SceneManager::loadOldVersion( wxXmlNode * pRoot )
         else if( wxT( "data" ) == nodeName )
         {
             map<long, DatasetIndex> realPositions;
+            vector<SceneDataset> datasets;
 
             wxXmlNode *pDatasetNode = pChild->GetChildren();
             while( pDatasetNode )
             {
-                bool     active         = true;
-                bool     isFiberGroup   = false;
-                bool     showFS         = true;
-                bool     useTex         = true;
-                double   alpha          = 1.00;
-                double   threshold      = 0.00;
-                long     position       = 0;
-                wxString name;
-                wxString path;
+                SceneDataset dataset;
+                dataset.active       = true;
+                dataset.isFiberGroup = false;
+                dataset.showFS       = true;
+                dataset.useTex       = true;
+                dataset.alpha        = 1.00;
+                dataset.threshold    = 0.00;
+                dataset.position     = 0;
 
                 wxXmlNode *pAttribute = pDatasetNode->GetChildren();
                 while( NULL != pAttribute )
                 {
                     if( wxT( "status" ) == pAttribute->GetName() )
                     {
-                        isFiberGroup = pAttribute->GetPropVal( wxT( "isFiberGroup" ), wxT( "no" ) ) == wxT( "yes" );
-                        name         = pAttribute->GetPropVal( wxT( "name" ), wxT( "" ) );
-                        useTex       = pAttribute->GetPropVal( wxT( "useTex" ), wxT( "yes" ) ) == wxT( "yes" );
-                        showFS       = pAttribute->GetPropVal( wxT( "showFS" ), wxT( "yes" ) ) == wxT( "yes" );
-                        active       = pAttribute->GetPropVal( wxT( "active" ), wxT( "yes" ) ) == wxT( "yes" );
+                        dataset.isFiberGroup = pAttribute->GetPropVal( wxT( "isFiberGroup" ), wxT( "no" ) ) == wxT( "yes" );
+                        dataset.useTex       = pAttribute->GetPropVal( wxT( "useTex" ), wxT( "yes" ) ) == wxT( "yes" );
+                        dataset.showFS       = pAttribute->GetPropVal( wxT( "showFS" ), wxT( "yes" ) ) == wxT( "yes" );
+                        dataset.active       = pAttribute->GetPropVal( wxT( "active" ), wxT( "yes" ) ) == wxT( "yes" );
                         
-                        pAttribute->GetPropVal( wxT( "alpha" ), wxT( "1.0" ) ).ToDouble( &alpha );
-                        pAttribute->GetPropVal( wxT( "threshold" ), wxT( "0.0" ) ).ToDouble( &threshold );
-                        pAttribute->GetPropVal( wxT( "position" ), wxT( "-1" ) ).ToLong( &position );
+                        pAttribute->GetPropVal( wxT( "alpha" ), wxT( "1.0" ) ).ToDouble( &dataset.alpha );
+                        pAttribute->GetPropVal( wxT( "threshold" ), wxT( "0.0" ) ).ToDouble( &dataset.threshold );
+                        pAttribute->GetPropVal( wxT( "position" ), wxT( "-1" ) ).ToLong( &dataset.position );
                     }
                     else if( wxT( "path" ) == pAttribute->GetName() )
                     {
-                        path = pAttribute->GetNodeContent();
+                        dataset.path = pAttribute->GetNodeContent();
                     }
 
                     pAttribute = pAttribute->GetNext();
                 }
 
-                wxString extension = path.AfterLast( '.' );
-                if( wxT( "gz" ) == extension )
+                datasets.push_back( dataset );
+                pDatasetNode = pDatasetNode->GetNext();
+            }
+
+            // The files are parsed concurrently, except the ones up to the
+            // first anatomy: it sets the dimensions the others depend on.
+            vector< AsyncLoadResult * > results( datasets.size(), NULL );
+            vector< DatasetIndex > indexes( datasets.size() );
+
+            size_t first = 0;
+            for( ; first < datasets.size() && !DatasetManager::getInstance()->isAnatomyLoaded(); ++first )
+            {
+                if( !datasets[first].isFiberGroup )
+                {
+                    AsyncLoadResult *pResult = new AsyncLoadResult( datasets[first].path );
+                    AsyncLoader::parse( *pResult );
+                    indexes[first] = AsyncLoader::insert( pResult );
+                }
+            }
+
+            for( size_t i = first; i < datasets.size(); ++i )
+            {
+                if( !datasets[i].isFiberGroup )
                 {
-                    extension = path.BeforeLast( '.' ).AfterLast( '.' );
+                    results[i] = new AsyncLoadResult( datasets[i].path );
                 }
+            }
+
+            if( first < datasets.size() )
+            {
+                SceneParseTask task( results, first );
+                parallelFor( std::min( datasets.size() - first, static_cast< size_t >( getParallelThreadsCount() ) ), task );
+            }
 
-                DatasetIndex index;
-                if( isFiberGroup )
+            // Datasets are inserted in the order of the scene file.
+            for( size_t i = 0; i < datasets.size(); ++i )
+            {
+                const SceneDataset &dataset = datasets[i];
+                DatasetIndex index = indexes[i];
+
+                if( dataset.isFiberGroup )
                 {
                     if( !DatasetManager::getInstance()->isFibersGroupLoaded() )
                     {
                         index = DatasetManager::getInstance()->createFibersGroup();
                     }
                 }
-                else
+                else if( NULL != results[i] )
                 {
-                    index = DatasetManager::getInstance()->load( path, extension );
+                    index = AsyncLoader::insert( results[i] );
                 }
 
                 if( index.isOk() )
                 {
                     DatasetInfo *pDataset = DatasetManager::getInstance()->getDataset( index );
-                    pDataset->setShow( active );
-                    pDataset->setShowFS( showFS );
-                    pDataset->setUseTex( useTex );
-                    pDataset->setAlpha( alpha );
-                    pDataset->setThreshold( threshold );
+                    pDataset->setShow( dataset.active );
+                    pDataset->setShowFS( dataset.showFS );
+                    pDataset->setUseTex( dataset.useTex );
+                    pDataset->setAlpha( dataset.alpha );
+                    pDataset->setThreshold( dataset.threshold );
 
-                    realPositions[position] = index;
+                    realPositions[dataset.position] = index;
                 }
                 else
                 {
                     ++errors;
                 }
-
-                pDatasetNode = pDatasetNode->GetNext();
             }
 
             // Insert datasets into list
@@ -77,6 +77,10 @@ public:
     bool  isUsingVBO() const        { return m_useVBO; }
     void  setUsingVBO( bool state ) { m_useVBO = state; }
 
+    // Only applies to the fibers buffers created afterwards.
+    bool  isUsingCompactFibers() const  { return m_useCompactFibers; }
+    bool  toggleCompactFibers()         { return m_useCompactFibers = !m_useCompactFibers; }
+
     int   getQuadrant() const       { return m_quadrant; }
     void  setQuadrant( int quad )   { m_quadrant = quad; }
 
@@ -190,6 +194,7 @@ private:
     float m_sliceZ;
 
     bool  m_useVBO;
+    bool  m_useCompactFibers;
     int   m_quadrant;
 
     bool  m_segmentActive;
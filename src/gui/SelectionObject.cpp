@@ -17,10 +17,12 @@
 #include "../main.h"
 #include "../dataset/Anatomy.h"
 #include "../dataset/DatasetManager.h"
+#include "../dataset/FiberTiles.h"
 #include "../dataset/Fibers.h"
+#include "../dataset/FibersCrossSections.h"
+#include "../dataset/FibersStats.h"
 #include "../gui/MainFrame.h"
-#include "../misc/Algorithms/ConvexGrahamHull.h"
-#include "../misc/Algorithms/ConvexHullIncremental.h"
+#include "../misc/Algorithms/ConvexHullQuickhull.h"
 #include "../misc/IsoSurface/CIsoSurface.h"
 #include "../misc/IsoSurface/TriangleMesh.h"
 
@@ -41,6 +43,27 @@ using std::vector;
 #define DEF_POS   wxDefaultPosition
 #define DEF_SIZE  wxDefaultSize
 
+namespace
+{
+    // Appends the points of the visited fibers.
+    class PointsVisitor : public FiberTiles::Visitor
+    {
+    public:
+        PointsVisitor( vector< Vector > &points ) : m_points( points ) {}
+
+        virtual void visit( int, const float *pPoints, int nbPoints, const float * )
+        {
+            for( int pointIdx(0); pointIdx < nbPoints; ++pointIdx )
+            {
+                m_points.push_back( Vector( pPoints[pointIdx * 3], pPoints[pointIdx * 3 + 1], pPoints[pointIdx * 3 + 2] ) );
+            }
+        }
+
+    private:
+        vector< Vector > &m_points;
+    };
+}
+
 SelectionObject::SelectionObject( Vector i_center, Vector i_size )
 :   m_pLabelAnatomy   ( NULL ),
     m_pCBSelectDataSet( NULL ),
@@ -77,6 +100,13 @@ SelectionObject::SelectionObject( Vector i_center, Vector i_size )
     m_boxMoved              = false;
     m_boxResized            = false;
     m_mustUpdateConvexHull  = true;
+    m_inBoxChanged          = false;
+    m_inBranchChanged       = false;
+    m_childrenChanged       = false;
+    m_appliedCenter         = m_center;
+    m_appliedSize           = m_size;
+    m_appliedIsActive       = m_isActive;
+    m_appliedIsNOT          = m_isNOT;
 
     //Distance coloring
     m_DistColoring          = false;
@@ -395,6 +425,7 @@ bool SelectionObject::toggleIsActive()
 void SelectionObject::setIsActive( bool isActive )
 {
     SceneManager::getInstance()->setSelBoxChanged( true );
+    SceneManager::getInstance()->getSelectionTree().notifyInBranchNeedsUpdating( this );
     SceneManager::getInstance()->getSelectionTree().notifyStatsNeedUpdating( this );
     m_isActive = isActive;
 }
@@ -463,6 +494,7 @@ bool SelectionObject::toggleIsNOT()
 void SelectionObject::setIsNOT( bool i_isNOT )
 {
     m_isNOT = i_isNOT;
+    SceneManager::getInstance()->getSelectionTree().notifyInBranchNeedsUpdating( this );
     SceneManager::getInstance()->getSelectionTree().notifyStatsNeedUpdating( this );
     SceneManager::getInstance()->setSelBoxChanged( true );
 }
@@ -625,22 +657,35 @@ void SelectionObject::drawThickFiber( const vector< Vector > &i_fiberPoints, flo
 
 }
 
+///////////////////////////////////////////////////////////////////////////
+// Computes the hull of the points of the selected fibers of all the shown
+// sets. The points are read in place, only their order does not matter.
+///////////////////////////////////////////////////////////////////////////
 void SelectionObject::computeConvexHull()
 {
-    m_mustUpdateConvexHull = true;
-//     if ( m_pToggleDisplayConvexHull->GetValue() && m_convexHullOpacity != 0)
-//     {
-//             vector< Vector > pts;
-//             vector< vector< Vector > > l_selectedFibersPoints = getSelectedFibersPoints();
-//             for (unsigned int i(0); i< l_selectedFibersPoints.size(); i++)
-//                 pts.insert(pts.end(), l_selectedFibersPoints[i].begin(), l_selectedFibersPoints[i].end());
-// 
-//             m_hullTriangles.clear();
-//             ConvexHullIncremental hull(pts);
-//             hull.buildHull();
-//             hull.getHullTriangles( m_hullTriangles );
-//             m_mustUpdateConvexHull = false;
-//     }
+    m_hullTriangles.clear();
+
+    vector< Vector > points;
+    vector< Fibers * > pFibersSet = DatasetManager::getInstance()->getFibers();
+
+    for( size_t fiberSetIdx(0); fiberSetIdx < pFibersSet.size(); ++fiberSetIdx )
+    {
+        Fibers *pCurFibers = pFibersSet[ fiberSetIdx ];
+        if( !pCurFibers->getShow() )
+        {
+            continue;
+        }
+
+        PointsVisitor visitor( points );
+        pCurFibers->visitFibers( getSelectedFibers( pCurFibers ), visitor );
+    }
+
+    ConvexHullQuickhull hull( points );
+    if( hull.buildHull() )
+    {
+        hull.getHullTriangles( m_hullTriangles );
+    }
+    m_mustUpdateConvexHull = false;
 }
 
 void SelectionObject::drawConvexHull()
@@ -794,12 +839,21 @@ void SelectionObject::updateStats()
         m_stats.m_meanValue  = 0.0f;
     }
     
-    if( m_meanFiberIsBeingDisplayed )
+    // The cross sections are cut along the mean fiber.
+    const bool meanFiberIsNeeded = m_meanFiberIsBeingDisplayed || m_statsAreBeingComputed;
+    
+    if( meanFiberIsNeeded )
     {
         m_meanFiberPoints.assign(MEAN_FIBER_NB_POINTS, Vector( 0.0, 0.0, 0.0 ));
     }
     
     int activeFiberSetCount( 0 );
+    vector< Fibers * > activeFibersSets;
+    vector< BitSet >   activeSelections;
+    
+    // Only read the values when they are shown, the anatomy is picked here
+    // since the combo box cannot be read from the threads.
+    Anatomy *pValues = m_statsAreBeingComputed ? getStatsAnatomy() : NULL;
     
     vector< Fibers * > pFibersSet = DatasetManager::getInstance()->getFibers();
     
@@ -808,52 +862,35 @@ void SelectionObject::updateStats()
         Fibers *pCurFibers = pFibersSet[ fiberSetIdx ];
         if( pCurFibers->getShow() )
         {
-            vector< int > selectedFibersIdx = getSelectedFibersIndexes( pCurFibers );
+            BitSet selectedFibers = getSelectedFibers( pCurFibers );
             
-            if( selectedFibersIdx.empty() )
+            if( !selectedFibers.any() )
             {
                 // Do not want to do any processing in this case.
                 continue;
             }
             
-            vector< int > nbPointsBySelectedFiber;
-            vector< vector < Vector > > pointsBySelectedFiber;
-            
-            getSelectedFibersInfo( selectedFibersIdx, pCurFibers, 
-                                  nbPointsBySelectedFiber, pointsBySelectedFiber );
+            // One pass over the points of the selected fibers, in place.
+            FibersStats stats( pCurFibers, selectedFibers, pValues, 
+                               meanFiberIsNeeded ? MEAN_FIBER_NB_POINTS : 0 );
             
             ++activeFiberSetCount;
+            activeFibersSets.push_back( pCurFibers );
+            activeSelections.push_back( selectedFibers );
             
             if( m_statsAreBeingComputed )
             {
-                m_stats.m_count += selectedFibersIdx.size();
-                
-                float localMeanLength( 0.0f );
-                float localMaxLength(  0.0f );
-                float localMinLength(  0.0f );
-                
-                getMeanMaxMinFiberLength( selectedFibersIdx, pCurFibers, 
-                                            localMeanLength, 
-                                            localMaxLength, 
-                                            localMinLength );
-                
-                m_stats.m_meanLength += localMeanLength;
-                
-                m_stats.m_maxLength = std::max( m_stats.m_maxLength, localMaxLength );
-                m_stats.m_minLength = std::min( m_stats.m_minLength, localMinLength );
-                
-                float localMeanValue( 0.0f );
-                
-                getMeanFiberValue( pointsBySelectedFiber, localMeanValue );
-                
-                m_stats.m_meanValue += localMeanValue;
+                m_stats.m_count      += stats.getCount();
+                m_stats.m_meanLength += stats.getMeanLength();
+                m_stats.m_maxLength   = std::max( m_stats.m_maxLength, stats.getMaxLength() );
+                m_stats.m_minLength   = std::min( m_stats.m_minLength, stats.getMinLength() );
+                m_stats.m_meanValue  += stats.getMeanValue();
             }
 
             // Get the mean fiber.
-            if( m_meanFiberIsBeingDisplayed )
+            if( meanFiberIsNeeded )
             {
-                vector< Vector > meanFiberPoint;
-                getMeanFiber(pointsBySelectedFiber, MEAN_FIBER_NB_POINTS, meanFiberPoint);
+                const vector< Vector > &meanFiberPoint = stats.getMeanFiber();
                 
                 for( int meanPtIdx( 0 ); meanPtIdx < MEAN_FIBER_NB_POINTS; ++meanPtIdx )
                 {
@@ -871,7 +908,7 @@ void SelectionObject::updateStats()
             m_stats.m_meanValue     /= activeFiberSetCount;
         }
         
-        if( m_meanFiberIsBeingDisplayed )
+        if( meanFiberIsNeeded )
         {
             for( int meanPtIdx( 0 ); meanPtIdx < MEAN_FIBER_NB_POINTS; ++meanPtIdx )
             {
@@ -880,6 +917,14 @@ void SelectionObject::updateStats()
         }
     }
     
+    if( m_statsAreBeingComputed )
+    {
+        getMeanMaxMinFiberCrossSection( activeFibersSets, activeSelections, m_meanFiberPoints,
+                                        m_stats.m_meanCrossSection,
+                                        m_stats.m_maxCrossSection,
+                                        m_stats.m_minCrossSection );
+    }
+    
     if( m_stats.m_minLength == std::numeric_limits< float >::max() )
     {
         m_stats.m_minLength = 0.0f;
@@ -889,13 +934,6 @@ void SelectionObject::updateStats()
     
     updateStatsGrid();
     
-    //vector< vector< Vector > > l_selectedFibersPoints = getSelectedFibersPoints();
-    
-    /*//getMeanMaxMinFiberCrossSection  ( l_selectedFibersPoints,
-     //                                  m_meanFiberPoints,
-     //                                  o_gridInfo.m_meanCrossSection, 
-     //                                  o_gridInfo.m_maxCrossSection,
-     //                                  o_gridInfo.m_minCrossSection   );*/
     ////getFiberDispersion              ( o_gridInfo.m_dispersion        );
     
     
@@ -908,12 +946,27 @@ void SelectionObject::notifyStatsNeedUpdating()
 
 vector< int > SelectionObject::getSelectedFibersIndexes( Fibers *pFibers )
 {
-    vector< bool > filteredFiber = pFibers->getFilteredFibers();
+    BitSet selectedFibers = getSelectedFibers( pFibers );
     
-    SelectionState &curState = getState( pFibers->getName() );
+    vector< int > selectedIndexes;
+    selectedIndexes.reserve( selectedFibers.count() );
     
-    vector< bool > branchToUse;
+    for( size_t fiberIdx = selectedFibers.findNext( 0 ); fiberIdx < selectedFibers.size(); fiberIdx = selectedFibers.findNext( fiberIdx + 1 ) )
+    {
+        selectedIndexes.push_back( fiberIdx );
+    }
+    
+    return selectedIndexes;
+}
+
+BitSet SelectionObject::getSelectedFibers( Fibers *pFibers )
+{
     SelectionTree &selTree( SceneManager::getInstance()->getSelectionTree() );
+    selTree.waitForSelectionUpdate();
+    
+    SelectionState &curState = getState( pFibers->getName() );
+    
+    BitSet branchToUse;
     
     if( selTree.getActiveChildrenObjectsCount( this ) > 0 )
     {
@@ -926,31 +979,23 @@ vector< int > SelectionObject::getSelectedFibersIndexes( Fibers *pFibers )
         
         if( pParentObj != NULL )
         {
-            // OPTIM: this could be optimized
             SelectionState &parentState = pParentObj->getState( pFibers->getName() );
-            branchToUse.assign( curState.m_inBranch.size(), false );
             
-            bool parentIsNot( pParentObj->getIsNOT() );
-            bool currentIsNot( getIsNOT() );
+            // ( parent or not parent ) and ( current or not current ).
+            branchToUse = parentState.m_inBox;
             
-            for( unsigned int fiberIdx( 0 ); fiberIdx < curState.m_inBox.size(); ++fiberIdx )
+            if( pParentObj->getIsNOT() )
             {
-                if( !parentIsNot && !currentIsNot )
-                {
-                    branchToUse[ fiberIdx ] = parentState.m_inBox[ fiberIdx ] & curState.m_inBox[ fiberIdx ];
-                }
-                else if( !parentIsNot && currentIsNot )
-                {
-                    branchToUse[ fiberIdx ] = parentState.m_inBox[ fiberIdx ] & !curState.m_inBox[ fiberIdx ];
-                }
-                else if( parentIsNot && !currentIsNot )
-                {
-                    branchToUse[ fiberIdx ] = !parentState.m_inBox[ fiberIdx ] & curState.m_inBox[ fiberIdx ];
-                }
-                else // parentIsNot && currentIsNot
-                {
-                    branchToUse[ fiberIdx ] = !parentState.m_inBox[ fiberIdx ] & !curState.m_inBox[ fiberIdx ];
-                }
+                branchToUse.flip();
+            }
+            
+            if( getIsNOT() )
+            {
+                branchToUse.andNot( curState.m_inBox );
+            }
+            else
+            {
+                branchToUse &= curState.m_inBox;
             }
         }
         else // No parent, so this is a root object with no child.
@@ -959,37 +1004,9 @@ vector< int > SelectionObject::getSelectedFibersIndexes( Fibers *pFibers )
         }
     }
     
-    vector< int > selectedIndexes;
+    branchToUse.andNot( pFibers->getFilteredFibers() );
     
-    for( unsigned int fiberIdx = 0; fiberIdx < branchToUse.size(); ++fiberIdx )
-    {
-        if( branchToUse[fiberIdx] && !filteredFiber[fiberIdx] )
-        {
-            selectedIndexes.push_back( fiberIdx );
-        }
-    }
-    
-    return selectedIndexes;
-}
-
-bool SelectionObject::getSelectedFibersInfo( const vector< int > &selectedFibersIdx, 
-                                            Fibers *pFibers, 
-                                            vector< int > &pointsCount, 
-                                            vector< vector< Vector > > &fibersPoints )
-
-{
-    pointsCount.assign( selectedFibersIdx.size(), 0 );
-    fibersPoints.assign( selectedFibersIdx.size(), vector< Vector >() );
-    
-    int curItem( 0 );
-    
-    for( vector< int >::const_iterator idxIt( selectedFibersIdx.begin() ); idxIt != selectedFibersIdx.end(); ++idxIt, ++curItem )
-    {
-        pointsCount[ curItem ] = pFibers->getPointsPerLine( *idxIt );
-        pFibers->getFiberCoordValues( *idxIt, fibersPoints[ curItem ] );
-    }
-    
-    return true;
+    return branchToUse;
 }
 
 ///////////////////////////////////////////////////////////////////////////
@@ -1010,9 +1027,9 @@ vector< vector< Vector > > SelectionObject::getSelectedFibersPoints()
     {
         pFibers = DatasetManager::getInstance()->getSelectedFibers( MyApp::frame->m_pListCtrl->GetItem( index ) );
     }
-    vector< bool > filteredFiber = pFibers->getFilteredFibers();
+    const BitSet &filteredFiber = pFibers->getFilteredFibers();
     
-    vector< bool > selectedInBranch = SceneManager::getInstance()->getSelectionTree().getSelectedFibersInBranch( pFibers, this);
+    BitSet selectedInBranch = SceneManager::getInstance()->getSelectionTree().getSelectedFibersInBranch( pFibers, this);
     
     for( unsigned int i = 0; i < selectedInBranch.size(); ++i )
     {
@@ -1092,84 +1109,6 @@ bool SelectionObject::getFiberLength( const vector< Vector > &i_fiberPoints, flo
     return true;
 }
 
-///////////////////////////////////////////////////////////////////////////
-// Will calculate the mean fiber of a set of fibers.
-//
-// i_fibersPoints          : Set of fibers points we will use to calculate the mean fiber.
-// i_nbPoints              : Number of points the mean fiber will have.
-// o_meanFiberPoints       : The resulting points are store in o_meanFiberPoints.
-//
-// Returns true if successful, false otherwise.
-///////////////////////////////////////////////////////////////////////////
-bool SelectionObject::getMeanFiber( const vector< vector< Vector > > &i_fibersPoints, 
-                                          unsigned int                i_nbPoints,
-                                          vector< Vector >           &o_meanFiberPoints )
-{
-    o_meanFiberPoints.resize( i_nbPoints );
-
-    for( unsigned int i = 0; i < i_fibersPoints.size(); ++i )
-    {
-        unsigned int l_currentFiberNbPoints = i_fibersPoints[i].size();
-        
-        // The -1 is because we dont take into consideration the number of points but 
-        // the number of vector between the points.
-        
-        float        l_currentFiberRatio    = (float)( i_fibersPoints[i].size() - 1 ) / ( i_nbPoints - 1 );
-        
-        // These two variable help to know if the fibers are in the same direction
-        float comp_first_pt = abs(i_fibersPoints[i][0].x-i_fibersPoints[0][0].x) + 
-                              abs(i_fibersPoints[i][0].y-i_fibersPoints[0][0].y) +
-                              abs(i_fibersPoints[i][0].z-i_fibersPoints[0][0].z);
-
-        float comp_last_pt = abs(i_fibersPoints[i][i_fibersPoints[i].size()-1].x-i_fibersPoints[0][0].x) +
-                             abs(i_fibersPoints[i][i_fibersPoints[i].size()-1].y-i_fibersPoints[0][0].y) +
-                             abs(i_fibersPoints[i][i_fibersPoints[i].size()-1].z-i_fibersPoints[0][0].z);
-
-        if(comp_first_pt < comp_last_pt)    
-        {
-
-            o_meanFiberPoints[0]              += i_fibersPoints[i][0];
-            o_meanFiberPoints[i_nbPoints - 1] += i_fibersPoints[i][l_currentFiberNbPoints - 1] ;
-
-            for( unsigned int j = 1; j < i_nbPoints - 1; ++j )
-            {
-                float l_currentPointInterpolationRatio = l_currentFiberRatio * j;
-             
-                 // Calculating the ratio of the interpolation.
-                int l_pointBelow = (int)l_currentPointInterpolationRatio;
-                l_currentPointInterpolationRatio -= l_pointBelow;
-                // Simple interpolation.
-                o_meanFiberPoints[j] += ( ( i_fibersPoints[i][l_pointBelow]     * ( 1.0 - l_currentPointInterpolationRatio ) ) + 
-                                        ( i_fibersPoints[i][l_pointBelow + 1] *         l_currentPointInterpolationRatio ) );
-            }
-        }
-        else
-        {
-
-            o_meanFiberPoints[0]              += i_fibersPoints[i][l_currentFiberNbPoints - 1];
-            o_meanFiberPoints[i_nbPoints - 1] += i_fibersPoints[i][0];
-            
-            for( unsigned int j = i_nbPoints - 2 ; j > 0 ; --j )    
-            {
-                float l_currentPointInterpolationRatio = l_currentFiberRatio * j;
-             
-                 // Calculating the ratio of the interpolation.
-                int l_pointBelow = (int)l_currentPointInterpolationRatio;
-                l_currentPointInterpolationRatio -= l_pointBelow;
-                // Simple interpolation.
-                o_meanFiberPoints[i_nbPoints-j-1] += ( ( i_fibersPoints[i][l_pointBelow]     * ( 1.0 - l_currentPointInterpolationRatio ) ) + 
-                                        ( i_fibersPoints[i][l_pointBelow + 1] *           l_currentPointInterpolationRatio ) );
-
-            }            
-        }
-    }
-
-    for( unsigned int i = 0; i < o_meanFiberPoints.size(); ++i )
-        o_meanFiberPoints[i] /= i_fibersPoints.size();
-
-    return true;
-}
-
 ///////////////////////////////////////////////////////////////////////////
 // Fills the o_fiberPoints vector with the points that compose a given fiber.
 //
@@ -1208,211 +1147,99 @@ bool SelectionObject::getFiberCoordValues( int i_fiberIndex, vector< Vector > &o
 }
 
 ///////////////////////////////////////////////////////////////////////////
-// Computes the mean value of a given set of fibers. This value is calculated 
-// from the anatomy that is already loaded.
-//
-// i_fibersPoints           : The given set of fibers.
-// o_meanValue              : The output mean value.
-//
-// Returns true if successful, false otherwise.
+// Returns the anatomy whose values are averaged along the fibers, NULL if
+// there is none.
 ///////////////////////////////////////////////////////////////////////////
-bool SelectionObject::getMeanFiberValue( const vector< vector< Vector > > &fibersPoints, float &computedMeanValue )
+Anatomy * SelectionObject::getStatsAnatomy()
 {
-    computedMeanValue = 0.0f;
-
-    if( fibersPoints.size() == 0 )
-    {
-        return false;
-    }
-    
-    Anatomy *pCurrentAnatomy( NULL );
-
     vector< Anatomy* > datasets = DatasetManager::getInstance()->getAnatomies();
     
     if( m_pCBSelectDataSet == NULL && datasets.size() > 0 )
     {
         // Select the first dataset in the list
-        pCurrentAnatomy = datasets[0];
+        return datasets[0];
     }
     else if( m_pCBSelectDataSet != NULL && 
              m_pCBSelectDataSet->GetCount() > 0 && 
-             m_pCBSelectDataSet->GetCurrentSelection() != -1 )
+             m_pCBSelectDataSet->GetCurrentSelection() != -1 &&
+             static_cast< size_t >( m_pCBSelectDataSet->GetSelection() ) < datasets.size() )
     {
-        // TODO: Verify if the selection is the right index
         // Get the currently selected dataset.
-        pCurrentAnatomy = datasets[ m_pCBSelectDataSet->GetSelection() ];
+        return datasets[ m_pCBSelectDataSet->GetSelection() ];
     }
-    else
-    {
-        return false;
-    }
-
-    unsigned int pointsCount( 0 );
-    unsigned int datasetPos ( 0 );
-
-    float voxelX = DatasetManager::getInstance()->getVoxelX();
-    float voxelY = DatasetManager::getInstance()->getVoxelY();
-    float voxelZ = DatasetManager::getInstance()->getVoxelZ();
-
-    for( unsigned int i = 0; i < fibersPoints.size(); ++i )
-    {
-        for( unsigned int j = 0; j < fibersPoints[i].size(); ++j )
-        {
-            datasetPos = ( static_cast<int>( fibersPoints[i][j].x / voxelX ) +
-                           static_cast<int>( fibersPoints[i][j].y / voxelY ) * pCurrentAnatomy->getColumns() +
-                           static_cast<int>( fibersPoints[i][j].z / voxelZ ) * pCurrentAnatomy->getColumns() * pCurrentAnatomy->getRows() ) * pCurrentAnatomy->getBands();
-            
-            for (int i(0); i < pCurrentAnatomy->getBands(); i++)
-            {
-                computedMeanValue += (* ( pCurrentAnatomy->getFloatDataset() ) )[datasetPos + i];
-            }
-
-            ++pointsCount;
-        }
-    }
-    
-    computedMeanValue /= pointsCount;
-    return true;
-}
-
-///////////////////////////////////////////////////////////////////////////
-// Computes the mean, max and min length for a given set of fibers.
-//
-// selectedFibersIndexes : The indexes of the selected fibers.
-// pCurFibers            : A pointer to the current fiber dataset.
-// meanLength            : The output mean length.
-// maxLength             : The output max length.
-// minLength             : The output min length.
-//
-// Returns true if successful, false otherwise.
-///////////////////////////////////////////////////////////////////////////
-bool SelectionObject::getMeanMaxMinFiberLength( const vector< int > &selectedFibersIndexes,
-                                                  Fibers        *pCurFibers,
-                                                  float         &meanLength,
-                                                  float         &maxLength,
-                                                  float         &minLength )
-{
-    meanLength = 0.0f;
-    maxLength  = 0.0f;
-    minLength  = numeric_limits<float>::max();
-    
-    if( selectedFibersIndexes.empty() )
-    {
-        minLength = 0.0f;
-        return false;
-    }
-    
-    float curFiberLength( 0.0f );
-    
-    for( vector< int >::const_iterator idxIt( selectedFibersIndexes.begin() );
-        idxIt != selectedFibersIndexes.end(); ++idxIt )
-    {
-        curFiberLength = pCurFibers->getFiberLength( *idxIt );
-        
-        meanLength += curFiberLength;
-        
-        maxLength = std::max( maxLength, curFiberLength );
-        minLength = std::min( minLength, curFiberLength );
-    }
-    
-    meanLength /= selectedFibersIndexes.size();
     
-    return true;
+    return NULL;
 }
 
-
 ///////////////////////////////////////////////////////////////////////////
 // Computes the mean, max and the min cross section for a given set of fibers.
 //
-// i_fibersPoints           : The given set of fibers we are going to calculate the cross section for.
-// i_meanFiberPoints        : The mean fiber we are going to use to generate the plane for the cross section calculation.
+// fibersSets               : The fiber sets we are going to calculate the cross section for.
+// selectedFibers           : The selected fibers of each set.
+// meanFiberPoints          : The mean fiber we are going to use to generate the plane for the cross section calculation.
 // o_meanCrossSection       : The output mean cross section.
 // o_maxCrossSection        : The output max cross section.
 // o_minCrossSection        : The output min cross section.
 //
 // Returns true if successful, false otherwise.
 ///////////////////////////////////////////////////////////////////////////
-bool SelectionObject::getMeanMaxMinFiberCrossSection( const vector< vector< Vector > > &i_fibersPoints,
-                                                      const vector< Vector >           &i_meanFiberPoints, 
-                                                            float                      &o_meanCrossSection,
-                                                            float                      &o_maxCrossSection,
-                                                            float                      &o_minCrossSection )
+bool SelectionObject::getMeanMaxMinFiberCrossSection( const vector< Fibers* > &fibersSets,
+                                                      const vector< BitSet >  &selectedFibers,
+                                                      const vector< Vector >  &meanFiberPoints, 
+                                                            float             &o_meanCrossSection,
+                                                            float             &o_maxCrossSection,
+                                                            float             &o_minCrossSection )
 {
     m_crossSectionsPoints.clear();
     m_crossSectionsAreas.clear();
     m_crossSectionsNormals.clear();
-    m_crossSectionsPoints.resize ( i_meanFiberPoints.size() );
-    m_crossSectionsAreas.resize  ( i_meanFiberPoints.size() );
-    m_crossSectionsNormals.resize( i_meanFiberPoints.size() );
+    m_crossSectionsPoints.resize ( meanFiberPoints.size() );
+    m_crossSectionsAreas.resize  ( meanFiberPoints.size() );
+    m_crossSectionsNormals.resize( meanFiberPoints.size() );
 
     o_meanCrossSection = 0.0f;
     o_maxCrossSection  = 0.0f;
+    o_minCrossSection  = 0.0f;
+
+    size_t fibersCount( 0 );
+    for( size_t setIdx = 0; setIdx < selectedFibers.size(); ++setIdx )
+    {
+        fibersCount += selectedFibers[setIdx].count();
+    }
 
     // We need at least 3 fibers to get 3 points to be able to calculate a convex hull!
-    if( i_fibersPoints.size() < 3 )
+    if( fibersCount < 3 || meanFiberPoints.size() < 2 )
     {
-        o_minCrossSection  = 0.0f;
         return false;
     }
 
-    o_minCrossSection  = numeric_limits<float>::max();
+    FibersCrossSections crossSections( meanFiberPoints );
 
-    vector< Vector > l_maxHullPts, l_maxOriginalPts, l_minHullPts, l_minOriginalPts;
-
-    // For each points on the mean fiber we calculate a plane perpendicular with it.
-    for( unsigned int i = 0; i < i_meanFiberPoints.size(); ++i )
-    {        
-        vector < Vector > l_intersectionPoints;
-        Vector l_pointOnPlane, l_planeNormal;
-        l_pointOnPlane = i_meanFiberPoints[i];
-
-        // When we are at the last point of the mean fiber, since i_meanFiberPoints[i + 1] 
-        // will not exist, we calculate the vector with the previous point.
-        if( i == i_meanFiberPoints.size() - 1 )
-            l_planeNormal = i_meanFiberPoints[i] - i_meanFiberPoints[i - 1];
-        else
-            l_planeNormal = i_meanFiberPoints[i + 1] - i_meanFiberPoints[i];
-
-        l_planeNormal.normalize();
-
-        // We get the points intersecting the current plane for all the selectedFibers.
-        for( unsigned int j = 0; j < i_fibersPoints.size(); ++j )
-            getFiberPlaneIntersectionPoint( i_fibersPoints[j], l_pointOnPlane, l_planeNormal, l_intersectionPoints );
+    for( size_t setIdx = 0; setIdx < fibersSets.size(); ++setIdx )
+    {
+        crossSections.addFibers( fibersSets[setIdx], selectedFibers[setIdx] );
+    }
 
-        // We need at least 3 points to get a valid cross section.
+    crossSections.computeHulls();
 
-        if( l_intersectionPoints.size() < 3 )
-            continue;
+    o_minCrossSection = numeric_limits<float>::max();
 
-        vector < Vector > original3Dpts = l_intersectionPoints;
+    for( unsigned int i = 0; i < crossSections.getPlanesCount(); ++i )
+    {
+        // We save the normals of the planes to be able to draw the dispersion cone.
+        m_crossSectionsNormals[i] = crossSections.getNormal( i );
 
-        // Once we have those 3d points, we need to map them to 2d so we can calculate the convex hull.
-        if( ! ( Helper::convert3DPlanePointsTo2D( l_planeNormal, l_intersectionPoints ) ) )
+        if( !crossSections.hasHull( i ) )
             continue;
 
-        ConvexGrahamHull hull( l_intersectionPoints );
-       
-        // Let's build the convex hull.
-        vector < Vector > l_hullPoints;
-        if( ! ( hull.buildHull() ) )
-            continue;
-        hull.getHullPoints( l_hullPoints );
-        // Computing the surface area of the hull.
-        double l_hullArea = 0.0f;
-        if( ! ( hull.area( l_hullArea ) ) )
-            continue;
+        // To be able to see the cross section on the screen we save the points in m_crossSectionsPoints
+        // and the area value in m_crossSectionsAreas.
+        double l_hullArea = crossSections.getArea( i );
+        m_crossSectionsPoints[i] = crossSections.getHull( i );
+        m_crossSectionsAreas[i]  = l_hullArea;
 
         o_meanCrossSection += l_hullArea;
 
-        // To be able to see the cross section on the screen we save the points in m_crossSectionsPoints
-        // and the area value in m_crossSectionsAreas, we also save the normals of the planes inside
-        // m_crossSectionsNormals to be able to draw the dispersion cone.
-        vector< Vector > tmp;
-        Helper::convert2DPlanePointsTo3D( original3Dpts, l_hullPoints, tmp );
-        m_crossSectionsPoints[i]  = tmp;
-        m_crossSectionsAreas[i]   = l_hullArea;
-        m_crossSectionsNormals[i] = l_planeNormal;
-
         // Maximum Cross Section.
         if( l_hullArea > o_maxCrossSection )
         {
@@ -1427,8 +1254,13 @@ bool SelectionObject::getMeanMaxMinFiberCrossSection( const vector< vector< Vect
             m_minCrossSectionIndex = i;
         }
     }
-     
-    o_meanCrossSection /= i_meanFiberPoints.size();
+
+    if( o_minCrossSection == numeric_limits<float>::max() )
+    {
+        o_minCrossSection = 0.0f;
+    }
+
+    o_meanCrossSection /= meanFiberPoints.size();
 
     float voxelX = DatasetManager::getInstance()->getVoxelX();
     float voxelY = DatasetManager::getInstance()->getVoxelY();
@@ -1444,52 +1276,6 @@ bool SelectionObject::getMeanMaxMinFiberCrossSection( const vector< vector< Vect
     return true;
 }
 
-///////////////////////////////////////////////////////////////////////////
-// Will return the intersection point between a fiber and a plane.
-//
-// i_fiberPoints            : Containt the points information of the fiber.
-// i_pointOnPlane           : A point on the plane.
-// i_planeNormal            : The normal of the plane.
-// o_intersectionPoints     : Output vector that will containt the intersection point.
-//
-// Returns true if successful, false otherwise.
-///////////////////////////////////////////////////////////////////////////
-bool SelectionObject::getFiberPlaneIntersectionPoint( const vector< Vector > &i_fiberPoints,
-                                                      const Vector           &i_pointOnPlane,
-                                                      const Vector           &i_planeNormal,
-                                                            vector< Vector > &o_intersectionPoints )
-{
-    float l_minDistance = numeric_limits<float>::max();
-    Vector l_tmp;
-    bool l_intersected = false;
-    
-    for( unsigned int i = 0; i < i_fiberPoints.size() - 1; ++i )
-    {
-        Vector l_intersectionPoint;
-        // Check if there is an intersection point between the plane and the line.
-        if( Helper::getIntersectionPoint( i_fiberPoints[i], i_fiberPoints[i + 1], i_pointOnPlane, i_planeNormal, l_intersectionPoint ) )
-        {
-            // If there was more that 1 point of the current fiber that was in contact with the plane,
-            // we only keep the one closest to the mean fiber and since i_pointOnPlane is actually the
-            // mean fiber point used to generate the plane, we use it.
-            float  l_distance = ( l_intersectionPoint - i_pointOnPlane ).getLength();
-
-            if( l_distance < l_minDistance )
-            {
-                l_minDistance = l_distance;
-                l_tmp         = l_intersectionPoint;
-                l_intersected = true;
-            }
-        }
-    }
-
-    // Only push back a point if there was at least 1 intersection.
-    if( l_intersected )
-        o_intersectionPoints.push_back( l_tmp );
-
-    return true;
-}
-
 ///////////////////////////////////////////////////////////////////////////
 // We compute the dispersion in the following manner:
 // We create the two tightest circles we can fit around the min and max cross sections.
@@ -1893,19 +1679,52 @@ wxString SelectionObject::getTypeTag() const
 
 void SelectionObject::notifyInBoxNeedsUpdating()
 {
-    for( map< FiberIdType, SelectionState >::iterator stateIt( m_selectionStates.begin() );
-        stateIt != m_selectionStates.end(); ++stateIt )
+    // Always update in branch at the same time, since an
+    // update to the inBox will always influence the inBranch.
+    m_inBoxChanged = true;
+
+    SceneManager::getInstance()->getSelectionTree().notifyInBranchNeedsUpdating( this );
+    SceneManager::getInstance()->getSelectionTree().notifyStatsNeedUpdating( this );    
+}
+
+void SelectionObject::notifyFibersChanged( const FiberIdType &fiberId )
+{
+    map< FiberIdType, SelectionState >::iterator stateIt = m_selectionStates.find( fiberId );
+    
+    if( stateIt != m_selectionStates.end() )
     {
-        // Always update in branch at the same time, since an
-        // update to the inBox will always influence the inBranch.
         stateIt->second.m_inBoxNeedsUpdating = true;
+        stateIt->second.m_segmentsInBox.clear();
     }
+    
+    SceneManager::getInstance()->getSelectionTree().notifyInBranchNeedsUpdating( this );
+    SceneManager::getInstance()->getSelectionTree().notifyStatsNeedUpdating( this );
+}
 
-    SceneManager::getInstance()->getSelectionTree().notifyStatsNeedUpdating( this );    
+void SelectionObject::notifyInBranchNeedsUpdating( bool childrenChanged )
+{
+    m_inBranchChanged = true;
+    m_childrenChanged |= childrenChanged;
 }
 
-void SelectionObject::notifyInBranchNeedsUpdating()
+void SelectionObject::applyChanges()
 {
+    for( map< FiberIdType, SelectionState >::iterator stateIt( m_selectionStates.begin() );
+        stateIt != m_selectionStates.end(); ++stateIt )
+    {
+        stateIt->second.m_inBoxNeedsUpdating    |= m_inBoxChanged;
+        stateIt->second.m_inBranchNeedsUpdating |= m_inBranchChanged;
+        stateIt->second.m_childrenNeedUpdating  |= m_childrenChanged;
+    }
+    
+    m_inBoxChanged    = false;
+    m_inBranchChanged = false;
+    m_childrenChanged = false;
+    
+    m_appliedCenter   = m_center;
+    m_appliedSize     = m_size;
+    m_appliedIsActive = m_isActive;
+    m_appliedIsNOT    = m_isNOT;
 }
 
 ///////////////////////////////////////////////////////////////////////////
@@ -1920,6 +1739,9 @@ void SelectionObject::updateStatsGrid()
         m_pGridFibersInfo->SetCellValue( 2,  0, wxString::Format( wxT( "%.2f" ), m_stats.m_meanLength       ) );
         m_pGridFibersInfo->SetCellValue( 3,  0, wxString::Format( wxT( "%.2f" ), m_stats.m_minLength        ) );
         m_pGridFibersInfo->SetCellValue( 4,  0, wxString::Format( wxT( "%.2f" ), m_stats.m_maxLength        ) );
+        m_pGridFibersInfo->SetCellValue( 5,  0, wxString::Format( wxT( "%.2f" ), m_stats.m_meanCrossSection ) );
+        m_pGridFibersInfo->SetCellValue( 6,  0, wxString::Format( wxT( "%.2f" ), m_stats.m_minCrossSection  ) );
+        m_pGridFibersInfo->SetCellValue( 7,  0, wxString::Format( wxT( "%.2f" ), m_stats.m_maxCrossSection  ) );
     }
 }
 
@@ -2083,16 +1905,16 @@ void SelectionObject::createPropertiesSizer( PropertiesWindow *pParent )
     font.SetWeight( wxFONTWEIGHT_BOLD );
     m_pGridFibersInfo->SetFont( font );
     m_pGridFibersInfo->SetColLabelSize( 2 );
-    m_pGridFibersInfo->CreateGrid( 5, 1, wxGrid::wxGridSelectCells );
+    m_pGridFibersInfo->CreateGrid( 8, 1, wxGrid::wxGridSelectCells );
     m_pGridFibersInfo->SetColLabelValue( 0, wxT( "" ) );
     m_pGridFibersInfo->SetRowLabelValue( 0, wxT( "Count" ) );
     m_pGridFibersInfo->SetRowLabelValue( 1, wxT( "Mean Value" ) );
     m_pGridFibersInfo->SetRowLabelValue( 2, wxT( "Mean Length (mm)" ) );
     m_pGridFibersInfo->SetRowLabelValue( 3, wxT( "Min Length (mm)" ) );
     m_pGridFibersInfo->SetRowLabelValue( 4, wxT( "Max Length (mm)" ) );
-//     m_pGridFibersInfo->SetRowLabelValue( 5, wxT( "Mean C. S. (mm)" ) );
-//     m_pGridFibersInfo->SetRowLabelValue( 6, wxT( "Min C. S. (mm)" ) );
-//     m_pGridFibersInfo->SetRowLabelValue( 7, wxT( "Max C. S. (mm)" ) );
+    m_pGridFibersInfo->SetRowLabelValue( 5, wxT( "Mean C. S. (mm)" ) );
+    m_pGridFibersInfo->SetRowLabelValue( 6, wxT( "Min C. S. (mm)" ) );
+    m_pGridFibersInfo->SetRowLabelValue( 7, wxT( "Max C. S. (mm)" ) );
 //     m_pGridFibersInfo->SetRowLabelValue( 10, wxT( "Dispersion" ) );
 
     m_pGridFibersInfo->SetRowLabelSize( 120 );
@@ -16,6 +16,7 @@
 #include "SceneObject.h"
 
 #include "../misc/Algorithms/Face3D.h"
+#include "../misc/BitSet.h"
 #include "../misc/Algorithms/Helper.h"
 #include "../misc/IsoSurface/Vector.h"
 
@@ -171,18 +172,61 @@ public :
     {
         public: 
             SelectionState()
-            : m_inBoxNeedsUpdating( true )
+            : m_inBoxNeedsUpdating( true ),
+              m_inBranchNeedsUpdating( true ),
+              m_childrenNeedUpdating( true ),
+              m_hasIncludedChildren( false ),
+              m_hasExcludedChildren( false )
             {};
             
-            vector< bool > m_inBranch;
-            vector< bool > m_inBox;
+            BitSet         m_inBranch;
+            BitSet         m_inBox;
             bool           m_inBoxNeedsUpdating;
+            
+            // Set on the changed object and its ancestors only, the clean
+            // branches keep their inBranch.
+            bool           m_inBranchNeedsUpdating;
+            
+            // Union of the inBranch of the active including and excluding
+            // children. Kept until a child changes, so that moving this object
+            // only combines its new inBox with them.
+            bool           m_childrenNeedUpdating;
+            bool           m_hasIncludedChildren;
+            bool           m_hasExcludedChildren;
+            BitSet         m_childrenInBranch;
+            BitSet         m_childrenNotInBranch;
+            
+            // Segments of each fiber inside the box m_countedMin/Max, so that
+            // a moving box only tests the segments entering or leaving it.
+            // Empty when the counts must be computed again.
+            vector< int >  m_segmentsInBox;
+            float          m_countedMin[3];
+            float          m_countedMax[3];
     };
     
     bool            addFiberDataset(    const FiberIdType &fiberId, const int fiberCount );
     void            removeFiberDataset( const FiberIdType &fiberId );
     SelectionState& getState(           const FiberIdType &fiberId );
     
+    // The points of the fibers changed, their states must be computed again.
+    void            notifyFibersChanged( const FiberIdType &fiberId );
+    
+    // The inBranch of this object must be computed again, and also the
+    // union of its children if one of them changed.
+    void            notifyInBranchNeedsUpdating( bool childrenChanged );
+    
+    // Flags the states with the changes notified since the last call. Called
+    // by the selection tree when no update is running, so that the object can
+    // change while the fibers are selected on a worker thread.
+    void            applyChanges();
+    
+    // The object as it was at the last applyChanges(), the only values the
+    // selection update reads while the object is dragged or toggled.
+    Vector          getAppliedCenter() const    { return m_appliedCenter;   }
+    Vector          getAppliedSize() const      { return m_appliedSize;     }
+    bool            getAppliedIsActive() const  { return m_appliedIsActive; }
+    bool            getAppliedIsNOT() const     { return m_appliedIsNOT;    }
+    
     // Methods related to saving and loading.
     // TODO selection saving
     //bool populateXMLNode( wxXmlNode *pCurNode );
@@ -262,8 +306,17 @@ protected :
 
     std::map< FiberIdType, SelectionState > m_selectionStates;
     
+    // Changes not applied to the states yet.
+    bool            m_inBoxChanged;
+    bool            m_inBranchChanged;
+    bool            m_childrenChanged;
+    
+    Vector          m_appliedCenter;
+    Vector          m_appliedSize;
+    bool            m_appliedIsActive;
+    bool            m_appliedIsNOT;
+    
     void notifyInBoxNeedsUpdating();
-    void notifyInBranchNeedsUpdating();
 
     /******************************************************************************************
     * Functions/variables related to the fiber info calculation.
@@ -305,41 +358,26 @@ protected:
     bool   getFiberLength                    ( const std::vector< Vector >           &i_fiberPoints,
                                                      float                           &o_length                  );
    
-    bool   getFiberPlaneIntersectionPoint    ( const std::vector< Vector >           &i_fiberPoints, 
-                                               const Vector                          &i_pointOnPlane,
-                                               const Vector                          &i_planeNormal,
-                                                     std::vector< Vector >           &o_intersectionPoints      );
-    
     bool   getFiberDispersion                (       float                           &o_dispersion              );
     
     float  getMaxDistanceBetweenPoints       ( const std::vector< Vector >           &i_points, 
                                                      int*                            o_firstPointIndex = NULL, 
                                                      int*                            o_secondPointIndex = NULL );
-    bool   getMeanFiber                      ( const std::vector< std::vector< Vector > > &i_fibersPoints,
-                                                     unsigned int                    i_nbPoints,
-                                                     std::vector< Vector >           &o_meanFiber               );
-    bool   getMeanFiberValue                 ( const std::vector< std::vector< Vector > > &fibersPoints, 
-                                                     float                           &computedMeanValue         );
-    
-    bool   getMeanMaxMinFiberCrossSection    ( const std::vector< std::vector< Vector > > &i_fibersPoints,
-                                               const std::vector< Vector >           &i_meanFiberPoints,
+    Anatomy * getStatsAnatomy                ();
+    
+    bool   getMeanMaxMinFiberCrossSection    ( const std::vector< Fibers* >          &fibersSets,
+                                               const std::vector< BitSet >           &selectedFibers,
+                                               const std::vector< Vector >           &meanFiberPoints,
                                                      float                           &o_meanCrossSection,
                                                      float                           &o_maxCrossSection,
                                                      float                           &o_minCrossSection         );
     
-    bool   getMeanMaxMinFiberLength( const vector< int > &selectedFibersIndexes,
-                                           Fibers        *pCurFibers,
-                                           float         &o_meanLength,
-                                           float         &o_maxLength,
-                                           float         &o_minLength );
-
     std::vector< std::vector< Vector > >   getSelectedFibersPoints ();
     
     vector< int > getSelectedFibersIndexes( Fibers *pFibers );
-    bool          getSelectedFibersInfo( const vector< int > &selectedFibersIdx, 
-                                        Fibers *pFibers,
-                                        vector< int > &pointsCount, 
-                                        vector< vector< Vector > > &fibersPoints );
+    
+    // Fibers of the branch of this object, without the filtered ones.
+    BitSet        getSelectedFibers( Fibers *pFibers );
 
     
     std::vector< float >        m_crossSectionsAreas;   // All the cross sections areas value.
@@ -6,45 +6,39 @@
 #include "SelectionTree.h"
 #include "SelectionObject.h"
 
+#include "../dataset/FiberTiles.h"
 #include "../dataset/Fibers.h"
+#include "../dataset/FiberVoxelIndex.h"
 #include "../dataset/Octree.h"
+#include "../dataset/SegmentTree.h"
 #include "../gui/SelectionBox.h"
 #include "../gui/SelectionEllipsoid.h"
+#include "../gui/SelectionVOI.h"
+#include "../misc/ParallelFor.h"
 
 #include <algorithm>
 #include <utility>
 using std::pair;
 
-// Anonymous namespace
-namespace {
-    void combineBoolVectors( vector< bool > &dest, const vector< bool > &source, const bool negateSrc, const bool useAnd )
-    {
-        if( dest.size() != source.size() )
-        {
-            return;
-        }
+extern const wxEventType wxEVT_SELECTION_UPDATE_EVENT = wxNewEventType();
 
-        for( unsigned int elemIdx( 0 ); elemIdx < dest.size(); ++elemIdx )
+namespace
+{
+    void eraseFibers( vector< Fibers* > &io_fibers, const SelectionObject::FiberIdType &fiberId )
+    {
+        for( vector< Fibers* >::iterator fibIt( io_fibers.begin() ); fibIt != io_fibers.end(); )
         {
-            if( !negateSrc && !useAnd )
-            {
-                dest[elemIdx] = dest[elemIdx] | source[elemIdx];
-            }
-            else if( !negateSrc && useAnd )
+            if( (*fibIt)->getName() == fiberId )
             {
-                dest[elemIdx] = dest[elemIdx] & source[elemIdx];
+                fibIt = io_fibers.erase( fibIt );
             }
-            else if( negateSrc && useAnd )
-            {
-                dest[elemIdx] = dest[elemIdx] & !source[elemIdx];
-            }
-            else // Negate and use Or
+            else
             {
-                dest[elemIdx] = dest[elemIdx] | !source[elemIdx];
+                ++fibIt;
             }
         }
     }
-};
+}
 
 /////
 // SelectionTreeNode methods
@@ -219,17 +213,33 @@ SelectionTree::SelectionTreeNode * const
     return NULL;
 }
 
-void SelectionTree::SelectionTreeNode::updateInObjectRecur( const int fibersCount, Octree *pCurOctree, const vector< int > &reverseIdx, const SelectionObject::FiberIdType &fiberId )
+void SelectionTree::SelectionTreeNode::updateInObjectRecur( const Fibers *pFibers, const SelectionObject::FiberIdType &fiberId )
 {
     if( m_pSelObject != NULL )
     {
         SelectionObject::SelectionState &curState = m_pSelObject->getState( fiberId );
+        ObjectType type = m_pSelObject->getSelectionType();
         
-        if( curState.m_inBoxNeedsUpdating )
+        // The indices of the fibers are built on first use, by the first object needing them.
+        if( curState.m_inBoxNeedsUpdating && pFibers->getFiberTiles() != NULL )
+        {
+            // Out-of-core fibers have no octree, the tiles answer directly per fiber.
+            pFibers->getFiberTiles()->getFibersInside( m_pSelObject, curState.m_inBox );
+        }
+        else if( curState.m_inBoxNeedsUpdating && ( type == BOX_TYPE || type == ELLIPSOID_TYPE ) && pFibers->getSegmentTree() != NULL )
         {
-            vector< int > pointsInsideObject = pCurOctree->getPointsInside( m_pSelObject );
+            // Test the segments, a thin object between two points still selects the fiber.
+            pFibers->getSegmentTree()->updateFibersInside( m_pSelObject, curState );
+        }
+        else if( curState.m_inBoxNeedsUpdating &&
+                 ( type != VOI_TYPE || pFibers->getVoxelIndex() == NULL ||
+                   !pFibers->getVoxelIndex()->getFibersInside( static_cast< SelectionVOI * >( m_pSelObject ), curState.m_inBox ) ) )
+        {
+            // The octree is left for the empty fiber sets, and the VOIs off the grid of the voxel index.
+            const vector< int > &reverseIdx( pFibers->getReverseIdx() );
+            vector< int > pointsInsideObject = pFibers->getOctree()->getPointsInside( m_pSelObject );
             
-            curState.m_inBox.assign( fibersCount, false );
+            curState.m_inBox.assign( pFibers->getFibersCount(), false );
             
             for( unsigned int ptIdx( 0 ); ptIdx < pointsInsideObject.size(); ++ptIdx )
             {
@@ -243,113 +253,111 @@ void SelectionTree::SelectionTreeNode::updateInObjectRecur( const int fibersCoun
     // Call this recursively for all children.
     for( unsigned int childIdx( 0 ); childIdx < m_children.size(); ++childIdx )
     {
-        m_children[ childIdx ]->updateInObjectRecur( fibersCount, pCurOctree, reverseIdx, fiberId );
+        m_children[ childIdx ]->updateInObjectRecur( pFibers, fiberId );
     }
 }
 
 void SelectionTree::SelectionTreeNode::updateInBranchRecur( const int fibersCount,
                                                             const SelectionObject::FiberIdType &fiberId )
 {
-    // OPTIM: If we ever encounter a case / dataset where selection is really, really 
-    // slow, this should be the first method to be optimized, using a 
-    // m_inBranchNeedsUpdating mecanism on the SelectionStates.
-
-    bool atLeastOneActiveIncludeChild( false );
-    bool atLeastOneActiveExcludeChild( false );
-    vector< bool > childIncludedFibers( fibersCount, false );
-    vector< bool > childExcludedFibers( fibersCount, false );
+    // Only the changed objects and their ancestors are flagged,
+    // the other branches keep the inBranch of the last update.
+    if( m_pSelObject != NULL && !m_pSelObject->getState( fiberId ).m_inBranchNeedsUpdating )
+    {
+        return;
+    }
     
     for( unsigned int childIdx( 0 ); childIdx < m_children.size(); ++childIdx )
     {
         m_children[ childIdx ]->updateInBranchRecur( fibersCount, fiberId );
+    }
+    
+    // Update self state, if we have a selection object.
+    if( m_pSelObject == NULL )
+    {
+        return;
+    }
+    
+    SelectionObject::SelectionState &curState = m_pSelObject->getState( fiberId );
+    
+    if( curState.m_childrenNeedUpdating )
+    {
+        curState.m_hasIncludedChildren = false;
+        curState.m_hasExcludedChildren = false;
         
-        if( m_children[ childIdx ]->m_pSelObject->getIsActive() )
+        for( unsigned int childIdx( 0 ); childIdx < m_children.size(); ++childIdx )
         {
+            if( !m_children[ childIdx ]->m_pSelObject->getAppliedIsActive() )
+            {
+                continue;
+            }
+            
             SelectionObject::SelectionState &curChildState = m_children[ childIdx ]->m_pSelObject->getState( fiberId );
             
-            if( !m_children[ childIdx ]->m_pSelObject->getIsNOT() )
+            if( m_children[ childIdx ]->m_pSelObject->getAppliedIsNOT() )
             {
-                atLeastOneActiveIncludeChild = true;
-                
-                // Merge in inclusion child vector.
-                for( unsigned int elemIdx( 0 ); elemIdx < curChildState.m_inBox.size(); ++elemIdx )
+                // Removing each excluded branch removes their union.
+                if( !curState.m_hasExcludedChildren )
                 {
-                    childIncludedFibers[ elemIdx ] = childIncludedFibers[ elemIdx ] | curChildState.m_inBranch[ elemIdx ];
+                    curState.m_hasExcludedChildren = true;
+                    curState.m_childrenNotInBranch = curChildState.m_inBranch;
                 }
+                else
+                {
+                    curState.m_childrenNotInBranch |= curChildState.m_inBranch;
+                }
+            }
+            else if( !curState.m_hasIncludedChildren )
+            {
+                curState.m_hasIncludedChildren = true;
+                curState.m_childrenInBranch = curChildState.m_inBranch;
             }
             else
             {
-                atLeastOneActiveExcludeChild = true;
-                
-                // Merge in exclusion child vector
-                for( unsigned int elemIdx( 0 ); elemIdx < curChildState.m_inBox.size(); ++elemIdx )
-                {
-                    childExcludedFibers[ elemIdx ] = childExcludedFibers[ elemIdx ] | curChildState.m_inBranch[ elemIdx ];
-                }
+                curState.m_childrenInBranch |= curChildState.m_inBranch;
             }
         }
         
+        curState.m_childrenNeedUpdating = false;
     }
     
-    // Update self state, if we have a selection object.
-    if( m_pSelObject != NULL )
+    // Basic update of the inBranch of this object.
+    // If no (active) child object, it will simply be the inBox.
+    curState.m_inBranch = curState.m_inBox;
+    
+    if( curState.m_hasExcludedChildren )
     {
-        SelectionObject::SelectionState &curState = m_pSelObject->getState( fiberId );
-        
-        if( curState.m_inBranch.empty() )
-        {
-            curState.m_inBranch.assign( fibersCount, false );
-        }
-        
-        // Basic update of the inBranch of this object.
-        // If no (active) child object, it will simply be the inBox.
-        std::copy( curState.m_inBox.begin(), curState.m_inBox.end(), curState.m_inBranch.begin() );
-
-        if( atLeastOneActiveIncludeChild )
-        {
-            // TODO what do we do if not active.
-            // Combine the child state with the current.
-            for( unsigned int elemIdx( 0 ); elemIdx < curState.m_inBox.size(); ++elemIdx )
-            {
-                curState.m_inBranch[ elemIdx ] = curState.m_inBranch[ elemIdx ] & childIncludedFibers[ elemIdx ];
-            }
-        }
-        
-        if( atLeastOneActiveExcludeChild )
-        {
-            for( unsigned int elemIdx( 0 ); elemIdx < curState.m_inBox.size(); ++elemIdx )
-            {
-                curState.m_inBranch[ elemIdx ] = curState.m_inBranch[ elemIdx ] & !childExcludedFibers[ elemIdx ];
-            }
-        }
+        curState.m_inBranch.andNot( curState.m_childrenNotInBranch );
+    }
+    
+    if( curState.m_hasIncludedChildren )
+    {
+        // TODO what do we do if not active.
+        // Combine the child state with the current.
+        curState.m_inBranch &= curState.m_childrenInBranch;
     }
+    
+    curState.m_inBranchNeedsUpdating = false;
 }
 
-vector< bool > SelectionTree::SelectionTreeNode::combineChildrenFiberStates(const SelectionObject::FiberIdType &fiberId ) const
+void SelectionTree::SelectionTreeNode::combineChildrenFiberStates( const SelectionObject::FiberIdType &fiberId, BitSet &o_combined ) const
 {
-    vector< bool > combinedStates;
-    
     if( m_children.empty() )
     {
-        return combinedStates;
+        o_combined.clear();
+        return;
     }
     
-    SelectionObject::SelectionState tempChildState = m_children[0]->m_pSelObject->getState( fiberId );
-
-    combinedStates.assign( tempChildState.m_inBox.size(), false );
+    o_combined.assign( m_children[0]->m_pSelObject->getState( fiberId ).m_inBox.size(), false );
     
     for( unsigned int childIdx( 0 ); childIdx < m_children.size(); ++childIdx )
     {
-        if( m_children[ childIdx ]->m_pSelObject->getIsActive() )
+        if( m_children[ childIdx ]->m_pSelObject->getAppliedIsActive() )
         {
             // Get the inBranch and the state, and combine.
-            // First false probably not needed.
-            SelectionObject::SelectionState &curChildState = m_children[childIdx]->m_pSelObject->getState( fiberId );
-            combineBoolVectors( combinedStates, curChildState.m_inBranch, false, false );
+            o_combined |= m_children[childIdx]->m_pSelObject->getState( fiberId ).m_inBranch;
         }
     }
-    
-    return combinedStates;
 }
 
 int SelectionTree::SelectionTreeNode::getId() const
@@ -502,7 +510,13 @@ SelectionTree::SelectionTreeNode::~SelectionTreeNode()
 /////
 
 SelectionTree::SelectionTree()
-    : m_nextNodeId( 0 )
+    : m_nextNodeId( 0 ),
+      m_pUpdateThread( NULL ),
+      m_requestedUpdate( 0 ),
+      m_runningUpdate( 0 ),
+      m_updateHasActiveObjects( false ),
+      m_pUpdateHandler( NULL ),
+      m_updateId( 0 )
 {
     m_pRootNode = new SelectionTreeNode( m_nextNodeId, NULL );
     ++m_nextNodeId;
@@ -516,6 +530,8 @@ int SelectionTree::addChildrenObject( const int parentId, SelectionObject *pSelO
         return -1;
     }
     
+    waitForSelectionUpdate();
+    
     SelectionTreeNode *pParentNode( NULL );
     
     if( parentId == -1 )
@@ -553,6 +569,8 @@ int SelectionTree::addChildrenObject( const int parentId, SelectionObject *pSelO
 
 bool SelectionTree::removeObject( const int nodeId )
 {
+    waitForSelectionUpdate();
+    
     SelectionTreeNode * const pParentNode = m_pRootNode->findParentNode( nodeId );
 
     // If found, remove it
@@ -560,6 +578,19 @@ bool SelectionTree::removeObject( const int nodeId )
     {        
         pParentNode->removeChildren( nodeId );
         
+        // The parent lost a child, its branch and the ones above must be combined again.
+        // The root has no object, its children are combined on each selection.
+        if( pParentNode->getSelectionObject() != NULL )
+        {
+            vector< SelectionObject* > genealogy = findGenealogy( pParentNode->getSelectionObject() );
+            
+            for( vector< SelectionObject* >::iterator nodeIt( genealogy.begin() );
+                nodeIt != genealogy.end(); ++nodeIt )
+            {
+                (*nodeIt)->notifyInBranchNeedsUpdating( true );
+            }
+        }
+        
         return true;
     }
     
@@ -698,7 +729,19 @@ void SelectionTree::notifyAllObjectsNeedUpdating()
     }
 }
 
-vector< bool > SelectionTree::getSelectedFibers( const Fibers* const pFibers )
+void SelectionTree::notifyFibersChanged( const SelectionObject::FiberIdType &fiberId )
+{
+    waitForSelectionUpdate();
+    
+    SelectionObjectVector objs = getAllObjects();
+    
+    for( SelectionObjectVector::iterator objIt( objs.begin() ); objIt != objs.end(); ++objIt )
+    {
+        (*objIt)->notifyFibersChanged( fiberId );
+    }
+}
+
+BitSet SelectionTree::getSelectedFibers( const Fibers* const pFibers )
 {
     if( pFibers == NULL )
     {
@@ -711,18 +754,17 @@ vector< bool > SelectionTree::getSelectedFibers( const Fibers* const pFibers )
     if( isEmpty() || m_pRootNode->getActiveDirectChildrenCount() == 0 )
     {
         // TODO print warning message.
-        return vector< bool >( fibersCount, true );
+        return BitSet( fibersCount, true );
     }
     
-    const vector< int > reverseIndex( pFibers->getReverseIdx() );
-    
-    Octree *pCurOctree( pFibers->getOctree() );
-    
     SelectionObject::FiberIdType fiberId = const_cast< Fibers* >(pFibers)->getName();
     
+    waitForSelectionUpdate();
+    applyObjectsChanges();
+    
     // Update all selection objects to make sure that each of them knows which 
     // fibers is in it.
-    m_pRootNode->updateInObjectRecur( fibersCount, pCurOctree, reverseIndex, fiberId );
+    m_pRootNode->updateInObjectRecur( pFibers, fiberId );
     
     // Update all selection objects to make sure they take into account their state
     // and the selected fibers of its children.
@@ -730,12 +772,218 @@ vector< bool > SelectionTree::getSelectedFibers( const Fibers* const pFibers )
     
     // Since the root does not have a selection object, we need to combine each of its
     // children to get the selected fibers.
-    m_rootSelectionStatus[ fiberId ] = m_pRootNode->combineChildrenFiberStates( fiberId );
+    m_pRootNode->combineChildrenFiberStates( fiberId, m_rootSelectionStatus[ fiberId ] );
     
     return m_rootSelectionStatus[ fiberId ];
 }
 
-vector< bool > SelectionTree::getSelectedFibersInBranch( const Fibers *const pFibers, SelectionObject *pSelObj )
+/////
+// Updates the states of the fiber sets [begin, end[ and combines their root selection.
+// Each set only touches its own states, the tree itself is not modified. Stops
+// between the passes when a newer update is requested, the flags of the states
+// keep what is left to do.
+/////
+class SelectionTree::DatasetsTask : public ParallelTask
+{
+public:
+    DatasetsTask( SelectionTree &tree )
+    :   m_tree( tree )
+    {
+    }
+
+    virtual void run( size_t begin, size_t end )
+    {
+        for( size_t fibIdx = begin; fibIdx < end && !m_tree.isSelectionUpdateStale(); ++fibIdx )
+        {
+            const Fibers *pFibers = m_tree.m_updateFibers[fibIdx];
+            const SelectionObject::FiberIdType &fiberId = m_tree.m_updateFiberIds[fibIdx];
+            
+            m_tree.m_pRootNode->updateInObjectRecur( pFibers, fiberId );
+            
+            if( m_tree.isSelectionUpdateStale() )
+            {
+                return;
+            }
+            
+            m_tree.m_pRootNode->updateInBranchRecur( pFibers->getFibersCount(), fiberId );
+            m_tree.m_pRootNode->combineChildrenFiberStates( fiberId, *m_tree.m_updateRootStates[fibIdx] );
+        }
+    }
+
+private:
+    SelectionTree &m_tree;
+};
+
+wxThread::ExitCode SelectionTree::UpdateThread::Entry()
+{
+    m_tree.runSelectionUpdate();
+    
+    return 0;
+}
+
+BitSet SelectionTree::getLastSelectedFibers( const Fibers* const pFibers )
+{
+    waitForSelectionUpdate();
+    
+    if( isEmpty() || m_pRootNode->getActiveDirectChildrenCount() == 0 )
+    {
+        return BitSet( pFibers->getFibersCount(), true );
+    }
+    
+    return m_rootSelectionStatus[ const_cast< Fibers* >(pFibers)->getName() ];
+}
+
+void SelectionTree::requestSelectionUpdate( const vector< Fibers* > &fibers, wxEvtHandler *pHandler, int id )
+{
+    {
+        wxCriticalSectionLocker lock( m_updateLock );
+        ++m_requestedUpdate;
+        m_pUpdateHandler = pHandler;
+        m_updateId       = id;
+    }
+    
+    m_requestedFibers = fibers;
+    
+    // A running update sees it is stale, the new one starts when it is done.
+    if( m_pUpdateThread == NULL )
+    {
+        startSelectionUpdate();
+    }
+}
+
+vector< Fibers* > SelectionTree::finishSelectionUpdate( const wxCommandEvent &evt )
+{
+    // The updates already waited for still post their event.
+    if( evt.GetInt() != m_runningUpdate )
+    {
+        return vector< Fibers* >();
+    }
+    
+    waitForSelectionUpdate();
+    
+    if( m_runningUpdate != m_requestedUpdate )
+    {
+        startSelectionUpdate();
+        return vector< Fibers* >();
+    }
+    
+    return m_updateFibers;
+}
+
+void SelectionTree::waitForSelectionUpdate()
+{
+    if( m_pUpdateThread != NULL )
+    {
+        m_pUpdateThread->Wait();
+        delete m_pUpdateThread;
+        m_pUpdateThread = NULL;
+    }
+}
+
+void SelectionTree::applyObjectsChanges()
+{
+    SelectionObjectVector objs = getAllObjects();
+    
+    for( SelectionObjectVector::iterator objIt( objs.begin() ); objIt != objs.end(); ++objIt )
+    {
+        (*objIt)->applyChanges();
+    }
+}
+
+/////
+// Done on the calling thread: the maps of states must not be modified by the
+// threads, and building the indices of the fibers logs messages. The objects
+// are read through the values applied here, they may change meanwhile.
+//
+// The tiles of the out-of-core fibers are paged in and out by the drawing
+// too, their objects are updated here so that the thread only combines them.
+/////
+void SelectionTree::prepareUpdate()
+{
+    applyObjectsChanges();
+    
+    SelectionObjectVector objs = getAllObjects();
+    m_updateFibers = m_requestedFibers;
+    m_updateFiberIds.clear();
+    m_updateRootStates.clear();
+    m_updateHasActiveObjects = !isEmpty() && m_pRootNode->getActiveDirectChildrenCount() > 0;
+    
+    for( unsigned int fibIdx( 0 ); fibIdx < m_updateFibers.size(); ++fibIdx )
+    {
+        m_updateFiberIds.push_back( m_updateFibers[fibIdx]->getName() );
+        m_updateRootStates.push_back( &m_rootSelectionStatus[ m_updateFiberIds.back() ] );
+        
+        if( m_updateHasActiveObjects && m_updateFibers[fibIdx]->getFiberTiles() != NULL )
+        {
+            m_pRootNode->updateInObjectRecur( m_updateFibers[fibIdx], m_updateFiberIds.back() );
+            continue;
+        }
+        
+        for( unsigned int objIdx( 0 ); objIdx < objs.size(); ++objIdx )
+        {
+            SelectionObject::SelectionState &curState = objs[objIdx]->getState( m_updateFiberIds.back() );
+            ObjectType type = objs[objIdx]->getSelectionType();
+            
+            if( !curState.m_inBoxNeedsUpdating )
+            {
+                continue;
+            }
+            
+            if( type == BOX_TYPE || type == ELLIPSOID_TYPE )
+            {
+                m_updateFibers[fibIdx]->getSegmentTree();
+            }
+            else if( type == VOI_TYPE )
+            {
+                m_updateFibers[fibIdx]->getVoxelIndex();
+            }
+        }
+    }
+}
+
+void SelectionTree::startSelectionUpdate()
+{
+    prepareUpdate();
+    
+    {
+        wxCriticalSectionLocker lock( m_updateLock );
+        m_runningUpdate = m_requestedUpdate;
+    }
+    
+    m_pUpdateThread = new UpdateThread( *this );
+    
+    if( m_pUpdateThread->Create() != wxTHREAD_NO_ERROR || m_pUpdateThread->Run() != wxTHREAD_NO_ERROR )
+    {
+        delete m_pUpdateThread;
+        m_pUpdateThread = NULL;
+        
+        runSelectionUpdate();
+    }
+}
+
+void SelectionTree::runSelectionUpdate()
+{
+    if( m_updateHasActiveObjects )
+    {
+        DatasetsTask task( *this );
+        parallelFor( m_updateFibers.size(), task );
+    }
+    
+    wxCriticalSectionLocker lock( m_updateLock );
+    
+    wxCommandEvent event( wxEVT_SELECTION_UPDATE_EVENT, m_updateId );
+    event.SetInt( m_runningUpdate );
+    m_pUpdateHandler->AddPendingEvent( event );
+}
+
+bool SelectionTree::isSelectionUpdateStale()
+{
+    wxCriticalSectionLocker lock( m_updateLock );
+    
+    return m_runningUpdate != m_requestedUpdate;
+}
+
+BitSet SelectionTree::getSelectedFibersInBranch( const Fibers *const pFibers, SelectionObject *pSelObj )
 {
     if( pFibers == NULL )
     {
@@ -749,26 +997,20 @@ vector< bool > SelectionTree::getSelectedFibersInBranch( const Fibers *const pFi
     
     SelectionObject::FiberIdType fiberId = const_cast< Fibers* >(pFibers)->getName();
     
+    waitForSelectionUpdate();
+    
     // Find the intersection of the root selection and the selection object's
     // inBranch.
     SelectionObject::SelectionState &childState = pSelObj->getState( fiberId );
-    vector< bool > &rootSel = m_rootSelectionStatus[ fiberId ];
-    
-    vector< bool > selInter( pFibers->getFibersCount(), false );
+    BitSet selInter( m_rootSelectionStatus[ fiberId ] );
     
     if( !pSelObj->getIsNOT() )
     {
-        for( int fibIdx( 0 ); fibIdx < pFibers->getFibersCount(); ++fibIdx )
-        {
-            selInter[ fibIdx ] = rootSel[ fibIdx ] & childState.m_inBranch[ fibIdx ];
-        }
+        selInter &= childState.m_inBranch;
     }
     else
     {
-        for( int fibIdx( 0 ); fibIdx < pFibers->getFibersCount(); ++fibIdx )
-        {
-            selInter[ fibIdx ] = rootSel[ fibIdx ] & !childState.m_inBranch[ fibIdx ];
-        }
+        selInter.andNot( childState.m_inBranch );
     }
     
     return selInter;
@@ -776,6 +1018,8 @@ vector< bool > SelectionTree::getSelectedFibersInBranch( const Fibers *const pFi
 
 bool SelectionTree::addFiberDataset( const SelectionObject::FiberIdType &fiberId, const int fibersCount )
 {
+    waitForSelectionUpdate();
+    
     SelectionObjectVector selObjs = getAllObjects();
  
     for( SelectionObjectVector::iterator objIt (selObjs.begin()); objIt != selObjs.end(); ++objIt )
@@ -783,13 +1027,19 @@ bool SelectionTree::addFiberDataset( const SelectionObject::FiberIdType &fiberId
         (*objIt)->addFiberDataset( fiberId, fibersCount );
     }
     
-    m_rootSelectionStatus.insert( pair< SelectionObject::FiberIdType, vector< bool > >( fiberId, vector< bool >( fibersCount, false ) ) );
+    m_rootSelectionStatus.insert( pair< SelectionObject::FiberIdType, BitSet >( fiberId, BitSet( fibersCount, false ) ) );
     
     return ( m_fibersIdAndCount.insert( pair< SelectionObject::FiberIdType, int >( fiberId, fibersCount ) ) ).second;
 }
 
 void SelectionTree::removeFiberDataset( const SelectionObject::FiberIdType &fiberId )
 {
+    waitForSelectionUpdate();
+    
+    // The fibers are being deleted, they must not be updated or reported.
+    eraseFibers( m_requestedFibers, fiberId );
+    eraseFibers( m_updateFibers, fiberId );
+    
     if( m_fibersIdAndCount.count( fiberId ) > 0 )
     {
         SelectionObjectVector selObjs = getAllObjects();
@@ -815,6 +1065,18 @@ void SelectionTree::notifyStatsNeedUpdating( SelectionObject *pSelObject )
     }
 }
 
+void SelectionTree::notifyInBranchNeedsUpdating( SelectionObject *pSelObject )
+{
+    vector< SelectionObject* > genealogy = findGenealogy( pSelObject );
+    
+    // The ancestors also combine the inBranch of their children again,
+    // the object itself keeps the union of its own children.
+    for( unsigned int nodeIdx( 0 ); nodeIdx < genealogy.size(); ++nodeIdx )
+    {
+        genealogy[ nodeIdx ]->notifyInBranchNeedsUpdating( nodeIdx > 0 );
+    }
+}
+
 // TODO selection saving
 /*bool SelectionTree::populateXMLNode( wxXmlNode *pRootSelObjNode )
 {
@@ -862,6 +1124,8 @@ vector< SelectionObject* > SelectionTree::findGenealogy( SelectionObject *pSelOb
 
 SelectionTree::~SelectionTree()
 {
+    waitForSelectionUpdate();
+    
     delete m_pRootNode;
     m_pRootNode = NULL;
 }
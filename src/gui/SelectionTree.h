@@ -8,13 +8,17 @@
 
 #include "SelectionObject.h"
 
+#include <wx/event.h>
+#include <wx/thread.h>
+
 #include <map>
 using std::map;
 #include <vector>
 using std::vector;
 
 class Fibers;
-class Octree;
+
+extern const wxEventType wxEVT_SELECTION_UPDATE_EVENT;
 
 class SelectionTree
 {
@@ -55,10 +59,29 @@ public:
     // TODO selection remove if not needed
     //void removeAllObjects();
     void notifyAllObjectsNeedUpdating();
+    void notifyFibersChanged( const SelectionObject::FiberIdType &fiberId );
     
     // Methods related to fiber selection.
-    vector< bool > getSelectedFibers( const Fibers* const pFibers );
-    vector< bool > getSelectedFibersInBranch( const Fibers* const pFibers, SelectionObject* pSelObj );
+    BitSet getSelectedFibers( const Fibers* const pFibers );
+    
+    // Selection found by the last update, without updating it.
+    BitSet getLastSelectedFibers( const Fibers* const pFibers );
+    
+    // Updates the selection of the fiber sets on a worker thread, one set per
+    // thread of its own. pHandler then gets wxEVT_SELECTION_UPDATE_EVENT, which
+    // must be passed to finishSelectionUpdate(). A request made meanwhile makes
+    // the running update stale: it stops early and only the newest request is
+    // started, the fibers keep their last selection until it is done.
+    void requestSelectionUpdate( const vector< Fibers* > &fibers, wxEvtHandler *pHandler, int id );
+    
+    // Returns the fiber sets whose last update is done and up to date, none
+    // when the event is stale or when a newer update was started instead.
+    vector< Fibers* > finishSelectionUpdate( const wxCommandEvent &evt );
+    
+    // Blocks until the running update is done. The states of the objects and
+    // the points of the fibers must not change while it runs.
+    void waitForSelectionUpdate();
+    BitSet getSelectedFibersInBranch( const Fibers* const pFibers, SelectionObject* pSelObj );
     
     // Methods related to multiple fibers dataset management.
     bool addFiberDataset(    const SelectionObject::FiberIdType &fiberId, const int fibersCount );
@@ -67,6 +90,9 @@ public:
     // Methods related to stats computation
     void notifyStatsNeedUpdating( SelectionObject *pSelObject );
     
+    // Flags the object and its ancestors, the other branches are not combined again.
+    void notifyInBranchNeedsUpdating( SelectionObject *pSelObject );
+    
     // Methods related to saving and loading.
     // TODO selection saving
     //bool populateXMLNode( wxXmlNode *pRootSelObjNode );
@@ -100,11 +126,10 @@ private:
         
         //vector< SelectionTreeNode * const > findGenealogy( SelectionObject *pSelObj );
         
-        void updateInObjectRecur( const int fibersCount, Octree *pCurOctree, 
-                                 const vector< int > &reverseIdx, const SelectionObject::FiberIdType &fiberId );
+        void updateInObjectRecur( const Fibers *pFibers, const SelectionObject::FiberIdType &fiberId );
         void updateInBranchRecur( const int fibersCount, const SelectionObject::FiberIdType &fiberId );
         
-        vector< bool > combineChildrenFiberStates( const SelectionObject::FiberIdType &fiberId ) const;
+        void combineChildrenFiberStates( const SelectionObject::FiberIdType &fiberId, BitSet &o_combined ) const;
         
         int getId() const;
         
@@ -138,8 +163,28 @@ private:
         int m_searchedId;
     };
 
+    class DatasetsTask;
+    
+    class UpdateThread : public wxThread
+    {
+    public:
+        UpdateThread( SelectionTree &tree ) : wxThread( wxTHREAD_JOINABLE ), m_tree( tree ) {}
+        
+    protected:
+        virtual ExitCode Entry();
+        
+    private:
+        SelectionTree &m_tree;
+    };
+
 private:
     vector< SelectionObject* > findGenealogy( SelectionObject *pSelObject );
+    
+    void applyObjectsChanges();
+    void prepareUpdate();
+    void startSelectionUpdate();
+    void runSelectionUpdate();
+    bool isSelectionUpdateStale();
 
 private:
     SelectionTreeNode *m_pRootNode;
@@ -148,7 +193,22 @@ private:
     
     map< SelectionObject::FiberIdType, int > m_fibersIdAndCount;
     
-    map< SelectionObject::FiberIdType, vector< bool > > m_rootSelectionStatus;
+    map< SelectionObject::FiberIdType, BitSet > m_rootSelectionStatus;
+    
+    // Background update. Only the generations and the handler are shared with
+    // the thread, the fiber sets and their states are set up before it starts. The newest
+    // request waits in m_requestedFibers until the running update is done.
+    UpdateThread                            *m_pUpdateThread;
+    wxCriticalSection                       m_updateLock;
+    int                                     m_requestedUpdate;
+    int                                     m_runningUpdate;
+    vector< Fibers* >                       m_requestedFibers;
+    vector< Fibers* >                       m_updateFibers;
+    vector< SelectionObject::FiberIdType >  m_updateFiberIds;
+    vector< BitSet* >                       m_updateRootStates;
+    bool                                    m_updateHasActiveObjects;
+    wxEvtHandler                            *m_pUpdateHandler;
+    int                                     m_updateId;
 };
 
 
@@ -31,6 +31,8 @@ public:
     // Checks if a point is inside the VOI.
     bool isPointInside( const float xPos, const float yPos, const float zPos ) const;
     
+    const vector< bool > & getIncludedVoxels() const { return m_includedVoxels; }
+    
     // Methods related to loading and saving.
     virtual wxString getTypeTag() const;
     
@@ -0,0 +1,636 @@
+#include "ConvexHullQuickhull.h"
+
+#include "../ParallelFor.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+namespace
+{
+    // The filter uses a regular octree of this depth over the bounding box.
+    const int    FILTER_CELLS_PER_AXIS = 16;
+    const size_t FILTER_MIN_POINTS     = 100000;
+
+    // Below this number of points, the points are assigned on one thread.
+    const size_t ASSIGN_MIN_CHUNK      = 4096;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Assigns each point to the face it is the farthest above, among the faces
+// [m_firstFace, m_faces.size()[ of the hull. The faces are only read.
+//////////////////////////////////////////////////////////////////////////////////
+class ConvexHullQuickhull::AssignTask : public ParallelTask
+{
+public:
+    AssignTask( const ConvexHullQuickhull &hull, const std::vector< int > &pointIds, int firstFace )
+    :   m_hull( hull ),
+        m_pointIds( pointIds ),
+        m_firstFace( firstFace ),
+        m_faceIds( pointIds.size(), -1 ),
+        m_distances( pointIds.size(), 0.0 )
+    {
+    }
+
+    void run( size_t begin, size_t end )
+    {
+        const int nbFaces = static_cast< int >( m_hull.m_faces.size() );
+
+        for( size_t i = begin; i < end; ++i )
+        {
+            double maxDistance( m_hull.m_epsilon );
+
+            for( int f = m_firstFace; f < nbFaces; ++f )
+            {
+                const Face &face = m_hull.m_faces[f];
+                if( face.m_deleted )
+                {
+                    continue;
+                }
+
+                const double distance = m_hull.getDistance( face, m_pointIds[i] );
+                if( distance > maxDistance )
+                {
+                    maxDistance  = distance;
+                    m_faceIds[i] = f;
+                }
+            }
+            m_distances[i] = maxDistance;
+        }
+    }
+
+public:
+    const ConvexHullQuickhull   &m_hull;
+    const std::vector< int >    &m_pointIds;
+    int                         m_firstFace;
+
+    std::vector< int >          m_faceIds;      // -1 if the point is above no face
+    std::vector< double >       m_distances;
+};
+
+//////////////////////////////////////////////////////////////////////////////////
+// Constructor
+//
+// std::vector< Vector > & i_pointsVector : vector containing all points
+// bool i_filterInsidePoints              : drop the points inside the hull of
+//                                          the extremal points of an octree first
+//////////////////////////////////////////////////////////////////////////////////
+ConvexHullQuickhull::ConvexHullQuickhull( std::vector< Vector > &i_pointsVector, bool i_filterInsidePoints )
+:   ConvexHull( i_pointsVector ),
+    m_filterInsidePoints( i_filterInsidePoints ),
+    m_epsilon( 0.0 ),
+    m_currentStamp( 0 )
+{
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Builds the hull and fills m_hullPoints with its vertices.
+//
+// Returns false if there are less than four points or if they are coplanar.
+//////////////////////////////////////////////////////////////////////////////////
+bool ConvexHullQuickhull::buildHull()
+{
+    m_faces.clear();
+    m_hullPoints.clear();
+
+    if( m_allPoints.size() < 4 )
+    {
+        return false;
+    }
+
+    // The distances to the faces are rounded relatively to the coordinates.
+    double maxCoords[3] = { 0.0, 0.0, 0.0 };
+    for( size_t i = 0; i < m_allPoints.size(); ++i )
+    {
+        maxCoords[0] = std::max( maxCoords[0], std::fabs( m_allPoints[i].x ) );
+        maxCoords[1] = std::max( maxCoords[1], std::fabs( m_allPoints[i].y ) );
+        maxCoords[2] = std::max( maxCoords[2], std::fabs( m_allPoints[i].z ) );
+    }
+    m_epsilon = 3.0 * DBL_EPSILON * ( maxCoords[0] + maxCoords[1] + maxCoords[2] );
+
+    m_visitStamps.assign( m_allPoints.size(), 0 );
+    m_newFaceByVertex.assign( m_allPoints.size(), -1 );
+    m_currentStamp = 0;
+
+    std::vector< int > pointIds( m_allPoints.size() );
+    for( size_t i = 0; i < pointIds.size(); ++i )
+    {
+        pointIds[i] = static_cast< int >( i );
+    }
+
+    if( m_filterInsidePoints && pointIds.size() >= FILTER_MIN_POINTS )
+    {
+        filterInsidePoints( pointIds );
+    }
+
+    if( !buildFromPoints( pointIds ) )
+    {
+        m_faces.clear();
+        return false;
+    }
+
+    m_currentStamp++;
+    for( size_t f = 0; f < m_faces.size(); ++f )
+    {
+        if( m_faces[f].m_deleted )
+        {
+            continue;
+        }
+
+        for( int i = 0; i < 3; ++i )
+        {
+            const int vertex = m_faces[f].m_vertices[i];
+            if( m_visitStamps[vertex] != m_currentStamp )
+            {
+                m_visitStamps[vertex] = m_currentStamp;
+                m_hullPoints.push_back( m_allPoints[vertex] );
+            }
+        }
+    }
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Gives the triangles of the hull, counter clockwise seen from outside.
+//
+// Returns true if successful, false otherwise
+//////////////////////////////////////////////////////////////////////////////////
+bool ConvexHullQuickhull::getHullTriangles( std::list< Face3D > &o_faces )
+{
+    o_faces.clear();
+
+    for( size_t f = 0; f < m_faces.size(); ++f )
+    {
+        const Face &face = m_faces[f];
+        if( !face.m_deleted )
+        {
+            o_faces.push_back( Face3D( m_allPoints[face.m_vertices[0]],
+                                       m_allPoints[face.m_vertices[1]],
+                                       m_allPoints[face.m_vertices[2]] ) );
+        }
+    }
+
+    return !o_faces.empty();
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Builds the hull of the given points in m_faces, the points that are not
+// vertices of the hull are left unassigned.
+//////////////////////////////////////////////////////////////////////////////////
+bool ConvexHullQuickhull::buildFromPoints( const std::vector< int > &pointIds )
+{
+    m_faces.clear();
+    m_nextOutside.assign( m_allPoints.size(), -1 );
+
+    if( !buildSimplex( pointIds ) )
+    {
+        return false;
+    }
+    assignPoints( pointIds, 0 );
+
+    // The new faces are appended, so that one pass reaches them all. A face
+    // with points above it is always deleted by adding its farthest point.
+    for( size_t f = 0; f < m_faces.size(); ++f )
+    {
+        if( !m_faces[f].m_deleted && m_faces[f].m_firstOutside != -1 )
+        {
+            addPoint( static_cast< int >( f ) );
+        }
+    }
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Builds the first tetrahedron from the points farthest apart.
+//
+// Returns false if the points are coplanar.
+//////////////////////////////////////////////////////////////////////////////////
+bool ConvexHullQuickhull::buildSimplex( const std::vector< int > &pointIds )
+{
+    if( pointIds.size() < 4 )
+    {
+        return false;
+    }
+
+    // Extremes along each axis.
+    int extremes[6];
+    std::fill( extremes, extremes + 6, pointIds[0] );
+    for( size_t i = 1; i < pointIds.size(); ++i )
+    {
+        const Vector &point = m_allPoints[pointIds[i]];
+        if( point.x < m_allPoints[extremes[0]].x ) extremes[0] = pointIds[i];
+        if( point.x > m_allPoints[extremes[1]].x ) extremes[1] = pointIds[i];
+        if( point.y < m_allPoints[extremes[2]].y ) extremes[2] = pointIds[i];
+        if( point.y > m_allPoints[extremes[3]].y ) extremes[3] = pointIds[i];
+        if( point.z < m_allPoints[extremes[4]].z ) extremes[4] = pointIds[i];
+        if( point.z > m_allPoints[extremes[5]].z ) extremes[5] = pointIds[i];
+    }
+
+    // The two extremes farthest apart.
+    int v0( extremes[0] );
+    int v1( extremes[1] );
+    double maxDistance( -1.0 );
+    for( int i = 0; i < 6; ++i )
+    {
+        for( int j = i + 1; j < 6; ++j )
+        {
+            const Vector diff = m_allPoints[extremes[j]] - m_allPoints[extremes[i]];
+            const double distance = diff.Dot( diff );
+            if( distance > maxDistance )
+            {
+                maxDistance = distance;
+                v0 = extremes[i];
+                v1 = extremes[j];
+            }
+        }
+    }
+
+    // The point farthest from their line.
+    const Vector axis = m_allPoints[v1] - m_allPoints[v0];
+    int v2( -1 );
+    maxDistance = 0.0;
+    for( size_t i = 0; i < pointIds.size(); ++i )
+    {
+        const Vector normal = axis.Cross( m_allPoints[pointIds[i]] - m_allPoints[v0] );
+        const double distance = normal.Dot( normal );
+        if( distance > maxDistance )
+        {
+            maxDistance = distance;
+            v2 = pointIds[i];
+        }
+    }
+    if( v2 == -1 || std::sqrt( maxDistance / axis.Dot( axis ) ) <= m_epsilon )
+    {
+        return false;
+    }
+
+    // The point farthest from their plane.
+    Vector normal = axis.Cross( m_allPoints[v2] - m_allPoints[v0] );
+    normal.normalize();
+    int v3( -1 );
+    double maxAbsDistance( 0.0 );
+    for( size_t i = 0; i < pointIds.size(); ++i )
+    {
+        const double distance = normal.Dot( m_allPoints[pointIds[i]] - m_allPoints[v0] );
+        if( std::fabs( distance ) > maxAbsDistance )
+        {
+            maxAbsDistance = std::fabs( distance );
+            v3 = pointIds[i];
+        }
+    }
+    if( v3 == -1 || maxAbsDistance <= m_epsilon )
+    {
+        return false;
+    }
+
+    // The base faces away from the fourth point.
+    if( normal.Dot( m_allPoints[v3] - m_allPoints[v0] ) > 0.0 )
+    {
+        std::swap( v1, v2 );
+    }
+
+    createFace( v0, v1, v2 );
+    createFace( v1, v0, v3 );
+    createFace( v2, v1, v3 );
+    createFace( v0, v2, v3 );
+
+    // Each face shares one edge with each of the others, in reverse order.
+    for( int f = 0; f < 4; ++f )
+    {
+        for( int i = 0; i < 3; ++i )
+        {
+            const int a = m_faces[f].m_vertices[i];
+            const int b = m_faces[f].m_vertices[( i + 1 ) % 3];
+
+            for( int g = 0; g < 4; ++g )
+            {
+                for( int j = 0; j < 3; ++j )
+                {
+                    if( m_faces[g].m_vertices[j] == b && m_faces[g].m_vertices[( j + 1 ) % 3] == a )
+                    {
+                        m_faces[f].m_neighbors[i] = g;
+                    }
+                }
+            }
+        }
+    }
+
+    return true;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Drops the points strictly inside the hull of the points extremal along an
+// axis in a cell of the octree. The points of a cell are only tested against
+// the faces the cell reaches above, none for the cells inside the hull.
+//////////////////////////////////////////////////////////////////////////////////
+void ConvexHullQuickhull::filterInsidePoints( std::vector< int > &io_pointIds )
+{
+    const int nbCells = FILTER_CELLS_PER_AXIS * FILTER_CELLS_PER_AXIS * FILTER_CELLS_PER_AXIS;
+
+    Vector minCorner( m_allPoints[io_pointIds[0]] );
+    Vector maxCorner( m_allPoints[io_pointIds[0]] );
+    for( size_t i = 1; i < io_pointIds.size(); ++i )
+    {
+        const Vector &point = m_allPoints[io_pointIds[i]];
+        minCorner.x = std::min( minCorner.x, point.x );
+        minCorner.y = std::min( minCorner.y, point.y );
+        minCorner.z = std::min( minCorner.z, point.z );
+        maxCorner.x = std::max( maxCorner.x, point.x );
+        maxCorner.y = std::max( maxCorner.y, point.y );
+        maxCorner.z = std::max( maxCorner.z, point.z );
+    }
+
+    double cellSize[3] = { ( maxCorner.x - minCorner.x ) / FILTER_CELLS_PER_AXIS,
+                           ( maxCorner.y - minCorner.y ) / FILTER_CELLS_PER_AXIS,
+                           ( maxCorner.z - minCorner.z ) / FILTER_CELLS_PER_AXIS };
+    if( cellSize[0] <= 0.0 || cellSize[1] <= 0.0 || cellSize[2] <= 0.0 )
+    {
+        return;
+    }
+
+    // Cell of each point, and the 6 extremes of each cell.
+    std::vector< int > cells( io_pointIds.size() );
+    std::vector< int > extremes( nbCells * 6, -1 );
+    for( size_t i = 0; i < io_pointIds.size(); ++i )
+    {
+        const Vector &point = m_allPoints[io_pointIds[i]];
+        const double coords[3] = { point.x, point.y, point.z };
+        const double mins[3]   = { minCorner.x, minCorner.y, minCorner.z };
+
+        int cell( 0 );
+        for( int axis = 2; axis >= 0; --axis )
+        {
+            const int index = std::min( FILTER_CELLS_PER_AXIS - 1, static_cast< int >( ( coords[axis] - mins[axis] ) / cellSize[axis] ) );
+            cell = cell * FILTER_CELLS_PER_AXIS + index;
+        }
+        cells[i] = cell;
+
+        for( int axis = 0; axis < 3; ++axis )
+        {
+            int &minId = extremes[cell * 6 + axis * 2];
+            int &maxId = extremes[cell * 6 + axis * 2 + 1];
+            if( minId == -1 )
+            {
+                minId = maxId = io_pointIds[i];
+                continue;
+            }
+
+            const Vector &minPoint = m_allPoints[minId];
+            const Vector &maxPoint = m_allPoints[maxId];
+            const double minCoords[3] = { minPoint.x, minPoint.y, minPoint.z };
+            const double maxCoords[3] = { maxPoint.x, maxPoint.y, maxPoint.z };
+            if( coords[axis] < minCoords[axis] ) minId = io_pointIds[i];
+            if( coords[axis] > maxCoords[axis] ) maxId = io_pointIds[i];
+        }
+    }
+
+    std::vector< int > candidates;
+    const int candidateStamp = ++m_currentStamp;
+    for( size_t i = 0; i < extremes.size(); ++i )
+    {
+        if( extremes[i] != -1 && m_visitStamps[extremes[i]] != candidateStamp )
+        {
+            m_visitStamps[extremes[i]] = candidateStamp;
+            candidates.push_back( extremes[i] );
+        }
+    }
+
+    if( !buildFromPoints( candidates ) )
+    {
+        return;
+    }
+
+    // The faces each cell reaches above, a point can only be above one of
+    // them. The cells reaching above no face are strictly inside the hull.
+    const double halfSize[3] = { cellSize[0] * 0.5, cellSize[1] * 0.5, cellSize[2] * 0.5 };
+    std::vector< int > cellFacesStart( nbCells + 1, 0 );
+    std::vector< int > cellFaces;
+    for( int cell = 0; cell < nbCells; ++cell )
+    {
+        cellFacesStart[cell] = static_cast< int >( cellFaces.size() );
+        if( extremes[cell * 6] == -1 )
+        {
+            continue;
+        }
+
+        const double center[3] = { minCorner.x + ( cell % FILTER_CELLS_PER_AXIS + 0.5 ) * cellSize[0],
+                                   minCorner.y + ( ( cell / FILTER_CELLS_PER_AXIS ) % FILTER_CELLS_PER_AXIS + 0.5 ) * cellSize[1],
+                                   minCorner.z + ( cell / ( FILTER_CELLS_PER_AXIS * FILTER_CELLS_PER_AXIS ) + 0.5 ) * cellSize[2] };
+
+        for( size_t f = 0; f < m_faces.size(); ++f )
+        {
+            const Face &face = m_faces[f];
+            if( face.m_deleted )
+            {
+                continue;
+            }
+
+            const double reach = face.m_normal[0] * center[0] + face.m_normal[1] * center[1] + face.m_normal[2] * center[2] - face.m_offset
+                               + std::fabs( face.m_normal[0] ) * halfSize[0]
+                               + std::fabs( face.m_normal[1] ) * halfSize[1]
+                               + std::fabs( face.m_normal[2] ) * halfSize[2];
+            if( reach >= -m_epsilon )
+            {
+                cellFaces.push_back( static_cast< int >( f ) );
+            }
+        }
+    }
+    cellFacesStart[nbCells] = static_cast< int >( cellFaces.size() );
+
+    // The candidates are kept, the other points unless they are strictly
+    // below the faces of their cell.
+    for( size_t i = 0; i < io_pointIds.size(); ++i )
+    {
+        const int pointId = io_pointIds[i];
+        if( m_visitStamps[pointId] == candidateStamp )
+        {
+            continue;
+        }
+
+        for( int k = cellFacesStart[cells[i]]; k < cellFacesStart[cells[i] + 1]; ++k )
+        {
+            if( getDistance( m_faces[cellFaces[k]], pointId ) >= -m_epsilon )
+            {
+                candidates.push_back( pointId );
+                break;
+            }
+        }
+    }
+
+    io_pointIds.swap( candidates );
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Adds the farthest point above a face to the hull: the faces it sees are
+// replaced by a cone of faces from the horizon to the point.
+//////////////////////////////////////////////////////////////////////////////////
+void ConvexHullQuickhull::addPoint( int faceId )
+{
+    const int eye = m_faces[faceId].m_farthest;
+
+    m_visibleFaces.clear();
+    m_horizon.clear();
+    m_orphans.clear();
+
+    // Depth first search of the visible faces, the edges to the other faces
+    // form the horizon. The stamps mark the visible faces found.
+    m_currentStamp++;
+    m_faceStamps.resize( m_faces.size(), 0 );
+    m_faceStamps[faceId] = m_currentStamp;
+
+    m_stack.assign( 1, faceId );
+    while( !m_stack.empty() )
+    {
+        const int f = m_stack.back();
+        m_stack.pop_back();
+        m_visibleFaces.push_back( f );
+
+        for( int i = 0; i < 3; ++i )
+        {
+            const int g = m_faces[f].m_neighbors[i];
+            if( m_faceStamps[g] == m_currentStamp )
+            {
+                continue;
+            }
+
+            if( getDistance( m_faces[g], eye ) > m_epsilon )
+            {
+                m_faceStamps[g] = m_currentStamp;
+                m_stack.push_back( g );
+            }
+            else
+            {
+                m_horizon.push_back( f );
+                m_horizon.push_back( i );
+            }
+        }
+    }
+
+    // One new face per horizon edge, indexed by the first vertex of the edge.
+    const int firstNewFace = static_cast< int >( m_faces.size() );
+    for( size_t h = 0; h < m_horizon.size(); h += 2 )
+    {
+        const int f = m_horizon[h];
+        const int i = m_horizon[h + 1];
+        const int a = m_faces[f].m_vertices[i];
+        const int b = m_faces[f].m_vertices[( i + 1 ) % 3];
+        const int g = m_faces[f].m_neighbors[i];
+
+        const int newFace = createFace( a, b, eye );
+        m_faces[newFace].m_neighbors[0] = g;
+        for( int j = 0; j < 3; ++j )
+        {
+            if( m_faces[g].m_neighbors[j] == f )
+            {
+                m_faces[g].m_neighbors[j] = newFace;
+            }
+        }
+        m_newFaceByVertex[a] = newFace;
+    }
+
+    // The face after a, b, eye starts at b, the face before ends at a.
+    for( int f = firstNewFace; f < static_cast< int >( m_faces.size() ); ++f )
+    {
+        const int next = m_newFaceByVertex[m_faces[f].m_vertices[1]];
+        m_faces[f].m_neighbors[1]    = next;
+        m_faces[next].m_neighbors[2] = f;
+    }
+    for( int f = firstNewFace; f < static_cast< int >( m_faces.size() ); ++f )
+    {
+        m_newFaceByVertex[m_faces[f].m_vertices[0]] = -1;
+    }
+
+    // The points above the visible faces go to the new faces, or are inside.
+    for( size_t v = 0; v < m_visibleFaces.size(); ++v )
+    {
+        Face &face = m_faces[m_visibleFaces[v]];
+        for( int p = face.m_firstOutside; p != -1; p = m_nextOutside[p] )
+        {
+            if( p != eye )
+            {
+                m_orphans.push_back( p );
+            }
+        }
+        face.m_deleted      = true;
+        face.m_firstOutside = -1;
+    }
+
+    assignPoints( m_orphans, firstNewFace );
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Links each point to the face among [firstFace, m_faces.size()[ it is the
+// farthest above. The distances are computed in parallel, the lists are then
+// filled in order.
+//////////////////////////////////////////////////////////////////////////////////
+void ConvexHullQuickhull::assignPoints( const std::vector< int > &pointIds, int firstFace )
+{
+    if( pointIds.empty() )
+    {
+        return;
+    }
+
+    AssignTask task( *this, pointIds, firstFace );
+    parallelFor( pointIds.size(), task, ASSIGN_MIN_CHUNK );
+
+    for( size_t i = 0; i < pointIds.size(); ++i )
+    {
+        const int f = task.m_faceIds[i];
+        if( f == -1 )
+        {
+            continue;
+        }
+
+        Face &face = m_faces[f];
+        m_nextOutside[pointIds[i]] = face.m_firstOutside;
+        face.m_firstOutside = pointIds[i];
+
+        if( task.m_distances[i] > face.m_farthestDistance )
+        {
+            face.m_farthestDistance = task.m_distances[i];
+            face.m_farthest         = pointIds[i];
+        }
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Appends the face a, b, c, counter clockwise seen from outside.
+//////////////////////////////////////////////////////////////////////////////////
+int ConvexHullQuickhull::createFace( int a, int b, int c )
+{
+    Face face;
+    face.m_vertices[0]  = a;
+    face.m_vertices[1]  = b;
+    face.m_vertices[2]  = c;
+    std::fill( face.m_neighbors, face.m_neighbors + 3, -1 );
+
+    // Vector::normalize() leaves the small normals of small faces as they are.
+    Vector normal = ( m_allPoints[b] - m_allPoints[a] ).Cross( m_allPoints[c] - m_allPoints[a] );
+    const double length = std::sqrt( normal.Dot( normal ) );
+    if( length > 0.0 )
+    {
+        normal = normal / length;
+    }
+    face.m_normal[0]        = normal.x;
+    face.m_normal[1]        = normal.y;
+    face.m_normal[2]        = normal.z;
+    face.m_offset           = normal.Dot( m_allPoints[a] );
+    face.m_firstOutside     = -1;
+    face.m_farthest         = -1;
+    face.m_farthestDistance = 0.0;
+    face.m_deleted          = false;
+
+    m_faces.push_back( face );
+    return static_cast< int >( m_faces.size() ) - 1;
+}
+
+//////////////////////////////////////////////////////////////////////////////////
+// Signed distance of a point to the plane of a face, positive above it.
+//////////////////////////////////////////////////////////////////////////////////
+double ConvexHullQuickhull::getDistance( const Face &face, int pointId ) const
+{
+    const Vector &point = m_allPoints[pointId];
+    return face.m_normal[0] * point.x + face.m_normal[1] * point.y + face.m_normal[2] * point.z - face.m_offset;
+}
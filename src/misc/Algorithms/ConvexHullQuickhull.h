@@ -0,0 +1,74 @@
+#ifndef CONVEXHULLQUICKHULL_H_
+#define CONVEXHULLQUICKHULL_H_
+
+#include "ConvexHull.h"
+#include "Face3D.h"
+
+#include <list>
+#include <vector>
+
+//////////////////////////////////////////////////////////////////////////////////
+// Description :
+//      This class uses the Quickhull algorithm to calculate the convex hull
+//      of a batch of points in 3D. The faces and the points are kept in flat
+//      arrays, each face links the points above it, and the points are
+//      assigned to the faces on several threads.
+//
+//      The points can first be filtered: the points of each leaf of a regular
+//      octree that are extremal along an axis give a first hull, and every
+//      point strictly inside it is dropped. The hull is the same, only faster
+//      to build when most of the points are inside.
+//////////////////////////////////////////////////////////////////////////////////
+class ConvexHullQuickhull : public ConvexHull
+{
+public:
+
+    ConvexHullQuickhull( std::vector< Vector > &i_pointsVector, bool i_filterInsidePoints = true );
+    ~ConvexHullQuickhull(){};
+
+    bool   buildHull        ();
+    bool   getHullTriangles ( std::list< Face3D > &o_faces );
+
+private:
+    class AssignTask;
+
+    struct Face
+    {
+        int     m_vertices[3];      // Counter clockwise seen from outside
+        int     m_neighbors[3];     // Face across the edge m_vertices[i], m_vertices[i + 1]
+        double  m_normal[3];
+        double  m_offset;
+        int     m_firstOutside;     // First point above the face, -1 if none
+        int     m_farthest;
+        double  m_farthestDistance;
+        bool    m_deleted;
+    };
+
+    bool    buildFromPoints     ( const std::vector< int > &pointIds );
+    bool    buildSimplex        ( const std::vector< int > &pointIds );
+    void    filterInsidePoints  ( std::vector< int > &io_pointIds );
+    void    addPoint            ( int faceId );
+    void    assignPoints        ( const std::vector< int > &pointIds, int firstFace );
+
+    int     createFace          ( int a, int b, int c );
+    double  getDistance         ( const Face &face, int pointId ) const;
+
+private:
+    bool                    m_filterInsidePoints;
+    double                  m_epsilon;
+
+    std::vector< Face >     m_faces;
+    std::vector< int >      m_nextOutside;     // Next point above the same face, -1 at the end
+
+    // Buffers of addPoint, kept from one point to the next.
+    std::vector< int >      m_stack;
+    std::vector< int >      m_visibleFaces;
+    std::vector< int >      m_horizon;         // Face, edge of each horizon edge
+    std::vector< int >      m_orphans;
+    std::vector< int >      m_newFaceByVertex;   // New face starting at each horizon vertex
+    std::vector< int >      m_visitStamps;       // Per point
+    std::vector< int >      m_faceStamps;
+    int                     m_currentStamp;
+};
+
+#endif //CONVEXHULLQUICKHULL_H_
@@ -133,7 +133,9 @@ enum FibersColorationMode
     DISTANCE_COLOR      = 3,
     MINDISTANCE_COLOR   = 4,
     CUSTOM_COLOR        = 5,    // This one is used only for the mean fiber. Should be moved.
-    CONSTANT_COLOR      = 6
+    CONSTANT_COLOR      = 6,
+    COLUMN_COLOR        = 7,    // Scalar or property column loaded with the fibers.
+    CLUSTER_COLOR       = 8     // One color per cluster of Fibers::clusterFibers.
 };
 
 ///////////////////////////////////////////////////////////////////////////
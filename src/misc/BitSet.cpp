@@ -0,0 +1,214 @@
+#include "BitSet.h"
+
+#include <algorithm>
+#include <cassert>
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#define BITSET_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    inline size_t wordsCount( size_t bits )
+    {
+        return ( bits + BitSet::WORD_BITS - 1 ) / BitSet::WORD_BITS;
+    }
+
+    inline size_t popCount( BitSet::Word word )
+    {
+#if defined( __GNUC__ )
+        return __builtin_popcountll( word );
+#else
+        size_t count( 0 );
+        for( ; word != 0; word &= word - 1 )
+        {
+            ++count;
+        }
+        return count;
+#endif
+    }
+
+    inline size_t lowestBit( BitSet::Word word )
+    {
+#if defined( __GNUC__ )
+        return __builtin_ctzll( word );
+#else
+        size_t pos( 0 );
+        for( ; ( word & 1 ) == 0; word >>= 1 )
+        {
+            ++pos;
+        }
+        return pos;
+#endif
+    }
+
+    enum Operation { OPERATION_OR, OPERATION_AND, OPERATION_AND_NOT };
+
+    // dest = dest op source, over count words.
+    template< Operation op >
+    void combine( BitSet::Word *pDest, const BitSet::Word *pSource, size_t count )
+    {
+        size_t i( 0 );
+
+#ifdef BITSET_USE_SSE2
+        const size_t wordsPerVector = sizeof( __m128i ) / sizeof( BitSet::Word );
+
+        for( ; i + wordsPerVector <= count; i += wordsPerVector )
+        {
+            __m128i dest   = _mm_loadu_si128( reinterpret_cast< const __m128i * >( pDest + i ) );
+            __m128i source = _mm_loadu_si128( reinterpret_cast< const __m128i * >( pSource + i ) );
+
+            if( op == OPERATION_OR )
+            {
+                dest = _mm_or_si128( dest, source );
+            }
+            else if( op == OPERATION_AND )
+            {
+                dest = _mm_and_si128( dest, source );
+            }
+            else
+            {
+                dest = _mm_andnot_si128( source, dest );
+            }
+
+            _mm_storeu_si128( reinterpret_cast< __m128i * >( pDest + i ), dest );
+        }
+#endif
+
+        for( ; i < count; ++i )
+        {
+            if( op == OPERATION_OR )
+            {
+                pDest[i] |= pSource[i];
+            }
+            else if( op == OPERATION_AND )
+            {
+                pDest[i] &= pSource[i];
+            }
+            else
+            {
+                pDest[i] &= ~pSource[i];
+            }
+        }
+    }
+}
+
+void BitSet::swap( BitSet &other )
+{
+    m_words.swap( other.m_words );
+    std::swap( m_size, other.m_size );
+}
+
+void BitSet::assign( size_t size, bool value )
+{
+    m_size = size;
+    m_words.assign( wordsCount( size ), value ? ~static_cast< Word >( 0 ) : 0 );
+    clearTail();
+}
+
+void BitSet::resize( size_t size, bool value )
+{
+    const size_t oldSize = m_size;
+
+    m_words.resize( wordsCount( size ), value ? ~static_cast< Word >( 0 ) : 0 );
+    m_size = size;
+
+    // The tail of the last old word was kept at 0.
+    if( value && size > oldSize && oldSize % WORD_BITS != 0 )
+    {
+        m_words[oldSize / WORD_BITS] |= ~static_cast< Word >( 0 ) << ( oldSize % WORD_BITS );
+    }
+    clearTail();
+}
+
+BitSet & BitSet::operator|=( const BitSet &other )
+{
+    assert( m_size == other.m_size );
+    if( !m_words.empty() )
+    {
+        combine< OPERATION_OR >( &m_words[0], &other.m_words[0], m_words.size() );
+    }
+    return *this;
+}
+
+BitSet & BitSet::operator&=( const BitSet &other )
+{
+    assert( m_size == other.m_size );
+    if( !m_words.empty() )
+    {
+        combine< OPERATION_AND >( &m_words[0], &other.m_words[0], m_words.size() );
+    }
+    return *this;
+}
+
+BitSet & BitSet::andNot( const BitSet &other )
+{
+    assert( m_size == other.m_size );
+    if( !m_words.empty() )
+    {
+        combine< OPERATION_AND_NOT >( &m_words[0], &other.m_words[0], m_words.size() );
+    }
+    return *this;
+}
+
+void BitSet::flip()
+{
+    for( size_t i = 0; i < m_words.size(); ++i )
+    {
+        m_words[i] = ~m_words[i];
+    }
+    clearTail();
+}
+
+size_t BitSet::count() const
+{
+    size_t count( 0 );
+    for( size_t i = 0; i < m_words.size(); ++i )
+    {
+        count += popCount( m_words[i] );
+    }
+    return count;
+}
+
+bool BitSet::any() const
+{
+    for( size_t i = 0; i < m_words.size(); ++i )
+    {
+        if( m_words[i] != 0 )
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t BitSet::findNext( size_t pos ) const
+{
+    if( pos >= m_size )
+    {
+        return m_size;
+    }
+
+    size_t wordIdx = pos / WORD_BITS;
+    Word   word    = m_words[wordIdx] & ( ~static_cast< Word >( 0 ) << ( pos % WORD_BITS ) );
+
+    while( word == 0 )
+    {
+        if( ++wordIdx == m_words.size() )
+        {
+            return m_size;
+        }
+        word = m_words[wordIdx];
+    }
+
+    return wordIdx * WORD_BITS + lowestBit( word );
+}
+
+void BitSet::clearTail()
+{
+    if( m_size % WORD_BITS != 0 )
+    {
+        m_words.back() &= ~( ~static_cast< Word >( 0 ) << ( m_size % WORD_BITS ) );
+    }
+}
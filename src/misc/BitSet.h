@@ -0,0 +1,76 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:            BitSet.h
+//
+// Description: Dynamic set of bits, one per fiber, used for the selection
+// states.
+//
+// The bits are packed in machine words, the boolean combinations of two
+// sets work on whole words (16 bytes at a time with SSE2) and the bits
+// past size() are always 0, so count() and operator== only look at words.
+/////////////////////////////////////////////////////////////////////////////
+#ifndef BITSET_H_
+#define BITSET_H_
+
+#include <cstddef>
+#include <vector>
+
+class BitSet
+{
+public:
+    typedef size_t Word;
+
+    static const size_t WORD_BITS = sizeof( Word ) * 8;
+
+    // Writable bit, like the one of std::vector< bool >.
+    class Reference
+    {
+    public:
+        Reference( Word &word, Word mask ) : m_word( word ), m_mask( mask ) {}
+
+        operator bool() const                       { return ( m_word & m_mask ) != 0; }
+        Reference & operator=( bool value )         { m_word = value ? ( m_word | m_mask ) : ( m_word & ~m_mask ); return *this; }
+        Reference & operator=( const Reference &r ) { return *this = static_cast< bool >( r ); }
+
+    private:
+        Word &m_word;
+        Word  m_mask;
+    };
+
+    BitSet() : m_size( 0 ) {}
+    explicit BitSet( size_t size, bool value = false ) : m_size( 0 ) { assign( size, value ); }
+
+    size_t  size() const    { return m_size; }
+    bool    empty() const   { return m_size == 0; }
+    void    clear()         { m_words.clear(); m_size = 0; }
+    void    swap( BitSet &other );
+
+    // Keeps the allocated words when the size does not grow.
+    void    assign( size_t size, bool value );
+    void    resize( size_t size, bool value = false );
+
+    bool        operator[]( size_t pos ) const  { return ( m_words[pos / WORD_BITS] >> ( pos % WORD_BITS ) & 1 ) != 0; }
+    Reference   operator[]( size_t pos )        { return Reference( m_words[pos / WORD_BITS], static_cast< Word >( 1 ) << ( pos % WORD_BITS ) ); }
+
+    // Word operations, both sets must have the same size.
+    BitSet &    operator|=( const BitSet &other );
+    BitSet &    operator&=( const BitSet &other );
+    BitSet &    andNot( const BitSet &other );  // Keeps the bits not set in other
+    void        flip();
+
+    size_t      count() const;
+    bool        any() const;
+
+    // Position of the first set bit at or after pos, size() if none.
+    size_t      findNext( size_t pos ) const;
+
+    bool operator==( const BitSet &other ) const { return m_size == other.m_size && m_words == other.m_words; }
+    bool operator!=( const BitSet &other ) const { return !( *this == other ); }
+
+private:
+    void clearTail();
+
+    std::vector< Word > m_words;
+    size_t              m_size;
+};
+
+#endif // BITSET_H_
@@ -0,0 +1,186 @@
+#include "FiberResampling.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#define FIBERRESAMPLING_USE_SSE2
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+    inline float getSegmentLength( const float *pA, const float *pB )
+    {
+        const float dx = pB[0] - pA[0];
+        const float dy = pB[1] - pA[1];
+        const float dz = pB[2] - pA[2];
+
+        return std::sqrt( dx * dx + dy * dy + dz * dz );
+    }
+
+#ifdef FIBERRESAMPLING_USE_SSE2
+    // Loads 4 points, x, y, z packed, as one vector per axis.
+    inline void loadPoints( const float *pPoints, __m128 &o_x, __m128 &o_y, __m128 &o_z )
+    {
+        const __m128 a = _mm_loadu_ps( pPoints );       // x0 y0 z0 x1
+        const __m128 b = _mm_loadu_ps( pPoints + 4 );   // y1 z1 x2 y2
+        const __m128 c = _mm_loadu_ps( pPoints + 8 );   // z2 x3 y3 z3
+
+        const __m128 xTail = _mm_shuffle_ps( b, c, _MM_SHUFFLE( 1, 1, 2, 2 ) );   // x2 x2 x3 x3
+        const __m128 yHead = _mm_shuffle_ps( a, b, _MM_SHUFFLE( 0, 0, 1, 1 ) );   // y0 y0 y1 y1
+        const __m128 yTail = _mm_shuffle_ps( b, c, _MM_SHUFFLE( 2, 2, 3, 3 ) );   // y2 y2 y3 y3
+        const __m128 zHead = _mm_shuffle_ps( a, b, _MM_SHUFFLE( 1, 1, 2, 2 ) );   // z0 z0 z1 z1
+
+        o_x = _mm_shuffle_ps( a, xTail, _MM_SHUFFLE( 2, 0, 3, 0 ) );
+        o_y = _mm_shuffle_ps( yHead, yTail, _MM_SHUFFLE( 2, 0, 2, 0 ) );
+        o_z = _mm_shuffle_ps( zHead, c, _MM_SHUFFLE( 3, 0, 2, 0 ) );
+    }
+
+    inline __m128 reverse( __m128 v )
+    {
+        return _mm_shuffle_ps( v, v, _MM_SHUFFLE( 0, 1, 2, 3 ) );
+    }
+
+    inline __m128 getDistances( __m128 ax, __m128 ay, __m128 az, __m128 bx, __m128 by, __m128 bz )
+    {
+        const __m128 dx = _mm_sub_ps( ax, bx );
+        const __m128 dy = _mm_sub_ps( ay, by );
+        const __m128 dz = _mm_sub_ps( az, bz );
+
+        return _mm_sqrt_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( dx, dx ), _mm_mul_ps( dy, dy ) ), _mm_mul_ps( dz, dz ) ) );
+    }
+
+    inline float getSum( __m128 v )
+    {
+        float values[4];
+        _mm_storeu_ps( values, v );
+
+        return ( values[0] + values[1] ) + ( values[2] + values[3] );
+    }
+#endif
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+float resampleFiber( const float *pPoints, int nbPoints, int count, float *o_resampled )
+{
+    float length( 0.0f );
+
+    for( int p = 1; p < nbPoints; ++p )
+    {
+        length += getSegmentLength( pPoints + ( p - 1 ) * 3, pPoints + p * 3 );
+    }
+
+    const float *pLast = pPoints + ( nbPoints - 1 ) * 3;
+    std::copy( pPoints, pPoints + 3, o_resampled );
+    std::copy( pLast, pLast + 3, o_resampled + ( count - 1 ) * 3 );
+
+    // Walks the segments once, each resampled point lies in the segment
+    // reaching its distance from the start.
+    const float step = length / ( count - 1 );
+    int   segment( 0 );
+    float segmentStart( 0.0f );
+    float segmentLength( nbPoints > 1 ? getSegmentLength( pPoints, pPoints + 3 ) : 0.0f );
+
+    for( int k = 1; k < count - 1; ++k )
+    {
+        const float target = step * k;
+
+        while( segmentStart + segmentLength < target && segment < nbPoints - 2 )
+        {
+            segmentStart += segmentLength;
+            ++segment;
+            segmentLength = getSegmentLength( pPoints + segment * 3, pPoints + ( segment + 1 ) * 3 );
+        }
+
+        const float *pBelow = pPoints + segment * 3;
+        const float *pAbove = pPoints + std::min( segment + 1, nbPoints - 1 ) * 3;
+        const float t = segmentLength > 0.0f ? std::min( 1.0f, std::max( 0.0f, ( target - segmentStart ) / segmentLength ) ) : 0.0f;
+
+        for( int axis = 0; axis < 3; ++axis )
+        {
+            o_resampled[k * 3 + axis] = pBelow[axis] + ( pAbove[axis] - pBelow[axis] ) * t;
+        }
+    }
+
+    return length;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+//////////////////////////////////////////////////////////////////////////
+// With SSE2, 4 points of A are compared at a time to the same 4 points of
+// B and to the 4 points at the other end of B, in reverse order.
+//////////////////////////////////////////////////////////////////////////
+float getMdfDistance( const float *pA, const float *pB, int count, bool *o_flipped )
+{
+    float direct( 0.0f );
+    float flipped( 0.0f );
+    int   k( 0 );
+
+#ifdef FIBERRESAMPLING_USE_SSE2
+    __m128 directSums  = _mm_setzero_ps();
+    __m128 flippedSums = _mm_setzero_ps();
+
+    for( ; k + 4 <= count; k += 4 )
+    {
+        __m128 ax, ay, az, bx, by, bz, fx, fy, fz;
+        loadPoints( pA + k * 3, ax, ay, az );
+        loadPoints( pB + k * 3, bx, by, bz );
+        loadPoints( pB + ( count - 4 - k ) * 3, fx, fy, fz );
+
+        directSums  = _mm_add_ps( directSums,  getDistances( ax, ay, az, bx, by, bz ) );
+        flippedSums = _mm_add_ps( flippedSums, getDistances( ax, ay, az, reverse( fx ), reverse( fy ), reverse( fz ) ) );
+    }
+
+    direct  = getSum( directSums );
+    flipped = getSum( flippedSums );
+#endif
+
+    for( ; k < count; ++k )
+    {
+        const float *pDirect  = pB + k * 3;
+        const float *pFlipped = pB + ( count - 1 - k ) * 3;
+
+        const float dx = pA[k * 3]     - pDirect[0];
+        const float dy = pA[k * 3 + 1] - pDirect[1];
+        const float dz = pA[k * 3 + 2] - pDirect[2];
+        const float fx = pA[k * 3]     - pFlipped[0];
+        const float fy = pA[k * 3 + 1] - pFlipped[1];
+        const float fz = pA[k * 3 + 2] - pFlipped[2];
+
+        direct  += std::sqrt( dx * dx + dy * dy + dz * dz );
+        flipped += std::sqrt( fx * fx + fy * fy + fz * fz );
+    }
+
+    if( o_flipped != 0 )
+    {
+        *o_flipped = flipped < direct;
+    }
+
+    return std::min( direct, flipped ) / count;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void addFiberPoints( const float *pPoints, int count, bool flipped, double *io_sum )
+{
+    if( flipped )
+    {
+        for( int k = 0; k < count; ++k )
+        {
+            const float *pPoint = pPoints + ( count - 1 - k ) * 3;
+            io_sum[k * 3]     += pPoint[0];
+            io_sum[k * 3 + 1] += pPoint[1];
+            io_sum[k * 3 + 2] += pPoint[2];
+        }
+    }
+    else
+    {
+        for( int i = 0; i < count * 3; ++i )
+        {
+            io_sum[i] += pPoints[i];
+        }
+    }
+}
@@ -0,0 +1,32 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:            FiberResampling.h
+//
+// Description: Kernels resampling the fibers and comparing them point to
+// point, whatever the number of points they were tracked with.
+//
+// The fibers are resampled to the same number of points spaced evenly
+// along their length. Two resampled fibers are then compared with the
+// minimum average direct-flip distance (MDF): the mean distance between
+// their points in the same order, or in reverse order if it is smaller.
+// The points are x, y, z packed in plain float arrays. getMdfDistance
+// compares 4 points at a time with SSE2 when the build targets it, and
+// addFiberPoints is a straight loop over the points. resampleFiber walks
+// the segments up to the arc length of each point, a loop depending on the
+// data that is not vectorized.
+/////////////////////////////////////////////////////////////////////////////
+#ifndef FIBERRESAMPLING_H_
+#define FIBERRESAMPLING_H_
+
+// Resamples the nbPoints points of pPoints to count >= 2 points spaced
+// evenly along its length, the first and last points are kept. Returns
+// the length of the fiber.
+float resampleFiber( const float *pPoints, int nbPoints, int count, float *o_resampled );
+
+// MDF distance between two fibers of count points. o_flipped tells if B
+// is closer to A in reverse order.
+float getMdfDistance( const float *pA, const float *pB, int count, bool *o_flipped = 0 );
+
+// Adds the count points of the fiber to io_sum, in reverse order if flipped.
+void  addFiberPoints( const float *pPoints, int count, bool flipped, double *io_sum );
+
+#endif // FIBERRESAMPLING_H_
@@ -0,0 +1,113 @@
+#include "MappedFile.h"
+
+#ifdef __WXMSW__
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile()
+:   m_pData( NULL ),
+    m_size( 0 )
+{
+}
+
+MappedFile::~MappedFile()
+{
+    close();
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Maps the whole file read-only. The file handles are released as soon as
+// the view exists, only the mapping itself is kept until close().
+//
+// Returns false if the file cannot be opened, is empty or cannot be mapped.
+//////////////////////////////////////////////////////////////////////////
+bool MappedFile::open( const wxString &filename )
+{
+    close();
+
+#ifdef __WXMSW__
+    HANDLE hFile = CreateFile( filename.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                               OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL );
+    if( INVALID_HANDLE_VALUE == hFile )
+    {
+        return false;
+    }
+
+    LARGE_INTEGER fileSize;
+    if( !GetFileSizeEx( hFile, &fileSize ) || 0 == fileSize.QuadPart ||
+        static_cast< unsigned long long >( fileSize.QuadPart ) > static_cast< size_t >( -1 ) )
+    {
+        CloseHandle( hFile );
+        return false;
+    }
+
+    HANDLE hMapping = CreateFileMapping( hFile, NULL, PAGE_READONLY, 0, 0, NULL );
+    CloseHandle( hFile );
+    if( NULL == hMapping )
+    {
+        return false;
+    }
+
+    void *pView = MapViewOfFile( hMapping, FILE_MAP_READ, 0, 0, 0 );
+    CloseHandle( hMapping );
+    if( NULL == pView )
+    {
+        return false;
+    }
+
+    m_pData = static_cast< wxUint8 * >( pView );
+    m_size  = static_cast< size_t >( fileSize.QuadPart );
+#else
+    int fd = ::open( filename.mb_str(), O_RDONLY );
+    if( fd < 0 )
+    {
+        return false;
+    }
+
+    struct stat fileStat;
+    if( fstat( fd, &fileStat ) != 0 || fileStat.st_size <= 0 ||
+        static_cast< unsigned long long >( fileStat.st_size ) > static_cast< size_t >( -1 ) )
+    {
+        ::close( fd );
+        return false;
+    }
+
+    size_t size = static_cast< size_t >( fileStat.st_size );
+    void *pView = mmap( NULL, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    ::close( fd );
+    if( MAP_FAILED == pView )
+    {
+        return false;
+    }
+
+    // The loaders walk the data front to back exactly once.
+    madvise( pView, size, MADV_SEQUENTIAL );
+
+    m_pData = static_cast< wxUint8 * >( pView );
+    m_size  = size;
+#endif
+
+    return true;
+}
+
+void MappedFile::close()
+{
+    if( NULL == m_pData )
+    {
+        return;
+    }
+
+#ifdef __WXMSW__
+    UnmapViewOfFile( m_pData );
+#else
+    munmap( m_pData, m_size );
+#endif
+
+    m_pData = NULL;
+    m_size  = 0;
+}
@@ -0,0 +1,39 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:            MappedFile.h
+//
+// Description: Read-only memory mapping of a whole file.
+//
+// The loaders use it to parse large binary files directly from the page
+// cache instead of copying them through an intermediate heap buffer.
+/////////////////////////////////////////////////////////////////////////////
+#ifndef MAPPEDFILE_H_
+#define MAPPEDFILE_H_
+
+#include <wx/defs.h>
+#include <wx/string.h>
+
+#include <cstddef>
+
+class MappedFile
+{
+public:
+    MappedFile();
+    ~MappedFile();
+
+    bool            open( const wxString &filename );
+    void            close();
+
+    bool            isOpen()  const { return m_pData != NULL; }
+    const wxUint8 * getData() const { return m_pData; }
+    size_t          getSize() const { return m_size; }
+
+private:
+    MappedFile( const MappedFile & );
+    MappedFile &operator=( const MappedFile & );
+
+private:
+    wxUint8 *m_pData;
+    size_t   m_size;
+};
+
+#endif // MAPPEDFILE_H_
@@ -0,0 +1,57 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:            Morton.h
+//
+// Description: Morton (Z-order) codes of the cells of a 1024^3 grid, used
+// to sort points so that the ones close in space are close in memory.
+/////////////////////////////////////////////////////////////////////////////
+#ifndef MORTON_H_
+#define MORTON_H_
+
+#include <algorithm>
+
+// Bits of the Morton codes per axis, the codes use 3 * MORTON_BITS bits.
+const int MORTON_BITS = 10;
+
+// Spreads the 10 low bits of v, with 2 zero bits between each.
+inline unsigned int mortonSpreadBits( unsigned int v )
+{
+    v &= 0x3ff;
+    v = ( v | ( v << 16 ) ) & 0x030000ff;
+    v = ( v | ( v << 8 ) )  & 0x0300f00f;
+    v = ( v | ( v << 4 ) )  & 0x030c30c3;
+    v = ( v | ( v << 2 ) )  & 0x09249249;
+    return v;
+}
+
+// Maps a box on the Morton grid. Flat axes all fall in the first cell.
+class MortonGrid
+{
+public:
+    MortonGrid( const float minPoint[3], const float maxPoint[3] )
+    {
+        for( int k = 0; k < 3; ++k )
+        {
+            m_min[k]   = minPoint[k];
+            m_scale[k] = maxPoint[k] > minPoint[k] ? ( 1 << MORTON_BITS ) / ( maxPoint[k] - minPoint[k] ) : 0.0f;
+        }
+    }
+
+    unsigned int getCode( const float *pPoint ) const
+    {
+        const unsigned int cellMax = ( 1 << MORTON_BITS ) - 1;
+        unsigned int code( 0 );
+
+        for( int k = 0; k < 3; ++k )
+        {
+            float cell = std::max( 0.0f, ( pPoint[k] - m_min[k] ) * m_scale[k] );
+            code |= mortonSpreadBits( std::min( cellMax, static_cast< unsigned int >( cell ) ) ) << k;
+        }
+        return code;
+    }
+
+private:
+    float m_min[3];
+    float m_scale[3];
+};
+
+#endif // MORTON_H_
@@ -0,0 +1,80 @@
+#include "ParallelFor.h"
+
+#include <wx/thread.h>
+
+#include <algorithm>
+#include <vector>
+
+namespace
+{
+    class ChunkThread : public wxThread
+    {
+    public:
+        ChunkThread( ParallelTask &task, size_t begin, size_t end )
+        :   wxThread( wxTHREAD_JOINABLE ),
+            m_task( task ),
+            m_begin( begin ),
+            m_end( end )
+        {
+        }
+
+    protected:
+        virtual ExitCode Entry()
+        {
+            m_task.run( m_begin, m_end );
+            return 0;
+        }
+
+    private:
+        ParallelTask &m_task;
+        size_t        m_begin;
+        size_t        m_end;
+    };
+}
+
+int getParallelThreadsCount()
+{
+    return std::max( 1, wxThread::GetCPUCount() );
+}
+
+//////////////////////////////////////////////////////////////////////////
+// If a worker thread cannot be started, its chunk is run on the calling
+// thread instead, so the whole range is always processed.
+//////////////////////////////////////////////////////////////////////////
+void parallelFor( size_t count, ParallelTask &task, size_t minChunkSize )
+{
+    if( count == 0 )
+    {
+        return;
+    }
+
+    size_t nbChunks = std::min( static_cast< size_t >( getParallelThreadsCount() ),
+                                std::max( static_cast< size_t >( 1 ), count / std::max( static_cast< size_t >( 1 ), minChunkSize ) ) );
+    size_t chunkSize = ( count + nbChunks - 1 ) / nbChunks;
+
+    std::vector< ChunkThread * > threads;
+    size_t begin = 0;
+
+    for( ; begin + chunkSize < count; begin += chunkSize )
+    {
+        ChunkThread *pThread = new ChunkThread( task, begin, begin + chunkSize );
+
+        if( pThread->Create() == wxTHREAD_NO_ERROR && pThread->Run() == wxTHREAD_NO_ERROR )
+        {
+            threads.push_back( pThread );
+        }
+        else
+        {
+            delete pThread;
+            task.run( begin, begin + chunkSize );
+        }
+    }
+
+    task.run( begin, count );
+
+    for( size_t i = 0; i < threads.size(); ++i )
+    {
+        threads[i]->Wait();
+        delete threads[i];
+    }
+}
@@ -0,0 +1,30 @@
+/////////////////////////////////////////////////////////////////////////////
+// Name:            ParallelFor.h
+//
+// Description: Splits a range of indices in contiguous chunks processed by
+// one joinable wxThread each, the calling thread taking the last chunk.
+//
+// The tasks must only write to disjoint parts of their outputs, there is
+// no other synchronization than waiting for all the chunks to be done.
+/////////////////////////////////////////////////////////////////////////////
+#ifndef PARALLELFOR_H_
+#define PARALLELFOR_H_
+
+#include <cstddef>
+
+class ParallelTask
+{
+public:
+    virtual ~ParallelTask() {}
+
+    // Processes the indices [begin, end[.
+    virtual void run( size_t begin, size_t end ) = 0;
+};
+
+// Returns the number of threads parallelFor uses, at least 1.
+int  getParallelThreadsCount();
+
+// Runs task over [0, count[ in chunks of at least minChunkSize indices.
+void parallelFor( size_t count, ParallelTask &task, size_t minChunkSize = 1 );
+
+#endif // PARALLELFOR_H_